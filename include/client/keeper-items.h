@@ -45,6 +45,9 @@ public:
     static QString const VERSION_KEY;
     static QString const FILE_NAME_KEY;
     static QString const DIR_NAME_KEY;
+    static QString const CODEC_KEY;
+    static QString const BASE_DIR_NAME_KEY;
+    static QString const INDEX_FILE_NAME_KEY;
     static QString const DISPLAY_NAME_KEY;
     static QString const STATUS_KEY;
     static QString const ERROR_KEY;
@@ -75,6 +78,9 @@ public:
     double get_percent_done(bool *valid = nullptr) const;
     keeper::Error get_error(bool *valid = nullptr) const;
     QString get_file_name(bool *valid = nullptr) const;
+    QString get_codec(bool *valid = nullptr) const;
+    QString get_base_dir_name(bool *valid = nullptr) const;
+    QString get_index_file_name(bool *valid = nullptr) const;
 
     // d-bus
     static void registerMetaType();
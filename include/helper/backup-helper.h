@@ -24,6 +24,7 @@
 #include "helper/helper.h" // parent class
 #include "helper/registry.h"
 
+#include <QByteArray>
 #include <QObject>
 #include <QScopedPointer>
 #include <QString>
@@ -48,12 +49,26 @@ public:
     static constexpr int MAX_INACTIVITY_TIME = 15000;
 
     void set_uploader(std::shared_ptr<Uploader> const& uploader);
+    // the helper writes to the uploader's socket itself,
+    // and reports its progress on the helper socket
+    void set_direct_uploader(std::shared_ptr<Uploader> const& uploader);
+    void start_stream();
     void start(QStringList const& urls) override;
     void stop() override;
     int get_helper_socket() const;
+    int get_uploader_socket() const;
     QString to_string(Helper::State state) const override;
     void set_state(State) override;
     QString get_uploader_committed_file_name() const;
+    // the first few bytes that were uploaded, e.g. to sniff the archive type
+    QByteArray get_uploaded_head() const;
+    // if a SeekableArchive was uploaded, its index; otherwise empty
+    QByteArray get_uploaded_index() const;
+
+Q_SIGNALS:
+    // emitted when a stream's end-of-stream trailer arrives
+    void stream_finished(qint64 n_bytes);
+
 protected:
     void on_helper_finished() override;
 
@@ -37,9 +37,13 @@ public:
 
     Q_DISABLE_COPY(DataDirRegistry)
 
-    QStringList get_backup_helper_urls(Metadata const& metadata) override;
+    QStringList get_backup_helper_urls(Metadata const& metadata, QString const& helper_path) override;
 
-    QStringList get_restore_helper_urls(Metadata const& metadata) override;
+    QStringList get_restore_helper_urls(Metadata const& metadata, QString const& helper_path) override;
+
+    bool use_chunk_store(Metadata const& metadata) override;
+
+    int max_concurrent_tasks() override;
 
 private:
     class Impl;
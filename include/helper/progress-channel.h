@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QtEndian>
+
+#include <cstring> // memcmp()
+
+/**
+ * What a helper tells Keeper when it writes its backup straight to
+ * storage with StartBackupDirect(), since Keeper doesn't see the data.
+ *
+ * The helper writes these records to the progress socket. Each one is
+ * an 8-byte magic string and a little-endian uint64. For HEAD and INDEX,
+ * the uint64 is the size of the payload that follows it:
+ *
+ *   "KEEPSNT1" n: the helper has written n bytes of the backup so far
+ *   "KEEPHED1" n: the first n bytes of the backup, so Keeper knows its codec
+ *   "KEEPIDX1" n: a seekable archive's index
+ *
+ * SENT records can be dropped if Keeper is slow to read them,
+ * since each one replaces the one before.
+ */
+class ProgressChannel
+{
+public:
+
+    static constexpr int RECORD_SIZE {16};
+
+    // don't let a bad helper make us hold onto too much
+    static constexpr quint64 PAYLOAD_SIZE_MAX {64*1024*1024};
+
+    static QByteArray create_sent(quint64 n_bytes)
+    {
+        return create(sent_magic(), n_bytes);
+    }
+
+    static QByteArray create_head(QByteArray const& head)
+    {
+        return create(head_magic(), quint64(head.size())) + head;
+    }
+
+    static QByteArray create_index(QByteArray const& index)
+    {
+        return create(index_magic(), quint64(index.size())) + index;
+    }
+
+    // reads the records as they arrive
+    class Parser
+    {
+    public:
+
+        // returns false if the records are garbled
+        bool feed(char const* buf, int len)
+        {
+            pending_.append(buf, len);
+
+            while (!failed_ && (pending_.size() >= RECORD_SIZE))
+            {
+                const auto value = qFromLittleEndian<quint64>(reinterpret_cast<uchar const*>(pending_.constData()) + MAGIC_SIZE);
+                if (is(sent_magic()))
+                {
+                    n_sent_ = qint64(value);
+                    pending_.remove(0, RECORD_SIZE);
+                    continue;
+                }
+
+                QByteArray* payload = is(head_magic()) ? &head_ : is(index_magic()) ? &index_ : nullptr;
+                if (!payload || (value > PAYLOAD_SIZE_MAX))
+                {
+                    failed_ = true;
+                    break;
+                }
+                if (pending_.size() < RECORD_SIZE + int(value))
+                    break;
+                *payload = pending_.mid(RECORD_SIZE, int(value));
+                pending_.remove(0, RECORD_SIZE + int(value));
+            }
+
+            return !failed_;
+        }
+
+        qint64 n_sent() const { return n_sent_; }
+        QByteArray head() const { return head_; }
+        QByteArray index() const { return index_; }
+
+    private:
+
+        bool is(char const* magic) const
+        {
+            return !memcmp(pending_.constData(), magic, MAGIC_SIZE);
+        }
+
+        QByteArray pending_;
+        qint64 n_sent_ {};
+        QByteArray head_;
+        QByteArray index_;
+        bool failed_ {};
+    };
+
+private:
+
+    static constexpr int MAGIC_SIZE {8};
+    static char const* sent_magic() { return "KEEPSNT1"; }
+    static char const* head_magic() { return "KEEPHED1"; }
+    static char const* index_magic() { return "KEEPIDX1"; }
+
+    static QByteArray create(char const* magic, quint64 value)
+    {
+        QByteArray ret(magic, MAGIC_SIZE);
+        uchar bytes[sizeof(quint64)];
+        qToLittleEndian(value, bytes);
+        ret.append(reinterpret_cast<char const*>(bytes), int(sizeof(bytes)));
+        return ret;
+    }
+};
@@ -29,8 +29,15 @@ public:
     virtual ~HelperRegistry() =default;
     Q_DISABLE_COPY(HelperRegistry)
 
-    virtual QStringList get_backup_helper_urls(Metadata const& task) =0;
-    virtual QStringList get_restore_helper_urls(Metadata const& task) =0;
+    // helper_path is the DBus path that the task's helper should call us on
+    virtual QStringList get_backup_helper_urls(Metadata const& task, QString const& helper_path) =0;
+    virtual QStringList get_restore_helper_urls(Metadata const& task, QString const& helper_path) =0;
+
+    // true if backups of this task should be deduplicated in the ChunkStore
+    virtual bool use_chunk_store(Metadata const& task) =0;
+
+    // how many tasks may be in flight at once
+    virtual int max_concurrent_tasks() =0;
 
 protected:
     HelperRegistry() =default;
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QtEndian>
+
+#include <cstring> // memcmp()
+
+/**
+ * The end-of-stream trailer that terminates a backup of unknown length.
+ *
+ * A helper that calls StartBackupStream() doesn't know its archive size
+ * up front, so when it's done writing the archive it appends this trailer:
+ * an 8-byte magic string followed by the archive's size in bytes as a
+ * little-endian uint64. Keeper strips the trailer before uploading.
+ */
+class StreamTrailer
+{
+public:
+
+    static constexpr int SIZE {16};
+
+    static QByteArray create(quint64 n_bytes)
+    {
+        QByteArray ret(magic(), MAGIC_SIZE);
+        uchar len[sizeof(quint64)];
+        qToLittleEndian(n_bytes, len);
+        ret.append(reinterpret_cast<char const*>(len), int(sizeof(len)));
+        return ret;
+    }
+
+    // returns true if `tail' is a trailer for an archive that is n_bytes long
+    static bool parse(QByteArray const& tail, quint64* n_bytes)
+    {
+        if (tail.size() != SIZE)
+            return false;
+
+        if (memcmp(tail.constData(), magic(), MAGIC_SIZE) != 0)
+            return false;
+
+        *n_bytes = qFromLittleEndian<quint64>(reinterpret_cast<uchar const*>(tail.constData()) + MAGIC_SIZE);
+        return true;
+    }
+
+private:
+
+    static constexpr int MAGIC_SIZE {8};
+    static char const* magic() { return "KEEPEOS1"; }
+};
@@ -37,6 +37,9 @@ const QString Item::TITLE_KEY = QStringLiteral("title");
 const QString Item::VERSION_KEY = QStringLiteral("version");
 const QString Item::FILE_NAME_KEY = QStringLiteral("file-name");
 const QString Item::DIR_NAME_KEY = QStringLiteral("dir-name");
+const QString Item::CODEC_KEY = QStringLiteral("codec");
+const QString Item::BASE_DIR_NAME_KEY = QStringLiteral("base-dir-name");
+const QString Item::INDEX_FILE_NAME_KEY = QStringLiteral("index-file-name");
 const QString Item::DISPLAY_NAME_KEY = QStringLiteral("display-name");
 const QString Item::STATUS_KEY = QStringLiteral("action");
 const QString Item::ERROR_KEY = QStringLiteral("error");
@@ -157,6 +160,21 @@ QString Item::get_file_name(bool *valid) const
     return get_property<QString>(FILE_NAME_KEY, valid);
 }
 
+QString Item::get_codec(bool *valid) const
+{
+    return get_property<QString>(CODEC_KEY, valid);
+}
+
+QString Item::get_base_dir_name(bool *valid) const
+{
+    return get_property<QString>(BASE_DIR_NAME_KEY, valid);
+}
+
+QString Item::get_index_file_name(bool *valid) const
+{
+    return get_property<QString>(INDEX_FILE_NAME_KEY, valid);
+}
+
 void Item::registerMetaType()
 {
     qRegisterMetaType<Item>("Item");
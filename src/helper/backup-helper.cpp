@@ -18,24 +18,42 @@
  *     Charles Kerr <charles.kerr@canonical.com>
  */
 
+#include "util/archive-magic.h"
 #include "util/connection-helper.h"
+#include "util/relay.h"
+#include "util/relay-loop.h"
 #include "helper/backup-helper.h"
+#include "helper/progress-channel.h"
+#include "helper/stream-trailer.h"
 #include "service/app-const.h" // HELPER_TYPE
+#include "tar/seekable-archive.h"
 
 #include <QByteArray>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
 #include <QLocalSocket>
 #include <QMap>
 #include <QObject>
+#include <QSocketNotifier>
+#include <QStandardPaths>
+#include <QStorageInfo>
 #include <QString>
+#include <QTemporaryFile>
 #include <QTimer>
 #include <QVector>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
+#include <algorithm> // std::min()
+#include <cerrno>
+#include <cstring> // strerror()
 #include <functional> // std::bind()
+#include <memory> // std::unique_ptr
 
 
 class BackupHelperPrivate
@@ -52,11 +70,6 @@ public:
             std::bind(&BackupHelperPrivate::on_inactivity_detected, this)
         );
 
-        // listen for data ready to read
-        QObject::connect(&read_socket_, &QLocalSocket::readyRead,
-            std::bind(&BackupHelperPrivate::on_ready_read, this)
-        );
-
         // fire up the sockets
         int fds[2];
         int rc = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
@@ -70,10 +83,24 @@ public:
         // helper socket is for the client.
         helper_socket_.setSocketDescriptor(fds[1], QLocalSocket::ConnectedState, QIODevice::WriteOnly);
 
-        read_socket_.setSocketDescriptor(fds[0], QLocalSocket::ConnectedState, QIODevice::ReadOnly);
+        // We read our end directly instead of through a QLocalSocket,
+        // so that its data can be spliced to the uploader without a copy.
+        // Listen for data ready to read once there's somewhere to put it.
+        read_fd_ = fds[0];
+        read_notifier_.reset(new QSocketNotifier(read_fd_, QSocketNotifier::Read));
+        read_notifier_->setEnabled(false);
+        QObject::connect(read_notifier_.get(), &QSocketNotifier::activated,
+            std::bind(&BackupHelperPrivate::on_ready_read, this)
+        );
     }
 
-    ~BackupHelperPrivate() = default;
+    ~BackupHelperPrivate()
+    {
+        stop_relay();
+        read_notifier_.reset();
+        if (read_fd_ != -1)
+            close(read_fd_);
+    }
 
     Q_DISABLE_COPY(BackupHelperPrivate)
 
@@ -85,6 +112,8 @@ public:
 
     void set_uploader(std::shared_ptr<Uploader> const& uploader)
     {
+        head_.clear();
+        index_reader_ = SeekableArchive::Reader{};
         n_read_ = 0;
         n_uploaded_ = 0;
         read_error_ = false;
@@ -93,14 +122,78 @@ public:
 
         uploader_ = uploader;
 
-        connections_.remember(QObject::connect(
-            uploader_->socket().get(), &QLocalSocket::bytesWritten,
-            std::bind(&BackupHelperPrivate::on_data_uploaded, this, std::placeholders::_1)
-        ));
-
         // TODO xavi is going to remove this line
         q_ptr->Helper::on_helper_started();
 
+        // the relay loop reads the helper socket (or the spool) from now on
+        if (read_notifier_)
+            read_notifier_->setEnabled(false);
+        start_relay();
+
+        reset_inactivity_timer();
+    }
+
+    void set_direct_uploader(std::shared_ptr<Uploader> const& uploader)
+    {
+        head_.clear();
+        progress_ = ProgressChannel::Parser{};
+        n_read_ = 0;
+        n_uploaded_ = 0;
+        read_error_ = false;
+        write_error_ = false;
+        cancelled_ = false;
+        direct_ = true;
+
+        // the helper writes the data itself, so nothing is relayed.
+        // All we read from it are its progress records.
+        uploader_ = uploader;
+
+        q_ptr->Helper::on_helper_started();
+
+        if (read_notifier_)
+            read_notifier_->setEnabled(true);
+
+        reset_inactivity_timer();
+    }
+
+    void start_stream()
+    {
+        n_read_ = 0;
+        n_uploaded_ = 0;
+        read_error_ = false;
+        write_error_ = false;
+        cancelled_ = false;
+
+        // we don't know the size yet, so we can't ask storage-framework
+        // for an uploader until the helper sends its end-of-stream trailer.
+        // Until then, spool the incoming data to a local file.
+        streaming_ = true;
+        stream_finished_ = false;
+        stream_tail_.clear();
+        n_spooled_since_space_check_ = 0;
+
+        // $TMPDIR is often a tmpfs, which a big backup would fill with RAM
+        const auto dir = spool_dir();
+        QDir().mkpath(dir);
+        spool_.setFileTemplate(dir + QStringLiteral("/backup-XXXXXX"));
+        if (!has_spool_space())
+        {
+            write_error_ = true;
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
+        }
+        else if (!spool_.open())
+        {
+            qWarning() << "Unable to open backup spool file:" << spool_.errorString();
+            write_error_ = true;
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
+        }
+        else if (read_notifier_)
+        {
+            read_notifier_->setEnabled(true);
+        }
+
+        q_ptr->Helper::on_helper_started();
+
         reset_inactivity_timer();
     }
 
@@ -115,6 +208,11 @@ public:
         return int(helper_socket_.socketDescriptor());
     }
 
+    int get_uploader_socket() const
+    {
+        return uploader_ ? int(uploader_->socket()->socketDescriptor()) : -1;
+    }
+
     QString to_string(Helper::State state) const
     {
         return state == Helper::State::STARTED
@@ -129,11 +227,13 @@ public:
             case Helper::State::CANCELLED:
             case Helper::State::FAILED:
                 qDebug() << "cancelled/failed, calling uploader_.reset()";
+                stop_relay();
                 uploader_.reset();
                 break;
 
             case Helper::State::DATA_COMPLETE: {
                 qDebug() << "Backup helper finished, calling uploader_.commit()";
+                stop_relay();
                 connections_.connect_oneshot(
                     uploader_.get(),
                     &Uploader::commit_finished,
@@ -164,9 +264,29 @@ public:
     void on_helper_finished()
     {
         stop_inactivity_timer();
+
+        // the helper may have exited before we read its last progress records
+        while (direct_ && !read_error_ && !read_eof_ && wait_for_ready_read(STREAM_DRAIN_TIMEOUT_MSEC_))
+            read_progress();
+
+        // the helper may have exited before we read its trailer
+        while (streaming_ && !stream_finished_ && !read_error_ && !write_error_ && !read_eof_
+               && wait_for_ready_read(STREAM_DRAIN_TIMEOUT_MSEC_))
+            spool_more();
+
         check_for_done();
     }
 
+    QByteArray get_uploaded_head() const
+    {
+        return head_;
+    }
+
+    QByteArray get_uploaded_index() const
+    {
+        return direct_ ? progress_.index() : index_reader_.index();
+    }
+
     QString get_uploader_committed_file_name() const
     {
         return uploader_committed_file_name_;
@@ -187,59 +307,278 @@ private:
         process_more();
     }
 
-    void on_data_uploaded(qint64 n)
+    // Relays the helper's output (or the spooled stream) to the uploader
+    // on the relay loop's thread, so it isn't slowed down by the main loop.
+    // Most of it is spliced through the kernel without being copied;
+    // we only look at the head and at what we need to find the index.
+    void start_relay()
     {
-        n_uploaded_ += n;
-        q_ptr->record_data_transferred(n);
-        process_more();
-        check_for_done();
+        const auto socket = uploader_->socket();
+        const auto out_fd = int(socket->socketDescriptor());
+        fcntl(out_fd, F_SETFL, fcntl(out_fd, F_GETFL) | O_NONBLOCK);
+
+        auto in_fd = read_fd_;
+        if (streaming_)
+        {
+            spool_fd_ = open(QFile::encodeName(spool_.fileName()).constData(), O_RDONLY|O_CLOEXEC);
+            if (spool_fd_ == -1)
+                qWarning() << "Unable to reopen backup spool file:" << strerror(errno);
+            in_fd = spool_fd_;
+        }
+
+        // called on the relay loop's thread. We don't touch head_
+        // or index_reader_ on ours until the relay's been removed
+        std::unique_ptr<Relay> relay {new Relay(in_fd, out_fd,
+            [this](char const* buf, size_t len) -> size_t {
+                if (buf)
+                {
+                    if (head_.size() < HEAD_SIZE_MAX_)
+                        head_.append(buf, std::min(int(len), HEAD_SIZE_MAX_ - head_.size()));
+                    // keep the index of a seekable archive as it goes by
+                    index_reader_.feed(buf, len);
+                }
+                else
+                {
+                    index_reader_.skip(len);
+                }
+                return head_.size() < HEAD_SIZE_MAX_ ? 0 : index_reader_.skippable();
+            }
+        )};
+
+        if (!relay_loop_)
+            relay_loop_ = RelayLoop::shared();
+        relay_job_ = relay_loop_->add(std::move(relay), in_fd, out_fd);
+
+        relay_notifier_.reset(new QSocketNotifier(relay_job_->notify_fd(), QSocketNotifier::Read));
+        QObject::connect(relay_notifier_.get(), &QSocketNotifier::activated,
+            std::bind(&BackupHelperPrivate::on_relay_progress, this)
+        );
+    }
+
+    // This can be reached from a notifier's own signal,
+    // so just disable them instead of destroying them here
+    void stop_relay()
+    {
+        if (relay_notifier_)
+            relay_notifier_->setEnabled(false);
+        if (relay_job_)
+        {
+            relay_loop_->remove(relay_job_);
+            relay_job_.reset();
+        }
+        if (read_notifier_)
+            read_notifier_->setEnabled(false);
+        if (spool_fd_ != -1)
+        {
+            close(spool_fd_);
+            spool_fd_ = -1;
+        }
     }
 
     void process_more()
     {
-        if (!uploader_)
+        if (direct_)
+        {
+            const auto n = read_progress();
+            reset_inactivity_timer();
+            if (n > 0)
+                check_for_done();
             return;
+        }
 
-        char readbuf[UPLOAD_BUFFER_MAX_];
-        auto socket = uploader_->socket();
-        for(;;)
+        if (streaming_ && !stream_finished_)
+            spool_more();
+    }
+
+    // the relay loop moved some more data, or finished
+    void on_relay_progress()
+    {
+        if (!uploader_ || !relay_job_)
+            return;
+
+        relay_job_->clear_notify();
+        const auto status = relay_job_->status();
+        n_read_ = relay_job_->n_read();
+        const auto n = relay_job_->n_written() - n_uploaded_;
+
+        if (status == Relay::Status::READ_FAILED)
         {
-            // try to fill the upload buf
-            int max_bytes = UPLOAD_BUFFER_MAX_ - upload_buffer_.size();
-            if (max_bytes > 0) {
-                const auto n = read_socket_.read(readbuf, max_bytes);
-                if (n > 0) {
-                    n_read_ += n;
-                    upload_buffer_.append(readbuf, int(n));
-                }
-                else if (n < 0) {
-                    read_error_ = true;
-                    Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
-                    stop();
-                    return;
-                }
-            }
+            read_error_ = true;
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
+            stop();
+            return;
+        }
+        if (status == Relay::Status::WRITE_FAILED)
+        {
+            write_error_ = true;
+            qWarning() << "Write error:" << uploader_->socket()->errorString();
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
+            stop();
+            return;
+        }
+
+        reset_inactivity_timer();
+
+        if (n > 0)
+        {
+            n_uploaded_ += n;
+            q_ptr->record_data_transferred(n);
+            check_for_done();
+        }
+    }
+
+    bool wait_for_ready_read(int msec)
+    {
+        pollfd pfd {read_fd_, POLLIN, 0};
+        int rc;
+        do {
+            rc = poll(&pfd, 1, msec);
+        } while ((rc == -1) && (errno == EINTR));
+        return rc > 0;
+    }
 
-            // try to empty the upload buf
-            const auto n = socket->write(upload_buffer_);
-            if (n > 0) {
-                upload_buffer_.remove(0, int(n));
+    void spool_more()
+    {
+        if (read_error_ || write_error_)
+            return;
+
+        char readbuf[SPOOL_BUFFER_SIZE_];
+        for(;;)
+        {
+            const auto n = read(read_fd_, readbuf, sizeof(readbuf));
+            if ((n < 0) && (errno == EINTR))
                 continue;
+            if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+                break;
+            if (n == 0) {
+                // the helper hung up
+                read_eof_ = true;
+                read_notifier_->setEnabled(false);
+                break;
+            }
+            if (n < 0) {
+                read_error_ = true;
+                Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
+                stop();
+                return;
+            }
+            if (spool_.write(readbuf, n) != n) {
+                write_error_ = true;
+                qWarning() << "Error writing to backup spool file:" << spool_.errorString();
+                Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
+                stop();
+                return;
             }
-            else {
-                if (n < 0) {
+            n_read_ += n;
+
+            // give up before the spool fills the disk
+            n_spooled_since_space_check_ += n;
+            if (n_spooled_since_space_check_ >= SPOOL_SPACE_CHECK_INTERVAL_) {
+                n_spooled_since_space_check_ = 0;
+                if (!spool_.flush() || !has_spool_space()) {
                     write_error_ = true;
-                    qWarning() << "Write error:" << socket->errorString();
                     Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
                     stop();
+                    return;
                 }
-                break;
             }
+
+            // remember the last bytes we've seen in case they're the trailer
+            const int trailer_size = StreamTrailer::SIZE;
+            const auto n_tail = std::min(int(n), trailer_size);
+            stream_tail_.append(readbuf + n - n_tail, n_tail);
+            stream_tail_ = stream_tail_.right(StreamTrailer::SIZE);
         }
 
+        quint64 n_bytes {};
+        if (StreamTrailer::parse(stream_tail_, &n_bytes) && (qint64(n_bytes) + StreamTrailer::SIZE == n_read_))
+            finish_stream(qint64(n_bytes));
+
         reset_inactivity_timer();
     }
 
+    static QString spool_dir()
+    {
+        return QStringLiteral("%1/keeper/spool")
+            .arg(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation));
+    }
+
+    // true if the spool's filesystem has room to keep spooling
+    bool has_spool_space() const
+    {
+        QStorageInfo storage(spool_dir());
+        storage.refresh();
+        const auto n_free = storage.bytesAvailable();
+        if (storage.isValid() && (n_free < SPOOL_FREE_SPACE_MIN_))
+        {
+            qWarning() << "Not enough free space to spool the backup stream in" << spool_dir() << ":" << n_free << "bytes left";
+            return false;
+        }
+        return true;
+    }
+
+    // Reads what a direct helper says it's written to the uploader.
+    // Returns how many more bytes that is.
+    qint64 read_progress()
+    {
+        if (read_error_ || write_error_)
+            return 0;
+
+        char readbuf[SPOOL_BUFFER_SIZE_];
+        for(;;)
+        {
+            const auto n = read(read_fd_, readbuf, sizeof(readbuf));
+            if ((n < 0) && (errno == EINTR))
+                continue;
+            if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+                break;
+            if (n == 0) {
+                // the helper hung up
+                read_eof_ = true;
+                read_notifier_->setEnabled(false);
+                break;
+            }
+            if ((n < 0) || !progress_.feed(readbuf, int(n))) {
+                qWarning() << "Unable to read backup helper's progress";
+                read_error_ = true;
+                Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
+                stop();
+                return 0;
+            }
+            n_read_ += n;
+        }
+
+        head_ = progress_.head();
+        const auto n = progress_.n_sent() - n_uploaded_;
+        if (n > 0)
+        {
+            n_uploaded_ += n;
+            q_ptr->record_data_transferred(n);
+        }
+        return n;
+    }
+
+    void finish_stream(qint64 n_bytes)
+    {
+        qDebug() << "backup stream finished:" << n_bytes << "bytes";
+
+        // strip the trailer and rewind for uploading
+        if (!spool_.flush() || !spool_.resize(n_bytes) || !spool_.seek(0))
+        {
+            write_error_ = true;
+            qWarning() << "Error rewinding backup spool file:" << spool_.errorString();
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
+            stop();
+            return;
+        }
+
+        stream_finished_ = true;
+        read_notifier_->setEnabled(false);
+        stop_inactivity_timer();
+        q_ptr->set_expected_size(n_bytes);
+        Q_EMIT(q_ptr->stream_finished(n_bytes));
+    }
+
     void reset_inactivity_timer()
     {
         static constexpr int MAX_TIME_WAITING_FOR_DATA {BackupHelper::MAX_INACTIVITY_TIME};
@@ -268,6 +607,16 @@ private:
                 q_ptr->set_state(Helper::State::FAILED);
             }
         }
+        else if (streaming_ && !uploader_)
+        {
+            // the helper exited without sending its end-of-stream trailer
+            if (!stream_finished_ && !q_ptr->is_helper_running())
+            {
+                qWarning() << "Backup helper finished without ending its stream";
+                Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
+                q_ptr->set_state(Helper::State::FAILED);
+            }
+        }
         else if (n_uploaded_ == q_ptr->expected_size())
         {
             if (uploader_)
@@ -289,19 +638,37 @@ private:
     ****
     ***/
 
-    static constexpr int UPLOAD_BUFFER_MAX_ {1024*16};
+    static constexpr int SPOOL_BUFFER_SIZE_ {1024*64};
+    static constexpr qint64 SPOOL_FREE_SPACE_MIN_ {1024*1024*256};
+    static constexpr qint64 SPOOL_SPACE_CHECK_INTERVAL_ {1024*1024*16};
+    static constexpr int STREAM_DRAIN_TIMEOUT_MSEC_ {500};
+    static constexpr int HEAD_SIZE_MAX_ {int(ArchiveMagic::HEAD_SIZE_MAX)};
 
     BackupHelper * const q_ptr;
     QTimer timer_;
     std::shared_ptr<Uploader> uploader_;
     QLocalSocket helper_socket_;
-    QLocalSocket read_socket_;
-    QByteArray upload_buffer_;
+    int read_fd_ {-1};
+    std::unique_ptr<QSocketNotifier> read_notifier_;
+    bool read_eof_ = false;
+    int spool_fd_ {-1};
+    std::shared_ptr<RelayLoop> relay_loop_;
+    std::shared_ptr<RelayLoop::Job> relay_job_;
+    std::unique_ptr<QSocketNotifier> relay_notifier_;
     qint64 n_read_ = 0;
     qint64 n_uploaded_ = 0;
     bool read_error_ = false;
     bool write_error_ = false;
     bool cancelled_ = false;
+    bool streaming_ = false;
+    bool stream_finished_ = false;
+    bool direct_ = false;
+    ProgressChannel::Parser progress_;
+    QTemporaryFile spool_;
+    qint64 n_spooled_since_space_check_ {};
+    QByteArray stream_tail_;
+    QByteArray head_;
+    SeekableArchive::Reader index_reader_;
     ConnectionHelper connections_;
     QString uploader_committed_file_name_;
 };
@@ -330,6 +697,22 @@ BackupHelper::start(QStringList const& url)
     d->start(url);
 }
 
+void
+BackupHelper::set_direct_uploader(std::shared_ptr<Uploader> const& uploader)
+{
+    Q_D(BackupHelper);
+
+    d->set_direct_uploader(uploader);
+}
+
+void
+BackupHelper::start_stream()
+{
+    Q_D(BackupHelper);
+
+    d->start_stream();
+}
+
 void
 BackupHelper::stop()
 {
@@ -354,6 +737,14 @@ BackupHelper::get_helper_socket() const
     return d->get_helper_socket();
 }
 
+int
+BackupHelper::get_uploader_socket() const
+{
+    Q_D(const BackupHelper);
+
+    return d->get_uploader_socket();
+}
+
 QString
 BackupHelper::to_string(Helper::State state) const
 {
@@ -385,3 +776,17 @@ QString BackupHelper::get_uploader_committed_file_name() const
 
     return d->get_uploader_committed_file_name();
 }
+
+QByteArray BackupHelper::get_uploaded_head() const
+{
+    Q_D(const BackupHelper);
+
+    return d->get_uploaded_head();
+}
+
+QByteArray BackupHelper::get_uploaded_index() const
+{
+    Q_D(const BackupHelper);
+
+    return d->get_uploaded_index();
+}
@@ -30,6 +30,7 @@
 #include <QUrl>
 #include <QUrlQuery>
 
+#include <algorithm> // std::max()
 #include <array>
 #include <utility> // pair
 
@@ -47,19 +48,30 @@ public:
     {
     }
 
-    QStringList get_backup_helper_urls(Metadata const& task)
+    QStringList get_backup_helper_urls(Metadata const& task, QString const& helper_path)
     {
-        return get_helper_urls(task, "backup");
+        return get_helper_urls(task, helper_path, "backup");
     }
 
-    QStringList get_restore_helper_urls(Metadata const& task)
+    QStringList get_restore_helper_urls(Metadata const& task, QString const& helper_path)
     {
-        return get_helper_urls(task, "restore");
+        return get_helper_urls(task, helper_path, "restore");
+    }
+
+    bool use_chunk_store(Metadata const& task)
+    {
+        auto it = registry_.find(std::make_pair(task.get_type(), QStringLiteral("backup")));
+        return it != registry_.end() && it.value().chunk_store;
+    }
+
+    int max_concurrent_tasks() const
+    {
+        return max_concurrent_tasks_;
     }
 
 private:
 
-    QStringList get_helper_urls(Metadata const& task, QString const & prop)
+    QStringList get_helper_urls(Metadata const& task, QString const& helper_path, QString const & prop)
     {
         QStringList ret;
 
@@ -74,7 +86,7 @@ private:
             else
             {
                 auto const& info = it.value();
-                ret = perform_url_substitution(task, info.urls);
+                ret = perform_url_substitution(task, helper_path, info.urls);
             }
         }
         else
@@ -85,8 +97,9 @@ private:
         return ret;
     }
 
-    // replace "${key}" with task.get_property("key")
-    QStringList perform_url_substitution(Metadata const& task, QStringList const& urls_in)
+    // replace "${key}" with task.get_property("key"),
+    // and "${helper-path}" with the DBus path that the helper should call
+    QStringList perform_url_substitution(Metadata const& task, QString const& helper_path, QStringList const& urls_in)
     {
         std::array<QString,6> keys = {
             keeper::Item::TYPE_KEY,
@@ -110,6 +123,12 @@ private:
             }
         }
 
+        if (!helper_path.isEmpty())
+        {
+            for (auto& url : urls)
+                url.replace(QStringLiteral("${helper-path}"), helper_path);
+        }
+
         for (auto const& url : urls_in)
             qDebug() << "in:" << url;
         for (auto const& url : urls)
@@ -121,11 +140,15 @@ private:
     struct HelperInfo
     {
         QStringList urls;
+        bool chunk_store {};
     };
 
     // pair is type + action, e.g. "folder" + "backup"
     QMap<std::pair<QString,QString>,HelperInfo> registry_;
 
+    static constexpr int DEFAULT_MAX_CONCURRENT_TASKS {4};
+    int max_concurrent_tasks_ {DEFAULT_MAX_CONCURRENT_TASKS};
+
     void load_registry()
     {
         // find the registry file
@@ -148,13 +171,17 @@ private:
              *     "folder": {
              *         "backup-urls": [
              *             "/path/to/helper.sh",
-             *             "${subtype}"
+             *             "${subtype}",
+             *             "${helper-path}"
              *         ],
              *         "restore-urls": [
              *             "/path/to/helper.sh",
-             *             "${subtype}"
-             *         ]
-             *     }
+             *             "${subtype}",
+             *             "${helper-path}"
+             *         ],
+             *         "chunk-store": true
+             *     },
+             *     "max-concurrent-tasks": 4
              * }
              */
 
@@ -173,6 +200,13 @@ private:
             const auto obj = doc.object();
             for (auto tit=obj.begin(), tend=obj.end(); tit!=tend; ++tit)
             {
+                if (tit.key() == QStringLiteral("max-concurrent-tasks"))
+                {
+                    max_concurrent_tasks_ = std::max(1, tit.value().toInt(DEFAULT_MAX_CONCURRENT_TASKS));
+                    qDebug() << "loaded max concurrent tasks" << max_concurrent_tasks_ << "from" << path;
+                    continue;
+                }
+
                 auto const type = tit.key();
                 auto const props = tit.value().toObject();
 
@@ -184,6 +218,7 @@ private:
                     {
                         info.urls.push_back(url_jsonval.toString());
                     }
+                    info.chunk_store = props["chunk-store"].toBool();
                     qDebug() << "loaded" << type << "backup urls from" << path;
                     for(auto const& url : info.urls)
                         qDebug() << "\turl:" << url;
@@ -220,13 +255,25 @@ DataDirRegistry::~DataDirRegistry()
 }
 
 QStringList
-DataDirRegistry::get_backup_helper_urls(Metadata const& task)
+DataDirRegistry::get_backup_helper_urls(Metadata const& task, QString const& helper_path)
 {
-    return impl_->get_backup_helper_urls(task);
+    return impl_->get_backup_helper_urls(task, helper_path);
 }
 
 QStringList
-DataDirRegistry::get_restore_helper_urls(Metadata const& task)
+DataDirRegistry::get_restore_helper_urls(Metadata const& task, QString const& helper_path)
+{
+    return impl_->get_restore_helper_urls(task, helper_path);
+}
+
+bool
+DataDirRegistry::use_chunk_store(Metadata const& task)
+{
+    return impl_->use_chunk_store(task);
+}
+
+int
+DataDirRegistry::max_concurrent_tasks()
 {
-    return impl_->get_restore_helper_urls(task);
+    return impl_->max_concurrent_tasks();
 }
@@ -19,7 +19,6 @@
 
 #include <helper/helper.h>
 
-#include <ubuntu-app-launch/registry.h>
 #include <service/app-const.h>
 #include <ubuntu-app-launch.h>
 
@@ -27,6 +26,8 @@
 #include <QTimer>
 
 #include <cmath> // std::fabs()
+#include <string>
+#include <vector>
 #include <sys/time.h> // gettimeofday()
 
 
@@ -144,7 +145,6 @@ public:
         , sized_{}
         , expected_size_{}
         , history_{}
-        , registry_(new ubuntu::app_launch::Registry())
     {
         ual_init();
         QObject::connect(&timer_wait_ual_, &QTimer::timeout,
@@ -279,49 +279,60 @@ private:
     {
         qDebug() << "Starting helper for app:" << appid_;
 
-        std::vector<ubuntu::app_launch::Helper::URL> urls;
+        std::vector<std::string> url_strs;
         for(const auto& url_string : url_strings) {
             qDebug() << "url" << url_string;
-            urls.push_back(ubuntu::app_launch::Helper::URL::from_raw(url_string.toStdString()));
+            url_strs.push_back(url_string.toStdString());
         }
+        std::vector<const gchar*> urls;
+        for(const auto& url_str : url_strs)
+            urls.push_back(url_str.c_str());
+        urls.push_back(nullptr);
 
-        auto backupType = ubuntu::app_launch::Helper::Type::from_raw(HELPER_TYPE);
-
-        auto appid = ubuntu::app_launch::AppID::parse(appid_.toStdString());
-        auto helper = ubuntu::app_launch::Helper::create(backupType, appid, registry_);
-
+        // every task's helper shares the same appid, so launch each as its own
+        // instance and use its instance id to tell our UAL events from theirs
         reset_wait_for_ual_timer();
-        helper->launch(urls);
+        auto const appid = appid_.toStdString();
+        auto instance_id = ubuntu_app_launch_start_multiple_helper(HELPER_TYPE, appid.c_str(), urls.data());
+        instance_id_ = QString::fromUtf8(instance_id);
+        g_free(instance_id);
+
+        if (instance_id_.isEmpty())
+            qWarning() << "Unable to start helper for app:" << appid_;
     }
 
     void ual_stop()
     {
-        qDebug() << "Stopping helper for app:" << appid_;
-        auto backupType = ubuntu::app_launch::Helper::Type::from_raw(HELPER_TYPE);
+        qDebug() << "Stopping helper for app:" << appid_ << "instance:" << instance_id_;
 
-        auto appid = ubuntu::app_launch::AppID::parse(appid_.toStdString());
-        auto helper = ubuntu::app_launch::Helper::create(backupType, appid, registry_);
+        if (instance_id_.isEmpty())
+            return;
 
-        auto instances = helper->instances();
+        auto const appid = appid_.toStdString();
+        auto const instance_id = instance_id_.toStdString();
+        ubuntu_app_launch_stop_multiple_helper(HELPER_TYPE, appid.c_str(), instance_id.c_str());
+    }
 
-        if (instances.size() > 0 )
-        {
-            qDebug() << "We have instances";
-            instances[0]->stop();
-        }
+    bool is_our_instance(const char* instance) const
+    {
+        return !instance_id_.isEmpty() && instance_id_ == QString::fromUtf8(instance);
     }
 
-    static void on_helper_started(const char* appid, const char* /*instance*/, const char* /*type*/, void* vself)
+    static void on_helper_started(const char* appid, const char* instance, const char* /*type*/, void* vself)
     {
-        qDebug() << "HELPER STARTED +++++++++++++++++++++++++++++++++++++" << appid;
+        qDebug() << "HELPER STARTED +++++++++++++++++++++++++++++++++++++" << appid << instance;
         auto self = static_cast<HelperPrivate*>(vself);
+        if (!self->is_our_instance(instance) || !self->timer_wait_ual_.isActive())
+            return;
         self->q_ptr->on_helper_started();
     }
 
-    static void on_helper_stopped(const char* appid, const char* /*instance*/, const char* /*type*/, void* vself)
+    static void on_helper_stopped(const char* appid, const char* instance, const char* /*type*/, void* vself)
     {
-        qDebug() << "HELPER STOPPED +++++++++++++++++++++++++++++++++++++" << appid;
+        qDebug() << "HELPER STOPPED +++++++++++++++++++++++++++++++++++++" << appid << instance;
         auto self = static_cast<HelperPrivate*>(vself);
+        if (!self->is_our_instance(instance) || !self->is_helper_running_)
+            return;
         self->q_ptr->on_helper_finished();
     }
 
@@ -369,7 +380,7 @@ private:
     RateHistory history_;
     float percent_done_ {};
     float last_notified_percent_done_ {};
-    std::shared_ptr<ubuntu::app_launch::Registry> registry_;
+    QString instance_id_; // our helper's UAL instance
     QTimer timer_wait_ual_;
     bool is_helper_running_ = false;
 };
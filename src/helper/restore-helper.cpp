@@ -19,6 +19,7 @@
  */
 
 #include "util/connection-helper.h"
+#include "util/relay.h"
 #include "helper/restore-helper.h"
 #include "service/app-const.h" // HELPER_TYPE
 
@@ -27,6 +28,7 @@
 #include <QLocalSocket>
 #include <QMap>
 #include <QObject>
+#include <QSocketNotifier>
 #include <QString>
 #include <QTimer>
 #include <QVector>
@@ -34,8 +36,10 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 #include <functional> // std::bind()
+#include <memory> // std::unique_ptr
 
 
 class RestoreHelperPrivate
@@ -66,10 +70,20 @@ public:
         // We don't use a QLocalSocket here as it buffers data and it makes the helper miss packets.
         helper_socket_ = fds[1];
 
-        write_socket_.setSocketDescriptor(fds[0], QLocalSocket::ConnectedState, QIODevice::WriteOnly);
+        // Nor for our end, so that what we read from the downloader
+        // can be written straight from the relay's buffer
+        write_fd_ = fds[0];
+        write_notifier_.reset(new QSocketNotifier(write_fd_, QSocketNotifier::Write));
+        write_notifier_->setEnabled(false);
+        QObject::connect(write_notifier_.get(), &QSocketNotifier::activated,
+            std::bind(&RestoreHelperPrivate::on_ready_write, this)
+        );
     }
 
-    ~RestoreHelperPrivate() = default;
+    ~RestoreHelperPrivate()
+    {
+        close_write_fd();
+    }
 
     Q_DISABLE_COPY(RestoreHelperPrivate)
 
@@ -90,15 +104,25 @@ public:
         q_ptr->set_expected_size(downloader->file_size());
         downloader_ = downloader;
 
-        connections_.remember(QObject::connect(
-            &write_socket_, &QLocalSocket::bytesWritten,
-            std::bind(&RestoreHelperPrivate::on_data_uploaded, this, std::placeholders::_1)
+        // Qt reads the downloader's socket itself,
+        // so the relay has to take the data from there
+        auto socket = downloader_->socket();
+        relay_.reset(new Relay(
+            [socket](char* buf, size_t maxlen) -> ssize_t {
+                if (!socket->bytesAvailable())
+                    return 0;
+                const auto n = socket->read(buf, qint64(maxlen));
+                if (n < 0)
+                    qDebug() << "Read error in restore helper: " << socket->errorString();
+                return ssize_t(n);
+            },
+            write_fd_
         ));
 
         // listen for data ready to read
-        QObject::connect(downloader_->socket().get(), &QLocalSocket::readyRead,
+        connections_.remember(QObject::connect(socket.get(), &QLocalSocket::readyRead,
             std::bind(&RestoreHelperPrivate::on_ready_read, this)
-        );
+        ));
 
         // TODO investigate why UAL takes so long to call the helper started callback
         // At this point we are sure that the helper started, as it is the helper
@@ -113,7 +137,7 @@ public:
 
     void stop()
     {
-        write_socket_.disconnectFromServer();
+        close_write_fd();
         cancelled_ = true;
         q_ptr->Helper::stop();
     }
@@ -137,12 +161,13 @@ public:
             case Helper::State::CANCELLED:
             case Helper::State::FAILED:
                 qDebug() << "cancelled/failed, calling downloader_.reset()";
+                relay_.reset();
                 downloader_.reset();
                 break;
 
             case Helper::State::DATA_COMPLETE: {
                 qDebug() << "Restore helper finished, calling downloader_.finish()";
-                write_socket_.disconnectFromServer();
+                close_write_fd();
                 downloader_->finish();
                 downloader_.reset();
                 break;
@@ -176,66 +201,64 @@ private:
         process_more();
     }
 
-    void on_data_uploaded(qint64 n)
+    void on_ready_write()
     {
-        n_uploaded_ += n;
-        q_ptr->record_data_transferred(n);
         process_more();
-        check_for_done();
     }
 
     void process_more()
     {
-        if (!downloader_)
+        if (!downloader_ || !relay_)
             return;
 
-        char readbuf[UPLOAD_BUFFER_MAX_];
-        auto socket = downloader_->socket();
-        while(socket->bytesAvailable() || upload_buffer_.size())
-        {
-            if (socket->bytesAvailable())
-            {
-                // try to fill the upload buf
-                int max_bytes = UPLOAD_BUFFER_MAX_ - upload_buffer_.size();
-                if (max_bytes > 0) {
-                    const auto n = socket->read(readbuf, max_bytes);
-                    if (n > 0) {
-                        n_read_ += n;
-                        upload_buffer_.append(readbuf, int(n));
-                    }
-                    else if (n < 0) {
-                        read_error_ = true;
-                        qDebug() << "Read error in restore helper: " << socket->errorString();
-                        Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
-                        stop();
-                        check_for_done();
-                        return;
-                    }
-                }
-            }
+        const auto n_uploaded = relay_->n_written();
+        const auto status = relay_->pump();
+        n_read_ = relay_->n_read();
+        const auto n = relay_->n_written() - n_uploaded;
 
-            if (upload_buffer_.size())
-            {
-                // try to empty the upload buf
-                const auto n = write_socket_.write(upload_buffer_);
-                if (n > 0) {
-                    upload_buffer_.remove(0, int(n));
-                    continue;
-                }
-                else {
-                    if (n < 0) {
-                        write_error_ = true;
-                        qWarning() << "Write error:" << write_socket_.errorString();
-                        Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
-                        stop();
-                        check_for_done();
-                    }
-                    break;
-                }
-            }
+        // wait for the helper to catch up
+        if (write_notifier_)
+            write_notifier_->setEnabled(status == Relay::Status::WAIT_WRITE);
+
+        if (status == Relay::Status::READ_FAILED)
+        {
+            read_error_ = true;
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_READ));
+            stop();
+            check_for_done();
+            return;
+        }
+        if (status == Relay::Status::WRITE_FAILED)
+        {
+            write_error_ = true;
+            Q_EMIT(q_ptr->error(keeper::Error::HELPER_WRITE));
+            stop();
+            check_for_done();
+            return;
         }
 
         reset_inactivity_timer();
+
+        if (n > 0)
+        {
+            n_uploaded_ += n;
+            q_ptr->record_data_transferred(n);
+            check_for_done();
+        }
+    }
+
+    // hangs up on the helper, so that it sees the end of the data.
+    // This can be reached from the notifier's own signal, so it's only disabled.
+    void close_write_fd()
+    {
+        relay_.reset();
+        if (write_notifier_)
+            write_notifier_->setEnabled(false);
+        if (write_fd_ != -1)
+        {
+            close(write_fd_);
+            write_fd_ = -1;
+        }
     }
 
     void reset_inactivity_timer()
@@ -287,14 +310,13 @@ private:
     ****
     ***/
 
-    static constexpr int UPLOAD_BUFFER_MAX_ {1024*16};
-
     RestoreHelper * const q_ptr;
     QTimer timer_;
     std::shared_ptr<Downloader> downloader_;
     int helper_socket_ = -1;
-    QLocalSocket write_socket_;
-    QByteArray upload_buffer_;
+    int write_fd_ = -1;
+    std::unique_ptr<QSocketNotifier> write_notifier_;
+    std::unique_ptr<Relay> relay_;
     qint64 n_read_ = 0;
     qint64 n_uploaded_ = 0;
     bool read_error_ = false;
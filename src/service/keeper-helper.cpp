@@ -42,6 +42,24 @@ QDBusUnixFileDescriptor KeeperHelper::StartBackup(quint64 n_bytes)
     return keeper_.StartBackup(bus, msg, n_bytes);
 }
 
+QDBusUnixFileDescriptor KeeperHelper::StartBackupStream()
+{
+    // pass it back to Keeper to do the work
+    Q_ASSERT(calledFromDBus());
+    auto bus = connection();
+    auto& msg = message();
+    return keeper_.StartBackupStream(bus, msg);
+}
+
+QDBusUnixFileDescriptor KeeperHelper::StartBackupDirect(quint64 n_bytes, QDBusUnixFileDescriptor& progress)
+{
+    // pass it back to Keeper to do the work
+    Q_ASSERT(calledFromDBus());
+    auto bus = connection();
+    auto& msg = message();
+    return keeper_.StartBackupDirect(bus, msg, n_bytes, progress);
+}
+
 QDBusUnixFileDescriptor KeeperHelper::StartRestore()
 {
     // pass it back to Keeper to do the work
@@ -34,6 +34,8 @@ public:
 
 public Q_SLOTS:
     QDBusUnixFileDescriptor StartBackup(quint64 nbytes);
+    QDBusUnixFileDescriptor StartBackupStream();
+    QDBusUnixFileDescriptor StartBackupDirect(quint64 nbytes, QDBusUnixFileDescriptor& progress);
     QDBusUnixFileDescriptor StartRestore();
 
     void UpdateStatus(const QString &app_id, const QString &status, double percentage);
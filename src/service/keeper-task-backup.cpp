@@ -19,12 +19,14 @@
  */
 
 #include "util/connection-helper.h"
+#include "storage-framework/chunk-store.h"
 #include "storage-framework/storage_framework_client.h"
 #include "helper/backup-helper.h"
 #include "service/app-const.h" // DEKKO_APP_ID
 #include "service/keeper-task-backup.h"
 #include "service/keeper-task.h"
 #include "service/private/keeper-task_p.h"
+#include "util/archive-magic.h"
 
 class KeeperTaskBackupPrivate : public KeeperTaskPrivate
 {
@@ -42,7 +44,7 @@ public:
 
     QStringList get_helper_urls() const
     {
-        return helper_registry_->get_backup_helper_urls(task_data_.metadata);
+        return helper_registry_->get_backup_helper_urls(task_data_.metadata, task_data_.helper_path);
     }
 
     void init_helper()
@@ -53,20 +55,26 @@ public:
         QObject::connect(helper_.data(), &Helper::error, [this](keeper::Error error){ error_ = error;});
     }
 
-    void ask_for_uploader(quint64 n_bytes, QString const & dir_name)
+    void ask_for_uploader(quint64 n_bytes, QString const & dir_name, bool direct)
     {
         qDebug() << "asking storage framework for a socket";
 
         helper_->set_expected_size(n_bytes);
 
-        const auto file_name = QString("%1.keeper").arg(task_data_.metadata.get_display_name());
-
         connections_.connect_future(
-            storage_->get_new_uploader(n_bytes, dir_name, file_name),
+            get_new_uploader(n_bytes, dir_name),
             std::function<void(std::shared_ptr<Uploader> const&)>{
-                [this](std::shared_ptr<Uploader> const& uploader){
+                [this, direct](std::shared_ptr<Uploader> const& uploader){
                     auto fd {-1};
-                    if (uploader) {
+                    if (uploader && direct) {
+                        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+                        backup_helper->set_direct_uploader(uploader);
+                        fd = backup_helper->get_uploader_socket();
+                        const auto progress_fd = backup_helper->get_helper_socket();
+                        qDebug("emitting task_direct_sockets_ready(socket=%d, progress=%d)", fd, progress_fd);
+                        Q_EMIT(q_ptr->task_direct_sockets_ready(fd, progress_fd));
+                    }
+                    else if (uploader) {
                         auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
                         backup_helper->set_uploader(uploader);
                         fd = backup_helper->get_helper_socket();
@@ -84,12 +92,84 @@ public:
         );
     }
 
+    // Deduplicated backups are split into chunks as they arrive,
+    // so their helpers can't bypass us
+    bool can_upload_directly() const
+    {
+        return !helper_registry_->use_chunk_store(task_data_.metadata);
+    }
+
+    void ask_for_stream_uploader(QString const & dir_name)
+    {
+        qDebug() << "starting a backup stream";
+
+        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+
+        // we can't ask storage framework for an uploader until we know
+        // the size, so wait for the helper to finish its stream
+        connections_.connect_oneshot(
+            backup_helper.data(),
+            &BackupHelper::stream_finished,
+            std::function<void(qint64)>{
+                [this, dir_name](qint64 n_bytes){
+                    connections_.connect_future(
+                        get_new_uploader(n_bytes, dir_name),
+                        std::function<void(std::shared_ptr<Uploader> const&)>{
+                            [this](std::shared_ptr<Uploader> const& uploader){
+                                auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+                                if (uploader) {
+                                    backup_helper->set_uploader(uploader);
+                                }
+                                else
+                                {
+                                    error_ = storage_->get_last_error();
+                                    qWarning("Unable to upload backup stream (error=%d)", static_cast<int>(error_));
+                                    backup_helper->set_state(Helper::State::FAILED);
+                                }
+                            }
+                        }
+                    );
+                }
+            }
+        );
+
+        backup_helper->start_stream();
+        const auto fd = backup_helper->get_helper_socket();
+        qDebug("emitting task_socket_ready(socket=%d)", fd);
+        Q_EMIT(q_ptr->task_socket_ready(fd));
+    }
+
+    // Backups are stored as a single ".keeper" file unless the
+    // helper registry asks for them to be deduplicated
+    QFuture<std::shared_ptr<Uploader>> get_new_uploader(qint64 n_bytes, QString const & dir_name)
+    {
+        const auto name = task_data_.metadata.get_display_name();
+
+        if (helper_registry_->use_chunk_store(task_data_.metadata))
+            return storage_->get_new_chunk_uploader(n_bytes, dir_name, name + ChunkStore::LIST_SUFFIX);
+
+        return storage_->get_new_uploader(n_bytes, dir_name, QString("%1.keeper").arg(name));
+    }
+
     QString get_file_name() const
     {
         auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
         return backup_helper->get_uploader_committed_file_name();
     }
 
+    QString get_codec() const
+    {
+        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+        const auto head = backup_helper->get_uploaded_head();
+        return ArchiveMagic::name(ArchiveMagic::detect(head.constData(), size_t(head.size())));
+    }
+
+    QByteArray get_index() const
+    {
+        auto backup_helper = qSharedPointerDynamicCast<BackupHelper>(helper_);
+        return backup_helper->get_uploaded_index();
+    }
+
 private:
     ConnectionHelper connections_;
     QString file_name_;
@@ -123,7 +203,28 @@ void KeeperTaskBackup::ask_for_uploader(quint64 n_bytes, QString const & dir_nam
 {
     Q_D(KeeperTaskBackup);
 
-    d->ask_for_uploader(n_bytes, dir_name);
+    d->ask_for_uploader(n_bytes, dir_name, false);
+}
+
+void KeeperTaskBackup::ask_for_stream_uploader(QString const & dir_name)
+{
+    Q_D(KeeperTaskBackup);
+
+    d->ask_for_stream_uploader(dir_name);
+}
+
+bool KeeperTaskBackup::can_upload_directly() const
+{
+    Q_D(const KeeperTaskBackup);
+
+    return d->can_upload_directly();
+}
+
+void KeeperTaskBackup::ask_for_direct_uploader(quint64 n_bytes, QString const & dir_name)
+{
+    Q_D(KeeperTaskBackup);
+
+    d->ask_for_uploader(n_bytes, dir_name, true);
 }
 
 QString KeeperTaskBackup::get_file_name() const
@@ -132,3 +233,17 @@ QString KeeperTaskBackup::get_file_name() const
 
     return d->get_file_name();
 }
+
+QString KeeperTaskBackup::get_codec() const
+{
+    Q_D(const KeeperTaskBackup);
+
+    return d->get_codec();
+}
+
+QByteArray KeeperTaskBackup::get_index() const
+{
+    Q_D(const KeeperTaskBackup);
+
+    return d->get_index();
+}
@@ -38,9 +38,20 @@ public:
     Q_DISABLE_COPY(KeeperTaskBackup)
 
     void ask_for_uploader(quint64 n_bytes, QString const & dir_name);
+    void ask_for_stream_uploader(QString const & dir_name);
+
+    // true if the helper can write straight to storage with ask_for_direct_uploader()
+    bool can_upload_directly() const;
+    void ask_for_direct_uploader(quint64 n_bytes, QString const & dir_name);
 
     QString get_file_name() const;
 
+    // the name of the codec the uploaded archive was compressed with
+    QString get_codec() const;
+
+    // the uploaded archive's index, if it's a SeekableArchive
+    QByteArray get_index() const;
+
 protected:
     QStringList get_helper_urls() const override;
     void init_helper() override;
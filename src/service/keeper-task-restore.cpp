@@ -19,6 +19,7 @@
  */
 
 #include "util/connection-helper.h"
+#include "storage-framework/chunk-store.h"
 #include "storage-framework/storage_framework_client.h"
 #include "helper/restore-helper.h"
 #include "service/app-const.h" // DEKKO_APP_ID
@@ -44,7 +45,7 @@ public:
 
     QStringList get_helper_urls() const
     {
-        return helper_registry_->get_restore_helper_urls(task_data_.metadata);
+        return helper_registry_->get_restore_helper_urls(task_data_.metadata, task_data_.helper_path);
     }
 
     void init_helper()
@@ -71,9 +72,14 @@ public:
             return;
         }
 
+        // deduplicated backups are reassembled from the chunk store
+        auto const future = file_name.endsWith(ChunkStore::LIST_SUFFIX)
+            ? storage_->get_new_chunk_downloader(dir_name, file_name)
+            : storage_->get_new_downloader(dir_name, file_name);
+
         // extract the dir_name.
         connections_.connect_future(
-            storage_->get_new_downloader(dir_name, file_name),
+            future,
             std::function<void(std::shared_ptr<Downloader> const&)>{
                 [this](std::shared_ptr<Downloader> const& downloader){
                     auto fd {-1};
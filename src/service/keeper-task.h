@@ -43,6 +43,7 @@ public:
         QString action;
         keeper::Error error;
         Metadata metadata;
+        QString helper_path; // the DBus path that the helper calls us on
     };
 
     KeeperTask(TaskData & task_data,
@@ -67,6 +68,7 @@ public:
 Q_SIGNALS:
     void task_state_changed(Helper::State state);
     void task_socket_ready(int socket_descriptor);
+    void task_direct_sockets_ready(int data_descriptor, int progress_descriptor);
     void task_socket_error(keeper::Error error);
 
 protected:
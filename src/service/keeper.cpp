@@ -24,6 +24,7 @@
 #include "service/metadata-provider.h"
 #include "service/keeper.h"
 #include "service/task-manager.h"
+#include "tar/catalog.h"
 
 #include <QDebug>
 #include <QDBusMessage>
@@ -31,7 +32,9 @@
 #include <QSharedPointer>
 #include <QVector>
 
-#include <algorithm> // std::find_if
+#include <algorithm> // std::find_if(), std::none_of()
+#include <array>
+#include <memory> // std::make_shared()
 #include <unistd.h>
 
 namespace
@@ -58,6 +61,69 @@ namespace
 
         return ret;
     }
+
+    // An incremental backup only holds what changed since its base,
+    // so restoring it means restoring its bases first, oldest first.
+    // Adds `task' and its bases to `tasks', skipping any already there.
+    // Returns false if one of the bases can't be found in `pool'.
+    bool add_restore_chain(Metadata const& task, QVector<Metadata> const& pool, QList<Metadata>& tasks)
+    {
+        QList<Metadata> chain {task};
+        for (auto base_dir_name = task.get_base_dir_name(); !base_dir_name.isEmpty(); )
+        {
+            auto const& newest = chain.front();
+            auto it = std::find_if(pool.begin(), pool.end(), [&newest, &base_dir_name](Metadata const& m){
+                return m.get_dir_name() == base_dir_name
+                    && m.get_type() == newest.get_type()
+                    && m.get_display_name() == newest.get_display_name()
+                    && m.get_property_value(keeper::Item::SUBTYPE_KEY) == newest.get_property_value(keeper::Item::SUBTYPE_KEY);
+            });
+            if (it == pool.end() || chain.size() > pool.size())
+            {
+                qWarning() << "Unable to find backup" << base_dir_name << "that" << task.get_uuid() << "depends on";
+                return false;
+            }
+            chain.prepend(*it);
+            base_dir_name = it->get_base_dir_name();
+        }
+
+        for (auto const& link : chain)
+        {
+            auto const uuid = link.get_uuid();
+            if (std::none_of(tasks.begin(), tasks.end(), [&uuid](Metadata const& m){return m.get_uuid()==uuid;}))
+                tasks << link;
+        }
+        return true;
+    }
+
+    // A folder's next backup is incremental to the one its catalog
+    // describes, so that backup and all of its bases must still be in
+    // storage. If they aren't, or if `stored' couldn't be listed, forget
+    // the catalog so that keeper-tar makes a full backup instead.
+    void forget_missing_bases(QList<Metadata> const& tasks, QVector<Metadata> const& stored, bool stored_ok)
+    {
+        for (auto const& task : tasks)
+        {
+            if (task.get_type() != keeper::Item::FOLDER_VALUE)
+                continue;
+            auto const folder = task.get_property_value(keeper::Item::SUBTYPE_KEY).toString();
+            Catalog catalog;
+            if (folder.isEmpty() || !catalog.load(Catalog::path_for(folder)))
+                continue;
+
+            auto it = std::find_if(stored.begin(), stored.end(), [&task, &catalog](Metadata const& m){
+                return m.get_dir_name() == catalog.dir_name
+                    && m.get_type() == task.get_type()
+                    && m.get_property_value(keeper::Item::SUBTYPE_KEY) == task.get_property_value(keeper::Item::SUBTYPE_KEY);
+            });
+            QList<Metadata> chain;
+            if (stored_ok && (it != stored.end()) && add_restore_chain(*it, stored, chain))
+                continue;
+
+            qWarning() << "Backup" << catalog.dir_name << "of" << folder << "isn't in storage; the next one will be a full backup";
+            Catalog::discard(folder);
+        }
+    }
 }
 
 class KeeperPrivate : public QObject
@@ -113,11 +179,22 @@ public:
                 auto tasks = get_tasks(cached_backup_choices_, uuids);
                 if (!tasks.empty())
                 {
-                    auto unhandled = QSet<QString>::fromList(uuids);
-                    if (task_manager_.start_backup(tasks.values(), storage))
-                        unhandled.subtract(QSet<QString>::fromList(tasks.keys()));
+                    // see what's in storage before building on it
+                    connections_.connect_oneshot(
+                        this,
+                        &KeeperPrivate::restore_choices_ready,
+                        std::function<void(keeper::Error)>{[this, uuids, msg, bus, tasks, storage](keeper::Error error){
+                            forget_missing_bases(tasks.values(), cached_restore_choices_, error == keeper::Error::OK);
 
-                    check_for_unhandled_tasks_and_reply(unhandled, bus, msg);
+                            auto unhandled = QSet<QString>::fromList(uuids);
+                            if (task_manager_.start_backup(tasks.values(), storage))
+                                unhandled.subtract(QSet<QString>::fromList(tasks.keys()));
+
+                            check_for_unhandled_tasks_and_reply(unhandled, bus, msg);
+                        }}
+                    );
+                    cached_restore_choices_.clear();
+                    get_choices(restore_choices_, KeeperPrivate::ChoicesType::RESTORES_CHOICES, storage);
                 }
                 else // restore
                 {
@@ -132,8 +209,13 @@ public:
                             {
                                 auto restore_tasks = get_tasks(cached_restore_choices_, uuids);
                                 qDebug() << "After getting tasks...";
-                                if (!restore_tasks.empty() && task_manager_.start_restore(restore_tasks.values(), storage))
-                                    unhandled.subtract(QSet<QString>::fromList(restore_tasks.keys()));
+                                QList<Metadata> chains;
+                                QSet<QString> chained;
+                                for (auto const& task : restore_tasks)
+                                    if (add_restore_chain(task, cached_restore_choices_, chains))
+                                        chained << task.get_uuid();
+                                if (!chains.empty() && task_manager_.start_restore(chains, storage))
+                                    unhandled.subtract(chained);
                             }
                             check_for_unhandled_tasks_and_reply(unhandled, bus, msg);
                         }}
@@ -268,22 +350,72 @@ public:
     {
         qDebug("Keeper::StartBackup(n_bytes=%zu)", size_t(n_bytes));
 
-        connections_.connect_oneshot(
-            &task_manager_,
-            &TaskManager::socket_ready,
-            std::function<void(int)>{
-                [bus,msg](int fd){
-                    qDebug("BackupManager returned socket %d", fd);
+        auto const uuid = task_for_helper(bus, msg);
+        if (!uuid.isEmpty())
+        {
+            reply_with_backup_socket(bus, msg, uuid);
+
+            qDebug() << "Asking for a storage framework socket from the task manager";
+            task_manager_.ask_for_uploader(uuid, n_bytes);
+        }
+
+        // tell the caller that we'll be responding async
+        msg.setDelayedReply(true);
+        return QDBusUnixFileDescriptor(0);
+    }
+
+    QDBusUnixFileDescriptor start_backup_stream(QDBusConnection bus,
+                                                QDBusMessage const & msg)
+    {
+        qDebug() << "Keeper::StartBackupStream()";
+
+        auto const uuid = task_for_helper(bus, msg);
+        if (!uuid.isEmpty())
+        {
+            reply_with_backup_socket(bus, msg, uuid);
+
+            qDebug() << "Asking for a streaming backup socket from the task manager";
+            task_manager_.ask_for_stream_uploader(uuid);
+        }
+
+        // tell the caller that we'll be responding async
+        msg.setDelayedReply(true);
+        return QDBusUnixFileDescriptor(0);
+    }
+
+    // The helper writes straight to the storage socket, and
+    // reports its progress to us on the helper socket instead
+    QDBusUnixFileDescriptor start_backup_direct(QDBusConnection bus,
+                                                QDBusMessage const & msg,
+                                                quint64 n_bytes,
+                                                QDBusUnixFileDescriptor& /*progress*/)
+    {
+        qDebug("Keeper::StartBackupDirect(n_bytes=%zu)", size_t(n_bytes));
+
+        auto const uuid = task_for_helper(bus, msg);
+        if (uuid.isEmpty())
+            return QDBusUnixFileDescriptor(0);
+
+        // the helper falls back to StartBackup() when we say no
+        if (!task_manager_.can_upload_directly(uuid))
+        {
+            msg.setDelayedReply(true);
+            bus.send(msg.createErrorReply(QDBusError::NotSupported, "This backup can't be written directly to storage"));
+            return QDBusUnixFileDescriptor(0);
+        }
+
+        reply_when_ready(
+            uuid,
+            &TaskManager::direct_sockets_ready,
+            std::function<void(int,int)>{
+                [bus,msg](int data_fd, int progress_fd){
+                    qDebug("BackupManager returned sockets %d and %d", data_fd, progress_fd);
                     auto reply = msg.createReply();
-                    reply << QVariant::fromValue(QDBusUnixFileDescriptor(fd));
+                    reply << QVariant::fromValue(QDBusUnixFileDescriptor(data_fd));
+                    reply << QVariant::fromValue(QDBusUnixFileDescriptor(progress_fd));
                     bus.send(reply);
                 }
-            }
-        );
-
-        connections_.connect_oneshot(
-            &task_manager_,
-            &TaskManager::socket_error,
+            },
             std::function<void(keeper::Error)>{
                 [bus,msg](keeper::Error error){
                     qDebug("BackupManager returned socket error: %d", static_cast<int>(error));
@@ -292,22 +424,50 @@ public:
             }
         );
 
-        qDebug() << "Asking for a storage framework socket from the task manager";
-        task_manager_.ask_for_uploader(n_bytes);
+        qDebug() << "Asking for a direct storage framework socket from the task manager";
+        task_manager_.ask_for_direct_uploader(uuid, n_bytes);
 
         // tell the caller that we'll be responding async
         msg.setDelayedReply(true);
         return QDBusUnixFileDescriptor(0);
     }
 
+    void reply_with_backup_socket(QDBusConnection bus,
+                                  QDBusMessage const & msg,
+                                  QString const & uuid)
+    {
+        reply_when_ready(
+            uuid,
+            &TaskManager::socket_ready,
+            std::function<void(int)>{
+                [bus,msg](int fd){
+                    qDebug("BackupManager returned socket %d", fd);
+                    auto reply = msg.createReply();
+                    reply << QVariant::fromValue(QDBusUnixFileDescriptor(fd));
+                    bus.send(reply);
+                }
+            },
+            std::function<void(keeper::Error)>{
+                [bus,msg](keeper::Error error){
+                    qDebug("BackupManager returned socket error: %d", static_cast<int>(error));
+                    bus.send(msg.createErrorReply(QDBusError::InvalidArgs, "Error obtaining remote backup socket"));
+                }
+            }
+        );
+    }
+
 
     QDBusUnixFileDescriptor start_restore(QDBusConnection bus,
                                           QDBusMessage const & msg)
     {
         qDebug() << "Keeper::StartRestore()";
 
-        connections_.connect_oneshot(
-            &task_manager_,
+        auto const uuid = task_for_helper(bus, msg);
+        if (uuid.isEmpty())
+            return QDBusUnixFileDescriptor(0);
+
+        reply_when_ready(
+            uuid,
             &TaskManager::socket_ready,
             std::function<void(int)>{
                 [bus,msg](int fd){
@@ -317,12 +477,7 @@ public:
                     close(fd);
                     bus.send(reply);
                 }
-            }
-        );
-
-        connections_.connect_oneshot(
-            &task_manager_,
-            &TaskManager::socket_error,
+            },
             std::function<void(keeper::Error)>{
                 [bus,msg](keeper::Error error){
                     qDebug("RestoreManager returned socket error: %d", static_cast<int>(error));
@@ -332,13 +487,61 @@ public:
         );
 
         qDebug() << "Asking for a storage framework socket from the task manager";
-        task_manager_.ask_for_downloader();
+        task_manager_.ask_for_downloader(uuid);
 
         // tell the caller that we'll be responding async
         msg.setDelayedReply(true);
         return QDBusUnixFileDescriptor(0);
     }
 
+    // The task whose helper sent `msg', which we can tell by the path it called.
+    // If there isn't one, replies with an error and returns an empty string.
+    QString task_for_helper(QDBusConnection bus,
+                            QDBusMessage const & msg)
+    {
+        auto const uuid = task_manager_.task_for_helper_path(msg.path());
+        if (uuid.isEmpty())
+        {
+            qWarning() << "No running helper calls us on" << msg.path();
+            msg.setDelayedReply(true);
+            bus.send(msg.createErrorReply(QDBusError::InvalidArgs, QStringLiteral("No running helper calls keeper on %1").arg(msg.path())));
+        }
+        return uuid;
+    }
+
+    // Calls on_ready or on_error once, when the task manager answers this task's helper.
+    // Several helpers can be waiting at once, so the other tasks' answers are ignored.
+    template<typename... Fds>
+    void reply_when_ready(QString const & uuid,
+                          void (TaskManager::*ready_signal)(QString const &, Fds...),
+                          std::function<void(Fds...)> const & on_ready,
+                          std::function<void(keeper::Error)> const & on_error)
+    {
+        auto connections = std::make_shared<std::array<QMetaObject::Connection,2>>();
+        auto disconnect_both = [connections](){
+            for (auto const& connection : *connections)
+                QObject::disconnect(connection);
+        };
+
+        (*connections)[0] = QObject::connect(&task_manager_, ready_signal,
+            [uuid, on_ready, disconnect_both](QString const & task_uuid, Fds... fds){
+                if (task_uuid != uuid)
+                    return;
+                disconnect_both();
+                on_ready(fds...);
+            }
+        );
+
+        (*connections)[1] = QObject::connect(&task_manager_, &TaskManager::socket_error,
+            [uuid, on_error, disconnect_both](QString const & task_uuid, keeper::Error error){
+                if (task_uuid != uuid)
+                    return;
+                disconnect_both();
+                on_error(error);
+            }
+        );
+    }
+
     void cancel()
     {
         task_manager_.cancel();
@@ -441,6 +644,26 @@ Keeper::StartBackup(QDBusConnection bus,
     return d->start_backup(bus, msg, n_bytes);
 }
 
+QDBusUnixFileDescriptor
+Keeper::StartBackupStream(QDBusConnection bus,
+                          QDBusMessage const & msg)
+{
+    Q_D(Keeper);
+
+    return d->start_backup_stream(bus, msg);
+}
+
+QDBusUnixFileDescriptor
+Keeper::StartBackupDirect(QDBusConnection bus,
+                          QDBusMessage const & msg,
+                          quint64 n_bytes,
+                          QDBusUnixFileDescriptor& progress)
+{
+    Q_D(Keeper);
+
+    return d->start_backup_direct(bus, msg, n_bytes, progress);
+}
+
 QDBusUnixFileDescriptor
 Keeper::StartRestore(QDBusConnection bus,
                      QDBusMessage const & msg)
@@ -59,6 +59,13 @@ public:
                                         QDBusMessage const & message,
                                         quint64 nbytes);
 
+    QDBusUnixFileDescriptor StartBackupStream(QDBusConnection,
+                                              QDBusMessage const & message);
+
+    QDBusUnixFileDescriptor StartBackupDirect(QDBusConnection,
+                                              QDBusMessage const & message,
+                                              quint64 nbytes,
+                                              QDBusUnixFileDescriptor& progress);
 
     QDBusUnixFileDescriptor StartRestore(QDBusConnection,
                                         QDBusMessage const & message);
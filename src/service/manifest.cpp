@@ -25,6 +25,7 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QPair>
 #include <QSharedPointer>
 #include <QVector>
 
@@ -64,8 +65,21 @@ public:
         entries_.push_back(entry);
     }
 
+    void add_file(QString const & name, QByteArray const & contents)
+    {
+        files_.push_back(qMakePair(name, contents));
+    }
+
     void store()
     {
+        // store the other files first, so that
+        // the manifest never lists one that isn't there
+        if (!files_.isEmpty())
+        {
+            store_next_file();
+            return;
+        }
+
         qDebug() << "Metadata asking storage framework for a socket";
         auto json_data = to_json();
         auto n_bytes = json_data.size();
@@ -176,6 +190,38 @@ public:
 
 private:
 
+    void store_next_file()
+    {
+        const auto file = files_.takeFirst();
+        const auto name = file.first;
+        const auto contents = file.second;
+
+        connections_.connect_future(
+            storage_->get_new_uploader(contents.size(), dir_, name),
+            std::function<void(std::shared_ptr<Uploader> const&)>{
+                [this, name, contents](std::shared_ptr<Uploader> const& uploader){
+                    if (!uploader)
+                    {
+                        finish_with_error(QStringLiteral("Error retrieving uploader for %1 from storage-framework").arg(name));
+                        return;
+                    }
+                    uploader->socket()->write(contents);
+                    connections_.connect_oneshot(
+                        uploader.get(),
+                        &Uploader::commit_finished,
+                        std::function<void(bool)>{[this, name, uploader](bool success){
+                            if (success)
+                                store();
+                            else
+                                finish_with_error(QStringLiteral("Error committing %1 to storage-framework").arg(name));
+                        }}
+                    );
+                    uploader->commit();
+                }
+            }
+        );
+    }
+
     void finish_with_error(QString const & message)
     {
         error_string_ = message;
@@ -193,6 +239,7 @@ private:
     QString dir_;
 
     QVector<Metadata> entries_;
+    QVector<QPair<QString,QByteArray>> files_;
     QString error_string_;
     QString uploader_committed_file_name_;
 
@@ -219,6 +266,13 @@ void Manifest::add_entry(Metadata const & entry)
     d->add_entry(entry);
 }
 
+void Manifest::add_file(QString const & name, QByteArray const & contents)
+{
+    Q_D(Manifest);
+
+    d->add_file(name, contents);
+}
+
 void Manifest::store()
 {
     Q_D(Manifest);
@@ -36,6 +36,8 @@ public:
     Q_DISABLE_COPY(Manifest)
 
     void add_entry(Metadata const & entry);
+    // adds a file to store beside the manifest, e.g. an archive's index
+    void add_file(QString const & name, QByteArray const & contents);
     void store();
 
     void read();
@@ -20,6 +20,7 @@
 #include "service/restore-choices.h"
 
 #include "service/manifest.h"
+#include "storage-framework/chunk-store.h"
 #include "storage-framework/storage_framework_client.h"
 
 #include <QDebug>
@@ -49,7 +50,11 @@ RestoreChoices::get_backups_async(QString const & storage)
     connections_.connect_future(
         storage_->get_keeper_dirs(),
         std::function<void(QVector<QString> const &)>{
-            [this](QVector<QString> const & dirs){
+            [this](QVector<QString> const & keeper_dirs){
+                // the chunk store isn't a backup
+                auto dirs = keeper_dirs;
+                dirs.removeAll(ChunkStore::DIR_NAME);
+
                 if (dirs.size() > 0)
                 {
                     manifests_to_read_ = dirs.size();
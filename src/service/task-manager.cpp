@@ -23,10 +23,15 @@
 #include "keeper-task-restore.h"
 #include "manifest.h"
 #include "storage-framework/storage_framework_client.h"
+#include "tar/catalog.h"
+#include "tar/seekable-archive.h"
 #include "task-manager.h"
+#include "task-queue.h"
 #include "util/connection-helper.h"
 #include "util/dbus-utils.h"
 
+#include <QDBusConnection>
+
 class TaskManagerPrivate
 {
 public:
@@ -36,6 +41,7 @@ public:
         : q_ptr(manager)
         , helper_registry_(helper_registry)
         , storage_(storage)
+        , queue_(helper_registry->max_concurrent_tasks())
     {
     }
 
@@ -45,6 +51,7 @@ public:
     {
         auto const now = QDateTime::currentDateTime();
         backup_dir_name_ = now.toString("yyyy-MM-ddTHH-mm-ss");
+        pending_catalogs_.clear();
         active_manifest_.reset(new Manifest(storage_, backup_dir_name_), [](Manifest *m){m->deleteLater();});
         return start_tasks(tasks, storage, Mode::BACKUP);
     }
@@ -76,12 +83,18 @@ public:
 //        return state_;
     }
 
-    void ask_for_uploader(quint64 n_bytes)
+    QString task_for_helper_path(QString const& path) const
+    {
+        return queue_.task_for_helper_path(path);
+    }
+
+    void ask_for_uploader(QString const& uuid, quint64 n_bytes)
     {
-        qDebug() << "Starting backup";
-        if (task_)
+        qDebug() << "Starting backup for" << uuid;
+        auto task = tasks_.value(uuid);
+        if (task)
         {
-            auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(task_);
+            auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(task);
             if (!backup_task_)
             {
                 qWarning() << "Only backup tasks are allowed to ask for storage framework sockets";
@@ -92,12 +105,53 @@ public:
         }
     }
 
-    void ask_for_downloader()
+    void ask_for_stream_uploader(QString const& uuid)
+    {
+        qDebug() << "Starting backup stream for" << uuid;
+        auto task = tasks_.value(uuid);
+        if (task)
+        {
+            auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(task);
+            if (!backup_task_)
+            {
+                qWarning() << "Only backup tasks are allowed to ask for storage framework sockets";
+                // TODO Mark this as an error at the current task and move to the next task
+                return;
+            }
+            backup_task_->ask_for_stream_uploader(backup_dir_name_);
+        }
+    }
+
+    bool can_upload_directly(QString const& uuid) const
+    {
+        auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(tasks_.value(uuid));
+        return backup_task_ && backup_task_->can_upload_directly();
+    }
+
+    void ask_for_direct_uploader(QString const& uuid, quint64 n_bytes)
+    {
+        qDebug() << "Starting direct backup for" << uuid;
+        auto task = tasks_.value(uuid);
+        if (task)
+        {
+            auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(task);
+            if (!backup_task_)
+            {
+                qWarning() << "Only backup tasks are allowed to ask for storage framework sockets";
+                // TODO Mark this as an error at the current task and move to the next task
+                return;
+            }
+            backup_task_->ask_for_direct_uploader(n_bytes, backup_dir_name_);
+        }
+    }
+
+    void ask_for_downloader(QString const& uuid)
     {
-        qDebug() << "Starting restore";
-        if (task_)
+        qDebug() << "Starting restore for" << uuid;
+        auto task = tasks_.value(uuid);
+        if (task)
         {
-            auto restore_task_ = qSharedPointerDynamicCast<KeeperTaskRestore>(task_);
+            auto restore_task_ = qSharedPointerDynamicCast<KeeperTaskRestore>(task);
             if (!restore_task_)
             {
                 qWarning() << "Only restore tasks are allowed to ask for storage framework downloaders";
@@ -111,11 +165,11 @@ public:
     void cancel()
     {
         qDebug() << "=============== CANCELING =======================";
-        if (task_)
+        for (auto const & task: tasks_.values())
         {
-            task_->cancel();
+            task->cancel();
         }
-        for (auto const & task: remaining_tasks_)
+        for (auto const & task: queue_.take_remaining())
         {
             auto& td = task_data_[task];
             td.action = QStringLiteral("cancelled"); // TODO i18n
@@ -123,7 +177,6 @@ public:
         }
         // notify the initial state once for all tasks
         notify_state_changed();
-        remaining_tasks_.clear();
         Q_EMIT(q_ptr->finished());
     }
 
@@ -136,7 +189,7 @@ private:
         storage_->set_storage(storage);
         bool success = true;
 
-        if (!remaining_tasks_.isEmpty())
+        if (!queue_.remaining().isEmpty())
         {
             // FIXME: return a dbus error here
             qWarning() << "keeper is already active";
@@ -145,18 +198,19 @@ private:
         else
         {
             // rebuild the state variables
+            for (auto const & uuid: tasks_.keys())
+                remove_task(uuid);
             state_.clear();
             task_data_.clear();
-            current_task_.clear();
-            remaining_tasks_.clear();
 
             mode_ = mode;
 
+            QStringList uuids;
             for(auto const& metadata : tasks)
             {
                 auto const uuid = metadata.get_uuid();
 
-                remaining_tasks_ << uuid;
+                uuids << uuid;
 
                 auto& td = task_data_[uuid];
                 td.metadata = metadata;
@@ -165,6 +219,9 @@ private:
                 set_initial_task_state(td);
             }
 
+            // a restore chain needs its base restored before its increments
+            queue_.reset(uuids, mode == Mode::RESTORE);
+
             // notify the initial state once for all tasks
             notify_state_changed();
 
@@ -174,68 +231,117 @@ private:
         return success;
     }
 
-    void manifest_stored(bool success)
+    void manifest_stored(QString const& uuid, bool success)
     {
-        qDebug() << "Manifest upload finished success = " << success << " current task=" << current_task_;
-        auto& td = task_data_[current_task_];
+        qDebug() << "Manifest upload finished success = " << success << " last task=" << uuid;
         if (success)
         {
-            update_task_state(td);
+            update_task_state(uuid);
         }
         else
         {
-            td.error = keeper::Error::MANIFEST_STORAGE;
-            set_current_task_action(task_->to_string(Helper::State::FAILED));
+            task_data_[uuid].error = keeper::Error::MANIFEST_STORAGE;
+            set_task_action(uuid, Helper::State::FAILED);
         }
+        remove_task(uuid);
         active_manifest_.reset();
 
+        // now that the backups are stored, later ones can be incremental to them
+        for (auto const& folder : pending_catalogs_)
+        {
+            if (success)
+                Catalog::commit_pending(folder, backup_dir_name_);
+            else
+                Catalog::discard_pending(folder);
+        }
+        pending_catalogs_.clear();
+
         Q_EMIT(q_ptr->finished());
     }
 
-    void on_helper_state_changed(Helper::State state)
+    void on_task_state_changed(QString const& uuid, Helper::State state)
     {
-        auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(task_);
-        auto& td = task_data_[current_task_];
+        auto task = tasks_.value(uuid);
+        if (!task)
+            return;
+
+        auto backup_task_ = qSharedPointerDynamicCast<KeeperTaskBackup>(task);
+        auto& td = task_data_[uuid];
+
+        const auto task_done = state == Helper::State::COMPLETE || state == Helper::State::FAILED;
+
+        // a backup helper has exited by the time its task is DATA_COMPLETE.
+        // A restore helper is still writing files until its task is COMPLETE.
+        const auto helper_done = task_done
+                              || state == Helper::State::CANCELLED
+                              || (backup_task_ && state == Helper::State::DATA_COMPLETE);
+        if (helper_done)
+            queue_.helper_finished(uuid);
 
         // for the last completed backup task we delay updating the
         // state until the manifest file is stored
-        if (remaining_tasks_.size() || (state != Helper::State::COMPLETE && state != Helper::State::FAILED))
-            update_task_state(td);
+        const auto is_last = task_done && queue_.is_last(uuid);
+        if (!is_last)
+            update_task_state(uuid);
 
-        if (state == Helper::State::COMPLETE || state == Helper::State::FAILED)
+        if (task_done)
         {
             if (backup_task_ && state == Helper::State::COMPLETE && active_manifest_)
             {
                 qDebug() << "Backup task finished. The file created in storage framework is: [" << backup_task_->get_file_name() << "]";
                 td.metadata.set_property_value(keeper::Item::FILE_NAME_KEY, backup_task_->get_file_name());
                 td.metadata.set_property_value(keeper::Item::DIR_NAME_KEY, backup_dir_name_);
+                td.metadata.set_property_value(keeper::Item::CODEC_KEY, backup_task_->get_codec());
+
+                // keep a copy of a seekable archive's index beside it,
+                // so that it can be read without downloading the archive
+                const auto index = backup_task_->get_index();
+                if (!index.isEmpty())
+                {
+                    const auto index_file_name = backup_task_->get_file_name() + SeekableArchive::INDEX_SUFFIX;
+                    td.metadata.set_property_value(keeper::Item::INDEX_FILE_NAME_KEY, index_file_name);
+                    active_manifest_->add_file(index_file_name, index);
+                }
+
+                // if the helper made an incremental backup, note which backup it's based on
+                const auto folder = get_folder(td.metadata);
+                Catalog catalog;
+                if (!folder.isEmpty() && catalog.load(Catalog::pending_path_for(folder)))
+                {
+                    if (!catalog.base_dir_name.isEmpty())
+                        td.metadata.set_property_value(keeper::Item::BASE_DIR_NAME_KEY, catalog.base_dir_name);
+                    pending_catalogs_ << folder;
+                }
+
                 active_manifest_->add_entry(td.metadata);
             }
-            if (remaining_tasks_.size())
-            {
-                qDebug() << "STARTING NEXT TASK ---------------------------------------";
-                start_next_task();
-            }
-            else
+
+            if (is_last)
             {
+                // every task is done, so the manifest can list them all
                 if (active_manifest_ && active_manifest_->get_entries().size())
                 {
                     qDebug() << "STORING MANIFEST------------";
                     connections_.connect_oneshot(
                         active_manifest_.data(),
                         &Manifest::finished,
-                        std::function<void(bool)>{[this](bool success){
-                            manifest_stored(success);
+                        std::function<void(bool)>{[this, uuid](bool success){
+                            manifest_stored(uuid, success);
                         }}
                     );
                     active_manifest_->store();
+                    return;
                 }
-                else
-                {
-                    update_task_state(td);
-                }
+
+                update_task_state(uuid);
             }
         }
+
+        if (task_done || state == Helper::State::CANCELLED)
+        {
+            remove_task(uuid);
+            start_next_task();
+        }
     }
 
     /***
@@ -248,81 +354,116 @@ private:
         if (it == task_data_.end())
         {
             qCritical() << "no task data for" << uuid;
+            queue_.task_finished(uuid);
             return false;
         }
 
         auto& td = it.value();
+        td.helper_path = queue_.helper_path(uuid);
+        register_helper_path(td.helper_path);
 
-        qDebug() << "Creating task for uuid = " << uuid;
+        qDebug() << "Creating task for uuid = " << uuid << "helper path = " << td.helper_path;
         // initialize a new task
 
-        if (task_)
-            task_.data()->disconnect();
-
+        // tasks may finish while they're emitting a signal, so delete them later
+        QSharedPointer<KeeperTask> task;
         if (mode_ == Mode::BACKUP)
         {
-            task_.reset(new KeeperTaskBackup(td, helper_registry_, storage_));
+            // don't mistake a catalog left by an earlier, failed backup for this one's
+            const auto folder = get_folder(td.metadata);
+            if (!folder.isEmpty())
+                Catalog::discard_pending(folder);
+
+            task.reset(new KeeperTaskBackup(td, helper_registry_, storage_), [](KeeperTask *t){t->deleteLater();});
         }
         else
         {
-            task_.reset(new KeeperTaskRestore(td, helper_registry_, storage_));
+            task.reset(new KeeperTaskRestore(td, helper_registry_, storage_), [](KeeperTask *t){t->deleteLater();});
         }
+        tasks_[uuid] = task;
 
         qDebug() << "task created: " << state_;
 
-        set_current_task(uuid);
+        update_task_state(uuid);
+
+        QObject::connect(task.data(), &KeeperTask::task_state_changed,
+            std::bind(&TaskManagerPrivate::on_task_state_changed, this, uuid, std::placeholders::_1)
+        );
 
-        QObject::connect(task_.data(), &KeeperTask::task_state_changed,
-            std::bind(&TaskManagerPrivate::on_helper_state_changed, this, std::placeholders::_1)
+        QObject::connect(task.data(), &KeeperTask::task_socket_ready,
+            std::bind(&TaskManager::socket_ready, q_ptr, uuid, std::placeholders::_1)
         );
 
-        QObject::connect(task_.data(), &KeeperTask::task_socket_ready,
-            std::bind(&TaskManager::socket_ready, q_ptr, std::placeholders::_1)
+        QObject::connect(task.data(), &KeeperTask::task_direct_sockets_ready,
+            std::bind(&TaskManager::direct_sockets_ready, q_ptr, uuid, std::placeholders::_1, std::placeholders::_2)
         );
 
-        QObject::connect(task_.data(), &KeeperTask::task_socket_error,
-                    std::bind(&TaskManagerPrivate::on_task_socket_error, this, std::placeholders::_1)
+        QObject::connect(task.data(), &KeeperTask::task_socket_error,
+                    std::bind(&TaskManagerPrivate::on_task_socket_error, this, uuid, std::placeholders::_1)
         );
 
-        return task_->start();
+        return task->start();
+    }
+
+    void remove_task(QString const& uuid)
+    {
+        auto task = tasks_.take(uuid);
+        if (task)
+            task->disconnect();
+
+        unregister_helper_path(queue_.helper_path(uuid));
+        queue_.task_finished(uuid);
     }
 
-    void on_task_socket_error(keeper::Error error)
+    // Each task's helper calls the helper object on its own path,
+    // so that we know which task it's asking for a socket for
+    static void register_helper_path(QString const& path)
     {
-        if (!task_)
+        auto bus = QDBusConnection::sessionBus();
+        auto helper = bus.objectRegisteredAt(DBusTypes::KEEPER_HELPER_PATH);
+        if (!helper)
+        {
+            qWarning() << "No helper object to register at" << path;
+        }
+        else if (!bus.registerObject(path, helper))
         {
-            qWarning() << "Error updating current task state";
+            qWarning() << "Could not register the helper object at" << path << ':' << bus.lastError().message();
         }
-        auto& td = task_data_[current_task_];
-        td.error = error;
-        set_current_task_action(task_->to_string(Helper::State::FAILED));
-        Q_EMIT(q_ptr->socket_error(error));
     }
 
-    void set_current_task(QString const& uuid)
+    static void unregister_helper_path(QString const& path)
     {
-        auto const prev = current_task_;
-
-        current_task_ = uuid;
+        if (!path.isEmpty())
+            QDBusConnection::sessionBus().unregisterObject(path);
+    }
 
-        if (!uuid.isEmpty())
-            update_task_state(uuid);
+    // the directory that a folder task backs up, or an empty string for other tasks
+    static QString get_folder(Metadata const& metadata)
+    {
+        if (metadata.get_type() != keeper::Item::FOLDER_VALUE)
+            return QString();
+        return metadata.get_property_value(keeper::Item::SUBTYPE_KEY).toString();
     }
 
-    void clear_current_task()
+    void on_task_socket_error(QString const& uuid, keeper::Error error)
     {
-        set_current_task(QString());
+        if (!tasks_.contains(uuid))
+        {
+            qWarning() << "Error updating task state for" << uuid;
+        }
+        else
+        {
+            task_data_[uuid].error = error;
+            set_task_action(uuid, Helper::State::FAILED);
+        }
+        Q_EMIT(q_ptr->socket_error(uuid, error));
     }
 
     void start_next_task()
     {
-        bool started {false};
-
-        while (!started && !remaining_tasks_.isEmpty())
-            started = start_task(remaining_tasks_.takeFirst());
-
-        if (!started)
-            clear_current_task();
+        // A task that fails to start may have started the next one on its way out.
+        for (QString uuid; !(uuid = queue_.take_next()).isEmpty(); )
+            start_task(uuid);
     }
 
     /***
@@ -331,15 +472,15 @@ private:
 
     void update_task_state(QString const& uuid)
     {
-        qDebug() << "Updating state for " << uuid << static_cast<void *>(task_.data());
-        auto it = task_data_.find(uuid);
-        if (it == task_data_.end())
+        auto task = tasks_.value(uuid);
+        qDebug() << "Updating state for " << uuid << static_cast<void *>(task.data());
+        if (!task)
         {
-            qCritical() << "no task data for" << uuid;
+            qCritical() << "no task for" << uuid;
             return;
         }
 
-        update_task_state(it.value());
+        update_task_state(*task, task_data_[uuid]);
     }
 
     void set_initial_task_state(KeeperTask::KeeperTask::TaskData& td)
@@ -360,9 +501,9 @@ private:
         Q_EMIT(q_ptr->state_changed());
     }
 
-    void update_task_state(KeeperTask::KeeperTask::TaskData& td)
+    void update_task_state(KeeperTask const& task, KeeperTask::KeeperTask::TaskData& td)
     {
-        auto task_state = task_->state();
+        auto task_state = task.state();
 
         // avoid sending repeated states to minimize the use of the bus
         if (task_state != state_[td.metadata.get_uuid()] && !task_state.isEmpty())
@@ -378,12 +519,15 @@ private:
         }
     }
 
-    void set_current_task_action(QString const& action)
+    void set_task_action(QString const& uuid, Helper::State state)
     {
-        auto& td = task_data_[current_task_];
-        td.action = action;
-        task_->recalculate_task_state();
-        update_task_state(td);
+        auto task = tasks_.value(uuid);
+        if (!task)
+            return;
+        auto& td = task_data_[uuid];
+        td.action = task->to_string(state);
+        task->recalculate_task_state();
+        update_task_state(*task, td);
     }
 
     /***
@@ -395,14 +539,14 @@ private:
     QSharedPointer<HelperRegistry> helper_registry_;
     QSharedPointer<StorageFrameworkClient> storage_;
 
-    QStringList remaining_tasks_;
-    QString current_task_;
+    TaskQueue queue_;
     QString backup_dir_name_;
 
     QVariantDictMap state_;
-    QSharedPointer<KeeperTask> task_;
+    QMap<QString,QSharedPointer<KeeperTask>> tasks_; // the tasks in flight
 
     QSharedPointer<Manifest> active_manifest_;
+    QStringList pending_catalogs_; // folders whose catalogs to commit once the manifest is stored
 
     ConnectionHelper connections_;
 
@@ -446,18 +590,46 @@ keeper::Items TaskManager::get_state() const
     return d->get_state();
 }
 
-void TaskManager::ask_for_uploader(quint64 n_bytes)
+QString TaskManager::task_for_helper_path(QString const& path) const
+{
+    Q_D(const TaskManager);
+
+    return d->task_for_helper_path(path);
+}
+
+void TaskManager::ask_for_uploader(QString const& uuid, quint64 n_bytes)
+{
+    Q_D(TaskManager);
+
+    d->ask_for_uploader(uuid, n_bytes);
+}
+
+void TaskManager::ask_for_stream_uploader(QString const& uuid)
+{
+    Q_D(TaskManager);
+
+    d->ask_for_stream_uploader(uuid);
+}
+
+bool TaskManager::can_upload_directly(QString const& uuid) const
+{
+    Q_D(const TaskManager);
+
+    return d->can_upload_directly(uuid);
+}
+
+void TaskManager::ask_for_direct_uploader(QString const& uuid, quint64 n_bytes)
 {
     Q_D(TaskManager);
 
-    d->ask_for_uploader(n_bytes);
+    d->ask_for_direct_uploader(uuid, n_bytes);
 }
 
-void TaskManager::ask_for_downloader()
+void TaskManager::ask_for_downloader(QString const& uuid)
 {
     Q_D(TaskManager);
 
-    d->ask_for_downloader();
+    d->ask_for_downloader(uuid);
 }
 
 void TaskManager::cancel()
@@ -56,15 +56,27 @@ public:
 
     keeper::Items get_state() const;
 
-    void ask_for_uploader(quint64 n_bytes);
+    // the task whose helper calls us on this DBus path, or an empty string
+    QString task_for_helper_path(QString const& path) const;
 
-    void ask_for_downloader();
+    void ask_for_uploader(QString const& uuid, quint64 n_bytes);
+
+    void ask_for_stream_uploader(QString const& uuid);
+
+    // true if the task's helper can write straight to storage
+    bool can_upload_directly(QString const& uuid) const;
+
+    void ask_for_direct_uploader(QString const& uuid, quint64 n_bytes);
+
+    void ask_for_downloader(QString const& uuid);
 
     void cancel();
 
 Q_SIGNALS:
-    void socket_ready(int reply);
-    void socket_error(keeper::Error error);
+    // the uuid says which task's helper asked for the socket
+    void socket_ready(QString const& uuid, int reply);
+    void direct_sockets_ready(QString const& uuid, int data_fd, int progress_fd);
+    void socket_error(QString const& uuid, keeper::Error error);
     void state_changed();
     void finished();
 
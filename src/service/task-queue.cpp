@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "qdbus-stubs/dbus-types.h"
+#include "service/task-queue.h"
+
+#include <algorithm> // std::max()
+
+TaskQueue::TaskQueue(int max_concurrent_tasks)
+    : max_concurrent_tasks_(std::max(1, max_concurrent_tasks))
+{
+}
+
+void
+TaskQueue::reset(QStringList const& uuids, bool serial)
+{
+    serial_ = serial;
+    remaining_ = uuids;
+    in_flight_.clear();
+    helpers_.clear();
+    helper_paths_.clear();
+}
+
+QString
+TaskQueue::take_next()
+{
+    if (remaining_.isEmpty())
+        return QString();
+
+    auto const limit = serial_ ? 1 : max_concurrent_tasks_;
+    if (in_flight_.size() >= limit)
+        return QString();
+
+    auto const uuid = remaining_.takeFirst();
+    helper_paths_[uuid] = make_helper_path(uuid);
+    in_flight_ << uuid;
+    helpers_ << uuid;
+    return uuid;
+}
+
+void
+TaskQueue::helper_finished(QString const& uuid)
+{
+    helpers_.removeAll(uuid);
+}
+
+void
+TaskQueue::task_finished(QString const& uuid)
+{
+    helpers_.removeAll(uuid);
+    in_flight_.removeAll(uuid);
+    helper_paths_.remove(uuid);
+}
+
+QStringList
+TaskQueue::take_remaining()
+{
+    QStringList ret;
+    ret.swap(remaining_);
+    return ret;
+}
+
+QStringList
+TaskQueue::remaining() const
+{
+    return remaining_;
+}
+
+QStringList
+TaskQueue::in_flight() const
+{
+    return in_flight_;
+}
+
+bool
+TaskQueue::is_helper_running(QString const& uuid) const
+{
+    return helpers_.contains(uuid);
+}
+
+bool
+TaskQueue::is_last(QString const& uuid) const
+{
+    return remaining_.isEmpty() && in_flight_ == QStringList{uuid};
+}
+
+QString
+TaskQueue::helper_path(QString const& uuid) const
+{
+    return helper_paths_.value(uuid);
+}
+
+QString
+TaskQueue::task_for_helper_path(QString const& path) const
+{
+    if (path == QLatin1String(DBusTypes::KEEPER_HELPER_PATH))
+        return helpers_.size() == 1 ? helpers_.front() : QString();
+
+    return helper_paths_.key(path);
+}
+
+// DBus path elements may only hold [A-Za-z0-9_], so uuids' dashes become underscores
+QString
+TaskQueue::make_helper_path(QString const& uuid) const
+{
+    QString element;
+    for (auto const& ch : uuid)
+    {
+        auto const c = ch.unicode();
+        auto const ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+        element += ok ? ch : QChar('_');
+    }
+    if (element.isEmpty())
+        element = QStringLiteral("_");
+
+    auto const base = QStringLiteral("%1/%2").arg(QLatin1String(DBusTypes::KEEPER_HELPER_PATH)).arg(element);
+    auto path = base;
+    for (int i = 1; !helper_paths_.key(path).isEmpty(); ++i)
+        path = QStringLiteral("%1_%2").arg(base).arg(i);
+    return path;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+/**
+ * Decides which of the TaskManager's tasks run when,
+ * and which DBus path each task's helper talks to us on.
+ *
+ * Up to max_concurrent_tasks tasks are in flight at once.
+ * In serial mode a task doesn't start until the one before it is finished,
+ * e.g. a restore chain needs its base restored before its increments.
+ */
+class TaskQueue
+{
+public:
+    explicit TaskQueue(int max_concurrent_tasks);
+
+    // forget the previous tasks and queue these ones
+    void reset(QStringList const& uuids, bool serial);
+
+    // dequeues the next task if it can start now, or returns an empty string
+    QString take_next();
+
+    // the task's helper has exited, though the task may still be uploading
+    void helper_finished(QString const& uuid);
+
+    // the task is no longer in flight
+    void task_finished(QString const& uuid);
+
+    // dequeues the tasks that haven't started
+    QStringList take_remaining();
+
+    QStringList remaining() const;
+    QStringList in_flight() const;
+    bool is_helper_running(QString const& uuid) const;
+
+    // true if the task is the only one in flight and none are queued
+    bool is_last(QString const& uuid) const;
+
+    // the DBus path that the task's helper calls us on, or an empty string
+    QString helper_path(QString const& uuid) const;
+
+    // the task whose helper is calling us on `path', or an empty string.
+    // Helpers that use the shared KEEPER_HELPER_PATH are only
+    // told apart when one helper is running.
+    QString task_for_helper_path(QString const& path) const;
+
+private:
+    QString make_helper_path(QString const& uuid) const;
+
+    int const max_concurrent_tasks_;
+    bool serial_ {};
+    QStringList remaining_;
+    QStringList in_flight_;
+    QStringList helpers_; // the in-flight tasks whose helpers are running
+    QMap<QString,QString> helper_paths_; // uuid -> path
+};
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "storage-framework/chunk-cache.h"
+#include "storage-framework/chunk-store.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <utime.h>
+
+constexpr qint64 ChunkCache::MAX_BYTES;
+
+ChunkCache::ChunkCache(QString const& dir, qint64 max_bytes):
+    dir_{dir},
+    max_bytes_{max_bytes}
+{
+    // oldest first, so that the most recently used end up last
+    const auto files = QDir(dir_).entryInfoList(QDir::Files, QDir::Time|QDir::Reversed);
+    for (auto const& file : files)
+    {
+        const auto id = QByteArray::fromHex(file.fileName().toLatin1());
+        if (id.size() != 32)
+            continue;
+        add(id, file.size());
+    }
+    evict();
+}
+
+bool
+ChunkCache::contains(QByteArray const& id) const
+{
+    return entries_.contains(id);
+}
+
+QByteArray
+ChunkCache::get(QByteArray const& id)
+{
+    if (!contains(id))
+        return QByteArray();
+
+    const auto filename = path(id);
+    QFile file(filename);
+    QByteArray contents;
+    if (file.open(QIODevice::ReadOnly))
+        contents = file.readAll();
+
+    if (contents.isEmpty() || (ChunkStore::chunk_id(contents.constData(), contents.size()) != id))
+    {
+        qWarning() << "Removing bad cached chunk" << filename;
+        remove(id);
+        return QByteArray();
+    }
+
+    // mark it as recently used, both here and for the next ChunkCache
+    auto& entry = entries_[id];
+    lru_.splice(lru_.end(), lru_, entry.lru_pos);
+    utime(filename.toUtf8().constData(), nullptr);
+
+    return contents;
+}
+
+void
+ChunkCache::put(QByteArray const& id, char const* data, int len)
+{
+    if (contains(id) || (len > max_bytes_))
+        return;
+
+    QDir().mkpath(dir_);
+    QSaveFile file(path(id));
+    if (!file.open(QIODevice::WriteOnly) || (file.write(data, len) != len) || !file.commit())
+    {
+        qWarning() << "Unable to cache chunk" << file.fileName() << ':' << file.errorString();
+        return;
+    }
+
+    add(id, len);
+    evict();
+}
+
+qint64
+ChunkCache::size() const
+{
+    return size_;
+}
+
+QString
+ChunkCache::default_dir()
+{
+    return QStringLiteral("%1/keeper/chunks")
+        .arg(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation));
+}
+
+/***
+****
+***/
+
+QString
+ChunkCache::path(QByteArray const& id) const
+{
+    return QStringLiteral("%1/%2").arg(dir_).arg(QString::fromLatin1(id.toHex()));
+}
+
+void
+ChunkCache::add(QByteArray const& id, qint64 size)
+{
+    entries_.insert(id, Entry{lru_.insert(lru_.end(), id), size});
+    size_ += size;
+}
+
+void
+ChunkCache::remove(QByteArray const& id)
+{
+    auto it = entries_.find(id);
+    if (it == entries_.end())
+        return;
+
+    QFile::remove(path(id));
+    size_ -= it->size;
+    lru_.erase(it->lru_pos);
+    entries_.erase(it);
+}
+
+void
+ChunkCache::evict()
+{
+    while ((size_ > max_bytes_) && !lru_.empty())
+    {
+        const auto id = lru_.front();
+        remove(id);
+    }
+}
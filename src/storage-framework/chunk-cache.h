@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+#include <list>
+
+/**
+ * A bounded on-disk cache of chunks from the ChunkStore.
+ *
+ * Each chunk is kept in its own file, named after its id.
+ * When the cache grows past its limit, the least recently
+ * used chunks are removed.
+ */
+class ChunkCache
+{
+public:
+
+    explicit ChunkCache(QString const& dir = default_dir(), qint64 max_bytes = MAX_BYTES);
+    ~ChunkCache() =default;
+
+    bool contains(QByteArray const& id) const;
+
+    // returns an empty array if the chunk isn't cached
+    QByteArray get(QByteArray const& id);
+
+    void put(QByteArray const& id, char const* data, int len);
+
+    qint64 size() const;
+
+    static QString default_dir();
+    static constexpr qint64 MAX_BYTES {256*1024*1024};
+
+private:
+
+    QString path(QByteArray const& id) const;
+    void add(QByteArray const& id, qint64 size);
+    void remove(QByteArray const& id);
+    void evict();
+
+    struct Entry
+    {
+        std::list<QByteArray>::iterator lru_pos;
+        qint64 size;
+    };
+
+    QString const dir_;
+    qint64 const max_bytes_;
+    qint64 size_ {};
+    std::list<QByteArray> lru_; // least recently used first
+    QHash<QByteArray,Entry> entries_;
+};
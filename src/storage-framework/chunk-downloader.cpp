@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "storage-framework/chunk-downloader.h"
+#include "storage-framework/chunk-cache.h"
+#include "storage-framework/chunk-store.h"
+#include "storage-framework/storage_framework_client.h"
+#include "util/connection-helper.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+#include <sys/socket.h>
+
+#include <algorithm> // std::max()
+#include <cerrno>
+#include <cstring> // strerror()
+#include <functional> // std::bind()
+
+namespace
+{
+    // don't let more than this pile up waiting for the helper to read it
+    constexpr qint64 MAX_BUFFERED {4*1024*1024};
+
+    // how many packs to download at once
+    constexpr int MAX_FETCHES {4};
+
+    // how many packs to hold in memory, including the ones being downloaded
+    constexpr int MAX_PACKS {6};
+}
+
+class ChunkDownloader::Impl
+{
+public:
+
+    Impl(ChunkDownloader* q,
+         StorageFrameworkClient* storage,
+         QString const& dir_name,
+         QString const& file_name):
+        q_{q},
+        storage_{storage},
+        dir_name_{dir_name},
+        file_name_{file_name}
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, fds) == -1)
+        {
+            qWarning() << "Unable to create chunk downloader socket:" << strerror(errno);
+            failed_ = true;
+            return;
+        }
+        read_socket_->setSocketDescriptor(fds[0], QLocalSocket::ConnectedState, QIODevice::ReadOnly);
+        write_socket_.setSocketDescriptor(fds[1], QLocalSocket::ConnectedState, QIODevice::WriteOnly);
+
+        QObject::connect(&write_socket_, &QLocalSocket::bytesWritten,
+            std::bind(&Impl::pump, this)
+        );
+    }
+
+    ~Impl()
+    {
+        cancel_fetches();
+    }
+
+    Q_DISABLE_COPY(Impl)
+
+    void start()
+    {
+        if (failed_)
+        {
+            Q_EMIT(q_->ready(false));
+            return;
+        }
+
+        fetch(dir_name_, file_name_,
+            [this](QByteArray const& list){
+                if (!ChunkStore::parse_list(list, chunks_))
+                {
+                    qWarning() << "Unable to parse chunk list" << file_name_;
+                    Q_EMIT(q_->ready(false));
+                    return;
+                }
+                for (auto const& chunk : chunks_)
+                {
+                    file_size_ += chunk.length;
+                    if (!n_refs_left_[chunk.id]++)
+                        pack_contents_[chunk.pack] << chunk;
+                }
+                Q_EMIT(q_->ready(true));
+                pump();
+            },
+            [this](){
+                Q_EMIT(q_->ready(false));
+            }
+        );
+    }
+
+    std::shared_ptr<QLocalSocket> socket()
+    {
+        return read_socket_;
+    }
+
+    void finish()
+    {
+        cancel_fetches();
+        write_socket_.disconnectFromServer();
+        Q_EMIT(q_->download_finished());
+    }
+
+    qint64 file_size() const
+    {
+        return file_size_;
+    }
+
+private:
+
+    // Writes the chunks in order while the packs
+    // that hold the chunks after them are downloaded
+    void pump()
+    {
+        if (failed_)
+            return;
+
+        while (next_ < chunks_.size())
+        {
+            // wait for the helper to catch up
+            if (write_socket_.bytesToWrite() > MAX_BUFFERED)
+                break;
+
+            auto const& chunk = chunks_.at(next_);
+            QByteArray data;
+            auto const pack = packs_.constFind(chunk.pack);
+            if (pack != packs_.constEnd())
+            {
+                if (qint64(chunk.offset) + chunk.length > pack->size())
+                {
+                    fail(QStringLiteral("Chunk %1 is past the end of %2").arg(QString::fromLatin1(chunk.id.toHex())).arg(chunk.pack));
+                    return;
+                }
+                data = QByteArray::fromRawData(pack->constData() + chunk.offset, int(chunk.length));
+            }
+            else
+            {
+                data = cache_.get(chunk.id);
+                if (data.isEmpty())
+                {
+                    // we need this one now, whatever else is being downloaded
+                    if (!fetching_.contains(chunk.pack))
+                        fetch_pack(chunk.pack);
+                    break;
+                }
+                ++n_cached_;
+            }
+
+            if (ChunkStore::chunk_id(data.constData(), data.size()) != chunk.id)
+            {
+                fail(QStringLiteral("Chunk %1 in %2 is corrupt").arg(QString::fromLatin1(chunk.id.toHex())).arg(chunk.pack));
+                return;
+            }
+
+            write_socket_.write(data);
+            --n_refs_left_[chunk.id];
+            ++next_;
+
+            // moving on to another pack?
+            if (packs_.contains(chunk.pack) && ((next_ == chunks_.size()) || (chunks_.at(next_).pack != chunk.pack)))
+                retire_pack(chunk.pack);
+
+            if (next_ == chunks_.size())
+                qDebug() << "restored" << chunks_.size() << "chunks from" << n_fetched_ << "packs;"
+                         << n_cached_ << "chunks came from the cache";
+        }
+
+        prefetch();
+    }
+
+    // starts downloading the next packs that we'll need
+    void prefetch()
+    {
+        scan_ = std::max(scan_, next_);
+
+        while ((scan_ < chunks_.size())
+               && (fetching_.size() < MAX_FETCHES)
+               && (packs_.size() + fetching_.size() < MAX_PACKS))
+        {
+            auto const& chunk = chunks_.at(scan_);
+            if (!packs_.contains(chunk.pack) && !fetching_.contains(chunk.pack) && !cache_.contains(chunk.id))
+                fetch_pack(chunk.pack);
+            ++scan_;
+        }
+    }
+
+    // Frees a pack that we're done with for now.
+    // Its chunks that we need again later go into the cache.
+    void retire_pack(QString const& name)
+    {
+        auto const pack = packs_.take(name);
+
+        for (auto const& chunk : pack_contents_.value(name))
+            if ((n_refs_left_.value(chunk.id) > 0) && (qint64(chunk.offset) + chunk.length <= pack.size()))
+                cache_.put(chunk.id, pack.constData() + chunk.offset, int(chunk.length));
+    }
+
+    void fetch_pack(QString const& name)
+    {
+        fetching_ << name;
+
+        fetch(ChunkStore::DIR_NAME, name,
+            [this, name](QByteArray const& pack){
+                fetching_.remove(name);
+                packs_.insert(name, pack);
+                ++n_fetched_;
+                pump();
+            },
+            [this, name](){
+                fetching_.remove(name);
+                fail(QStringLiteral("Unable to read %1").arg(name));
+            }
+        );
+    }
+
+    /***
+    ****  Downloading whole files
+    ***/
+
+    struct Fetch
+    {
+        std::shared_ptr<Downloader> downloader;
+        QByteArray buf;
+        QVector<QMetaObject::Connection> connections;
+        std::function<void(QByteArray const&)> on_fetched;
+        std::function<void()> on_failed;
+    };
+
+    // reads all of a remote file
+    void fetch(QString const& dir_name,
+               QString const& file_name,
+               std::function<void(QByteArray const&)> on_fetched,
+               std::function<void()> on_failed)
+    {
+        auto job = std::make_shared<Fetch>();
+        job->on_fetched = on_fetched;
+        job->on_failed = on_failed;
+        fetches_.insert(file_name, job);
+
+        connections_.connect_future(
+            storage_->get_new_downloader(dir_name, file_name),
+            std::function<void(std::shared_ptr<Downloader> const&)>{
+                [this, file_name, job](std::shared_ptr<Downloader> const& downloader){
+                    // cancelled?
+                    if (fetches_.value(file_name) != job)
+                        return;
+
+                    if (!downloader)
+                    {
+                        qWarning() << "Unable to download" << file_name;
+                        end_fetch(file_name);
+                        job->on_failed();
+                        return;
+                    }
+
+                    job->downloader = downloader;
+                    job->buf.reserve(int(downloader->file_size()));
+
+                    auto socket = downloader->socket().get();
+                    job->connections << QObject::connect(socket, &QLocalSocket::readyRead,
+                        std::bind(&Impl::read_fetched, this, file_name)
+                    );
+                    job->connections << QObject::connect(socket, &QLocalSocket::disconnected,
+                        std::bind(&Impl::read_fetched, this, file_name)
+                    );
+                    read_fetched(file_name);
+                }
+            }
+        );
+    }
+
+    void read_fetched(QString const& file_name)
+    {
+        auto const job = fetches_.value(file_name);
+        if (!job || !job->downloader)
+            return;
+
+        auto const socket = job->downloader->socket();
+        job->buf.append(socket->readAll());
+        auto const expected = job->downloader->file_size();
+        if ((job->buf.size() < expected) && (socket->state() == QLocalSocket::ConnectedState))
+            return;
+
+        QByteArray contents;
+        contents.swap(job->buf);
+        end_fetch(file_name);
+        job->downloader->finish();
+
+        if (contents.size() == expected)
+            job->on_fetched(contents);
+        else
+            job->on_failed();
+    }
+
+    void end_fetch(QString const& file_name)
+    {
+        auto const job = fetches_.take(file_name);
+        if (job)
+            for (auto const& connection : job->connections)
+                QObject::disconnect(connection);
+    }
+
+    void cancel_fetches()
+    {
+        for (auto const& file_name : fetches_.keys())
+        {
+            auto const job = fetches_.value(file_name);
+            end_fetch(file_name);
+            if (job->downloader)
+                job->downloader->finish();
+        }
+        fetching_.clear();
+    }
+
+    void fail(QString const& message)
+    {
+        qWarning() << "Chunk download failed:" << message;
+        failed_ = true;
+        cancel_fetches();
+        packs_.clear();
+
+        // hang up so that the helper doesn't wait for the rest
+        write_socket_.disconnectFromServer();
+    }
+
+    ChunkDownloader* const q_;
+    StorageFrameworkClient* const storage_;
+    QString const dir_name_;
+    QString const file_name_;
+
+    std::shared_ptr<QLocalSocket> read_socket_ {std::make_shared<QLocalSocket>()};
+    QLocalSocket write_socket_;
+
+    QVector<ChunkStore::Chunk> chunks_; // the backup, chunk by chunk
+    QHash<QString,QVector<ChunkStore::Chunk>> pack_contents_; // the chunks we need from each pack
+    QHash<QByteArray,int> n_refs_left_; // how many more times each chunk gets written
+    qint64 file_size_ {};
+    int next_ {}; // the next chunk to write
+    int scan_ {}; // how far ahead we've looked for packs to download
+
+    QHash<QString,QByteArray> packs_; // the packs in memory
+    QSet<QString> fetching_; // the packs being downloaded
+    ChunkCache cache_;
+    int n_fetched_ {};
+    int n_cached_ {};
+    bool failed_ {};
+
+    QHash<QString,std::shared_ptr<Fetch>> fetches_;
+    ConnectionHelper connections_;
+};
+
+/***
+****
+***/
+
+ChunkDownloader::ChunkDownloader(StorageFrameworkClient* storage,
+                                 QString const& dir_name,
+                                 QString const& file_name,
+                                 QObject* parent):
+    Downloader(parent),
+    impl_{new Impl{this, storage, dir_name, file_name}}
+{
+}
+
+ChunkDownloader::~ChunkDownloader() =default;
+
+void
+ChunkDownloader::start()
+{
+    impl_->start();
+}
+
+std::shared_ptr<QLocalSocket>
+ChunkDownloader::socket()
+{
+    return impl_->socket();
+}
+
+void
+ChunkDownloader::finish()
+{
+    impl_->finish();
+}
+
+qint64
+ChunkDownloader::file_size() const
+{
+    return impl_->file_size();
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "storage-framework/downloader.h"
+
+#include <QLocalSocket>
+#include <QString>
+
+#include <memory>
+
+class StorageFrameworkClient;
+
+/**
+ * A Downloader that reassembles a backup from the ChunkStore.
+ *
+ * It reads the chunk list `file_name' from `dir_name', then writes
+ * the chunks to socket() in order. The packs that hold them are
+ * downloaded several at a time, ahead of the writing. Chunks that
+ * are needed again after their pack is freed come from a ChunkCache.
+ */
+class ChunkDownloader final: public Downloader
+{
+    Q_OBJECT
+
+public:
+
+    ChunkDownloader(StorageFrameworkClient* storage,
+                    QString const& dir_name,
+                    QString const& file_name,
+                    QObject* parent = nullptr);
+    ~ChunkDownloader();
+
+    // reads the chunk list, then emits ready()
+    void start();
+
+    std::shared_ptr<QLocalSocket> socket() override;
+    void finish() override;
+    qint64 file_size() const override;
+
+Q_SIGNALS:
+
+    void ready(bool success);
+
+private:
+
+    class Impl;
+    friend class Impl;
+    std::unique_ptr<Impl> impl_;
+};
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "storage-framework/chunk-store.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringList>
+
+namespace
+{
+    constexpr quint32 LIST_MAGIC {0x4b43484c}; // "KCHL"
+    constexpr quint32 INDEX_MAGIC {0x4b434958}; // "KCIX"
+    constexpr quint32 VERSION {1};
+
+    // Pack names are long and shared by many chunks,
+    // so write each one once and refer to it by number
+    template<typename Chunks>
+    void write_chunks(QDataStream& out, quint32 magic, Chunks const& chunks)
+    {
+        QHash<QString,quint32> pack_numbers;
+        QStringList packs;
+        for (auto const& chunk : chunks) {
+            if (!pack_numbers.contains(chunk.pack)) {
+                pack_numbers.insert(chunk.pack, quint32(packs.size()));
+                packs << chunk.pack;
+            }
+        }
+
+        out << magic << VERSION << packs << quint64(chunks.size());
+        for (auto const& chunk : chunks)
+            out << chunk.id << pack_numbers.value(chunk.pack) << chunk.offset << chunk.length;
+    }
+
+    template<typename Func>
+    bool read_chunks(QDataStream& in, quint32 magic, Func&& func)
+    {
+        quint32 file_magic {}, version {};
+        in >> file_magic >> version;
+        if ((file_magic != magic) || (version != VERSION))
+            return false;
+
+        QStringList packs;
+        quint64 n_chunks {};
+        in >> packs >> n_chunks;
+        for (quint64 i=0; (i<n_chunks) && (in.status() == QDataStream::Ok); ++i)
+        {
+            ChunkStore::Chunk chunk;
+            quint32 pack_number {};
+            in >> chunk.id >> pack_number >> chunk.offset >> chunk.length;
+            if (pack_number >= quint32(packs.size()))
+                return false;
+            chunk.pack = packs.at(int(pack_number));
+            func(chunk);
+        }
+
+        return in.status() == QDataStream::Ok;
+    }
+}
+
+QString const ChunkStore::DIR_NAME = QStringLiteral("chunks");
+QString const ChunkStore::LIST_SUFFIX = QStringLiteral(".chunks");
+constexpr int ChunkStore::PACK_SIZE;
+
+QByteArray
+ChunkStore::chunk_id(char const* data, int len)
+{
+    return QCryptographicHash::hash(QByteArray::fromRawData(data, len), QCryptographicHash::Sha256);
+}
+
+QByteArray
+ChunkStore::create_list(QVector<Chunk> const& chunks)
+{
+    QByteArray list;
+    QDataStream out(&list, QIODevice::WriteOnly);
+    write_chunks(out, LIST_MAGIC, chunks);
+    return list;
+}
+
+bool
+ChunkStore::parse_list(QByteArray const& list, QVector<Chunk>& setme)
+{
+    setme.clear();
+    QDataStream in(list);
+    return read_chunks(in, LIST_MAGIC, [&setme](Chunk const& chunk){setme << chunk;});
+}
+
+/***
+****
+***/
+
+bool
+ChunkStore::Index::find(QByteArray const& id, Chunk& setme) const
+{
+    auto it = chunks_.constFind(id);
+    if (it == chunks_.constEnd())
+        return false;
+    setme = it.value();
+    return true;
+}
+
+void
+ChunkStore::Index::add(Chunk const& chunk)
+{
+    chunks_.insert(chunk.id, chunk);
+}
+
+int
+ChunkStore::Index::size() const
+{
+    return chunks_.size();
+}
+
+QSet<QString>
+ChunkStore::Index::packs() const
+{
+    QSet<QString> packs;
+    for (auto const& chunk : chunks_)
+        packs.insert(chunk.pack);
+    return packs;
+}
+
+void
+ChunkStore::Index::remove_packs(QSet<QString> const& packs)
+{
+    for (auto it = chunks_.begin(); it != chunks_.end(); )
+    {
+        if (packs.contains(it.value().pack))
+            it = chunks_.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool
+ChunkStore::Index::load(QString const& path)
+{
+    chunks_.clear();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    if (!read_chunks(in, INDEX_MAGIC, [this](Chunk const& chunk){add(chunk);})) {
+        qWarning() << "Ignoring unreadable chunk index" << path;
+        chunks_.clear();
+        return false;
+    }
+    return true;
+}
+
+bool
+ChunkStore::Index::save(QString const& path) const
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to save chunk index" << path << ':' << file.errorString();
+        return false;
+    }
+
+    QDataStream out(&file);
+    write_chunks(out, INDEX_MAGIC, chunks_);
+    if ((out.status() != QDataStream::Ok) || !file.commit()) {
+        qWarning() << "Unable to save chunk index" << path << ':' << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QString
+ChunkStore::Index::path_for(QString const& storage)
+{
+    const auto name = QCryptographicHash::hash(storage.toUtf8(), QCryptographicHash::Md5).toHex();
+
+    return QStringLiteral("%1/keeper/chunks/%2.index")
+        .arg(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation))
+        .arg(QString::fromLatin1(name));
+}
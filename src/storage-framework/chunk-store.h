@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+/**
+ * A deduplicated store for backups.
+ *
+ * Instead of uploading a backup as one file, it's split into chunks
+ * and only the chunks that aren't already stored are uploaded.
+ * New chunks are packed into pack files in DIR_NAME, which all
+ * backups share, and the backup itself is stored as a list of
+ * chunks ending in LIST_SUFFIX.
+ *
+ * Each device keeps an index of the chunks it's stored, so that
+ * it doesn't have to download anything to know what to skip. Packs
+ * can disappear from storage behind its back, so each upload lists
+ * DIR_NAME once before it starts and forgets the chunks in packs
+ * that are gone; they're uploaded again if they're needed.
+ *
+ * Packs are never deleted. Packs are shared between backups, so a
+ * pack can only be deleted once no chunk list refers to it, and that
+ * can only be known by reading every list in storage. Deleting a backup
+ * leaves its packs behind, and nothing collects them yet.
+ */
+struct ChunkStore
+{
+    struct Chunk
+    {
+        QByteArray id; // the SHA-256 of the chunk's contents
+        QString pack; // the pack file it's stored in
+        quint32 offset {}; // where it starts in the pack
+        quint32 length {};
+    };
+
+    static QString const DIR_NAME;
+    static QString const LIST_SUFFIX;
+
+    // Packs are big enough to not pay a per-file cost for
+    // each small chunk, but small enough to hold in memory
+    static constexpr int PACK_SIZE {8*1024*1024};
+
+    static QByteArray chunk_id(char const* data, int len);
+
+    static QByteArray create_list(QVector<Chunk> const& chunks);
+    static bool parse_list(QByteArray const& list, QVector<Chunk>& setme);
+
+    // the chunks that this device has already stored
+    class Index
+    {
+    public:
+        bool find(QByteArray const& id, Chunk& setme) const;
+        void add(Chunk const& chunk);
+        int size() const;
+
+        // the packs that the chunks are stored in
+        QSet<QString> packs() const;
+
+        // forgets the chunks stored in `packs'
+        void remove_packs(QSet<QString> const& packs);
+
+        bool load(QString const& path);
+        bool save(QString const& path) const;
+
+        // where the index for a storage-framework account is kept
+        static QString path_for(QString const& storage);
+
+    private:
+        QHash<QByteArray,Chunk> chunks_;
+    };
+};
@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "storage-framework/chunk-uploader.h"
+#include "storage-framework/chunk-store.h"
+#include "storage-framework/chunker.h"
+#include "storage-framework/storage_framework_client.h"
+#include "util/connection-helper.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QSet>
+#include <QVector>
+
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cstring> // strerror()
+#include <functional> // std::bind()
+
+namespace
+{
+    // How much to read from the socket at a time. Keeping this bounded
+    // means that the writer blocks while we're busy uploading a pack.
+    constexpr qint64 READ_BUFFER_SIZE {1024*1024};
+}
+
+class ChunkUploader::Impl
+{
+public:
+
+    Impl(ChunkUploader* q,
+         StorageFrameworkClient* storage,
+         qint64 n_bytes,
+         QString const& dir_name,
+         QString const& file_name):
+        q_{q},
+        storage_{storage},
+        n_bytes_{n_bytes},
+        dir_name_{dir_name},
+        file_name_{file_name},
+        index_path_{ChunkStore::Index::path_for(storage->get_storage())}
+    {
+        index_.load(index_path_);
+
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, fds) == -1)
+        {
+            qWarning() << "Unable to create chunk uploader socket:" << strerror(errno);
+            failed_ = true;
+            return;
+        }
+        write_socket_->setSocketDescriptor(fds[1], QLocalSocket::ConnectedState, QIODevice::WriteOnly);
+        read_socket_.setSocketDescriptor(fds[0], QLocalSocket::ConnectedState, QIODevice::ReadOnly);
+        read_socket_.setReadBufferSize(READ_BUFFER_SIZE);
+
+        QObject::connect(&read_socket_, &QLocalSocket::readyRead,
+            std::bind(&Impl::process, this)
+        );
+
+        // don't reuse chunks until we know that their packs are still there
+        busy_ = true;
+        connections_.connect_future(
+            storage_->get_keeper_files(ChunkStore::DIR_NAME),
+            std::function<void(StorageFrameworkClient::FileList const&)>{
+                [this](StorageFrameworkClient::FileList const& packs){
+                    forget_missing_packs(packs);
+                    busy_ = false;
+                    process();
+                }
+            }
+        );
+    }
+
+    ~Impl() =default;
+
+    Q_DISABLE_COPY(Impl)
+
+    std::shared_ptr<QLocalSocket> socket()
+    {
+        return write_socket_;
+    }
+
+    void commit()
+    {
+        committing_ = true;
+
+        if (failed_)
+            finish(false);
+        else
+            process();
+    }
+
+    QString file_name() const
+    {
+        return file_name_after_commit_;
+    }
+
+private:
+
+    void process()
+    {
+        // keep draining the socket so that the writer isn't stuck
+        if (failed_)
+        {
+            read_socket_.readAll();
+            return;
+        }
+
+        // wait for the pack or list that we're uploading
+        if (busy_)
+            return;
+
+        const auto incoming = read_socket_.readAll();
+        n_read_ += incoming.size();
+        buf_.append(incoming);
+        if (n_read_ > n_bytes_)
+        {
+            fail(QStringLiteral("Got %1 bytes, expected %2").arg(n_read_).arg(n_bytes_));
+            return;
+        }
+
+        // Only cut chunks when we can see a whole MAX_SIZE ahead
+        // or it's the end of the stream, so boundaries are stable
+        const bool at_end = committing_ && (n_read_ == n_bytes_);
+        int pos {};
+        for (;;)
+        {
+            const auto n_left = size_t(buf_.size() - pos);
+            if (!n_left || ((n_left < Chunker::MAX_SIZE) && !at_end))
+                break;
+
+            const auto n = int(Chunker::cut(buf_.constData() + pos, n_left));
+            add_chunk(buf_.constData() + pos, n);
+            pos += n;
+
+            if (pack_.size() >= ChunkStore::PACK_SIZE)
+                break;
+        }
+        buf_.remove(0, pos);
+
+        if (pack_.size() >= ChunkStore::PACK_SIZE)
+            store_pack();
+        else if (at_end && buf_.isEmpty())
+        {
+            if (!pack_.isEmpty())
+                store_pack();
+            else
+                store_list();
+        }
+    }
+
+    // Drops the chunks in packs that aren't in storage anymore,
+    // e.g. because someone cleaned up the backup folder by hand
+    void forget_missing_packs(StorageFrameworkClient::FileList const& stored_packs)
+    {
+        // Without a listing we can't tell which packs are gone, so don't
+        // reuse any chunks this time, but leave the saved index alone
+        if (!stored_packs.ok)
+        {
+            if (index_.size() > 0)
+                qWarning() << "Unable to list the chunk packs in storage; all chunks will be uploaded again";
+            index_ = ChunkStore::Index{};
+            return;
+        }
+
+        auto missing = index_.packs();
+        for (auto const& pack : stored_packs.names)
+            missing.remove(pack);
+        if (missing.isEmpty())
+            return;
+
+        qWarning() << missing.size() << "chunk packs are missing from storage; their chunks will be uploaded again";
+        index_.remove_packs(missing);
+
+        // only drop the packs we know are missing; other
+        // uploaders may have stored new ones since we looked
+        ChunkStore::Index latest;
+        if (latest.load(index_path_)) {
+            latest.remove_packs(missing);
+            latest.save(index_path_);
+        }
+    }
+
+    void add_chunk(char const* data, int len)
+    {
+        ChunkStore::Chunk chunk;
+        const auto id = ChunkStore::chunk_id(data, len);
+        ++n_chunks_;
+
+        if (index_.find(id, chunk))
+        {
+            list_ << chunk;
+        }
+        else if (pack_chunks_.find(id, chunk))
+        {
+            // already in the pack we're filling
+            pending_refs_ << list_.size();
+            list_ << chunk;
+        }
+        else
+        {
+            chunk.id = id;
+            chunk.offset = quint32(pack_.size());
+            chunk.length = quint32(len);
+            pack_.append(data, len);
+            pack_chunks_.add(chunk);
+            pending_new_ << chunk;
+            pending_refs_ << list_.size();
+            list_ << chunk;
+            ++n_new_chunks_;
+            n_new_bytes_ += len;
+        }
+    }
+
+    void store_pack()
+    {
+        busy_ = true;
+
+        // name packs after their contents so that names never collide
+        const auto name = QString::fromLatin1(ChunkStore::chunk_id(pack_.constData(), pack_.size()).toHex())
+                        + QStringLiteral(".pack");
+
+        upload(ChunkStore::DIR_NAME, name, pack_, [this](QString const& stored_name){
+            // now we know where the new chunks are stored
+            for (const auto i : pending_refs_)
+                list_[i].pack = stored_name;
+            for (auto chunk : pending_new_) {
+                chunk.pack = stored_name;
+                index_.add(chunk);
+                stored_ << chunk;
+            }
+            pending_refs_.clear();
+            pending_new_.clear();
+            pack_chunks_ = ChunkStore::Index{};
+            ++n_packs_;
+
+            busy_ = false;
+            process();
+        });
+        pack_.clear();
+    }
+
+    void store_list()
+    {
+        busy_ = true;
+
+        upload(dir_name_, file_name_, ChunkStore::create_list(list_), [this](QString const& stored_name){
+            file_name_after_commit_ = stored_name;
+            qDebug() << "stored" << n_bytes_ << "bytes in" << n_chunks_ << "chunks;"
+                     << n_new_bytes_ << "bytes in" << n_new_chunks_ << "new chunks, using" << n_packs_ << "new packs";
+            save_index();
+            finish(true);
+        });
+    }
+
+    void upload(QString const& dir_name,
+                QString const& file_name,
+                QByteArray const& contents,
+                std::function<void(QString const&)> on_stored)
+    {
+        connections_.connect_future(
+            storage_->get_new_uploader(contents.size(), dir_name, file_name),
+            std::function<void(std::shared_ptr<Uploader> const&)>{
+                [this, file_name, contents, on_stored](std::shared_ptr<Uploader> const& uploader){
+                    if (!uploader)
+                    {
+                        fail(QStringLiteral("Unable to create %1").arg(file_name));
+                        return;
+                    }
+                    uploader->socket()->write(contents);
+                    connections_.connect_oneshot(
+                        uploader.get(),
+                        &Uploader::commit_finished,
+                        std::function<void(bool)>{[this, file_name, uploader, on_stored](bool success){
+                            if (success)
+                                on_stored(uploader->file_name());
+                            else
+                                fail(QStringLiteral("Unable to commit %1").arg(file_name));
+                        }}
+                    );
+                    uploader->commit();
+                }
+            }
+        );
+    }
+
+    void fail(QString const& message)
+    {
+        qWarning() << "Chunk upload failed:" << message;
+        failed_ = true;
+        busy_ = false;
+        buf_.clear();
+        pack_.clear();
+
+        // the packs we did store are still good
+        save_index();
+
+        if (committing_)
+            finish(false);
+        else
+            process();
+    }
+
+    void finish(bool success)
+    {
+        if (finished_)
+            return;
+        finished_ = true;
+        Q_EMIT(q_->commit_finished(success));
+    }
+
+    // Other uploaders may have saved since we loaded,
+    // so add our chunks to the latest index
+    void save_index()
+    {
+        if (stored_.isEmpty())
+            return;
+
+        ChunkStore::Index latest;
+        latest.load(index_path_);
+        for (auto const& chunk : stored_)
+            latest.add(chunk);
+        if (latest.save(index_path_))
+            stored_.clear();
+    }
+
+    ChunkUploader* const q_;
+    StorageFrameworkClient* const storage_;
+    qint64 const n_bytes_;
+    QString const dir_name_;
+    QString const file_name_;
+    QString const index_path_;
+
+    std::shared_ptr<QLocalSocket> write_socket_ {std::make_shared<QLocalSocket>()};
+    QLocalSocket read_socket_;
+    QByteArray buf_;
+    qint64 n_read_ {};
+
+    ChunkStore::Index index_; // chunks stored before now
+    QVector<ChunkStore::Chunk> list_; // the backup, chunk by chunk
+    QVector<ChunkStore::Chunk> stored_; // chunks that we stored that aren't saved in the index yet
+
+    QByteArray pack_; // the pack that we're filling
+    ChunkStore::Index pack_chunks_; // the chunks in pack_
+    QVector<ChunkStore::Chunk> pending_new_; // the chunks in pack_, in order
+    QVector<int> pending_refs_; // the list_ entries that point into pack_
+
+    int n_chunks_ {};
+    int n_new_chunks_ {};
+    qint64 n_new_bytes_ {};
+    int n_packs_ {};
+
+    bool busy_ {};
+    bool committing_ {};
+    bool failed_ {};
+    bool finished_ {};
+    QString file_name_after_commit_;
+
+    ConnectionHelper connections_;
+};
+
+/***
+****
+***/
+
+ChunkUploader::ChunkUploader(StorageFrameworkClient* storage,
+                             qint64 n_bytes,
+                             QString const& dir_name,
+                             QString const& file_name,
+                             QObject* parent):
+    Uploader(parent),
+    impl_{new Impl{this, storage, n_bytes, dir_name, file_name}}
+{
+}
+
+ChunkUploader::~ChunkUploader() =default;
+
+std::shared_ptr<QLocalSocket>
+ChunkUploader::socket()
+{
+    return impl_->socket();
+}
+
+void
+ChunkUploader::commit()
+{
+    impl_->commit();
+}
+
+QString
+ChunkUploader::file_name() const
+{
+    return impl_->file_name();
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "storage-framework/uploader.h"
+
+#include <QLocalSocket>
+#include <QString>
+
+#include <memory>
+
+class StorageFrameworkClient;
+
+/**
+ * An Uploader that stores a backup in the ChunkStore.
+ *
+ * The backup is chunked as it's written to socket(), and chunks
+ * that aren't already stored are packed and uploaded as they fill
+ * a pack. When it's committed, the chunk list is uploaded as
+ * `file_name' in `dir_name'.
+ */
+class ChunkUploader final: public Uploader
+{
+public:
+
+    ChunkUploader(StorageFrameworkClient* storage,
+                  qint64 n_bytes,
+                  QString const& dir_name,
+                  QString const& file_name,
+                  QObject* parent = nullptr);
+    ~ChunkUploader();
+
+    std::shared_ptr<QLocalSocket> socket() override;
+    void commit() override;
+    QString file_name() const override;
+
+private:
+
+    class Impl;
+    friend class Impl;
+    std::unique_ptr<Impl> impl_;
+};
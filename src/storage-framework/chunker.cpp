@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "storage-framework/chunker.h"
+
+#include <algorithm> // std::min()
+#include <array>
+#include <cstdint> // uint64_t
+
+namespace
+{
+    // FastCDC's "normalized chunking": before AVG_SIZE, cut points need
+    // two more zero bits than usual, and after it they need two fewer,
+    // which keeps chunk sizes bunched around AVG_SIZE (2^16)
+    constexpr uint64_t MASK_S {~uint64_t{} << (64 - 18)};
+    constexpr uint64_t MASK_L {~uint64_t{} << (64 - 14)};
+
+    // random values for the gear hash. These must never change,
+    // or new backups won't share chunks with the old ones.
+    std::array<uint64_t,256> const& gear()
+    {
+        static std::array<uint64_t,256> const table = [](){
+            std::array<uint64_t,256> t;
+            uint64_t x {0x4b45455045524344ULL}; // splitmix64
+            for (auto& val : t) {
+                uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                val = z ^ (z >> 31);
+            }
+            return t;
+        }();
+        return table;
+    }
+}
+
+constexpr size_t Chunker::MIN_SIZE;
+constexpr size_t Chunker::AVG_SIZE;
+constexpr size_t Chunker::MAX_SIZE;
+
+size_t
+Chunker::cut(char const* data, size_t len)
+{
+    if (len <= MIN_SIZE)
+        return len;
+
+    auto const& table = gear();
+    auto const end = std::min(len, MAX_SIZE);
+    auto const normal = std::min(end, AVG_SIZE);
+    auto const bytes = reinterpret_cast<unsigned char const*>(data);
+
+    // no chunk is smaller than MIN_SIZE, so don't bother hashing it
+    uint64_t fp {};
+    size_t i {MIN_SIZE};
+    for (; i<normal; ++i) {
+        fp = (fp << 1) + table[bytes[i]];
+        if (!(fp & MASK_S))
+            return i + 1;
+    }
+    for (; i<end; ++i) {
+        fp = (fp << 1) + table[bytes[i]];
+        if (!(fp & MASK_L))
+            return i + 1;
+    }
+    return end;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <cstddef> // size_t
+
+/**
+ * Splits a stream into content-defined chunks with FastCDC.
+ *
+ * Chunk boundaries depend only on the bytes near them, so inserting or
+ * removing data only changes the chunks around the edit: the rest of
+ * the stream chunks the same way it did before and can be deduplicated.
+ */
+class Chunker
+{
+public:
+
+    static constexpr size_t MIN_SIZE {16*1024};
+    static constexpr size_t AVG_SIZE {64*1024};
+    static constexpr size_t MAX_SIZE {256*1024};
+
+    // Returns the size of the chunk at the front of `data'.
+    // For boundaries to be stable, `len' must be at least MAX_SIZE
+    // unless this is the end of the stream.
+    static size_t cut(char const* data, size_t len);
+};
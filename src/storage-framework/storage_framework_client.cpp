@@ -19,6 +19,8 @@
  */
 
 #include "storage-framework/storage_framework_client.h"
+#include "storage-framework/chunk-downloader.h"
+#include "storage-framework/chunk-uploader.h"
 #include "storage-framework/sf-downloader.h"
 #include "storage-framework/sf-uploader.h"
 
@@ -142,6 +144,11 @@ void StorageFrameworkClient::set_storage(QString const & storage)
     storage_id_ = storage;
 }
 
+QString StorageFrameworkClient::get_storage() const
+{
+    return storage_id_;
+}
+
 QFuture<std::shared_ptr<Uploader>>
 StorageFrameworkClient::get_new_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name)
 {
@@ -289,6 +296,53 @@ StorageFrameworkClient::get_new_downloader(QString const & dir_name, QString con
     return fi.future();
 }
 
+QFuture<std::shared_ptr<Uploader>>
+StorageFrameworkClient::get_new_chunk_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name)
+{
+    clear_last_error();
+
+    // nothing's uploaded until the first pack is full,
+    // so the uploader is ready right away
+    std::shared_ptr<Uploader> ret(
+        new ChunkUploader(this, n_bytes, dir_name, file_name, this),
+        [](Uploader* u){u->deleteLater();}
+    );
+    QFutureInterface<decltype(ret)> fi;
+    fi.reportResult(ret);
+    fi.reportFinished();
+    return fi.future();
+}
+
+QFuture<std::shared_ptr<Downloader>>
+StorageFrameworkClient::get_new_chunk_downloader(QString const & dir_name, QString const & file_name)
+{
+    clear_last_error();
+
+    QFutureInterface<std::shared_ptr<Downloader>> fi;
+
+    std::shared_ptr<ChunkDownloader> downloader(
+        new ChunkDownloader(this, dir_name, file_name, this),
+        [](Downloader* d){d->deleteLater();}
+    );
+    connection_helper_.connect_oneshot(
+        downloader.get(),
+        &ChunkDownloader::ready,
+        std::function<void(bool)>{[this, fi, downloader](bool success){
+            std::shared_ptr<Downloader> ret;
+            if (success)
+                ret = downloader;
+            else
+                last_error_ = keeper::Error::READING_REMOTE_FILE;
+            QFutureInterface<decltype(ret)> qfi(fi);
+            qfi.reportResult(ret);
+            qfi.reportFinished();
+        }}
+    );
+    downloader->start();
+
+    return fi.future();
+}
+
 QFuture<QVector<QString>>
 StorageFrameworkClient::get_keeper_dirs()
 {
@@ -343,6 +397,57 @@ StorageFrameworkClient::get_keeper_dirs()
     return fi.future();
 }
 
+QFuture<StorageFrameworkClient::FileList>
+StorageFrameworkClient::get_keeper_files(QString const & dir_name)
+{
+    clear_last_error();
+
+    QFutureInterface<FileList> fi;
+
+    add_roots_task([this, fi, dir_name](QVector<sf::Root::SPtr> const& roots)
+    {
+        auto root = choose(roots);
+        if (root)
+        {
+            connection_helper_.connect_future(
+                get_keeper_folder(root, dir_name, false),
+                std::function<void(sf::Folder::SPtr const &)>{
+                    [this, fi](sf::Folder::SPtr const & folder){
+                        if (folder)
+                        {
+                            connection_helper_.connect_future(
+                                get_storage_framework_files(folder),
+                                std::function<void(FileList const &)>{
+                                    [fi](FileList const & files){
+                                        QFutureInterface<FileList> qfi(fi);
+                                        qfi.reportResult(files);
+                                        qfi.reportFinished();
+                                    }
+                                }
+                            );
+                        }
+                        else
+                        {
+                            FileList res;
+                            QFutureInterface<decltype(res)> qfi(fi);
+                            qfi.reportResult(res);
+                            qfi.reportFinished();
+                        }
+                    }
+                }
+            );
+        }
+        else
+        {
+            FileList res;
+            QFutureInterface<decltype(res)> qfi(fi);
+            qfi.reportResult(res);
+            qfi.reportFinished();
+        }
+    });
+    return fi.future();
+}
+
 keeper::Error
 StorageFrameworkClient::get_last_error() const
 {
@@ -529,6 +634,46 @@ StorageFrameworkClient::get_storage_framework_dirs(unity::storage::qt::client::F
     return fi.future();
 }
 
+QFuture<StorageFrameworkClient::FileList>
+StorageFrameworkClient::get_storage_framework_files(unity::storage::qt::client::Folder::SPtr const & root)
+{
+    QFutureInterface<FileList> fi;
+
+    connection_helper_.connect_future(
+        root->list(),
+        std::function<void(QVector<sf::Item::SPtr> const &)>{
+            [fi](QVector<sf::Item::SPtr> const & items){
+                FileList res;
+                res.ok = true;
+
+                for (auto item : items)
+                {
+                    if (item->type() == unity::storage::ItemType::file)
+                    {
+                        res.names.push_back(item->name());
+                    }
+                }
+
+                QFutureInterface<decltype(res)> qfi(fi);
+                qfi.reportResult(res);
+                qfi.reportFinished();
+            }
+        },
+        std::function<void()>{
+            [this, fi, root](){
+                qWarning() << "Unable to list" << root->name();
+                last_error_ = keeper::Error::READING_REMOTE_FILE;
+                FileList res;
+                QFutureInterface<decltype(res)> qfi(fi);
+                qfi.reportResult(res);
+                qfi.reportFinished();
+            }
+        }
+    );
+
+    return fi.future();
+}
+
 void
 StorageFrameworkClient::clear_last_error()
 {
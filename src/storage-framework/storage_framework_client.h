@@ -46,9 +46,24 @@ public:
     Q_DISABLE_COPY(StorageFrameworkClient)
 
     void set_storage(QString const & storage);
+    QString get_storage() const;
     QFuture<std::shared_ptr<Uploader>> get_new_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name);
     QFuture<std::shared_ptr<Downloader>> get_new_downloader(QString const & dir_name, QString const & file_name);
+
+    // like get_new_uploader() and get_new_downloader(), but the file is kept in the ChunkStore
+    QFuture<std::shared_ptr<Uploader>> get_new_chunk_uploader(int64_t n_bytes, QString const & dir_name, QString const & file_name);
+    QFuture<std::shared_ptr<Downloader>> get_new_chunk_downloader(QString const & dir_name, QString const & file_name);
     QFuture<QVector<QString>> get_keeper_dirs();
+
+    // The names of the files in a keeper folder. `ok' is only true if the
+    // folder was found and listed, so that an empty folder can be told
+    // apart from one that couldn't be read.
+    struct FileList
+    {
+        bool ok {};
+        QVector<QString> names;
+    };
+    QFuture<FileList> get_keeper_files(QString const & dir_name);
     keeper::Error get_last_error() const;
     QFuture<QStringList> get_accounts();
 
@@ -65,6 +80,7 @@ private:
     QFuture<unity::storage::qt::client::Folder::SPtr> get_storage_framework_folder(unity::storage::qt::client::Folder::SPtr const & root, QString const & dir_name, bool create_if_not_exists);
     QFuture<unity::storage::qt::client::File::SPtr> get_storage_framework_file(unity::storage::qt::client::Folder::SPtr const & root, QString const & file_name);
     QFuture<QVector<QString>> get_storage_framework_dirs(unity::storage::qt::client::Folder::SPtr const & root);
+    QFuture<FileList> get_storage_framework_files(unity::storage::qt::client::Folder::SPtr const & root);
 
     void clear_last_error();
 
@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/archive-extractor.h"
+#include "tar/catalog.h"
+#include "tar/file-writer-pool.h"
+#include "tar/safe-path.h"
+
+#include <QDebug>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <algorithm> // std::min()
+#include <array>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility> // std::move(), std::pair
+#include <vector>
+
+namespace
+{
+    // like GNU tar: restore mtimes, but let the umask
+    // decide permissions and never write outside the target,
+    // neither through '..' nor through a symlink on disk
+    constexpr int EXTRACT_FLAGS { ARCHIVE_EXTRACT_TIME
+                                | ARCHIVE_EXTRACT_SECURE_NODOTDOT
+                                | ARCHIVE_EXTRACT_SECURE_SYMLINKS };
+
+    // how big the pieces of large files handed to the writer pool are
+    constexpr size_t EXTENT_SIZE {1024*1024};
+
+    // how much to read ahead of the writer pool
+    constexpr size_t MAX_BUFFERED {1024*1024*64};
+}
+
+class ArchiveExtractor::Impl
+{
+public:
+
+    Impl(std::string const& target_path, int n_writers, EntryFunc const& on_entry)
+        : target_path_{target_path}
+        , n_writers_{n_writers}
+        , on_entry_{on_entry}
+    {
+        worker_ = std::thread(&Impl::worker_main, this);
+    }
+
+    ~Impl()
+    {
+        finish();
+    }
+
+    bool write(char const* buf, size_t buflen)
+    {
+        bool ok;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if ((buflen > 0) && !done_)
+            {
+                in_ = buf;
+                in_len_ = buflen;
+                worker_cv_.notify_one();
+
+                // libarchive is done with a buffer when it asks for the next one
+                writer_cv_.wait(lock, [this](){return !in_ || done_;});
+                in_ = nullptr;
+            }
+            ok = !failed_;
+        }
+
+        report_entries();
+        return ok;
+    }
+
+    bool finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            eof_ = true;
+        }
+        worker_cv_.notify_one();
+        if (worker_.joinable())
+            worker_.join();
+
+        report_entries();
+        return !failed_;
+    }
+
+    bool take_deletion_list(std::string& setme)
+    {
+        if (!has_deletion_list_)
+            return false;
+
+        has_deletion_list_ = false;
+        setme.clear();
+        std::swap(setme, deletion_list_);
+        return true;
+    }
+
+private:
+
+    static la_ssize_t on_read(struct archive*, void* vself, const void** setme)
+    {
+        auto self = static_cast<Impl*>(vself);
+
+        std::unique_lock<std::mutex> lock(self->mutex_);
+        if (self->handed_out_)
+        {
+            self->handed_out_ = false;
+            self->in_ = nullptr;
+            self->writer_cv_.notify_one();
+        }
+
+        self->worker_cv_.wait(lock, [self](){return self->in_ || self->eof_;});
+        if (!self->in_)
+            return 0;
+
+        *setme = self->in_;
+        self->handed_out_ = true;
+        return la_ssize_t(self->in_len_);
+    }
+
+    void worker_main()
+    {
+        const auto ok = extract();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        failed_ = !ok;
+        done_ = true;
+        writer_cv_.notify_one();
+    }
+
+    bool extract()
+    {
+        std::shared_ptr<struct archive> in(archive_read_new(), [](struct archive* a){archive_read_free(a);});
+        archive_read_support_filter_all(in.get());
+        archive_read_support_format_tar(in.get());
+
+        std::shared_ptr<struct archive> out(archive_write_disk_new(), [](struct archive* a){archive_write_free(a);});
+        archive_write_disk_set_options(out.get(), EXTRACT_FLAGS);
+
+        std::shared_ptr<FileWriterPool> pool;
+        if (n_writers_ > 1)
+            pool.reset(new FileWriterPool{target_path_, n_writers_, MAX_BUFFERED});
+
+        if (archive_read_open(in.get(), this, nullptr, on_read, nullptr) != ARCHIVE_OK)
+        {
+            qCritical() << "Unable to read archive:" << archive_error_string(in.get());
+            return false;
+        }
+
+        for (int n_entries=0; ; ++n_entries)
+        {
+            struct archive_entry* entry;
+            auto ret = archive_read_next_header(in.get(), &entry);
+            if (ret == ARCHIVE_EOF)
+                break;
+            if (ret == ARCHIVE_WARN)
+                qWarning() << "Reading archive:" << archive_error_string(in.get());
+            else if (ret != ARCHIVE_OK)
+            {
+                qCritical() << "Unable to read archive:" << archive_error_string(in.get());
+                return false;
+            }
+
+            if (!n_entries)
+                qDebug() << "restoring archive with codec" << archive_filter_name(in.get(), 0);
+
+            // extract into target_path_; hard link targets are archive paths too
+            const std::string path {archive_entry_pathname(entry)};
+            archive_entry_set_pathname(entry, target_path(path).c_str());
+            if (archive_entry_hardlink(entry))
+                archive_entry_set_hardlink(entry, target_path(archive_entry_hardlink(entry)).c_str());
+
+            const auto type = archive_entry_filetype(entry);
+            if ((type == AE_IFREG) && is_deletion_list(path))
+            {
+                if (!read_deletion_list(in.get(), path))
+                    return false;
+            }
+            else if (pool && (type == AE_IFREG) && !archive_entry_hardlink(entry))
+            {
+                if (!write_pooled(*pool, in.get(), entry, path))
+                    return false;
+            }
+            else
+            {
+                // links may point at files that are still being written
+                if (pool && (type != AE_IFDIR) && !pool->wait())
+                    return false;
+                if (!write_disk(in.get(), out.get(), entry, path))
+                    return false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            extracted_.emplace_back(path, archive_entry_size(entry));
+        }
+
+        if (pool && !pool->wait())
+            return false;
+
+        // this is where directories get their mtimes
+        if (archive_write_close(out.get()) != ARCHIVE_OK)
+        {
+            qCritical() << "Unable to finish extracting:" << archive_error_string(out.get());
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool write_disk(struct archive* in, struct archive* out, struct archive_entry* entry, std::string const& path)
+    {
+        const auto ret = archive_write_header(out, entry);
+        if (ret == ARCHIVE_WARN)
+            qWarning() << "Extracting" << path.c_str() << ':' << archive_error_string(out);
+        else if (ret != ARCHIVE_OK)
+        {
+            qCritical() << "Unable to extract" << path.c_str() << ':' << archive_error_string(out);
+            return false;
+        }
+
+        if ((archive_entry_size(entry) > 0) && !copy_data(in, out, path))
+            return false;
+
+        if (archive_write_finish_entry(out) < ARCHIVE_WARN)
+        {
+            qCritical() << "Unable to extract" << path.c_str() << ':' << archive_error_string(out);
+            return false;
+        }
+
+        return true;
+    }
+
+    // An incremental backup's deletion list is applied by our caller
+    // after the restore, so it's kept instead of being extracted
+    static bool is_deletion_list(std::string path)
+    {
+        path.erase(0, path.find_first_not_of('/'));
+        return path == Catalog::DELETION_LIST_NAME;
+    }
+
+    bool read_deletion_list(struct archive* in, std::string const& path)
+    {
+        std::string list;
+        std::array<char,4096> buf;
+        for (;;)
+        {
+            const auto n = archive_read_data(in, buf.data(), buf.size());
+            if (n == 0)
+                break;
+            if (n < 0)
+            {
+                qCritical() << "Unable to read" << path.c_str() << ':' << archive_error_string(in);
+                return false;
+            }
+            list.append(buf.data(), size_t(n));
+        }
+
+        deletion_list_ = std::move(list);
+        has_deletion_list_ = true;
+        return true;
+    }
+
+    // Reads a regular file's data and hands it to the pool in extents.
+    // Like copy_data(), it leaves the holes in sparse files unwritten.
+    static bool write_pooled(FileWriterPool& pool, struct archive* in, struct archive_entry* entry, std::string const& path)
+    {
+        // what ARCHIVE_EXTRACT_SECURE_NODOTDOT checks for the other entries;
+        // the pool does the ARCHIVE_EXTRACT_SECURE_SYMLINKS part itself
+        if (has_dotdot(path))
+        {
+            qCritical() << "Not extracting" << path.c_str() << "because its path contains '..'";
+            return false;
+        }
+
+        const struct timespec mtime { archive_entry_mtime(entry), archive_entry_mtime_nsec(entry) };
+        auto file = pool.create(path,
+                                mode_t(archive_entry_perm(entry)),
+                                archive_entry_size(entry),
+                                archive_entry_sparse_count(entry) > 0,
+                                mtime);
+
+        std::vector<char> extent;
+        int64_t extent_offset {};
+        for (;;)
+        {
+            const void* buf;
+            size_t buflen;
+            la_int64_t offset;
+            const auto ret = archive_read_data_block(in, &buf, &buflen, &offset);
+            if (ret == ARCHIVE_EOF)
+                break;
+            if (ret < ARCHIVE_WARN)
+            {
+                qCritical() << "Unable to read" << path.c_str() << ':' << archive_error_string(in);
+                return false;
+            }
+
+            // start a new extent after a hole, or if this one is full
+            if (!extent.empty() && ((offset != extent_offset + int64_t(extent.size())) || (extent.size() + buflen > EXTENT_SIZE)))
+            {
+                pool.write(file, extent_offset, std::move(extent));
+                extent.clear();
+            }
+            if (extent.empty())
+            {
+                extent_offset = offset;
+                extent.reserve(std::min(EXTENT_SIZE, size_t(archive_entry_size(entry) - offset)));
+            }
+            auto const data = static_cast<char const*>(buf);
+            extent.insert(extent.end(), data, data+buflen);
+        }
+
+        // even an empty file gets one, to create it
+        pool.write(file, extent_offset, std::move(extent));
+        return !pool.failed();
+    }
+
+    // The blocks' offsets skip over the holes in sparse entries,
+    // so writing them at those offsets recreates the holes
+    static bool copy_data(struct archive* in, struct archive* out, std::string const& path)
+    {
+        for (;;)
+        {
+            const void* buf;
+            size_t buflen;
+            la_int64_t offset;
+            auto ret = archive_read_data_block(in, &buf, &buflen, &offset);
+            if (ret == ARCHIVE_EOF)
+                return true;
+            if (ret < ARCHIVE_WARN)
+            {
+                qCritical() << "Unable to read" << path.c_str() << ':' << archive_error_string(in);
+                return false;
+            }
+
+            if (archive_write_data_block(out, buf, buflen, offset) < ARCHIVE_WARN)
+            {
+                qCritical() << "Unable to write" << path.c_str() << ':' << archive_error_string(out);
+                return false;
+            }
+        }
+    }
+
+    // Like GNU tar, strip leading slashes so that absolute paths
+    // are extracted relative to the target directory too
+    std::string target_path(std::string path) const
+    {
+        path.erase(0, path.find_first_not_of('/'));
+        return path.empty() ? target_path_ : target_path_ + '/' + path;
+    }
+
+    // tell the caller about the entries that were extracted since last time
+    void report_entries()
+    {
+        std::vector<std::pair<std::string,int64_t>> extracted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(extracted, extracted_);
+        }
+
+        if (on_entry_)
+            for (auto const& entry : extracted)
+                on_entry_(entry.first, entry.second);
+    }
+
+    std::string const target_path_;
+    int const n_writers_;
+    EntryFunc const on_entry_;
+    std::thread worker_;
+
+    std::mutex mutex_;
+    std::condition_variable worker_cv_;
+    std::condition_variable writer_cv_;
+    char const* in_ {}; // the caller's buffer, while write() waits on it
+    size_t in_len_ {};
+    bool handed_out_ {}; // true if libarchive has in_
+    bool eof_ {};
+    bool done_ {};
+    bool failed_ {};
+    std::vector<std::pair<std::string,int64_t>> extracted_;
+
+    // only touched by the worker until it's joined
+    bool has_deletion_list_ {};
+    std::string deletion_list_;
+};
+
+/**
+***
+**/
+
+ArchiveExtractor::ArchiveExtractor(std::string const& target_path, int n_writers, EntryFunc const& on_entry)
+    : impl_{new Impl{target_path, n_writers, on_entry}}
+{
+}
+
+ArchiveExtractor::~ArchiveExtractor() =default;
+
+bool
+ArchiveExtractor::write(char const* buf, size_t buflen)
+{
+    return impl_->write(buf, buflen);
+}
+
+bool
+ArchiveExtractor::finish()
+{
+    return impl_->finish();
+}
+
+bool
+ArchiveExtractor::take_deletion_list(std::string& setme)
+{
+    return impl_->take_deletion_list(setme);
+}
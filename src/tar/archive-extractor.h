@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+#include <functional>
+#include <memory> // shared_ptr
+#include <string>
+
+/**
+ * Extracts a tar archive into a directory with libarchive.
+ * The archive may be compressed with any codec that libarchive reads.
+ *
+ * libarchive pulls its input, so it runs on a worker thread that
+ * reads straight out of the buffers passed to write(). If n_writers
+ * is more than one, that thread hands regular files to a
+ * FileWriterPool so that many small files can be written at once.
+ */
+class ArchiveExtractor
+{
+public:
+    // called with each entry's path, relative to the target
+    // directory, after it's been read from the archive
+    using EntryFunc = std::function<void(std::string const& path, int64_t size)>;
+
+    explicit ArchiveExtractor(std::string const& target_path,
+                              int n_writers = 1,
+                              EntryFunc const& on_entry = EntryFunc());
+    ~ArchiveExtractor();
+
+    // Blocks until libarchive is done with `buf'.
+    // Returns false if extraction has failed.
+    bool write(char const* buf, size_t buflen);
+
+    // Ends the input and waits for the extraction to finish.
+    // Returns true if the whole archive was extracted.
+    bool finish();
+
+    // After finish(), moves this archive's deletion list into `setme'.
+    // Returns false if the archive had none, or it was already taken.
+    bool take_deletion_list(std::string& setme);
+
+private:
+    class Impl;
+    std::shared_ptr<Impl> impl_;
+};
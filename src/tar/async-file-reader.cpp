@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/async-file-reader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm> // std::min()
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring> // memcpy(), strerror()
+#include <mutex>
+#include <thread>
+#include <utility> // std::move()
+#include <vector>
+
+namespace
+{
+    // once we're into the part of a large file that wasn't read
+    // ahead, ask the kernel to prefetch this much of it
+    constexpr off_t TAIL_READAHEAD {1024*1024*2};
+
+    int open_file(char const* path)
+    {
+        // try not to dirty the inodes we're backing up.
+        // O_NOATIME needs us to own the file, so fall back without it
+        auto fd = open(path, O_RDONLY|O_CLOEXEC|O_NOATIME);
+        if ((fd == -1) && (errno == EPERM))
+            fd = open(path, O_RDONLY|O_CLOEXEC);
+        return fd;
+    }
+
+    ssize_t read_fully(int fd, char* buf, size_t len)
+    {
+        size_t n_read {};
+        while (n_read < len)
+        {
+            const auto n = ::read(fd, buf + n_read, len - n_read);
+            if (n > 0)
+                n_read += size_t(n);
+            else if (n == 0)
+                break;
+            else if (errno != EINTR)
+                return -1;
+        }
+        return ssize_t(n_read);
+    }
+
+    void close_file(int fd)
+    {
+        // we won't read it again, so don't let it crowd
+        // the rest of the system out of the page cache
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+class AsyncFileReader::Impl
+{
+public:
+
+    Impl(PathTable const& files, int n_threads, size_t window)
+        : files_(files)
+        , next_path_(files_.begin())
+        , slots_(std::max(window, size_t(1)))
+    {
+        if (n_threads < 1)
+            n_threads = DEFAULT_THREADS;
+        n_threads = int(std::min(size_t(n_threads), std::max(files_.size(), size_t(1))));
+        for (int i=0; i<n_threads; ++i)
+            workers_.emplace_back(&Impl::worker_main, this);
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cancelled_ = true;
+        }
+        workers_cv_.notify_all();
+        for (auto& worker : workers_)
+            worker.join();
+
+        for (auto& slot : slots_)
+            if (slot.fd != -1)
+                close(slot.fd);
+    }
+
+    qint64 read(char* buf, qint64 maxlen)
+    {
+        if (current_ >= files_.size())
+            return 0;
+
+        if (!current_ready_)
+            wait_for_current();
+
+        auto& slot = slots_[current_ % slots_.size()];
+
+        if (slot.error) {
+            error_ = slot.error;
+            finish_current();
+            return -1;
+        }
+
+        // first hand out what was read ahead
+        if (slot.head_pos < slot.head.size()) {
+            const auto n = std::min(size_t(maxlen), slot.head.size() - slot.head_pos);
+            memcpy(buf, &slot.head[slot.head_pos], n);
+            slot.head_pos += n;
+            return qint64(n);
+        }
+
+        // then read the rest, if there's any
+        if (slot.fd == -1) {
+            finish_current();
+            return 0;
+        }
+
+        if (!slot.tail_hinted) {
+            posix_fadvise(slot.fd, off_t(HEAD_SIZE), TAIL_READAHEAD, POSIX_FADV_WILLNEED);
+            slot.tail_hinted = true;
+        }
+
+        const auto n = read_fully(slot.fd, buf, size_t(maxlen));
+        if (n < 0) {
+            error_ = errno;
+            finish_current();
+            return -1;
+        }
+        if (n == 0)
+            finish_current();
+        return n;
+    }
+
+    QString error_string() const
+    {
+        return QString::fromUtf8(strerror(error_));
+    }
+
+    Stats stats() const
+    {
+        return stats_;
+    }
+
+private:
+
+    struct Slot
+    {
+        bool ready {};
+        int fd {-1}; // still open if there's more to read after `head'
+        int error {};
+        bool tail_hinted {};
+        std::vector<char> head;
+        size_t head_pos {};
+    };
+
+    void wait_for_current()
+    {
+        auto& slot = slots_[current_ % slots_.size()];
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!slot.ready)
+        {
+            ++stats_.n_stalls;
+            const auto begin = std::chrono::steady_clock::now();
+            reader_cv_.wait(lock, [&slot](){return slot.ready;});
+            const auto elapsed = std::chrono::steady_clock::now() - begin;
+            stats_.stall_usec += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        }
+        current_ready_ = true;
+    }
+
+    // frees the current file's slot for the workers and moves to the next file
+    void finish_current()
+    {
+        auto& slot = slots_[current_ % slots_.size()];
+        if (slot.fd != -1)
+            close_file(slot.fd);
+        // keep the buffer for the slot's next file
+        auto head = std::move(slot.head);
+        head.clear();
+        slot = Slot{};
+        slot.head = std::move(head);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++current_;
+        }
+        current_ready_ = false;
+        ++stats_.n_files;
+        workers_cv_.notify_one();
+    }
+
+    void worker_main()
+    {
+        QByteArray path;
+        for (;;)
+        {
+            size_t index;
+            {
+                // claim the next file, staying within `window' of the reader
+                std::unique_lock<std::mutex> lock(mutex_);
+                workers_cv_.wait(lock, [this](){
+                    return cancelled_ || (n_claimed_ >= files_.size()) || (n_claimed_ < current_ + slots_.size());
+                });
+                if (cancelled_ || (n_claimed_ >= files_.size()))
+                    break;
+                index = n_claimed_++;
+                path = *next_path_;
+                ++next_path_;
+            }
+
+            // The slot is ours until it's marked ready: the reader
+            // won't look at it before then, and no other worker
+            // can claim its index until the reader has finished it.
+            auto& slot = slots_[index % slots_.size()];
+            fill(slot, path);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                slot.ready = true;
+            }
+            reader_cv_.notify_one();
+        }
+
+        // wake up any other idle workers so that they can exit too
+        workers_cv_.notify_all();
+    }
+
+    static void fill(Slot& slot, QByteArray const& path)
+    {
+        const auto fd = open_file(path.constData());
+        if (fd == -1) {
+            slot.error = errno;
+            return;
+        }
+
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        slot.head.resize(HEAD_SIZE);
+        const auto n_read = read_fully(fd, slot.head.data(), slot.head.size());
+        if (n_read < 0) {
+            slot.error = errno;
+            slot.head.clear();
+            close(fd);
+            return;
+        }
+
+        slot.head.resize(size_t(n_read));
+        if (slot.head.size() < HEAD_SIZE) { // got the whole file
+            close_file(fd);
+        } else {
+            slot.fd = fd;
+        }
+    }
+
+    const PathTable files_;
+    PathTable::const_iterator next_path_;
+    std::vector<Slot> slots_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable workers_cv_; // a slot was freed
+    std::condition_variable reader_cv_; // a slot was filled
+    bool cancelled_ {};
+    size_t n_claimed_ {}; // files that workers have started on
+    size_t current_ {}; // the file that read() is reading
+
+    // only used by the reading thread
+    bool current_ready_ {};
+    int error_ {};
+    Stats stats_;
+};
+
+/***
+****
+***/
+
+AsyncFileReader::AsyncFileReader(PathTable const& files, int n_threads, size_t window)
+    : impl_{new Impl{files, n_threads, window}}
+{
+}
+
+AsyncFileReader::~AsyncFileReader() =default;
+
+qint64
+AsyncFileReader::read(char* buf, qint64 maxlen)
+{
+    return impl_->read(buf, maxlen);
+}
+
+QString
+AsyncFileReader::error_string() const
+{
+    return impl_->error_string();
+}
+
+AsyncFileReader::Stats
+AsyncFileReader::stats() const
+{
+    return impl_->stats();
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/path-table.h"
+
+#include <QString>
+#include <QtGlobal> // qint64
+
+#include <cstddef> // size_t
+#include <memory> // shared_ptr
+
+/**
+ * Reads a list of files in order, opening and reading the next ones
+ * ahead of time on a pool of threads.
+ *
+ * Reading many small files one at a time leaves the disk idle while
+ * each open() and read() waits its turn. Here the workers open the
+ * next `window' files and read their first bytes in parallel, so the
+ * device always has several requests queued. Small files are read
+ * whole; the rest of a large file is read on demand, with the kernel's
+ * sequential readahead hinted by posix_fadvise().
+ */
+class AsyncFileReader
+{
+public:
+
+    // if n_threads is 0, uses DEFAULT_THREADS
+    explicit AsyncFileReader(PathTable const& files, int n_threads=0, size_t window=DEFAULT_WINDOW);
+    ~AsyncFileReader();
+
+    static constexpr int DEFAULT_THREADS {16};
+    static constexpr size_t DEFAULT_WINDOW {64};
+
+    // how much of each file is read ahead
+    static constexpr size_t HEAD_SIZE {1024*64};
+
+    // Reads up to maxlen bytes of the current file, like QFile::read().
+    // Returns 0 at the end of the file or -1 on an error, after which
+    // the next call reads from the next file in the list.
+    qint64 read(char* buf, qint64 maxlen);
+
+    // describes the last error returned by read()
+    QString error_string() const;
+
+    struct Stats
+    {
+        qint64 n_files {}; // files finished so far
+        qint64 n_stalls {}; // how many times read() had to wait for a worker
+        qint64 stall_usec {}; // how long it waited in total
+    };
+
+    Stats stats() const;
+
+private:
+    class Impl;
+    friend class Impl;
+    std::shared_ptr<Impl> impl_;
+};
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/block-compressor.h"
+
+#include <QFuture>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <algorithm> // std::min(), std::max()
+#include <deque>
+#include <stdexcept>
+
+class BlockCompressor::Impl
+{
+public:
+
+    Impl(Codec const& codec, int n_threads, size_t block_size)
+        : codec_(codec)
+        , block_size_(block_size)
+        , max_pending_(size_t(std::max(1, n_threads)) * 2)
+    {
+        pool_.setMaxThreadCount(std::max(1, n_threads));
+        block_.reserve(block_size_);
+    }
+
+    ~Impl()
+    {
+        pool_.waitForDone();
+    }
+
+    void write(const char* data, size_t len)
+    {
+        while (len > 0)
+        {
+            const auto n = std::min(len, block_size_ - block_.size());
+            block_.insert(block_.end(), data, data+n);
+            data += n;
+            len -= n;
+
+            if (block_.size() == block_size_)
+                submit_block();
+        }
+    }
+
+    void flush()
+    {
+        if (!block_.empty())
+            submit_block();
+    }
+
+    void set_codec(Codec const& codec)
+    {
+        flush();
+        codec_ = codec;
+    }
+
+    void take(std::vector<char>& fillme, bool wait, std::vector<Block>* blocks)
+    {
+        while (!pending_.empty() && (wait || pending_.front().compressed.isFinished()))
+            collect_front();
+
+        fillme.insert(fillme.end(), ready_.begin(), ready_.end());
+        ready_.clear();
+        if (blocks != nullptr)
+            blocks->insert(blocks->end(), ready_blocks_.begin(), ready_blocks_.end());
+        ready_blocks_.clear();
+    }
+
+private:
+
+    void submit_block()
+    {
+        // don't let the workers get too far ahead of the consumer
+        while (pending_.size() >= max_pending_)
+            collect_front();
+
+        std::vector<char> block;
+        block.reserve(block_size_);
+        std::swap(block, block_);
+        const auto raw_size = block.size();
+        pending_.push_back(Pending{raw_size, QtConcurrent::run(&pool_, [codec=codec_, block](){return codec.compress_block(block);})});
+    }
+
+    void collect_front()
+    {
+        auto pending = pending_.front();
+        pending_.pop_front();
+
+        // a non-empty block never compresses to an empty one
+        const auto& compressed = pending.compressed.result();
+        if (compressed.empty())
+            throw std::runtime_error("Unable to compress block");
+        ready_.insert(ready_.end(), compressed.begin(), compressed.end());
+        ready_blocks_.push_back(Block{pending.raw_size, compressed.size()});
+    }
+
+    struct Pending
+    {
+        size_t raw_size;
+        QFuture<std::vector<char>> compressed;
+    };
+
+    Codec codec_;
+    const size_t block_size_ {};
+    const size_t max_pending_ {};
+    QThreadPool pool_;
+    std::vector<char> block_;
+    std::deque<Pending> pending_;
+    std::vector<char> ready_;
+    std::vector<Block> ready_blocks_;
+};
+
+/**
+***
+**/
+
+BlockCompressor::BlockCompressor(Codec const& codec, int n_threads, size_t block_size)
+    : impl_{new Impl{codec, n_threads, block_size}}
+{
+}
+
+BlockCompressor::~BlockCompressor() =default;
+
+void
+BlockCompressor::write(const char* data, size_t len)
+{
+    impl_->write(data, len);
+}
+
+void
+BlockCompressor::flush()
+{
+    impl_->flush();
+}
+
+void
+BlockCompressor::set_codec(Codec const& codec)
+{
+    impl_->set_codec(codec);
+}
+
+void
+BlockCompressor::take(std::vector<char>& fillme, bool wait, std::vector<Block>* blocks)
+{
+    impl_->take(fillme, wait, blocks);
+}
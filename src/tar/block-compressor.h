@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/codec.h"
+
+#include <cstddef> // size_t
+#include <memory> // shared_ptr
+#include <vector>
+
+/**
+ * Compresses a byte stream on a pool of worker threads.
+ *
+ * The input is cut into fixed-size blocks and each block is compressed
+ * into its own complete .xz stream or zstd frame. Both formats allow
+ * concatenation, so the output can be read by any stock decoder.
+ * Output blocks are always returned in input order.
+ */
+class BlockCompressor
+{
+public:
+    BlockCompressor(Codec const& codec, int n_threads, size_t block_size=DEFAULT_BLOCK_SIZE);
+    ~BlockCompressor();
+
+    static constexpr size_t DEFAULT_BLOCK_SIZE {1024*1024*4};
+
+    // queue more input for compression
+    void write(const char* data, size_t len);
+
+    // compress any buffered input, even if it's less than a full block
+    void flush();
+
+    // flush, then compress all further input with a different codec.
+    // The codec's type must not change, just its level or whether it's stored.
+    void set_codec(Codec const& codec);
+
+    struct Block
+    {
+        size_t raw_size; // the input that went into the block
+        size_t size; // the block's compressed size
+    };
+
+    // append compressed blocks to `fillme`.
+    // If `wait` is true, blocks until all queued input has been compressed.
+    // If `blocks` isn't null, the sizes of the appended blocks are added to it.
+    void take(std::vector<char>& fillme, bool wait, std::vector<Block>* blocks=nullptr);
+
+private:
+    class Impl;
+    std::shared_ptr<Impl> impl_;
+};
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/block-decompressor.h"
+
+#include <QFuture>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <algorithm> // std::max()
+#include <deque>
+#include <utility> // std::move()
+
+class BlockDecompressor::Impl
+{
+public:
+
+    Impl(Codec::Type type, int n_threads)
+        : type_(type)
+        , max_pending_(size_t(std::max(1, n_threads)) * 2)
+    {
+        pool_.setMaxThreadCount(std::max(1, n_threads));
+    }
+
+    ~Impl()
+    {
+        pool_.waitForDone();
+    }
+
+    void write(std::vector<char>&& block)
+    {
+        // don't let the workers get too far ahead of the consumer
+        while (pending_.size() >= max_pending_)
+            collect_front();
+
+        auto in = std::make_shared<std::vector<char>>(std::move(block));
+        pending_.push_back(QtConcurrent::run(&pool_, [type=type_, in](){
+            Result result;
+            result.ok = Codec::decompress_block(type, *in, result.raw);
+            return result;
+        }));
+    }
+
+    bool take(std::vector<char>& fillme, bool wait)
+    {
+        while (!pending_.empty() && (wait || pending_.front().isFinished()))
+            collect_front();
+
+        fillme.insert(fillme.end(), ready_.begin(), ready_.end());
+        ready_.clear();
+        return !failed_;
+    }
+
+private:
+
+    struct Result
+    {
+        bool ok {};
+        std::vector<char> raw;
+    };
+
+    void collect_front()
+    {
+        auto future = pending_.front();
+        pending_.pop_front();
+
+        // once a block is bad, the rest of the stream is no use
+        const auto& result = future.result();
+        if (!result.ok)
+            failed_ = true;
+        else if (!failed_)
+            ready_.insert(ready_.end(), result.raw.begin(), result.raw.end());
+    }
+
+    const Codec::Type type_;
+    const size_t max_pending_ {};
+    QThreadPool pool_;
+    std::deque<QFuture<Result>> pending_;
+    std::vector<char> ready_;
+    bool failed_ {};
+};
+
+/**
+***
+**/
+
+BlockDecompressor::BlockDecompressor(Codec::Type type, int n_threads)
+    : impl_{new Impl{type, n_threads}}
+{
+}
+
+BlockDecompressor::~BlockDecompressor() =default;
+
+void
+BlockDecompressor::write(std::vector<char>&& block)
+{
+    impl_->write(std::move(block));
+}
+
+bool
+BlockDecompressor::take(std::vector<char>& fillme, bool wait)
+{
+    return impl_->take(fillme, wait);
+}
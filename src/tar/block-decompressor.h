@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/codec.h"
+
+#include <memory> // shared_ptr
+#include <vector>
+
+/**
+ * Decompresses independently compressed blocks, e.g. the blocks
+ * of a SeekableArchive, on a pool of worker threads.
+ *
+ * Output is always returned in input order.
+ */
+class BlockDecompressor
+{
+public:
+    BlockDecompressor(Codec::Type type, int n_threads);
+    ~BlockDecompressor();
+
+    // queue a block for decompression.
+    // Blocks if too many are already waiting to be taken.
+    void write(std::vector<char>&& block);
+
+    // append decompressed blocks to `fillme`.
+    // If `wait` is true, blocks until all queued blocks are decompressed.
+    // Returns false if a block couldn't be decompressed.
+    bool take(std::vector<char>& fillme, bool wait);
+
+private:
+    class Impl;
+    std::shared_ptr<Impl> impl_;
+};
@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/catalog.h"
+#include "tar/hash-cache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+
+#include <sys/stat.h>
+
+#include <algorithm> // std::min(), std::sort(), std::unique()
+#include <cerrno>
+#include <cstring> // memcpy(), strerror()
+#include <utility> // std::pair
+
+namespace
+{
+    constexpr quint32 CATALOG_MAGIC {0x4b434154}; // "KCAT"
+    constexpr quint32 CATALOG_VERSION {3};
+
+    // the catalog keeps the first 8 bytes of a file's SHA-256
+    uint64_t catalog_hash(QByteArray const& sha256)
+    {
+        uint64_t hash {};
+        memcpy(&hash, sha256.constData(), std::min(sizeof(hash), size_t(sha256.size())));
+        return hash != 0 ? hash : 1; // 0 means "not known yet"
+    }
+
+    // true if the file's contents are the same as when `old' was recorded.
+    // `info' is updated with the file's hash if we had to calculate it.
+    bool is_unchanged(QByteArray const& path, Catalog::Info const& old, Catalog::Info& info, HashCache& hash_cache)
+    {
+        if (old.size != info.size)
+            return false;
+
+        if ((old.mtime_nsec == info.mtime_nsec) && (old.ctime_nsec == info.ctime_nsec) && (old.ino == info.ino)) {
+            info.hash = old.hash;
+            return true;
+        }
+
+        // it's been touched or replaced; was it really modified?
+        QByteArray sha256;
+        if (!hash_cache.get_hash(path, sha256))
+            return false;
+        info.hash = catalog_hash(sha256);
+        return (old.hash != 0) && (old.hash == info.hash);
+    }
+}
+
+constexpr char Catalog::DELETION_LIST_NAME[];
+
+bool
+Catalog::can_be_base() const
+{
+    return !dir_name.isEmpty() && (depth < MAX_DEPTH);
+}
+
+Catalog
+Catalog::scan(PathTable const& files,
+              Catalog const* previous,
+              PathTable& changed,
+              PathTable& deleted,
+              HashCache* hash_cache)
+{
+    // without a cache to remember them in, still hash the same way
+    HashCache uncached;
+    auto& hashes = hash_cache != nullptr ? *hash_cache : uncached;
+
+    // stat the files, and sort them to match the previous catalog
+    struct Scanned
+    {
+        QByteArray path;
+        Info info;
+        bool ok;
+    };
+    std::vector<Scanned> scanned;
+    scanned.reserve(files.size());
+    for (auto const& path : files)
+    {
+        // like TarCreator, follow symlinks
+        struct stat st;
+        Scanned item {path, Info{}, stat(path.constData(), &st) != -1};
+        if (item.ok) {
+            item.info.size = int64_t(st.st_size);
+            item.info.mtime_nsec = int64_t(st.st_mtim.tv_sec)*1000000000 + int64_t(st.st_mtim.tv_nsec);
+            item.info.ctime_nsec = int64_t(st.st_ctim.tv_sec)*1000000000 + int64_t(st.st_ctim.tv_nsec);
+            item.info.ino = uint64_t(st.st_ino);
+        } else {
+            qWarning() << "Unable to stat" << path.constData() << ':' << strerror(errno);
+        }
+        scanned.push_back(std::move(item));
+    }
+    std::sort(scanned.begin(), scanned.end(), [](Scanned const& a, Scanned const& b){return a.path < b.path;});
+    scanned.erase(std::unique(scanned.begin(), scanned.end(), [](Scanned const& a, Scanned const& b){return a.path == b.path;}),
+                  scanned.end());
+
+    Catalog ret;
+    if (previous != nullptr) {
+        ret.base_dir_name = previous->dir_name;
+        ret.depth = previous->depth + 1;
+    }
+    ret.infos.reserve(scanned.size());
+    changed = PathTable{};
+    deleted = PathTable{};
+
+    // walk the two sorted lists together
+    PathTable const empty;
+    auto const& old_paths = previous ? previous->paths : empty;
+    auto old_path = old_paths.begin();
+    size_t old_index {};
+    for (auto& item : scanned)
+    {
+        while ((old_path != old_paths.end()) && (*old_path < item.path)) {
+            deleted.append(*old_path);
+            ++old_path;
+            ++old_index;
+        }
+
+        bool unchanged = false;
+        if ((old_path != old_paths.end()) && (*old_path == item.path)) {
+            unchanged = item.ok && is_unchanged(item.path, previous->infos[old_index], item.info, hashes);
+            ++old_path;
+            ++old_index;
+        }
+
+        if (!unchanged)
+            changed.append(item.path);
+
+        // if we couldn't stat it, leave it out so that it's new next time
+        if (item.ok) {
+            ret.paths.append(item.path);
+            ret.infos.push_back(item.info);
+        }
+    }
+    for (; old_path != old_paths.end(); ++old_path)
+        deleted.append(*old_path);
+
+    ret.paths.squeeze();
+    changed.squeeze();
+    deleted.squeeze();
+    return ret;
+}
+
+void
+Catalog::remove(PathTable const& remove)
+{
+    QSet<QByteArray> unwanted;
+    for (auto const& path : remove)
+        unwanted.insert(path);
+
+    PathTable kept_paths;
+    std::vector<Info> kept_infos;
+    kept_infos.reserve(infos.size());
+    auto info = infos.begin();
+    for (auto const& path : paths) {
+        if (!unwanted.contains(path)) {
+            kept_paths.append(path);
+            kept_infos.push_back(*info);
+        }
+        ++info;
+    }
+    kept_paths.squeeze();
+
+    paths = kept_paths;
+    infos.swap(kept_infos);
+}
+
+bool
+Catalog::load(QString const& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic {}, version {};
+    in >> magic >> version;
+    if ((magic != CATALOG_MAGIC) || (version != CATALOG_VERSION)) {
+        qWarning() << "Ignoring unrecognized catalog" << path;
+        return false;
+    }
+
+    qint32 n_depth {};
+    quint64 n_entries {};
+    in >> dir_name >> base_dir_name >> n_depth >> n_entries;
+    depth = n_depth;
+
+    paths = PathTable{};
+    infos.clear();
+    QByteArray entry_path;
+    for (quint64 i=0; (i<n_entries) && (in.status() == QDataStream::Ok); ++i)
+    {
+        Info info;
+        qint64 size, mtime_nsec, ctime_nsec;
+        quint64 ino, hash;
+        in >> entry_path >> size >> mtime_nsec >> ctime_nsec >> ino >> hash;
+        info.size = size;
+        info.mtime_nsec = mtime_nsec;
+        info.ctime_nsec = ctime_nsec;
+        info.ino = ino;
+        info.hash = hash;
+        paths.append(entry_path);
+        infos.push_back(info);
+    }
+    paths.squeeze();
+
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "Catalog" << path << "is truncated or corrupt";
+        return false;
+    }
+    return true;
+}
+
+bool
+Catalog::save(QString const& path) const
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    // don't leave a half-written catalog if we're interrupted
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to save catalog" << path << ':' << file.errorString();
+        return false;
+    }
+
+    QDataStream out(&file);
+    out << CATALOG_MAGIC << CATALOG_VERSION
+        << dir_name << base_dir_name << qint32(depth) << quint64(infos.size());
+    auto info = infos.begin();
+    for (auto const& entry_path : paths) {
+        out << entry_path << qint64(info->size) << qint64(info->mtime_nsec) << qint64(info->ctime_nsec)
+            << quint64(info->ino) << quint64(info->hash);
+        ++info;
+    }
+
+    if ((out.status() != QDataStream::Ok) || !file.commit()) {
+        qWarning() << "Unable to save catalog" << path << ':' << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QString
+Catalog::path_for(QString const& dir)
+{
+    // name it after the directory's real path, so that
+    // "~/Music" and "/home/user/Music/" share a catalog
+    QFileInfo info(dir);
+    auto key = info.canonicalFilePath();
+    if (key.isEmpty())
+        key = QDir::cleanPath(info.absoluteFilePath());
+    const auto name = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Md5).toHex();
+
+    return QStringLiteral("%1/keeper/catalogs/%2.catalog")
+        .arg(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation))
+        .arg(QString::fromLatin1(name));
+}
+
+QString
+Catalog::pending_path_for(QString const& dir)
+{
+    return path_for(dir) + QStringLiteral(".pending");
+}
+
+bool
+Catalog::commit_pending(QString const& dir, QString const& dir_name)
+{
+    const auto pending_path = pending_path_for(dir);
+
+    Catalog catalog;
+    if (!catalog.load(pending_path))
+        return false;
+
+    catalog.dir_name = dir_name;
+    if (!catalog.save(path_for(dir)))
+        return false;
+
+    QFile::remove(pending_path);
+    return true;
+}
+
+void
+Catalog::discard_pending(QString const& dir)
+{
+    QFile::remove(pending_path_for(dir));
+}
+
+void
+Catalog::discard(QString const& dir)
+{
+    QFile::remove(path_for(dir));
+}
+
+QByteArray
+Catalog::create_deletion_list(PathTable const& deleted)
+{
+    // paths can have newlines in them, so use nulls like `find -print0'
+    QByteArray list;
+    for (auto const& path : deleted) {
+        list += path;
+        list += '\0';
+    }
+    return list;
+}
+
+PathTable
+Catalog::parse_deletion_list(QByteArray const& list)
+{
+    PathTable paths;
+    for (auto const& path : list.split('\0'))
+        if (!path.isEmpty())
+            paths.append(path);
+    paths.squeeze();
+    return paths;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/path-table.h"
+
+#include <QByteArray>
+#include <QString>
+
+#include <cstdint> // int64_t, uint64_t
+#include <vector>
+
+class HashCache;
+
+/**
+ * A record of the files in a backed-up directory, so that the next
+ * backup of it can skip the files that haven't changed.
+ *
+ * Each directory has one committed catalog on the device, describing
+ * its last stored backup. keeper-tar writes a pending catalog as it
+ * starts an incremental backup, and drops any files from it that it
+ * couldn't archive in full. keeper commits it once the backup has been
+ * stored, so that a failed backup is never used as a base, and forgets
+ * it if that backup later disappears from storage.
+ *
+ * The catalog stays on the device rather than with the backups
+ * because inode numbers and mtimes only mean something here.
+ */
+struct Catalog
+{
+    struct Info
+    {
+        int64_t size {};
+        int64_t mtime_nsec {};
+        int64_t ctime_nsec {};
+        uint64_t ino {};
+        uint64_t hash {}; // from the file's SHA-256, or 0 if not known yet
+    };
+
+    QString dir_name; // the backup that this catalog describes, once it's committed
+    QString base_dir_name; // the backup this one is incremental to, or empty if it's a full backup
+    int depth {}; // how many incremental backups there have been since the last full one
+    PathTable paths; // sorted
+    std::vector<Info> infos; // one per path
+
+    // Long chains make restores slow, and losing one backup breaks
+    // every backup that comes after it, so every so often do a full one.
+    static constexpr int MAX_DEPTH {30};
+
+    // true if a backup can be incremental to the one this catalog describes
+    bool can_be_base() const;
+
+    // Builds a catalog of `files'. If `previous' is given, the new catalog
+    // is incremental to it: `changed' gets the files that are new or have
+    // changed since then, and `deleted' gets the files that are gone.
+    // Otherwise, `changed' gets all the files.
+    //
+    // A file whose size, mtime, ctime and inode all match is unchanged.
+    // If only its times or inode changed, its contents are hashed to
+    // tell whether it was really modified, e.g. rewritten in place
+    // with the same contents. The hashes come from `hash_cache' if
+    // it's given, so a file that was hashed before isn't read again.
+    static Catalog scan(PathTable const& files,
+                        Catalog const* previous,
+                        PathTable& changed,
+                        PathTable& deleted,
+                        HashCache* hash_cache=nullptr);
+
+    // Drops `remove' from the catalog, e.g. files that changed while
+    // they were being archived, so that the next backup archives them again.
+    void remove(PathTable const& remove);
+
+    bool load(QString const& path);
+    bool save(QString const& path) const;
+
+    // where the committed and pending catalogs for `dir' are kept
+    static QString path_for(QString const& dir);
+    static QString pending_path_for(QString const& dir);
+
+    // Makes the pending catalog for `dir' the committed one, now that
+    // it's been stored in the backup named `dir_name'.
+    static bool commit_pending(QString const& dir, QString const& dir_name);
+    static void discard_pending(QString const& dir);
+
+    // Forgets the committed catalog for `dir', e.g. because the backup it
+    // describes is gone from storage, so that the next backup is a full one.
+    static void discard(QString const& dir);
+
+    // An incremental backup carries a list of the files deleted since
+    // its base, as a file with this name at the top of the archive.
+    static constexpr char DELETION_LIST_NAME[] {".keeper-deleted"};
+    static QByteArray create_deletion_list(PathTable const& deleted);
+    static PathTable parse_deletion_list(QByteArray const& list);
+};
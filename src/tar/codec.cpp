@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/codec.h"
+#include "tar/seekable-archive.h"
+
+#include <archive.h>
+#include <lzma.h>
+#include <zstd.h>
+
+#include <QByteArray>
+#include <QDebug>
+
+#include <algorithm> // std::min(), std::max()
+#include <cstdint> // uint8_t, uint64_t
+#include <memory> // shared_ptr
+
+namespace
+{
+    constexpr int XZ_DEFAULT_LEVEL {6}; // same as libarchive's xz filter
+    constexpr int XZ_MAX_LEVEL {9};
+
+    constexpr int ZSTD_DEFAULT_LEVEL {3}; // same as the zstd command line tool
+    constexpr int ZSTD_MAX_LEVEL {19}; // higher levels need --ultra to decompress
+
+    int min_level(Codec::Type type)
+    {
+        // zstd treats 0 as "use the default level"
+        return type == Codec::Type::ZSTD ? 1 : 0;
+    }
+
+    int max_level(Codec::Type type)
+    {
+        switch (type)
+        {
+            case Codec::Type::XZ: return XZ_MAX_LEVEL;
+            case Codec::Type::ZSTD: return ZSTD_MAX_LEVEL;
+            case Codec::Type::NONE: break;
+        }
+        return 0;
+    }
+
+    int default_level(Codec::Type type)
+    {
+        switch (type)
+        {
+            case Codec::Type::XZ: return XZ_DEFAULT_LEVEL;
+            case Codec::Type::ZSTD: return ZSTD_DEFAULT_LEVEL;
+            case Codec::Type::NONE: break;
+        }
+        return 0;
+    }
+
+    // an .xz stream that holds `in' in LZMA2's uncompressed chunks
+    std::vector<char> store_xz(std::vector<char> const& in)
+    {
+        std::vector<char> out(lzma_stream_buffer_bound(in.size()));
+        auto const out_data = reinterpret_cast<uint8_t*>(out.data());
+        size_t out_pos {};
+
+        lzma_stream_flags flags {};
+        flags.version = 0;
+        flags.check = LZMA_CHECK_CRC64;
+        auto ret = lzma_stream_header_encode(&flags, out_data);
+        out_pos += LZMA_STREAM_HEADER_SIZE;
+
+        lzma_options_lzma options;
+        lzma_lzma_preset(&options, 0);
+        lzma_filter filters[] = { { LZMA_FILTER_LZMA2, &options }, { LZMA_VLI_UNKNOWN, nullptr } };
+        lzma_block block {};
+        block.version = 0;
+        block.check = flags.check;
+        block.filters = filters;
+        if (ret == LZMA_OK)
+            ret = lzma_block_uncomp_encode(&block, reinterpret_cast<const uint8_t*>(in.data()), in.size(), out_data, &out_pos, out.size());
+
+        auto index = lzma_index_init(nullptr);
+        if (ret == LZMA_OK)
+            ret = index ? lzma_index_append(index, nullptr, lzma_block_unpadded_size(&block), block.uncompressed_size) : LZMA_MEM_ERROR;
+        if (ret == LZMA_OK)
+        {
+            flags.backward_size = lzma_index_size(index);
+            ret = lzma_index_buffer_encode(index, out_data, &out_pos, out.size());
+        }
+        lzma_index_end(index, nullptr);
+        if ((ret == LZMA_OK) && (out.size() - out_pos >= LZMA_STREAM_HEADER_SIZE))
+        {
+            ret = lzma_stream_footer_encode(&flags, out_data + out_pos);
+            out_pos += LZMA_STREAM_HEADER_SIZE;
+        }
+
+        if (ret != LZMA_OK)
+        {
+            qWarning() << "Unable to store xz block:" << int(ret);
+            out_pos = 0;
+        }
+        out.resize(out_pos);
+        return out;
+    }
+
+    // a zstd frame that holds `in' in raw blocks
+    std::vector<char> store_zstd(std::vector<char> const& in)
+    {
+        static constexpr size_t RAW_BLOCK_SIZE_MAX {1024*128};
+        static constexpr size_t BLOCK_HEADER_SIZE {3};
+
+        std::vector<char> out;
+        out.reserve(in.size() + (in.size()/RAW_BLOCK_SIZE_MAX + 1)*BLOCK_HEADER_SIZE + 13);
+        auto append_le = [&out](uint64_t val, size_t n) {
+            for (size_t i=0; i<n; ++i)
+                out.push_back(char((val >> (8*i)) & 0xFF));
+        };
+
+        // a single-segment frame, so its window is its 8-byte content size
+        append_le(ZSTD_MAGICNUMBER, 4);
+        out.push_back(char(0xE0));
+        append_le(in.size(), 8);
+
+        size_t pos {};
+        do {
+            const auto n = std::min(in.size() - pos, RAW_BLOCK_SIZE_MAX);
+            const bool last = pos + n == in.size();
+            append_le((n << 3) | (last ? 1u : 0u), BLOCK_HEADER_SIZE); // block type 0 is raw
+            out.insert(out.end(), in.begin() + long(pos), in.begin() + long(pos + n));
+            pos += n;
+        } while (pos < in.size());
+
+        return out;
+    }
+}
+
+static_assert(ArchiveMagic::SEEKABLE_HEADER_SIZE == SeekableArchive::HEADER_SIZE, "seekable header size");
+static_assert(ArchiveMagic::SEEKABLE_BLOCK_HEADER_SIZE == SeekableArchive::BLOCK_HEADER_SIZE, "seekable block header size");
+
+Codec::Codec(Type type, int level)
+    : type_{type}
+    , level_{level == DEFAULT_LEVEL ? default_level(type) : std::min(std::max(level, min_level(type)), max_level(type))}
+{
+}
+
+Codec::Type
+Codec::type() const
+{
+    return type_;
+}
+
+int
+Codec::level() const
+{
+    return level_;
+}
+
+Codec
+Codec::stored() const
+{
+    Codec codec {*this};
+    codec.stored_ = type_ != Type::NONE;
+    return codec;
+}
+
+bool
+Codec::is_stored() const
+{
+    return stored_;
+}
+
+QString
+Codec::name(Type type)
+{
+    return ArchiveMagic::name(type);
+}
+
+QString
+Codec::to_string() const
+{
+    if (type_ == Type::NONE)
+        return name(type_);
+
+    return QStringLiteral("%1:%2").arg(name(type_)).arg(level_);
+}
+
+bool
+Codec::parse(QString const& str, Codec* setme)
+{
+    const auto tokens = str.split(':');
+    if (tokens.size() > 2)
+        return false;
+
+    Type type;
+    const auto& type_name = tokens[0];
+    if (type_name == name(Type::NONE))
+        type = Type::NONE;
+    else if (type_name == name(Type::XZ))
+        type = Type::XZ;
+    else if (type_name == name(Type::ZSTD))
+        type = Type::ZSTD;
+    else
+        return false;
+
+    int level = DEFAULT_LEVEL;
+    if (tokens.size() == 2)
+    {
+        bool ok {};
+        level = tokens[1].toInt(&ok);
+        if (!ok || (level < min_level(type)) || (level > max_level(type)))
+            return false;
+    }
+
+    *setme = Codec{type, level};
+    return true;
+}
+
+Codec::Type
+Codec::detect(char const* buf, size_t buflen)
+{
+    return ArchiveMagic::detect(buf, buflen);
+}
+
+void
+Codec::add_filter(struct archive* archive) const
+{
+    const auto level = QByteArray::number(level_);
+
+    switch (type_)
+    {
+        case Type::XZ:
+            archive_write_add_filter_xz(archive);
+            archive_write_set_filter_option(archive, "xz", "compression-level", level.constData());
+            break;
+
+        case Type::ZSTD:
+            archive_write_add_filter_zstd(archive);
+            archive_write_set_filter_option(archive, "zstd", "compression-level", level.constData());
+            break;
+
+        case Type::NONE:
+            break;
+    }
+}
+
+std::vector<char>
+Codec::compress_block(std::vector<char> const& in) const
+{
+    if (stored_)
+        return type_ == Type::XZ ? store_xz(in) : store_zstd(in);
+
+    std::vector<char> out;
+
+    switch (type_)
+    {
+        case Type::XZ:
+        {
+            out.resize(lzma_stream_buffer_bound(in.size()));
+            size_t out_pos {};
+            const auto ret = lzma_easy_buffer_encode(
+                uint32_t(level_),
+                LZMA_CHECK_CRC64,
+                nullptr,
+                reinterpret_cast<const uint8_t*>(in.data()),
+                in.size(),
+                reinterpret_cast<uint8_t*>(out.data()),
+                &out_pos,
+                out.size()
+            );
+            if (ret != LZMA_OK)
+            {
+                qWarning() << "lzma_easy_buffer_encode() failed:" << int(ret);
+                out_pos = 0;
+            }
+            out.resize(out_pos);
+            break;
+        }
+
+        case Type::ZSTD:
+        {
+            out.resize(ZSTD_compressBound(in.size()));
+            auto n = ZSTD_compress(out.data(), out.size(), in.data(), in.size(), level_);
+            if (ZSTD_isError(n))
+            {
+                qWarning() << "ZSTD_compress() failed:" << ZSTD_getErrorName(n);
+                n = 0;
+            }
+            out.resize(n);
+            break;
+        }
+
+        case Type::NONE:
+            out = in;
+            break;
+    }
+
+    return out;
+}
+
+bool
+Codec::decompress_block(Type type, std::vector<char> const& in, std::vector<char>& setme)
+{
+    // we don't know the decompressed size, so start with a guess and grow
+    static constexpr size_t MIN_GUESS {1024*64};
+    setme.resize(std::max(in.size()*4, MIN_GUESS));
+
+    switch (type)
+    {
+        case Type::XZ:
+        {
+            lzma_stream strm = LZMA_STREAM_INIT;
+            auto ret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+            if (ret != LZMA_OK)
+            {
+                qWarning() << "lzma_stream_decoder() failed:" << int(ret);
+                return false;
+            }
+            strm.next_in = reinterpret_cast<const uint8_t*>(in.data());
+            strm.avail_in = in.size();
+            strm.next_out = reinterpret_cast<uint8_t*>(setme.data());
+            strm.avail_out = setme.size();
+            while ((ret = lzma_code(&strm, LZMA_FINISH)) == LZMA_OK)
+            {
+                if (strm.avail_out == 0)
+                {
+                    const auto n_out = size_t(strm.total_out);
+                    setme.resize(setme.size()*2);
+                    strm.next_out = reinterpret_cast<uint8_t*>(setme.data()) + n_out;
+                    strm.avail_out = setme.size() - n_out;
+                }
+            }
+            setme.resize(size_t(strm.total_out));
+            const bool ok = (ret == LZMA_STREAM_END) && (strm.avail_in == 0);
+            lzma_end(&strm);
+            if (!ok)
+                qWarning() << "lzma_code() failed:" << int(ret);
+            return ok;
+        }
+
+        case Type::ZSTD:
+        {
+            std::shared_ptr<ZSTD_DStream> dstream(ZSTD_createDStream(), ZSTD_freeDStream);
+            ZSTD_initDStream(dstream.get());
+            ZSTD_inBuffer inbuf {in.data(), in.size(), 0};
+            ZSTD_outBuffer outbuf {setme.data(), setme.size(), 0};
+            for (;;)
+            {
+                if (outbuf.pos == outbuf.size)
+                {
+                    setme.resize(setme.size()*2);
+                    outbuf.dst = setme.data();
+                    outbuf.size = setme.size();
+                }
+                const auto ret = ZSTD_decompressStream(dstream.get(), &outbuf, &inbuf);
+                if (ZSTD_isError(ret))
+                {
+                    qWarning() << "ZSTD_decompressStream() failed:" << ZSTD_getErrorName(ret);
+                    return false;
+                }
+                if (inbuf.pos < inbuf.size)
+                    continue;
+                if (ret == 0) // all frames are done
+                    break;
+                if (outbuf.pos < outbuf.size)
+                {
+                    qWarning() << "zstd block is truncated";
+                    return false;
+                }
+            }
+            setme.resize(outbuf.pos);
+            return true;
+        }
+
+        case Type::NONE:
+            setme = in;
+            return true;
+    }
+
+    return false;
+}
+
+QStringList
+Codec::decompress_command(Type type)
+{
+    switch (type)
+    {
+        case Type::XZ: return QStringList{ "xz", "--decompress", "--stdout" };
+        case Type::ZSTD: return QStringList{ "zstd", "--decompress", "--stdout", "--quiet" };
+        case Type::NONE: break;
+    }
+    return QStringList();
+}
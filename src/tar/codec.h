@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "util/archive-magic.h"
+
+#include <QString>
+#include <QStringList>
+
+#include <cstddef> // size_t
+#include <vector>
+
+struct archive;
+
+/**
+ * A compression codec and level used for keeper archives.
+ *
+ * Codecs are named "none", "xz", or "zstd", with an optional level
+ * suffix, e.g. "zstd:19". Archives can be identified by their magic
+ * numbers, so restoring never needs to be told which codec was used.
+ */
+class Codec
+{
+public:
+
+    using Type = ArchiveMagic::Type;
+
+    static constexpr int DEFAULT_LEVEL {-1};
+
+    explicit Codec(Type type=Type::NONE, int level=DEFAULT_LEVEL);
+
+    Type type() const;
+    int level() const;
+    QString to_string() const;
+
+    // the same codec, but writing blocks that aren't compressed at all,
+    // e.g. for files that are already compressed. They're still valid
+    // .xz streams or zstd frames, so decoders read them as usual.
+    Codec stored() const;
+    bool is_stored() const;
+
+    // parses a string made by to_string(). Returns false if it's invalid.
+    static bool parse(QString const& str, Codec* setme);
+
+    // identifies an archive's codec from its first few bytes.
+    // A SeekableArchive needs HEAD_SIZE_MAX of them.
+    static constexpr size_t MAGIC_SIZE_MAX {ArchiveMagic::MAGIC_SIZE_MAX};
+    static constexpr size_t HEAD_SIZE_MAX {ArchiveMagic::HEAD_SIZE_MAX};
+    static Type detect(char const* buf, size_t buflen);
+
+    static QString name(Type type);
+
+    // adds this codec as a filter to a libarchive writer
+    void add_filter(struct archive* archive) const;
+
+    // compresses a block into a standalone xz stream or zstd frame.
+    // Returns an empty vector on failure.
+    std::vector<char> compress_block(std::vector<char> const& in) const;
+
+    // the reverse of compress_block(). Returns false on failure.
+    static bool decompress_block(Type type, std::vector<char> const& in, std::vector<char>& setme);
+
+    // the command line to decompress `type' from stdin to stdout,
+    // or an empty list if `type' is uncompressed
+    static QStringList decompress_command(Type type);
+
+private:
+
+    Type type_ {Type::NONE};
+    int level_ {DEFAULT_LEVEL};
+    bool stored_ {};
+};
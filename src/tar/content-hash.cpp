@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/content-hash.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm> // std::min()
+#include <cerrno>
+#include <cstring> // memcpy()
+#include <vector>
+
+namespace
+{
+    constexpr size_t READ_SIZE {1024*64};
+}
+
+void
+ContentHash::update(char const* data, size_t len)
+{
+    n_bytes_ += len;
+
+    // finish any word left over from last time
+    if (n_pending_ > 0)
+    {
+        const auto n = std::min(len, sizeof(pending_) - n_pending_);
+        memcpy(pending_ + n_pending_, data, n);
+        n_pending_ += n;
+        data += n;
+        len -= n;
+        if (n_pending_ < sizeof(pending_))
+            return;
+        mix(h_, pending_);
+        n_pending_ = 0;
+    }
+
+    for (; len >= sizeof(uint64_t); data += sizeof(uint64_t), len -= sizeof(uint64_t))
+        mix(h_, data);
+
+    memcpy(pending_, data, len);
+    n_pending_ = len;
+}
+
+uint64_t
+ContentHash::value() const
+{
+    char tail[sizeof(uint64_t)] {};
+    memcpy(tail, pending_, n_pending_);
+    auto h = h_;
+    mix(h, tail);
+    h ^= n_bytes_;
+    // final avalanche, from MurmurHash3's fmix64
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void
+ContentHash::mix(uint64_t& h, char const* data)
+{
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    word *= 0x87c37b91114253d5ULL;
+    word = (word << 31) | (word >> 33);
+    word *= 0x4cf5ad432745937fULL;
+    h ^= word;
+    h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+}
+
+bool
+ContentHash::hash_file(QByteArray const& filename, uint64_t& setme)
+{
+    const auto fd = open(filename.constData(), O_RDONLY|O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    ContentHash hash;
+    std::vector<char> buf(READ_SIZE);
+    bool ok = true;
+    for (;;)
+    {
+        const auto n_read = read(fd, buf.data(), buf.size());
+        if (n_read == 0)
+            break;
+        if (n_read < 0) {
+            if (errno == EINTR)
+                continue;
+            ok = false;
+            break;
+        }
+        hash.update(buf.data(), size_t(n_read));
+    }
+    close(fd);
+
+    if (ok)
+        setme = hash.value();
+    return ok;
+}
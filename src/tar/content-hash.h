@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
+/**
+ * A quick 64-bit hash of a file's contents.
+ *
+ * It only has to tell files apart, not resist attacks, so it's
+ * not a cryptographic hash: callers that need to be certain two
+ * files match should compare them byte for byte.
+ */
+class ContentHash
+{
+public:
+
+    void update(char const* data, size_t len);
+    uint64_t value() const;
+
+    // Hashes the whole file. Returns false if it can't be read.
+    static bool hash_file(QByteArray const& filename, uint64_t& setme);
+
+private:
+
+    static void mix(uint64_t& h, char const* data);
+
+    uint64_t h_ {0x9e3779b97f4a7c15ULL};
+    uint64_t n_bytes_ {};
+    char pending_[sizeof(uint64_t)] {};
+    size_t n_pending_ {};
+};
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/directory-walker.h"
+
+#include <QDebug>
+#include <QThread>
+
+#include <dirent.h> // DT_*
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm> // std::sort()
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring> // strerror()
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// the record getdents64() fills its buffer with
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+constexpr size_t DIRENT_BUFSIZE {1024*32};
+
+class Walker
+{
+public:
+
+    Walker(int root_fd, int n_threads)
+        : root_fd_(root_fd)
+        , workers_(size_t(n_threads))
+    {
+        for (auto& worker : workers_)
+            worker.reset(new Worker);
+    }
+
+    // returns the files' paths relative to the root
+    std::vector<std::string> walk()
+    {
+        // start with the root itself
+        n_pending_ = 1;
+        workers_.front()->dirs.push_back(std::string());
+
+        // the calling thread is the first worker
+        std::vector<std::thread> threads;
+        for (size_t i=1; i<workers_.size(); ++i)
+            threads.emplace_back(&Walker::work, this, i);
+        work(0);
+        for (auto& thread : threads)
+            thread.join();
+
+        std::vector<std::string> files;
+        for (auto const& worker : workers_)
+            files.insert(files.end(), worker->files.begin(), worker->files.end());
+        return files;
+    }
+
+    // true if some of the tree couldn't be read
+    bool failed() const
+    {
+        return failed_;
+    }
+
+private:
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::string> dirs;
+        std::vector<std::string> files;
+    };
+
+    void work(size_t index)
+    {
+        auto& self = *workers_[index];
+        std::string dir;
+
+        for (;;)
+        {
+            // note the generation before looking, so that we
+            // can't miss directories queued while we were looking
+            const auto generation = generation_.load();
+
+            if (pop(self, dir) || steal(index, dir)) {
+                read_dir(self, dir);
+                if (--n_pending_ == 0)
+                    notify_idle();
+            } else if (n_pending_ == 0) {
+                break;
+            } else {
+                // someone's still reading a directory that may have subdirs
+                std::unique_lock<std::mutex> lock(idle_mutex_);
+                idle_cv_.wait(lock, [this, generation](){
+                    return (generation_ != generation) || (n_pending_ == 0);
+                });
+            }
+        }
+    }
+
+    // wakes the idle workers when there's new work or nothing's left to do
+    void notify_idle(bool queued_dirs=false)
+    {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            if (queued_dirs)
+                ++generation_;
+        }
+        idle_cv_.notify_all();
+    }
+
+    // take our newest directory, to stay depth-first and cache-friendly
+    static bool pop(Worker& worker, std::string& setme)
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.dirs.empty())
+            return false;
+        setme = std::move(worker.dirs.back());
+        worker.dirs.pop_back();
+        return true;
+    }
+
+    // take another worker's oldest directory, which probably has the most under it
+    bool steal(size_t thief, std::string& setme)
+    {
+        for (size_t i=1; i<workers_.size(); ++i)
+        {
+            auto& victim = *workers_[(thief + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.dirs.empty()) {
+                setme = std::move(victim.dirs.front());
+                victim.dirs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void read_dir(Worker& worker, std::string const& dir)
+    {
+        const auto fd = openat(root_fd_,
+                               dir.empty() ? "." : dir.c_str(),
+                               O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+        if (fd == -1) {
+            // it's fine if it was deleted or replaced since we listed its parent
+            if ((errno != ENOENT) && (errno != ENOTDIR) && (errno != ELOOP)) {
+                qWarning() << "Unable to open directory" << dir.c_str() << ':' << strerror(errno);
+                failed_ = true;
+            }
+            return;
+        }
+
+        std::vector<std::string> subdirs;
+        std::vector<char> buf(DIRENT_BUFSIZE);
+        for (;;)
+        {
+            const auto n_read = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+            if (n_read == 0)
+                break;
+            if (n_read < 0) {
+                qWarning() << "Unable to read directory" << dir.c_str() << ':' << strerror(errno);
+                failed_ = true;
+                break;
+            }
+
+            for (long pos=0; pos<n_read; )
+            {
+                const auto ent = reinterpret_cast<const linux_dirent64*>(&buf[size_t(pos)]);
+                pos += ent->d_reclen;
+
+                const char* name = ent->d_name;
+                if (!strcmp(name, ".") || !strcmp(name, ".."))
+                    continue;
+
+                // some filesystems don't fill in d_type
+                auto type = ent->d_type;
+                if (type == DT_UNKNOWN) {
+                    struct stat st;
+                    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                        if (errno != ENOENT) {
+                            qWarning() << "Unable to stat" << name << "in" << dir.c_str() << ':' << strerror(errno);
+                            failed_ = true;
+                        }
+                        continue;
+                    }
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+                }
+
+                if (type == DT_REG)
+                    worker.files.push_back(dir.empty() ? name : dir + '/' + name);
+                else if (type == DT_DIR)
+                    subdirs.push_back(dir.empty() ? name : dir + '/' + name);
+            }
+        }
+
+        close(fd);
+
+        if (!subdirs.empty())
+        {
+            n_pending_ += int(subdirs.size());
+            {
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                for (auto& subdir : subdirs)
+                    worker.dirs.push_back(std::move(subdir));
+            }
+            notify_idle(true);
+        }
+    }
+
+    const int root_fd_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    // directories that are queued or being read
+    std::atomic<int> n_pending_ {};
+
+    // idle workers sleep here until there's more to do
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    std::atomic<unsigned> generation_ {}; // bumped whenever dirs are queued
+
+    std::atomic<bool> failed_ {};
+};
+
+} // anonymous namespace
+
+PathTable
+DirectoryWalker::find_files(QString const& root, int n_threads, bool* ok)
+{
+    PathTable ret;
+
+    const auto root_utf8 = root.toUtf8();
+    const auto root_fd = open(root_utf8.constData(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (root_fd == -1) {
+        qWarning() << "Unable to open directory" << root << ':' << strerror(errno);
+        if (ok)
+            *ok = false;
+        return ret;
+    }
+
+    if (n_threads < 1)
+        n_threads = QThread::idealThreadCount();
+    Walker walker(root_fd, std::max(1, n_threads));
+    auto files = walker.walk();
+    close(root_fd);
+    if (ok)
+        *ok = !walker.failed();
+
+    std::sort(files.begin(), files.end());
+
+    std::string prefix = root_utf8.toStdString();
+    if (prefix.empty() || (prefix.back() != '/'))
+        prefix += '/';
+    std::string path;
+    for (auto const& file : files) {
+        path = prefix + file;
+        ret.append(path.data(), path.size());
+    }
+    ret.squeeze();
+
+    return ret;
+}
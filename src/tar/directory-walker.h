@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/path-table.h"
+
+#include <QString>
+
+/**
+ * Finds the regular files in a directory tree, like `find root -type f'.
+ *
+ * Directories are read with getdents64() on several threads at once.
+ * Each thread works depth-first through its own queue of directories
+ * and steals from the other threads' queues when it runs out.
+ * Symlinks are not followed.
+ */
+class DirectoryWalker
+{
+public:
+
+    // Returns the files under `root', each prefixed with `root',
+    // e.g. "./music/song.ogg" for a root of ".". The list is sorted
+    // so that the same tree always gives the same archive.
+    // If n_threads is 0, uses one thread per CPU core.
+    // If `ok' is given, it's set to false if any directory couldn't be
+    // read, in which case the list is missing whatever was under it.
+    static PathTable find_files(QString const& root, int n_threads=0, bool* ok=nullptr);
+};
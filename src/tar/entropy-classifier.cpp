@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/entropy-classifier.h"
+
+#include <QFile>
+
+#include <algorithm> // std::max()
+#include <array>
+#include <cmath> // log2()
+#include <cstdint>
+#include <cstring> // memcmp()
+
+namespace
+{
+    // sample this many bytes from the start, middle, and end of a file
+    constexpr qint64 SAMPLE_SIZE {1024*16};
+
+    // 8.0 is random noise. Compressed formats are typically above 7.9,
+    // while text and most uncompressed binaries are well below 7.
+    constexpr double INCOMPRESSIBLE_BITS_PER_BYTE {7.5};
+
+    struct Magic
+    {
+        size_t offset;
+        char const* bytes;
+        size_t len;
+    };
+
+    Magic const MAGICS[] = {
+        { 0, "\xFF\xD8\xFF", 3 },                // jpeg
+        { 0, "\x89PNG", 4 },                     // png
+        { 0, "GIF8", 4 },                        // gif
+        { 4, "ftyp", 4 },                        // mp4, m4a, mov, 3gp, heic
+        { 0, "ID3", 3 },                         // mp3 with id3v2 tag
+        { 0, "OggS", 4 },                        // ogg, opus
+        { 0, "fLaC", 4 },                        // flac
+        { 0, "\x1A\x45\xDF\xA3", 4 },            // webm, mkv
+        { 8, "WEBP", 4 },                        // webp
+        { 0, "PK\x03\x04", 4 },                  // zip, jar, apk, docx, odt
+        { 0, "\x1F\x8B", 2 },                    // gzip
+        { 0, "BZh", 3 },                         // bzip2
+        { 0, "\xFD" "7zXZ", 5 },                 // xz
+        { 0, "\x28\xB5\x2F\xFD", 4 },            // zstd
+        { 0, "7z\xBC\xAF\x27\x1C", 6 },          // 7z
+    };
+}
+
+bool
+EntropyClassifier::has_compressed_magic(unsigned char const* buf, size_t buflen)
+{
+    for (auto const& magic : MAGICS)
+        if ((buflen >= magic.offset + magic.len) && !memcmp(buf + magic.offset, magic.bytes, magic.len))
+            return true;
+
+    // mp3 without a tag starts with a frame sync
+    if ((buflen >= 2) && (buf[0] == 0xFF) && ((buf[1] & 0xE0) == 0xE0))
+        return true;
+
+    return false;
+}
+
+double
+EntropyClassifier::bits_per_byte(unsigned char const* buf, size_t buflen)
+{
+    if (buflen == 0)
+        return 0.0;
+
+    // count into four separate histograms, so that runs of the
+    // same byte value don't serialize on a single counter
+    std::array<std::array<uint32_t,256>,4> counts {};
+    size_t i = 0;
+    for (; i + 4 <= buflen; i += 4)
+    {
+        ++counts[0][buf[i]];
+        ++counts[1][buf[i+1]];
+        ++counts[2][buf[i+2]];
+        ++counts[3][buf[i+3]];
+    }
+    for (; i < buflen; ++i)
+        ++counts[0][buf[i]];
+
+    double bits {};
+    const auto total = double(buflen);
+    for (size_t byte = 0; byte < 256; ++byte)
+    {
+        const auto n = counts[0][byte] + counts[1][byte] + counts[2][byte] + counts[3][byte];
+        if (n > 0)
+        {
+            const auto p = n / total;
+            bits -= p * log2(p);
+        }
+    }
+
+    return bits;
+}
+
+bool
+EntropyClassifier::is_incompressible(QString const& filename)
+{
+    return is_incompressible(filename, QFile(filename).size());
+}
+
+bool
+EntropyClassifier::is_incompressible(QString const& filename, qint64 size)
+{
+    // small files aren't worth sampling, so check before opening
+    QFile file(filename);
+    if ((size < MIN_FILE_SIZE) || !file.open(QIODevice::ReadOnly))
+        return false;
+
+    // check the magic number
+    std::array<unsigned char,16> head {};
+    const auto n_head = file.read(reinterpret_cast<char*>(head.data()), qint64(head.size()));
+    if ((n_head > 0) && has_compressed_magic(head.data(), size_t(n_head)))
+        return true;
+
+    // check the entropy of samples from the start, middle, and end
+    std::array<unsigned char,SAMPLE_SIZE> sample;
+    for (auto const pos : { qint64(0), (size - SAMPLE_SIZE) / 2, size - SAMPLE_SIZE })
+    {
+        if (!file.seek(std::max(qint64(0), pos)))
+            return false;
+        const auto n = file.read(reinterpret_cast<char*>(sample.data()), SAMPLE_SIZE);
+        if ((n <= 0) || (bits_per_byte(sample.data(), size_t(n)) < INCOMPRESSIBLE_BITS_PER_BYTE))
+            return false;
+    }
+
+    return true;
+}
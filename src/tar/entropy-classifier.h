@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QString>
+#include <QtGlobal> // qint64
+
+#include <cstddef> // size_t
+
+/**
+ * Guesses whether a file is worth compressing.
+ *
+ * Media and archive files (JPEG, MP4, MP3, zip...) are already
+ * compressed, so compressing them again costs CPU for little gain.
+ * These are recognized by their magic numbers. Other files are judged
+ * by the Shannon entropy of a few samples of their contents.
+ */
+class EntropyClassifier
+{
+public:
+
+    // files smaller than this aren't worth classifying
+    static constexpr qint64 MIN_FILE_SIZE {1024*64};
+
+    static bool is_incompressible(QString const& filename);
+    // the same, for callers that already know the file's size
+    static bool is_incompressible(QString const& filename, qint64 size);
+
+    // exposed for testing
+    static bool has_compressed_magic(unsigned char const* buf, size_t buflen);
+    static double bits_per_byte(unsigned char const* buf, size_t buflen);
+};
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/file-writer-pool.h"
+#include "tar/safe-path.h"
+
+#include <QDebug>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm> // std::max()
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring> // strerror()
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility> // std::move()
+
+class FileWriterPool::File
+{
+public:
+
+    File(int dirfd,
+         std::string const& path,
+         mode_t mode,
+         int64_t size,
+         bool sparse,
+         struct timespec const& mtime,
+         std::atomic<bool>& failed)
+        : dirfd_{dirfd}
+        , path_{path}
+        , mode_{mode}
+        , size_{size}
+        , sparse_{sparse}
+        , mtime_(mtime)
+        , failed_(failed)
+    {
+    }
+
+    ~File()
+    {
+        if (fd_ == -1)
+            return;
+
+        // a sparse file may end with a hole, which was never written
+        if (sparse_ && (ftruncate(fd_, off_t(size_)) == -1))
+            fail("resize");
+
+        // after the last write, which would change it again
+        const struct timespec times[2] = { {0, UTIME_OMIT}, mtime_ };
+        if (futimens(fd_, times) == -1)
+            fail("set the time of");
+
+        if (close(fd_) == -1)
+            fail("close");
+    }
+
+    Q_DISABLE_COPY(File)
+
+    bool write(int64_t offset, std::vector<char> const& data)
+    {
+        const auto fd = open_once();
+        if (fd == -1)
+            return false;
+
+        for (size_t n_done=0; n_done<data.size(); )
+        {
+            const auto n = pwrite(fd, &data[n_done], data.size()-n_done, off_t(offset) + off_t(n_done));
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                fail("write");
+                return false;
+            }
+            n_done += size_t(n);
+        }
+
+        return true;
+    }
+
+private:
+
+    int open_once()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if ((fd_ == -1) && !open_failed_)
+        {
+            std::string name;
+            const auto parent = open_parent(dirfd_, path_, name, true);
+            if (parent != -1)
+            {
+                // Replace what's there instead of writing into it,
+                // in case it's a hard link to something else
+                unlinkat(parent, name.c_str(), 0);
+
+                static constexpr int flags {O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC};
+                fd_ = openat(parent, name.c_str(), flags, mode_ & 0777);
+                const auto err = errno;
+                close(parent);
+                errno = err;
+            }
+
+            if (fd_ == -1)
+            {
+                fail("create");
+                open_failed_ = true;
+            }
+            else if (!sparse_ && (size_ > 0))
+            {
+                // just a hint to keep the file in one piece, so ignore errors
+                fallocate(fd_, 0, 0, off_t(size_));
+            }
+        }
+
+        return fd_;
+    }
+
+    void fail(char const* what)
+    {
+        const auto err = errno;
+        qWarning() << "Unable to" << what << path_.c_str() << ':' << strerror(err);
+        failed_ = true;
+    }
+
+    int const dirfd_;
+    std::string const path_;
+    mode_t const mode_;
+    int64_t const size_;
+    bool const sparse_;
+    struct timespec const mtime_;
+    std::atomic<bool>& failed_;
+
+    std::mutex mutex_;
+    int fd_ {-1};
+    bool open_failed_ {};
+};
+
+/***
+****
+***/
+
+class FileWriterPool::Impl
+{
+public:
+
+    Impl(std::string const& target_dir, int n_threads, size_t max_buffered)
+        : max_buffered_{max_buffered}
+    {
+        // like write_disk, create the target if it's missing
+        const auto dir = target_dir.empty() ? std::string{"."} : target_dir;
+        for (auto pos = dir.find('/', 1); pos != std::string::npos; pos = dir.find('/', pos+1))
+            mkdir(dir.substr(0, pos).c_str(), 0777);
+        mkdir(dir.c_str(), 0777);
+        dirfd_ = open(dir.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (dirfd_ == -1)
+        {
+            qWarning() << "Unable to open" << dir.c_str() << ':' << strerror(errno);
+            failed_ = true;
+        }
+
+        for (int i=0, n=std::max(1, n_threads); i<n; ++i)
+            workers_.emplace_back(&Impl::worker_main, this);
+    }
+
+    ~Impl()
+    {
+        wait();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        workers_cv_.notify_all();
+        for (auto& worker : workers_)
+            worker.join();
+
+        if (dirfd_ != -1)
+            close(dirfd_);
+    }
+
+    std::shared_ptr<File> create(std::string const& path,
+                                 mode_t mode,
+                                 int64_t size,
+                                 bool sparse,
+                                 struct timespec const& mtime)
+    {
+        return std::make_shared<File>(dirfd_, path, mode, size, sparse, mtime, failed_);
+    }
+
+    void write(std::shared_ptr<File> const& file, int64_t offset, std::vector<char>&& data)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this](){return n_buffered_ < max_buffered_;});
+
+        n_buffered_ += data.size();
+        jobs_.push_back(Job{file, offset, std::move(data)});
+        workers_cv_.notify_one();
+    }
+
+    bool wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this](){return jobs_.empty() && !n_running_;});
+        return !failed_;
+    }
+
+    bool failed() const
+    {
+        return failed_;
+    }
+
+private:
+
+    struct Job
+    {
+        std::shared_ptr<File> file;
+        int64_t offset;
+        std::vector<char> data;
+    };
+
+    void worker_main()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                workers_cv_.wait(lock, [this](){return stopping_ || !jobs_.empty();});
+                if (jobs_.empty())
+                    break;
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+                ++n_running_;
+            }
+
+            // once something has failed, the restore is no good anyway
+            if (!failed_ && !job.file->write(job.offset, job.data))
+                failed_ = true;
+
+            // if this was the file's last extent, this closes it
+            const auto n_bytes = job.data.size();
+            job = Job{};
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --n_running_;
+                n_buffered_ -= n_bytes;
+            }
+            done_cv_.notify_all();
+        }
+    }
+
+    size_t const max_buffered_;
+    int dirfd_ {-1};
+    std::vector<std::thread> workers_;
+    std::atomic<bool> failed_ {};
+
+    std::mutex mutex_;
+    std::condition_variable workers_cv_;
+    std::condition_variable done_cv_;
+    std::deque<Job> jobs_;
+    size_t n_buffered_ {};
+    int n_running_ {};
+    bool stopping_ {};
+};
+
+/***
+****
+***/
+
+FileWriterPool::FileWriterPool(std::string const& target_dir, int n_threads, size_t max_buffered)
+    : impl_{new Impl{target_dir, n_threads, max_buffered}}
+{
+}
+
+FileWriterPool::~FileWriterPool() =default;
+
+std::shared_ptr<FileWriterPool::File>
+FileWriterPool::create(std::string const& path,
+                       mode_t mode,
+                       int64_t size,
+                       bool sparse,
+                       struct timespec const& mtime)
+{
+    return impl_->create(path, mode, size, sparse, mtime);
+}
+
+void
+FileWriterPool::write(std::shared_ptr<File> const& file, int64_t offset, std::vector<char>&& data)
+{
+    impl_->write(file, offset, std::move(data));
+}
+
+bool
+FileWriterPool::wait()
+{
+    return impl_->wait();
+}
+
+bool
+FileWriterPool::failed() const
+{
+    return impl_->failed();
+}
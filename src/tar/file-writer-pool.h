@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <sys/types.h> // mode_t
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+#include <ctime> // timespec
+#include <memory> // shared_ptr
+#include <string>
+#include <vector>
+
+/**
+ * Writes restored files on a pool of threads, so that the per-file
+ * costs of creating, writing, and closing many small files overlap
+ * instead of adding up.
+ *
+ * A file is opened by the first of its extents to be written,
+ * and the extents may be written in any order. The file gets its
+ * final size and mtime, and is closed, once all of its extents are
+ * written and the caller has released it.
+ *
+ * Files are created inside the target directory, whose path is trusted,
+ * one path component at a time and without following symlinks, so that
+ * a symlink on disk can't send a file somewhere else.
+ */
+class FileWriterPool
+{
+public:
+    class File;
+
+    FileWriterPool(std::string const& target_dir, int n_threads, size_t max_buffered);
+    ~FileWriterPool();
+
+    // Starts a file at `path' in the target directory.
+    // Missing parent directories are created when it's opened.
+    // If `sparse' is true, the unwritten parts are left as holes.
+    std::shared_ptr<File> create(std::string const& path,
+                                 mode_t mode,
+                                 int64_t size,
+                                 bool sparse,
+                                 struct timespec const& mtime);
+
+    // Queues `data' to be written to `file' at `offset'.
+    // Blocks while more than max_buffered bytes are waiting to be written.
+    void write(std::shared_ptr<File> const& file, int64_t offset, std::vector<char>&& data);
+
+    // Waits until everything that's queued is written
+    // and every released file is closed.
+    // Returns false if anything couldn't be written.
+    bool wait();
+
+    bool failed() const;
+
+private:
+    class Impl;
+    std::shared_ptr<Impl> impl_;
+};
@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/hash-cache.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QFuture>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm> // std::lower_bound()
+#include <cerrno>
+#include <cstring> // memcpy(), strerror()
+#include <ctime> // time()
+#include <map>
+#include <utility> // std::pair
+#include <vector>
+
+namespace
+{
+    constexpr quint32 CACHE_MAGIC {0x4b485348}; // "KHSH"
+    constexpr quint32 CACHE_VERSION {1};
+    constexpr size_t READ_SIZE {1024*64};
+
+    // Timestamps are coarser than they look, so a file that changed
+    // very recently could change again without its ctime changing.
+    // Don't remember the hashes of files that changed this recently.
+    constexpr int64_t RACY_SECS {1};
+
+    struct Header
+    {
+        quint32 magic;
+        quint32 version;
+        quint64 n_records;
+    };
+
+    // Records are fixed-size and sorted by device and inode, so that the
+    // mapped file can be searched in place. They're in the host's byte
+    // order because the cache never leaves this device.
+    struct Record
+    {
+        uint64_t dev;
+        uint64_t ino;
+        int64_t size;
+        int64_t mtime_nsec;
+        int64_t ctime_nsec;
+        int64_t last_used; // in seconds since the epoch
+        unsigned char hash[HashCache::HASH_SIZE];
+    };
+
+    static_assert(sizeof(Header) == 16, "the cache file's header must not have padding");
+    static_assert(sizeof(Record) == 80, "the cache file's records must not have padding");
+
+    using Key = std::pair<uint64_t,uint64_t>; // dev, ino
+
+    Key key_of(Record const& rec)
+    {
+        return Key{rec.dev, rec.ino};
+    }
+
+    Record make_record(struct stat const& st)
+    {
+        Record rec {};
+        rec.dev = uint64_t(st.st_dev);
+        rec.ino = uint64_t(st.st_ino);
+        rec.size = int64_t(st.st_size);
+        rec.mtime_nsec = int64_t(st.st_mtim.tv_sec)*1000000000 + int64_t(st.st_mtim.tv_nsec);
+        rec.ctime_nsec = int64_t(st.st_ctim.tv_sec)*1000000000 + int64_t(st.st_ctim.tv_nsec);
+        return rec;
+    }
+
+    // true if both records describe the same version of the same file
+    bool same_file(Record const& a, Record const& b)
+    {
+        return (a.dev == b.dev) && (a.ino == b.ino) && (a.size == b.size)
+            && (a.mtime_nsec == b.mtime_nsec) && (a.ctime_nsec == b.ctime_nsec);
+    }
+
+    QByteArray hash_of(Record const& rec)
+    {
+        return QByteArray(reinterpret_cast<char const*>(rec.hash), HashCache::HASH_SIZE);
+    }
+
+    bool hash_fd(int fd, QByteArray& setme, qint64& n_bytes)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+        std::vector<char> buf(READ_SIZE);
+        for (;;)
+        {
+            const auto n_read = read(fd, buf.data(), buf.size());
+            if (n_read == 0)
+                break;
+            if (n_read < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            hash.addData(buf.data(), int(n_read));
+            n_bytes += n_read;
+        }
+
+        setme = hash.result();
+        return true;
+    }
+}
+
+constexpr int HashCache::HASH_SIZE;
+constexpr int64_t HashCache::MAX_AGE;
+
+class HashCache::Impl
+{
+public:
+
+    Impl() =default;
+
+    ~Impl()
+    {
+        close();
+    }
+
+    void open(QString const& path, int64_t max_age)
+    {
+        close();
+        path_ = path;
+        max_age_ = max_age;
+        now_ = int64_t(time(nullptr));
+
+        const auto fd = ::open(path.toUtf8().constData(), O_RDONLY|O_CLOEXEC);
+        if (fd == -1) {
+            if (errno != ENOENT)
+                qWarning() << "Unable to open hash cache" << path << ':' << strerror(errno);
+            return;
+        }
+        struct stat st;
+        if ((fstat(fd, &st) != -1) && (size_t(st.st_size) >= sizeof(Header))) {
+            const auto map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                map_ = map;
+                map_size_ = size_t(st.st_size);
+            }
+        }
+        ::close(fd);
+        if (map_ == nullptr)
+            return;
+
+        const auto header = static_cast<Header const*>(map_);
+        if ((header->magic != CACHE_MAGIC)
+            || (header->version != CACHE_VERSION)
+            || (header->n_records > (map_size_ - sizeof(Header)) / sizeof(Record))) {
+            qWarning() << "Ignoring unrecognized hash cache" << path;
+            close();
+            path_ = path;
+            return;
+        }
+        records_ = reinterpret_cast<Record const*>(static_cast<char const*>(map_) + sizeof(Header));
+        n_records_ = size_t(header->n_records);
+
+        // sort out the stale entries while the backup gets started
+        compacted_ = QtConcurrent::run([this](){return compact();});
+        compacting_ = true;
+    }
+
+    bool get_hash(QByteArray const& filename, QByteArray& setme)
+    {
+        const auto fd = ::open(filename.constData(), O_RDONLY|O_CLOEXEC);
+        if (fd == -1)
+            return false;
+
+        struct stat st;
+        bool ok = fstat(fd, &st) != -1;
+        if (ok) {
+            auto rec = make_record(st);
+            if (find(rec, setme)) {
+                ++stats_.n_hits;
+            } else {
+                ++stats_.n_misses;
+                ok = hash_fd(fd, setme, stats_.n_bytes_hashed);
+
+                // if it changed while we were reading it, don't remember the hash
+                const auto racy_nsec = (int64_t(time(nullptr)) - RACY_SECS) * 1000000000;
+                struct stat after;
+                if (ok && (fstat(fd, &after) != -1) && same_file(rec, make_record(after))
+                       && (rec.ctime_nsec < racy_nsec)) {
+                    memcpy(rec.hash, setme.constData(), HASH_SIZE);
+                    rec.last_used = now_;
+                    added_[key_of(rec)] = rec;
+                }
+            }
+        }
+
+        ::close(fd);
+        return ok;
+    }
+
+    bool save()
+    {
+        if (path_.isEmpty())
+            return false;
+
+        std::vector<Record> kept;
+        if (compacting_)
+            kept = compacted_.result();
+
+        // nothing new and nothing to drop?
+        if (added_.empty() && used_.empty() && (kept.size() == n_records_))
+            return true;
+
+        // the entries we used this time get a new lease on life
+        auto updates = added_;
+        for (auto const i : used_) {
+            auto rec = records_[i];
+            rec.last_used = now_;
+            updates.emplace(key_of(rec), rec);
+        }
+
+        // merge the two sorted lists, preferring the newer entries
+        std::vector<Record> records;
+        records.reserve(kept.size() + updates.size());
+        auto update = updates.begin();
+        for (auto const& rec : kept) {
+            const auto key = key_of(rec);
+            for (; (update != updates.end()) && (update->first < key); ++update)
+                records.push_back(update->second);
+            if ((update != updates.end()) && (update->first == key)) {
+                records.push_back(update->second);
+                ++update;
+            } else {
+                records.push_back(rec);
+            }
+        }
+        for (; update != updates.end(); ++update)
+            records.push_back(update->second);
+
+        QDir().mkpath(QFileInfo(path_).absolutePath());
+
+        // don't leave a half-written cache if we're interrupted
+        QSaveFile file(path_);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "Unable to save hash cache" << path_ << ':' << file.errorString();
+            return false;
+        }
+        const Header header {CACHE_MAGIC, CACHE_VERSION, quint64(records.size())};
+        const auto records_size = qint64(records.size() * sizeof(Record));
+        if ((file.write(reinterpret_cast<char const*>(&header), sizeof(header)) != qint64(sizeof(header)))
+            || (file.write(reinterpret_cast<char const*>(records.data()), records_size) != records_size)
+            || !file.commit()) {
+            qWarning() << "Unable to save hash cache" << path_ << ':' << file.errorString();
+            return false;
+        }
+
+        qDebug() << "saved" << records.size() << "hashes;" << (n_records_ - kept.size()) << "old ones were dropped";
+        return true;
+    }
+
+    Stats stats() const
+    {
+        return stats_;
+    }
+
+private:
+
+    bool find(Record const& key, QByteArray& setme)
+    {
+        const auto it = added_.find(key_of(key));
+        if ((it != added_.end()) && same_file(it->second, key)) {
+            setme = hash_of(it->second);
+            return true;
+        }
+
+        const auto end = records_ + n_records_;
+        const auto rec = std::lower_bound(records_, end, key, [](Record const& a, Record const& b){
+            return key_of(a) < key_of(b);
+        });
+        if ((rec == end) || !same_file(*rec, key))
+            return false;
+
+        used_.push_back(size_t(rec - records_));
+        setme = hash_of(*rec);
+        return true;
+    }
+
+    // the entries that have been used recently enough to keep
+    std::vector<Record> compact() const
+    {
+        std::vector<Record> kept;
+        kept.reserve(n_records_);
+        for (size_t i=0; i<n_records_; ++i)
+            if (now_ - records_[i].last_used <= max_age_)
+                kept.push_back(records_[i]);
+        return kept;
+    }
+
+    void close()
+    {
+        if (compacting_) {
+            compacted_.waitForFinished();
+            compacting_ = false;
+        }
+        if (map_ != nullptr)
+            munmap(map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+        records_ = nullptr;
+        n_records_ = 0;
+        path_.clear();
+        added_.clear();
+        used_.clear();
+        stats_ = Stats{};
+    }
+
+    QString path_;
+    int64_t max_age_ {MAX_AGE};
+    int64_t now_ {};
+
+    void* map_ {};
+    size_t map_size_ {};
+    Record const* records_ {};
+    size_t n_records_ {};
+
+    QFuture<std::vector<Record>> compacted_;
+    bool compacting_ {};
+
+    std::map<Key,Record> added_; // files we've hashed
+    std::vector<size_t> used_; // the records in the file that we've used
+    Stats stats_;
+};
+
+/***
+****
+***/
+
+HashCache::HashCache()
+    : impl_{new Impl{}}
+{
+}
+
+HashCache::~HashCache() =default;
+
+void
+HashCache::open(QString const& path, int64_t max_age)
+{
+    impl_->open(path, max_age);
+}
+
+bool
+HashCache::get_hash(QByteArray const& filename, QByteArray& setme)
+{
+    return impl_->get_hash(filename, setme);
+}
+
+bool
+HashCache::save()
+{
+    return impl_->save();
+}
+
+HashCache::Stats
+HashCache::stats() const
+{
+    return impl_->stats();
+}
+
+QString
+HashCache::default_path()
+{
+    return QStringLiteral("%1/keeper/hashes.cache")
+        .arg(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation));
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal> // qint64
+
+#include <cstdint> // int64_t
+#include <memory> // unique_ptr
+
+/**
+ * A persistent cache of files' SHA-256 hashes, so that a file that
+ * hasn't changed since it was last hashed doesn't have to be read again.
+ *
+ * Files are looked up by device and inode, and a hash is only used if
+ * the file's size, mtime and ctime all match the ones it was hashed with.
+ * Any write to a file changes its ctime, so resetting the mtime after
+ * a change doesn't fool it. Files that changed within the last second
+ * or so are hashed but not cached, since another change in the same
+ * clock tick wouldn't show.
+ *
+ * The cache file is memory-mapped for lookups, and new hashes are kept
+ * in memory until save() replaces the file in one step. Entries that
+ * haven't been used for a while are dropped when it's saved; working
+ * out which ones starts in the background as soon as it's opened.
+ */
+class HashCache
+{
+public:
+    HashCache();
+    ~HashCache();
+
+    static constexpr int HASH_SIZE {32};
+    static constexpr int64_t MAX_AGE {60*60*24*30}; // in seconds
+
+    // Maps the cache file. A missing or unreadable one is an empty cache.
+    void open(QString const& path, int64_t max_age=MAX_AGE);
+
+    // Sets `setme' to the file's hash, reading the file only if the cache
+    // doesn't have it. Returns false if the file can't be read.
+    bool get_hash(QByteArray const& filename, QByteArray& setme);
+
+    // Writes the cache back with the hashes that have been added or used.
+    // Call this once the backup has succeeded.
+    bool save();
+
+    struct Stats
+    {
+        int n_hits {}; // files whose hashes were in the cache
+        int n_misses {}; // files that had to be read
+        qint64 n_bytes_hashed {};
+    };
+
+    Stats stats() const;
+
+    // where keeper-tar keeps its cache
+    static QString default_path();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
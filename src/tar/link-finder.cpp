@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/content-hash.h"
+#include "tar/hash-cache.h"
+#include "tar/link-finder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm> // std::equal(), std::stable_sort()
+#include <cstdint>
+#include <functional> // std::hash
+#include <map>
+#include <unordered_map>
+#include <utility> // std::pair
+#include <vector>
+
+namespace
+{
+    constexpr size_t READ_SIZE {1024*64};
+
+    struct InodeKey
+    {
+        dev_t dev;
+        ino_t ino;
+        bool operator==(InodeKey const& that) const {return dev == that.dev && ino == that.ino;}
+    };
+
+    struct InodeKeyHash
+    {
+        size_t operator()(InodeKey const& key) const
+        {
+            return std::hash<uint64_t>()(uint64_t(key.ino) ^ (uint64_t(key.dev) << 32));
+        }
+    };
+
+    bool files_are_equal(QByteArray const& a, QByteArray const& b)
+    {
+        const auto fd_a = open(a.constData(), O_RDONLY|O_CLOEXEC);
+        const auto fd_b = open(b.constData(), O_RDONLY|O_CLOEXEC);
+
+        bool equal = (fd_a != -1) && (fd_b != -1);
+        std::vector<char> buf_a(READ_SIZE), buf_b(READ_SIZE);
+        while (equal)
+        {
+            // regular files give full reads until the end
+            const auto n_a = read(fd_a, buf_a.data(), buf_a.size());
+            const auto n_b = read(fd_b, buf_b.data(), buf_b.size());
+            if ((n_a < 0) || (n_a != n_b))
+                equal = false;
+            else if (n_a == 0)
+                break;
+            else
+                equal = std::equal(buf_a.begin(), buf_a.begin()+n_a, buf_b.begin());
+        }
+
+        if (fd_a != -1)
+            close(fd_a);
+        if (fd_b != -1)
+            close(fd_b);
+        return equal;
+    }
+}
+
+class LinkFinder::Impl
+{
+public:
+
+    Impl(PathTable const& filenames, bool find_duplicates, std::shared_ptr<HashCache> const& hash_cache)
+        : filenames_(filenames)
+        , find_duplicates_(find_duplicates)
+        , hash_cache_(hash_cache)
+    {
+    }
+
+    void add(struct stat const& st)
+    {
+        const auto index = n_files_++;
+        if (!S_ISREG(st.st_mode))
+            return;
+
+        // is it another link to an inode we've already seen?
+        if (st.st_nlink > 1)
+        {
+            const auto it = inodes_.emplace(InodeKey{st.st_dev, st.st_ino}, index);
+            if (!it.second) {
+                targets_.emplace(index, it.first->second);
+                ++stats_.n_hardlinks;
+                stats_.n_bytes_saved += qint64(st.st_size);
+                return;
+            }
+        }
+
+        if (find_duplicates_ && (qint64(st.st_size) >= MIN_DUPLICATE_SIZE))
+            candidates_.emplace_back(int64_t(st.st_size), index);
+    }
+
+    void finish()
+    {
+        // only files with the same size can be duplicates.
+        // the sort is stable so that earlier files become the targets.
+        std::stable_sort(candidates_.begin(), candidates_.end(),
+                         [](Candidate const& a, Candidate const& b){return a.first < b.first;});
+
+        for (auto begin=candidates_.begin(), end=begin; begin!=candidates_.end(); begin=end)
+        {
+            end = begin + 1;
+            while ((end != candidates_.end()) && (end->first == begin->first))
+                ++end;
+            if ((end - begin > 1) && hash_cache_)
+                find_cached_duplicates(begin, end);
+            else if (end - begin > 1)
+                find_duplicates(begin, end);
+        }
+
+        candidates_.clear();
+        candidates_.shrink_to_fit();
+        inodes_.clear();
+    }
+
+    bool find_target(size_t i, size_t& target) const
+    {
+        const auto it = targets_.find(i);
+        if (it == targets_.end())
+            return false;
+        target = it->second;
+        return true;
+    }
+
+    Stats stats() const
+    {
+        return stats_;
+    }
+
+private:
+
+    using Candidate = std::pair<int64_t, size_t>; // size, index
+
+    // finds the duplicates among files that all have the same size
+    void find_duplicates(std::vector<Candidate>::const_iterator begin,
+                         std::vector<Candidate>::const_iterator end)
+    {
+        std::unordered_map<uint64_t, std::vector<size_t>> originals; // hash -> files we're keeping
+
+        for (auto it=begin; it!=end; ++it)
+        {
+            const auto index = it->second;
+            const auto filename = filenames_.at(index);
+
+            uint64_t hash;
+            if (!ContentHash::hash_file(filename, hash))
+                continue;
+
+            auto& matches = originals[hash];
+            bool linked = false;
+            for (auto const original : matches)
+            {
+                if (files_are_equal(filenames_.at(original), filename)) {
+                    targets_.emplace(index, original);
+                    ++stats_.n_duplicates;
+                    stats_.n_bytes_saved += it->first;
+                    linked = true;
+                    break;
+                }
+            }
+            if (!linked)
+                matches.push_back(index);
+        }
+    }
+
+    // Like find_duplicates(), but with strong hashes that don't need to
+    // be confirmed, so files already in the cache aren't read at all
+    void find_cached_duplicates(std::vector<Candidate>::const_iterator begin,
+                                std::vector<Candidate>::const_iterator end)
+    {
+        std::map<QByteArray, size_t> originals; // hash -> the file we're keeping
+
+        for (auto it=begin; it!=end; ++it)
+        {
+            const auto index = it->second;
+
+            QByteArray hash;
+            if (!hash_cache_->get_hash(filenames_.at(index), hash))
+                continue;
+
+            const auto original = originals.emplace(hash, index);
+            if (!original.second) {
+                targets_.emplace(index, original.first->second);
+                ++stats_.n_duplicates;
+                stats_.n_bytes_saved += it->first;
+            }
+        }
+    }
+
+    const PathTable filenames_;
+    const bool find_duplicates_ {};
+    const std::shared_ptr<HashCache> hash_cache_;
+    size_t n_files_ {};
+    std::unordered_map<InodeKey, size_t, InodeKeyHash> inodes_;
+    std::vector<Candidate> candidates_;
+    std::unordered_map<size_t, size_t> targets_; // file index -> the earlier file it links to
+    Stats stats_;
+};
+
+/***
+****
+***/
+
+LinkFinder::LinkFinder(PathTable const& filenames,
+                       bool find_duplicates,
+                       std::shared_ptr<HashCache> const& hash_cache)
+    : impl_{new Impl{filenames, find_duplicates, hash_cache}}
+{
+}
+
+LinkFinder::~LinkFinder() =default;
+
+void
+LinkFinder::add(struct stat const& st)
+{
+    impl_->add(st);
+}
+
+void
+LinkFinder::finish()
+{
+    impl_->finish();
+}
+
+bool
+LinkFinder::find_target(size_t i, size_t& target) const
+{
+    return impl_->find_target(i, target);
+}
+
+LinkFinder::Stats
+LinkFinder::stats() const
+{
+    return impl_->stats();
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/path-table.h"
+
+class HashCache;
+
+#include <QtGlobal> // qint64
+
+#include <sys/stat.h>
+
+#include <cstddef> // size_t
+#include <memory> // shared_ptr
+
+/**
+ * Finds the files in an archive that can be stored as hard links
+ * to an earlier file instead of storing their contents again.
+ *
+ * Hard links to the same inode are always found. Optionally, files
+ * whose contents are identical are found too: files of the same size
+ * are grouped by a fast hash of their contents, and any matches are
+ * compared byte for byte before they're linked. If a HashCache is
+ * given, files are grouped by their SHA-256 from the cache instead and
+ * matches are trusted without being read. Note that these are restored
+ * as hard links to a single file.
+ */
+class LinkFinder
+{
+public:
+
+    explicit LinkFinder(PathTable const& files,
+                        bool find_duplicates=false,
+                        std::shared_ptr<HashCache> const& hash_cache=std::shared_ptr<HashCache>());
+    ~LinkFinder();
+
+    // smaller files aren't worth reading to look for duplicates
+    static constexpr qint64 MIN_DUPLICATE_SIZE {1024*4};
+
+    // Call once for each file, in archive order. If the file couldn't
+    // be stat()ed, pass a zeroed stat so that the indices stay in step.
+    void add(struct stat const& st);
+
+    // Call after the last add(). If finding duplicates,
+    // this reads the files that might be duplicates.
+    void finish();
+
+    // If the i'th file should be archived as a link to an
+    // earlier file, sets `target' to that file's index.
+    bool find_target(size_t i, size_t& target) const;
+
+    struct Stats
+    {
+        int n_hardlinks {}; // files that were hard links to an earlier file
+        int n_duplicates {}; // files whose contents matched an earlier file
+        qint64 n_bytes_saved {}; // contents that didn't have to be archived
+    };
+
+    Stats stats() const;
+
+private:
+    class Impl;
+    friend class Impl;
+    std::shared_ptr<Impl> impl_;
+};
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/path-table.h"
+
+#include <algorithm> // std::mismatch(), std::min()
+
+/**
+ * Each path is encoded in the arena as
+ *
+ *   varint n_shared  (bytes shared with the previous path)
+ *   varint n_suffix  (bytes that follow)
+ *   char   suffix[n_suffix]
+ *
+ * and `restarts' holds the arena offset of every RESTART_INTERVAL'th
+ * path, whose n_shared is always zero.
+ */
+struct PathTable::Data
+{
+    size_t interval {};
+    size_t count {};
+    std::vector<char> arena;
+    std::vector<size_t> restarts;
+    QByteArray last; // the most recently appended path
+};
+
+namespace
+{
+    void put_varint(std::vector<char>& arena, size_t val)
+    {
+        while (val >= 0x80) {
+            arena.push_back(char((val & 0x7F) | 0x80));
+            val >>= 7;
+        }
+        arena.push_back(char(val));
+    }
+
+    size_t get_varint(std::vector<char> const& arena, size_t& pos)
+    {
+        size_t val {};
+        for (int shift=0; ; shift+=7) {
+            const auto byte = static_cast<unsigned char>(arena[pos++]);
+            val |= size_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        return val;
+    }
+}
+
+PathTable::PathTable(bool front_coding)
+    : d_{new Data}
+{
+    d_->interval = front_coding ? RESTART_INTERVAL : 1;
+}
+
+PathTable::PathTable(QStringList const& paths, bool front_coding)
+    : PathTable{front_coding}
+{
+    for (auto const& path : paths)
+        append(path);
+    squeeze();
+}
+
+void
+PathTable::detach()
+{
+    if (d_.use_count() > 1)
+        d_.reset(new Data(*d_));
+}
+
+void
+PathTable::append(char const* path, size_t len)
+{
+    detach();
+
+    size_t n_shared {};
+    if (d_->count % d_->interval == 0) {
+        d_->restarts.push_back(d_->arena.size());
+    } else {
+        const auto n = std::min(len, size_t(d_->last.size()));
+        n_shared = size_t(std::mismatch(path, path+n, d_->last.constData()).first - path);
+    }
+
+    put_varint(d_->arena, n_shared);
+    put_varint(d_->arena, len - n_shared);
+    d_->arena.insert(d_->arena.end(), path + n_shared, path + len);
+
+    // only front coding needs to remember the last path
+    if (d_->interval > 1)
+        d_->last = QByteArray(path, int(len));
+    ++d_->count;
+}
+
+void
+PathTable::append(QByteArray const& path)
+{
+    append(path.constData(), size_t(path.size()));
+}
+
+void
+PathTable::append(QString const& path)
+{
+    append(path.toUtf8());
+}
+
+void
+PathTable::squeeze()
+{
+    detach();
+    d_->arena.shrink_to_fit();
+    d_->restarts.shrink_to_fit();
+}
+
+size_t
+PathTable::size() const
+{
+    return d_->count;
+}
+
+bool
+PathTable::empty() const
+{
+    return d_->count == 0;
+}
+
+// decodes the path at arena offset `pos' on top of `path',
+// which must hold the previous path. Returns the next path's offset.
+size_t
+PathTable::decode(size_t pos, QByteArray& path) const
+{
+    const auto n_shared = get_varint(d_->arena, pos);
+    const auto n_suffix = get_varint(d_->arena, pos);
+    path.truncate(int(n_shared));
+    path.append(&d_->arena[pos], int(n_suffix));
+    return pos + n_suffix;
+}
+
+QByteArray
+PathTable::at(size_t i) const
+{
+    QByteArray path;
+    auto pos = d_->restarts[i / d_->interval];
+    for (size_t j=0, n=i%d_->interval; j<=n; ++j)
+        pos = decode(pos, path);
+    return path;
+}
+
+QStringList
+PathTable::to_string_list() const
+{
+    QStringList ret;
+    ret.reserve(int(size()));
+    for (auto const& path : *this)
+        ret.append(QString::fromUtf8(path));
+    return ret;
+}
+
+size_t
+PathTable::memory_usage() const
+{
+    return d_->arena.capacity()
+         + d_->restarts.capacity() * sizeof(size_t)
+         + size_t(d_->last.capacity());
+}
+
+PathTable::const_iterator
+PathTable::begin() const
+{
+    return const_iterator{this, 0};
+}
+
+PathTable::const_iterator
+PathTable::end() const
+{
+    return const_iterator{this, size()};
+}
+
+/***
+****
+***/
+
+PathTable::const_iterator::const_iterator(PathTable const* table, size_t index)
+    : table_{table}
+    , index_{index}
+{
+    if (index_ < table_->size())
+        decode();
+}
+
+void
+PathTable::const_iterator::decode()
+{
+    pos_ = table_->decode(pos_, path_);
+}
+
+PathTable::const_iterator&
+PathTable::const_iterator::operator++()
+{
+    if (++index_ < table_->size())
+        decode();
+    return *this;
+}
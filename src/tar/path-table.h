@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+#include <cstddef> // size_t
+#include <iterator>
+#include <memory> // shared_ptr
+#include <vector>
+
+/**
+ * A compact, append-only list of file paths.
+ *
+ * A QStringList of a million paths costs several times the paths'
+ * UTF-8 size: each QString is UTF-16 and has its own heap block.
+ * PathTable keeps all the paths as UTF-8 in a single arena instead.
+ *
+ * With front coding, each path only stores how much of the previous
+ * path it shares plus the rest, which saves a lot on sorted paths that
+ * share their parent directories. Every RESTART_INTERVAL'th path is
+ * stored whole so that at() doesn't have to decode from the start.
+ *
+ * Copies are cheap: they share the arena until one of them is changed.
+ */
+class PathTable
+{
+public:
+
+    explicit PathTable(bool front_coding=true);
+    explicit PathTable(QStringList const& paths, bool front_coding=true);
+
+    static constexpr size_t RESTART_INTERVAL {16};
+
+    void append(char const* path, size_t len);
+    void append(QByteArray const& path);
+    void append(QString const& path);
+
+    // releases any spare capacity once the table is built
+    void squeeze();
+
+    size_t size() const;
+    bool empty() const;
+
+    // the i'th path, in UTF-8
+    QByteArray at(size_t i) const;
+
+    QStringList to_string_list() const;
+
+    // how many heap bytes the table uses
+    size_t memory_usage() const;
+
+    // decodes the paths in order, which is cheaper than calling at()
+    class const_iterator: public std::iterator<std::forward_iterator_tag, QByteArray>
+    {
+    public:
+        QByteArray const& operator*() const {return path_;}
+        QByteArray const* operator->() const {return &path_;}
+        const_iterator& operator++();
+        bool operator==(const_iterator const& that) const {return index_ == that.index_;}
+        bool operator!=(const_iterator const& that) const {return index_ != that.index_;}
+
+    private:
+        friend class PathTable;
+        const_iterator(PathTable const* table, size_t index);
+        void decode();
+
+        PathTable const* table_ {};
+        size_t index_ {};
+        size_t pos_ {};
+        QByteArray path_;
+    };
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+
+    struct Data;
+    void detach();
+    size_t decode(size_t pos, QByteArray& path) const;
+
+    std::shared_ptr<Data> d_;
+};
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/safe-path.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+bool
+has_dotdot(std::string const& path)
+{
+    for (size_t begin=0; begin<=path.size(); )
+    {
+        auto end = path.find('/', begin);
+        if (end == std::string::npos)
+            end = path.size();
+        if (path.compare(begin, end-begin, "..") == 0)
+            return true;
+        begin = end + 1;
+    }
+    return false;
+}
+
+int
+open_parent(int dirfd, std::string const& path, std::string& name, bool create)
+{
+    static constexpr int flags {O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC};
+
+    auto fd = openat(dirfd, ".", flags);
+    for (size_t begin=0; fd!=-1; )
+    {
+        begin = path.find_first_not_of('/', begin);
+        const auto end = path.find('/', begin);
+        if (end == std::string::npos) {
+            name = begin == std::string::npos ? std::string() : path.substr(begin);
+            break;
+        }
+        const auto dir = path.substr(begin, end-begin);
+        begin = end;
+        if (dir == ".")
+            continue;
+
+        auto child = openat(fd, dir.c_str(), flags);
+        if (create && (child == -1) && (errno == ENOENT) && ((mkdirat(fd, dir.c_str(), 0777) == 0) || (errno == EEXIST)))
+            child = openat(fd, dir.c_str(), flags);
+        const auto err = errno;
+        close(fd);
+        errno = err;
+        fd = child;
+    }
+    return fd;
+}
+
+bool
+unlink_beneath(int dirfd, std::string const& path)
+{
+    std::string name;
+    const auto parent = open_parent(dirfd, path, name, false);
+    if (parent == -1)
+        return errno == ENOENT; // its directory is already gone
+
+    const auto ok = (unlinkat(parent, name.c_str(), 0) == 0) || (errno == ENOENT);
+    const auto err = errno;
+    close(parent);
+    errno = err;
+    return ok;
+}
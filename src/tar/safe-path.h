@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <string>
+
+/**
+ * Helpers for working inside a restore's target directory, whose path
+ * is trusted, without letting what's in it send us somewhere else:
+ * neither a '..' in an archive's paths nor a symlink on disk.
+ */
+
+// true if any of `path's components is '..'
+bool has_dotdot(std::string const& path);
+
+// Opens the directory that `path' is in, relative to `dirfd', and sets
+// `name' to the path's last component. If `create' is true, missing
+// directories are created. Symlinks aren't followed, so a path whose
+// parent is a symlink fails. Callers check for '..' themselves.
+int open_parent(int dirfd, std::string const& path, std::string& name, bool create);
+
+// Deletes the file at `path', relative to `dirfd', without following
+// symlinks. Returns true if it's gone, including if it was never there.
+// On failure errno says why.
+bool unlink_beneath(int dirfd, std::string const& path);
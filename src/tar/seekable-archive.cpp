@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/seekable-archive.h"
+#include "util/archive-magic.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QIODevice>
+#include <QtEndian>
+
+#include <algorithm> // std::min()
+#include <cstdint> // SIZE_MAX
+#include <cstring> // memcmp()
+
+namespace
+{
+    constexpr char const FOOTER_MAGIC[] = { 'K', 'E', 'E', 'P', 'S', 'K', 'I', '1' };
+
+    constexpr quint32 INDEX_MAGIC {0x4b534958}; // "KSIX"
+    constexpr quint32 INDEX_VERSION {1};
+
+    // don't let a bad archive make us hold onto everything after its blocks
+    constexpr int INDEX_SIZE_MAX {64*1024*1024};
+
+    template<typename T>
+    void append_le(std::vector<char>& fillme, T val)
+    {
+        uchar bytes[sizeof(T)];
+        qToLittleEndian(val, bytes);
+        fillme.insert(fillme.end(), reinterpret_cast<char const*>(bytes), reinterpret_cast<char const*>(bytes) + sizeof(T));
+    }
+
+    // returns the index size from a footer, or -1 if it isn't a footer
+    qint64 parse_footer(char const* footer)
+    {
+        if (memcmp(footer + sizeof(quint64), FOOTER_MAGIC, sizeof(FOOTER_MAGIC)) != 0)
+            return -1;
+        const auto index_size = qFromLittleEndian<quint64>(reinterpret_cast<uchar const*>(footer));
+        return index_size <= quint64(INDEX_SIZE_MAX) ? qint64(index_size) : -1;
+    }
+}
+
+static_assert(ArchiveMagic::SEEKABLE_HEADER_SIZE == SeekableArchive::HEADER_SIZE, "header size");
+static_assert(sizeof(quint64) + sizeof(FOOTER_MAGIC) == SeekableArchive::FOOTER_SIZE, "footer size");
+
+constexpr size_t SeekableArchive::HEADER_SIZE;
+constexpr size_t SeekableArchive::BLOCK_HEADER_SIZE;
+constexpr size_t SeekableArchive::FOOTER_SIZE;
+QString const SeekableArchive::INDEX_SUFFIX = QStringLiteral(".index");
+
+/***
+****
+***/
+
+QByteArray
+SeekableArchive::Index::serialize() const
+{
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+
+    out << INDEX_MAGIC << INDEX_VERSION << quint64(blocks.size());
+    for (auto const& block : blocks)
+        out << block.offset << block.size << block.raw_offset << block.raw_size;
+
+    out << quint64(entries.size());
+    for (auto const& entry : entries)
+        out << entry.path << entry.block << entry.offset << entry.size;
+
+    return bytes;
+}
+
+bool
+SeekableArchive::Index::parse(QByteArray const& bytes)
+{
+    blocks.clear();
+    entries.clear();
+
+    QDataStream in(bytes);
+    quint32 magic {}, version {};
+    in >> magic >> version;
+    if ((magic != INDEX_MAGIC) || (version != INDEX_VERSION))
+        return false;
+
+    quint64 n_blocks {};
+    in >> n_blocks;
+    for (quint64 i=0; (i<n_blocks) && (in.status() == QDataStream::Ok); ++i)
+    {
+        Block block {};
+        in >> block.offset >> block.size >> block.raw_offset >> block.raw_size;
+        blocks << block;
+    }
+
+    quint64 n_entries {};
+    in >> n_entries;
+    for (quint64 i=0; (i<n_entries) && (in.status() == QDataStream::Ok); ++i)
+    {
+        Entry entry {};
+        in >> entry.path >> entry.block >> entry.offset >> entry.size;
+        if ((entry.block >= quint32(blocks.size())) || (entry.offset >= blocks[int(entry.block)].raw_size))
+            return false;
+        entries << entry;
+    }
+
+    return in.status() == QDataStream::Ok;
+}
+
+SeekableArchive::Entry const*
+SeekableArchive::Index::find(QByteArray const& path) const
+{
+    for (auto const& entry : entries)
+        if (entry.path == path)
+            return &entry;
+    return nullptr;
+}
+
+/***
+****
+***/
+
+bool
+SeekableArchive::is_seekable(char const* buf, size_t buflen)
+{
+    return ArchiveMagic::is_seekable(buf, buflen);
+}
+
+void
+SeekableArchive::append_header(std::vector<char>& fillme)
+{
+    fillme.insert(fillme.end(), ArchiveMagic::SEEKABLE_HEADER, ArchiveMagic::SEEKABLE_HEADER + HEADER_SIZE);
+}
+
+void
+SeekableArchive::append_block(std::vector<char>& fillme, char const* payload, size_t len)
+{
+    append_le(fillme, quint32(len));
+    fillme.insert(fillme.end(), payload, payload + len);
+}
+
+void
+SeekableArchive::append_index(std::vector<char>& fillme, Index const& index)
+{
+    const auto bytes = index.serialize();
+
+    append_le(fillme, quint32(0)); // end of blocks
+    fillme.insert(fillme.end(), bytes.begin(), bytes.end());
+    append_le(fillme, quint64(bytes.size()));
+    fillme.insert(fillme.end(), FOOTER_MAGIC, FOOTER_MAGIC + sizeof(FOOTER_MAGIC));
+}
+
+bool
+SeekableArchive::read_index(QIODevice& archive, Index& setme)
+{
+    const auto archive_size = archive.size();
+    if (archive.isSequential() || (archive_size < qint64(HEADER_SIZE + BLOCK_HEADER_SIZE + FOOTER_SIZE)))
+        return false;
+
+    char header[HEADER_SIZE];
+    if (!archive.seek(0) || (archive.read(header, sizeof(header)) != qint64(sizeof(header))) || !is_seekable(header, sizeof(header)))
+        return false;
+
+    char footer[FOOTER_SIZE];
+    if (!archive.seek(archive_size - qint64(FOOTER_SIZE)) || (archive.read(footer, sizeof(footer)) != qint64(sizeof(footer))))
+        return false;
+    const auto index_size = parse_footer(footer);
+    if ((index_size < 0) || (index_size > archive_size - qint64(HEADER_SIZE + BLOCK_HEADER_SIZE + FOOTER_SIZE)))
+        return false;
+
+    if (!archive.seek(archive_size - qint64(FOOTER_SIZE) - index_size))
+        return false;
+    const auto bytes = archive.read(index_size);
+    if ((bytes.size() != index_size) || !setme.parse(bytes))
+    {
+        qWarning() << "Unable to read seekable archive index";
+        return false;
+    }
+    return true;
+}
+
+/***
+****
+***/
+
+void
+SeekableArchive::Reader::feed(char const* buf,
+                              size_t buflen,
+                              PayloadFunc const& on_payload,
+                              BlockEndFunc const& on_block_end)
+{
+    while (buflen > 0)
+    {
+        switch (state_)
+        {
+            case State::HEADER:
+            case State::BLOCK_HEADER:
+            {
+                const auto want = state_ == State::HEADER ? HEADER_SIZE : BLOCK_HEADER_SIZE;
+                const auto n = std::min(buflen, want - size_t(pending_.size()));
+                pending_.append(buf, int(n));
+                buf += n;
+                buflen -= n;
+                if (size_t(pending_.size()) < want)
+                    break;
+
+                if (state_ == State::HEADER)
+                {
+                    state_ = SeekableArchive::is_seekable(pending_.constData(), size_t(pending_.size())) ? State::BLOCK_HEADER : State::NOT_SEEKABLE;
+                }
+                else
+                {
+                    payload_left_ = qFromLittleEndian<quint32>(reinterpret_cast<uchar const*>(pending_.constData()));
+                    state_ = payload_left_ ? State::PAYLOAD : State::INDEX;
+                }
+                pending_.clear();
+                break;
+            }
+
+            case State::PAYLOAD:
+            {
+                const auto n = std::min(buflen, payload_left_);
+                if (on_payload)
+                    on_payload(buf, n);
+                buf += n;
+                buflen -= n;
+                payload_left_ -= n;
+                if (!payload_left_)
+                {
+                    state_ = State::BLOCK_HEADER;
+                    if (on_block_end)
+                        on_block_end();
+                }
+                break;
+            }
+
+            case State::INDEX:
+                if (pending_.size() + qint64(buflen) > INDEX_SIZE_MAX + qint64(FOOTER_SIZE))
+                {
+                    qWarning() << "Seekable archive index is too big";
+                    pending_.clear();
+                    state_ = State::FAILED;
+                    return;
+                }
+                pending_.append(buf, int(buflen));
+                buflen = 0;
+                break;
+
+            case State::NOT_SEEKABLE:
+            case State::FAILED:
+                return;
+        }
+    }
+}
+
+size_t
+SeekableArchive::Reader::skippable() const
+{
+    switch (state_)
+    {
+        case State::PAYLOAD:
+            return payload_left_;
+
+        case State::NOT_SEEKABLE:
+        case State::FAILED:
+            return SIZE_MAX;
+
+        default:
+            return 0;
+    }
+}
+
+void
+SeekableArchive::Reader::skip(size_t len)
+{
+    if (state_ != State::PAYLOAD)
+        return;
+
+    payload_left_ -= std::min(len, payload_left_);
+    if (!payload_left_)
+        state_ = State::BLOCK_HEADER;
+}
+
+bool
+SeekableArchive::Reader::is_seekable() const
+{
+    return (state_ != State::HEADER) && (state_ != State::NOT_SEEKABLE);
+}
+
+bool
+SeekableArchive::Reader::failed() const
+{
+    return state_ == State::FAILED;
+}
+
+bool
+SeekableArchive::Reader::at_end() const
+{
+    if ((state_ != State::INDEX) || (size_t(pending_.size()) < FOOTER_SIZE))
+        return false;
+
+    const auto index_size = parse_footer(pending_.constData() + pending_.size() - FOOTER_SIZE);
+    return index_size == pending_.size() - qint64(FOOTER_SIZE);
+}
+
+QByteArray
+SeekableArchive::Reader::index() const
+{
+    return at_end() ? pending_.left(pending_.size() - int(FOOTER_SIZE)) : QByteArray();
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <cstddef> // size_t
+#include <functional>
+#include <vector>
+
+class QIODevice;
+
+/**
+ * A container for block-compressed archives that can be read
+ * from the middle, e.g. to restore or list a single file.
+ *
+ * It starts with an 8-byte magic string. Then comes each compressed
+ * block, i.e. a standalone .xz stream or zstd frame of the tar, as
+ * a little-endian uint32 length followed by that many bytes. A zero
+ * length ends the blocks. After that is the index, then a 16-byte
+ * footer: the index's size as a little-endian uint64 and another
+ * magic string, so the index can be found from the end of the file.
+ *
+ * The blocks' payloads, concatenated, are a valid .xz or .zst file.
+ */
+struct SeekableArchive
+{
+    static constexpr size_t HEADER_SIZE {8};
+    static constexpr size_t BLOCK_HEADER_SIZE {4};
+    static constexpr size_t FOOTER_SIZE {16};
+
+    // keeper stores a copy of the index beside the archive, with this suffix
+    static QString const INDEX_SUFFIX;
+
+    struct Block
+    {
+        quint64 offset; // where the block's payload starts in the container
+        quint32 size; // the payload's size
+        quint64 raw_offset; // where the block starts in the tar
+        quint32 raw_size;
+    };
+
+    struct Entry
+    {
+        QByteArray path;
+        quint32 block; // the block that the entry starts in
+        quint32 offset; // where it starts in that block's tar
+        quint64 size; // its size in the tar, including its headers and padding
+    };
+
+    struct Index
+    {
+        QVector<Block> blocks;
+        QVector<Entry> entries; // in archive order
+
+        QByteArray serialize() const;
+        bool parse(QByteArray const& bytes);
+
+        // returns the entry for `path', or nullptr if there isn't one
+        Entry const* find(QByteArray const& path) const;
+    };
+
+    // true if `buf' starts with a seekable archive's header
+    static bool is_seekable(char const* buf, size_t buflen);
+
+    // the parts of a container, for writers
+    static void append_header(std::vector<char>& fillme);
+    static void append_block(std::vector<char>& fillme, char const* payload, size_t len);
+    static void append_index(std::vector<char>& fillme, Index const& index);
+
+    // reads just the index of a seekable archive, via its footer
+    static bool read_index(QIODevice& archive, Index& setme);
+
+    /**
+     * Splits a seekable archive that's read from front to back
+     * into its blocks' payloads and its index.
+     *
+     * If the input isn't a seekable archive, it's ignored.
+     */
+    class Reader
+    {
+    public:
+        // called with each part of the blocks' payloads, in order
+        using PayloadFunc = std::function<void(char const* payload, size_t len)>;
+        // called after the last part of each block's payload
+        using BlockEndFunc = std::function<void()>;
+
+        void feed(char const* buf, size_t buflen,
+                  PayloadFunc const& on_payload = PayloadFunc(),
+                  BlockEndFunc const& on_block_end = BlockEndFunc());
+
+        // how many of the next bytes are payload that it doesn't need to
+        // see, e.g. because they're being relayed without being read
+        size_t skippable() const;
+        void skip(size_t len); // len must be no more than skippable()
+
+        bool is_seekable() const; // false until the whole header is read
+        bool failed() const;
+        bool at_end() const; // true if the whole index and footer were read
+
+        // the index's bytes, once at_end() is true
+        QByteArray index() const;
+
+    private:
+        enum class State { HEADER, BLOCK_HEADER, PAYLOAD, INDEX, NOT_SEEKABLE, FAILED };
+        State state_ {State::HEADER};
+        QByteArray pending_; // a partial header, or the index and footer
+        size_t payload_left_ {};
+    };
+};
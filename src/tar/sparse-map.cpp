@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+// for off_t and lseek() on 32-bit systems; see tar-creator.cpp
+#define _FILE_OFFSET_BITS 64
+
+#include "tar/sparse-map.h"
+
+#include <unistd.h>
+
+#include <algorithm> // std::min()
+#include <cerrno>
+
+namespace
+{
+    // each region costs a line or two in the map, so
+    // don't bother unless we skip at least this much
+    constexpr int64_t MIN_HOLE_BYTES {1024*64};
+
+    // st_blocks is always in 512-byte units
+    constexpr int64_t STAT_BLOCK_SIZE {512};
+}
+
+int64_t
+SparseMap::data_size() const
+{
+    int64_t n {};
+    for (auto const& region : regions)
+        n += region.length;
+    return n;
+}
+
+bool
+SparseMap::maybe_sparse(struct stat const& st)
+{
+    return S_ISREG(st.st_mode)
+        && (int64_t(st.st_blocks) * STAT_BLOCK_SIZE + MIN_HOLE_BYTES <= int64_t(st.st_size));
+}
+
+bool
+SparseMap::find(int fd, struct stat const& st, SparseMap& setme)
+{
+    if (!maybe_sparse(st))
+        return false;
+
+    SparseMap map;
+    const auto size = int64_t(st.st_size);
+    bool ok = true;
+    for (int64_t pos {}; pos < size; )
+    {
+        const auto data = int64_t(lseek(fd, off_t(pos), SEEK_DATA));
+        if (data == -1) {
+            // ENXIO means it's a hole from here to the end;
+            // anything else means the filesystem can't say
+            ok = errno == ENXIO;
+            break;
+        }
+        if (data >= size)
+            break;
+
+        const auto hole = int64_t(lseek(fd, off_t(data), SEEK_HOLE));
+        if (hole == -1) {
+            ok = false;
+            break;
+        }
+        const auto end = std::min(hole, size);
+
+        map.regions.push_back(Region{data, end - data});
+        pos = end;
+    }
+
+    // put the file back the way we found it for whoever reads it next
+    lseek(fd, 0, SEEK_SET);
+
+    if (!ok || (size - map.data_size() < MIN_HOLE_BYTES))
+        return false;
+
+    // mark the end of the file if it ends in a hole
+    if (map.regions.empty() || (map.regions.back().offset + map.regions.back().length < size))
+        map.regions.push_back(Region{size, 0});
+
+    setme = map;
+    return true;
+}
+
+std::string
+SparseMap::to_string() const
+{
+    std::string str = std::to_string(regions.size()) + '\n';
+    for (auto const& region : regions)
+        str += std::to_string(region.offset) + '\n' + std::to_string(region.length) + '\n';
+    return str;
+}
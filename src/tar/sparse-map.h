@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstdint> // int64_t
+#include <string>
+#include <vector>
+
+/**
+ * The data regions of a sparse file, e.g. a VM image or a
+ * preallocated database. Anything between the regions is a hole
+ * that reads back as zeroes and needn't be archived.
+ */
+struct SparseMap
+{
+    // int64_t rather than off_t, whose size depends on _FILE_OFFSET_BITS
+    struct Region
+    {
+        int64_t offset;
+        int64_t length;
+    };
+
+    // in order. If the file ends in a hole, the last
+    // region is an empty one at the end of the file.
+    std::vector<Region> regions;
+
+    // how many bytes are in the regions
+    int64_t data_size() const;
+
+    // Finds the data regions of an open file with SEEK_DATA and SEEK_HOLE.
+    // Returns false if the file isn't sparse enough to be worth it,
+    // or if its filesystem can't tell us where its holes are.
+    static bool find(int fd, struct stat const& st, SparseMap& setme);
+
+    // true if `st' has fewer blocks than its size needs,
+    // so that it's worth opening the file to call find()
+    static bool maybe_sparse(struct stat const& st);
+
+    // the map in GNU tar's 1.0 sparse format, which goes before
+    // the data: the number of regions, then each region's offset
+    // and length, all in decimal on their own lines
+    std::string to_string() const;
+};
@@ -17,7 +17,15 @@
  *     Charles Kerr <charles.kerr@canonical.com>
  */
 
-#include "tar/tar-creator.h"
+#include "helper/progress-channel.h"
+#include "helper/stream-trailer.h"
+#include "tar/catalog.h"
+#include "tar/codec.h"
+#include "tar/directory-walker.h"
+#include "tar/hash-cache.h"
+#include "tar/seekable-archive.h"
+#include "tar/tar-pipeline.h"
+#include "tar/tar-sender.h"
 #include "qdbus-stubs/dbus-types.h"
 #include "qdbus-stubs/keeper_helper_interface.h"
 
@@ -27,21 +35,28 @@
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
 #include <QDBusUnixFileDescriptor>
+#include <QDir>
 #include <QFile>
 #include <QLocalSocket>
+#include <QThread>
 
+#include <poll.h>
 #include <sys/select.h>
 #include <unistd.h>
 
+#include <algorithm> // std::min()
+#include <cerrno>
 #include <cstdio> // fileno()
 #include <ctime>
 #include <iostream>
+#include <functional> // std::bind()
+#include <memory> // shared_ptr, unique_ptr
 #include <type_traits>
 
 namespace
 {
 
-QStringList
+PathTable
 get_filenames_from_file(FILE * fp)
 {
     // don't wait forever...
@@ -54,7 +69,7 @@ get_filenames_from_file(FILE * fp)
     select(1, &readfds, NULL, NULL, &tv);
     if (!FD_ISSET(fd, &readfds)) {
         qWarning() << "Couldn't read files from stdin";
-        return QStringList();
+        return PathTable();
     }
 
     // read the file list
@@ -63,16 +78,36 @@ get_filenames_from_file(FILE * fp)
     auto filenames_raw = file.readAll();
     file.close();
 
-    // massage into a QStringList
-    QStringList filenames;
-    for (const auto& token : filenames_raw.split('\0'))
-        if (!token.isEmpty())
-            filenames.append(QString::fromUtf8(token));
+    // split it into a PathTable without making a string per file
+    PathTable filenames;
+    for (int begin=0, end; begin<filenames_raw.size(); begin=end+1) {
+        end = filenames_raw.indexOf('\0', begin);
+        if (end == -1)
+            end = filenames_raw.size();
+        if (end > begin)
+            filenames.append(filenames_raw.constData() + begin, size_t(end - begin));
+    }
+    filenames.squeeze();
 
     return filenames;
 }
 
-std::tuple<bool,QString,QStringList>
+struct Args
+{
+    Codec codec;
+    bool stream {};
+    bool store_incompressible {};
+    bool find_duplicates {};
+    bool seekable {};
+    bool incremental {};
+    int n_threads {1};
+    QString bus_path;
+    QString directory; // the directory being backed up
+    PathTable filenames;
+    bool filenames_complete {true}; // false if some of `directory' couldn't be read
+};
+
+Args
 parse_args(QCoreApplication& app)
 {
     // parse the command line
@@ -88,41 +123,162 @@ parse_args(QCoreApplication& app)
         "as a separator. If that program is GNU find, for example, the -print0 option does\n"
         "this for you.\n"
         "\n"
-        "Helper usage: find /your/data/path -print0 | "  APP_NAME " -a /bus/path"
+        "Helper usage: find /your/data/path -print0 | "  APP_NAME " -a /bus/path\n"
+        "          or: " APP_NAME " -a /bus/path -d /your/data/path"
     );
     QCommandLineOption compress_option{
         QStringList() << "c" << "compress",
         QStringLiteral("Compress files before adding to archive")
     };
     parser.addOption(compress_option);
+    QCommandLineOption codec_option{
+        QStringList() << "codec",
+        QStringLiteral("Compress with the given codec and optional level, e.g. 'xz', 'zstd', or 'zstd:19'. Implies --compress"),
+        QStringLiteral("codec")
+    };
+    parser.addOption(codec_option);
     QCommandLineOption bus_path_option{
         QStringList() << "a" << "bus-path",
         QStringLiteral("Keeper service's DBus path"),
         QStringLiteral("bus-path")
     };
     parser.addOption(bus_path_option);
+    QCommandLineOption stream_option{
+        QStringList() << "s" << "stream",
+        QStringLiteral("Stream the archive to Keeper without calculating its size first")
+    };
+    parser.addOption(stream_option);
+    QCommandLineOption threads_option{
+        QStringList() << "j" << "threads",
+        QStringLiteral("Number of threads to compress with, or 0 for one per CPU core"),
+        QStringLiteral("threads"),
+        QStringLiteral("1")
+    };
+    parser.addOption(threads_option);
+    QCommandLineOption store_incompressible_option{
+        QStringList() << "store-incompressible",
+        QStringLiteral("Don't spend time compressing files that look already compressed, e.g. photos and videos")
+    };
+    parser.addOption(store_incompressible_option);
+    QCommandLineOption dedupe_option{
+        QStringList() << "dedupe",
+        QStringLiteral("Store files with identical contents only once. They are restored as hard links to a single file")
+    };
+    parser.addOption(dedupe_option);
+    QCommandLineOption seekable_option{
+        QStringList() << "seekable",
+        QStringLiteral("Compress in independent blocks and add an index, so that single files can be restored without reading the whole archive")
+    };
+    parser.addOption(seekable_option);
+    QCommandLineOption incremental_option{
+        QStringList() << "incremental",
+        QStringLiteral("Only archive the files that changed since this directory's last backup, plus a list of the files that were deleted")
+    };
+    parser.addOption(incremental_option);
+    QCommandLineOption directory_option{
+        QStringList() << "d" << "directory",
+        QStringLiteral("Archive the files under this directory instead of reading filenames from the standard input"),
+        QStringLiteral("directory")
+    };
+    parser.addOption(directory_option);
     parser.process(app);
-    const bool compress = parser.isSet(compress_option);
-    const auto bus_path = parser.value(bus_path_option);
+
+    Args args;
+    args.codec = Codec{parser.isSet(compress_option) ? Codec::Type::XZ : Codec::Type::NONE};
+    if (parser.isSet(codec_option) && !Codec::parse(parser.value(codec_option), &args.codec)) {
+        std::cerr << "Invalid argument: --codec" << std::endl;
+        parser.showHelp(EXIT_FAILURE);
+    }
+    args.stream = parser.isSet(stream_option);
+    args.store_incompressible = parser.isSet(store_incompressible_option);
+    args.find_duplicates = parser.isSet(dedupe_option);
+    args.seekable = parser.isSet(seekable_option);
+    args.incremental = parser.isSet(incremental_option);
+    bool threads_ok {};
+    args.n_threads = parser.value(threads_option).toInt(&threads_ok);
+    if (!threads_ok || (args.n_threads < 0)) {
+        std::cerr << "Invalid argument: --threads" << std::endl;
+        parser.showHelp(EXIT_FAILURE);
+    }
+    if (args.n_threads == 0)
+        args.n_threads = QThread::idealThreadCount();
+    args.bus_path = parser.value(bus_path_option);
 
     // gotta have the bus path
-    if (bus_path.isEmpty()) {
+    if (args.bus_path.isEmpty()) {
         std::cerr << "Missing required argument: --bus-path" << std::endl;
         parser.showHelp(EXIT_FAILURE);
     }
 
     // gotta have files
-    const auto filenames = get_filenames_from_file(stdin);
-    for (const auto& filename : filenames)
-        qDebug() << "filename:" << filename;
+    args.directory = parser.isSet(directory_option) ? parser.value(directory_option) : QDir::currentPath();
+    if (parser.isSet(directory_option))
+        args.filenames = DirectoryWalker::find_files(args.directory, 0, &args.filenames_complete);
+    else
+        args.filenames = get_filenames_from_file(stdin);
+    for (const auto& filename : args.filenames)
+        qDebug() << "filename:" << filename.constData();
 
-    return std::make_tuple(compress, bus_path, filenames);
+    return args;
 }
 
-QDBusUnixFileDescriptor
-get_socket_from_keeper(size_t n_bytes, const QString& bus_path)
+// Narrows args.filenames down to the files that changed since the last
+// backup of args.directory, and sets `deleted' to the ones that are gone.
+// Also writes the pending catalog that keeper commits once this backup
+// is stored. If there's no usable last backup, this is a full backup.
+// Returns false if the pending catalog couldn't be saved.
+bool
+prepare_incremental_backup(Args& args, PathTable& deleted, Catalog& pending, HashCache* hash_cache)
 {
-    QDBusUnixFileDescriptor ret;
+    Catalog previous;
+    const bool has_base = previous.load(Catalog::path_for(args.directory)) && previous.can_be_base();
+    if (!has_base)
+        qDebug() << "no backup to be incremental to; archiving all the files";
+
+    PathTable changed;
+    pending = Catalog::scan(args.filenames, has_base ? &previous : nullptr, changed, deleted, hash_cache);
+
+    // without a pending catalog, keeper won't know this backup's
+    // base, so it mustn't be an incremental one
+    if (!pending.save(Catalog::pending_path_for(args.directory))) {
+        qWarning() << "Unable to save the catalog; archiving all the files";
+        deleted = PathTable{};
+        return false;
+    }
+
+    if (has_base) {
+        qDebug() << "incremental to" << previous.dir_name << ':'
+                 << changed.size() << "of" << args.filenames.size() << "files changed,"
+                 << deleted.size() << "deleted";
+        args.filenames = changed;
+    }
+    return true;
+}
+
+// Files that couldn't be read in full were archived with zeroes, but
+// the pending catalog says they're backed up; drop them from it so that
+// the next backup archives them again.
+bool
+forget_incomplete_files(Args const& args, Catalog& pending, PathTable const& incomplete)
+{
+    if (incomplete.empty())
+        return true;
+
+    qWarning() << incomplete.size() << "files couldn't be read in full; they'll be archived again next time";
+    pending.remove(incomplete);
+    return pending.save(Catalog::pending_path_for(args.directory));
+}
+
+struct KeeperSockets
+{
+    QDBusUnixFileDescriptor data; // where to write the archive
+    QDBusUnixFileDescriptor progress; // if `data' is storage's own socket, where to tell keeper about it
+};
+
+KeeperSockets
+get_sockets_from_keeper(ssize_t n_bytes, const QString& bus_path)
+{
+    KeeperSockets ret;
 
     qDebug() << "asking keeper for a socket";
     DBusInterfaceKeeperHelper helperInterface(
@@ -130,50 +286,138 @@ get_socket_from_keeper(size_t n_bytes, const QString& bus_path)
         bus_path,
         QDBusConnection::sessionBus()
     );
-    auto fd_reply = helperInterface.StartBackup(n_bytes);
+
+    // if keeper doesn't need to see the archive, write it straight to storage
+    if (n_bytes >= 0) {
+        auto direct_reply = helperInterface.StartBackupDirect(quint64(n_bytes));
+        direct_reply.waitForFinished();
+        if (!direct_reply.isError()) {
+            ret.data = direct_reply.argumentAt<0>();
+            ret.progress = direct_reply.argumentAt<1>();
+            return ret;
+        }
+        const auto error_type = direct_reply.error().type();
+        if ((error_type != QDBusError::NotSupported) && (error_type != QDBusError::UnknownMethod)) {
+            qCritical("Call to '%s.StartBackupDirect() at '%s' call failed: %s",
+                DBusTypes::KEEPER_SERVICE,
+                qPrintable(bus_path),
+                qPrintable(direct_reply.error().message())
+            );
+            return ret;
+        }
+        qDebug() << "sending the archive through keeper:" << direct_reply.error().message();
+    }
+
+    // a negative size means we don't know it yet, so stream it
+    const bool stream = n_bytes < 0;
+    auto fd_reply = stream
+        ? helperInterface.StartBackupStream()
+        : helperInterface.StartBackup(quint64(n_bytes));
     fd_reply.waitForFinished();
     if (fd_reply.isError()) {
-        qCritical("Call to '%s.StartBackup() at '%s' call failed: %s",
+        qCritical("Call to '%s.%s() at '%s' call failed: %s",
             DBusTypes::KEEPER_SERVICE,
+            stream ? "StartBackupStream" : "StartBackup",
             qPrintable(bus_path),
             qPrintable(fd_reply.error().message())
         );
     } else {
-        ret = fd_reply.value();
+        ret.data = fd_reply.value();
     }
 
     return ret;
 }
 
-ssize_t
-send_tar_to_keeper(TarCreator& tar_creator, int fd)
+bool
+write_all(int fd, const char* walk, size_t n_left, TarPipeline::StageStats& stalls)
 {
-    ssize_t n_sent {};
-
-    // send the tar to the socket piece by piece
-    std::vector<char> buf;
-    while(tar_creator.step(buf)) {
-        const char* walk {buf.data()};
-        auto n_left = size_t{buf.size()};
-        while(n_left > 0) {
-            const auto n_written_in = write(fd, walk, n_left);
-            if (n_written_in > 0) {
-                const auto n_written = size_t(n_written_in);
-                walk += n_written;
-                n_sent += n_written;
-                n_left -= n_written;
-            } else if (errno == EAGAIN) {
-                QThread::msleep(100);
-            } else {
-                qCritical("error sending binary blob to Keeper: %s", strerror(errno));
-                return -1;
-            }
+    while(n_left > 0) {
+        const auto n_written_in = write(fd, walk, n_left);
+        if (n_written_in > 0) {
+            const auto n_written = size_t(n_written_in);
+            walk += n_written;
+            n_left -= n_written;
+        } else if ((errno == EAGAIN) || (errno == EINTR)) {
+            // keeper's sockets are nonblocking, so wait for room instead of spinning
+            if (!wait_for_fd(fd, POLLOUT, stalls))
+                return false;
+        } else {
+            qCritical("error sending binary blob to Keeper: %s", strerror(errno));
+            return false;
         }
     }
 
-    return n_sent;
+    return true;
+}
+
+bool
+send_trailer_to_keeper(ssize_t n_sent, int fd, TarPipeline::StageStats& stalls)
+{
+    const auto trailer = StreamTrailer::create(quint64(n_sent));
+    return write_all(fd, trailer.constData(), size_t(trailer.size()), stalls);
 }
 
+// When we write straight to storage, keeper doesn't see the archive,
+// so tell it how much we've sent and the parts of it that it keeps
+class ProgressReporter
+{
+public:
+
+    ProgressReporter(int fd, TarPipeline::StageStats& stalls):
+        fd_{fd},
+        stalls_(stalls)
+    {
+    }
+
+    // a TarSender / TarPipeline observer
+    void on_sent(char const* buf, size_t len)
+    {
+        if (buf) {
+            if (head_.size() < HEAD_SIZE_MAX)
+                head_.append(buf, std::min(int(len), HEAD_SIZE_MAX - head_.size()));
+            index_reader_.feed(buf, len);
+        } else {
+            index_reader_.skip(len);
+        }
+        n_sent_ += len;
+
+        if (n_sent_ - n_reported_ < REPORT_INTERVAL)
+            return;
+
+        // Don't hold up the archive if keeper is slow to read these;
+        // each one replaces the one before, so just try again later
+        const auto record = ProgressChannel::create_sent(n_sent_);
+        const auto n_written = write(fd_, record.constData(), size_t(record.size()));
+        if (n_written <= 0)
+            return;
+        if (n_written < record.size())
+            write_all(fd_, record.constData() + n_written, size_t(record.size() - n_written), stalls_);
+        n_reported_ = n_sent_;
+    }
+
+    bool finish()
+    {
+        auto records = ProgressChannel::create_head(head_);
+        const auto index = index_reader_.index();
+        if (!index.isEmpty())
+            records += ProgressChannel::create_index(index);
+        records += ProgressChannel::create_sent(n_sent_); // must be last
+        return write_all(fd_, records.constData(), size_t(records.size()), stalls_);
+    }
+
+private:
+
+    static constexpr quint64 REPORT_INTERVAL {1024*1024};
+    static constexpr int HEAD_SIZE_MAX {int(Codec::HEAD_SIZE_MAX)};
+
+    const int fd_;
+    TarPipeline::StageStats& stalls_;
+    QByteArray head_;
+    SeekableArchive::Reader index_reader_;
+    quint64 n_sent_ {};
+    quint64 n_reported_ {};
+};
+
 } // anonymous namespace
 
 int
@@ -182,30 +426,117 @@ main(int argc, char **argv)
     QCoreApplication app(argc, argv);
 
     // get the inputs
-    bool compress;
-    QString bus_path;
-    QStringList filenames;
-    std::tie(compress, bus_path, filenames) = parse_args(app);
-
-    // build the creator
-    TarCreator tar_creator{filenames, compress};
-    const auto n_bytes_in = tar_creator.calculate_size();
-    if (n_bytes_in < 0) {
-        qCritical("Unable to estimate tar size");
-        return EXIT_FAILURE;
+    auto args = parse_args(app);
+
+    // a partial file list would make the unread files look deleted,
+    // so archive what was found, but without a catalog to build on
+    if (args.incremental && !args.filenames_complete) {
+        qWarning() << "Unable to read all of" << args.directory << "; archiving what was found in full";
+        args.incremental = false;
+    }
+
+    // remember the files' hashes so that next time we needn't read them
+    std::shared_ptr<HashCache> hash_cache;
+    if (args.incremental || args.find_duplicates) {
+        hash_cache = std::make_shared<HashCache>();
+        hash_cache->open(HashCache::default_path());
+    }
+
+    PathTable deleted;
+    Catalog pending;
+    const bool has_pending = args.incremental && prepare_incremental_backup(args, deleted, pending, hash_cache.get());
+
+    // build the creator.
+    // uncompressed archives don't need libarchive, so use
+    // TarSender to send the file contents without copying them
+    qDebug() << "compressing with" << args.codec.to_string();
+    const bool zero_copy = args.codec.type() == Codec::Type::NONE;
+    TarSender tar_sender{args.filenames};
+    tar_sender.set_find_duplicates(args.find_duplicates);
+    TarPipeline tar_pipeline{args.filenames, args.codec, args.n_threads};
+    tar_pipeline.set_store_incompressible(args.store_incompressible);
+    tar_pipeline.set_find_duplicates(args.find_duplicates);
+    tar_pipeline.set_seekable(args.seekable);
+    if (args.find_duplicates) {
+        tar_sender.set_hash_cache(hash_cache);
+        tar_pipeline.set_hash_cache(hash_cache);
+    }
+    if (!deleted.empty()) {
+        const auto list = Catalog::create_deletion_list(deleted);
+        tar_sender.add_memory_file(Catalog::DELETION_LIST_NAME, list);
+        tar_pipeline.add_memory_file(Catalog::DELETION_LIST_NAME, list);
+    }
+    ssize_t n_bytes {-1};
+    if (!args.stream) {
+        n_bytes = zero_copy ? tar_sender.calculate_size() : tar_pipeline.calculate_size();
+        if (n_bytes < 0) {
+            qCritical("Unable to estimate tar size");
+            return EXIT_FAILURE;
+        }
+        qDebug() << "tar size should be" << n_bytes;
     }
-    const auto n_bytes = size_t(n_bytes_in);
-    qDebug() << "tar size should be" << n_bytes;
 
     // do it!
-    const auto qfd = get_socket_from_keeper(n_bytes, bus_path);
-    if (!qfd.isValid()) {
+    const auto sockets = get_sockets_from_keeper(n_bytes, args.bus_path);
+    if (!sockets.data.isValid()) {
         qCritical() << "Can't proceed without a socket from keeper";
         return EXIT_FAILURE;
     }
-    const auto fd = qfd.fileDescriptor();
-    const auto n_sent = send_tar_to_keeper(tar_creator, fd);
+    const auto fd = sockets.data.fileDescriptor();
+    TarPipeline::StageStats control_stalls; // the trailer and progress records
+    std::unique_ptr<ProgressReporter> progress;
+    if (sockets.progress.isValid()) {
+        qDebug() << "writing straight to storage";
+        progress.reset(new ProgressReporter(sockets.progress.fileDescriptor(), control_stalls));
+        const auto observer = std::bind(&ProgressReporter::on_sent, progress.get(), std::placeholders::_1, std::placeholders::_2);
+        tar_sender.set_observer(observer);
+        tar_pipeline.set_observer(observer);
+    }
+    const auto n_sent = zero_copy ? tar_sender.send(fd) : tar_pipeline.send(fd);
     qDebug() << "tar size was" << n_sent;
+    const auto links = zero_copy ? tar_sender.stats().links : tar_pipeline.stats().creator.links;
+    qDebug() << "linked" << links.n_hardlinks << "hard links and" << links.n_duplicates << "duplicates,"
+             << "saving" << links.n_bytes_saved << "bytes";
+    if (zero_copy) {
+        const auto stats = tar_sender.stats();
+        qDebug() << "sent" << stats.n_bytes_sendfile << "bytes with sendfile(),"
+                 << "copied" << stats.n_bytes_copied << "bytes";
+        qDebug() << "sender (waiting for socket) stalled" << stats.socket.n_stalls << "times for" << stats.socket.stall_usec/1000 << "msec";
+    } else {
+        const auto stats = tar_pipeline.stats();
+        qDebug() << "stored" << stats.creator.n_stored_files << "files," << stats.creator.n_stored_bytes << "bytes;"
+                 << "compressed" << stats.creator.n_compressed_files << "files," << stats.creator.n_compressed_bytes << "bytes";
+        if (stats.creator.n_changed_files > 0)
+            qWarning() << stats.creator.n_changed_files << "files changed while being archived";
+        const auto log_stage = [](char const* name, TarPipeline::StageStats const& stage){
+            qDebug() << name << "stalled" << stage.n_stalls << "times for" << stage.stall_usec/1000 << "msec";
+        };
+        log_stage("reader (waiting for disk)", stats.reader_input);
+        log_stage("reader (waiting for compressor)", stats.reader);
+        log_stage("compressor (waiting for reader)", stats.compressor_input);
+        log_stage("compressor (waiting for sender)", stats.compressor_output);
+        log_stage("sender (waiting for compressor)", stats.sender_input);
+        log_stage("sender (waiting for socket)", stats.sender_output);
+    }
+    if (args.stream && ((n_sent < 0) || !send_trailer_to_keeper(n_sent, fd, control_stalls)))
+        return EXIT_FAILURE;
+    if (progress && ((n_sent < 0) || !progress->finish()))
+        return EXIT_FAILURE;
+    if (control_stalls.n_stalls)
+        qDebug() << "waited" << control_stalls.n_stalls << "times for" << control_stalls.stall_usec/1000 << "msec to tell Keeper about the archive";
+
+    const auto incomplete = zero_copy ? tar_sender.stats().incomplete : tar_pipeline.stats().creator.incomplete;
+    if (has_pending && (n_sent >= 0) && !forget_incomplete_files(args, pending, incomplete)) {
+        qCritical() << "Unable to update the catalog";
+        return EXIT_FAILURE;
+    }
+
+    if (hash_cache && (n_sent >= 0)) {
+        const auto stats = hash_cache->stats();
+        qDebug() << "hash cache had" << stats.n_hits << "files;"
+                 << "hashed" << stats.n_misses << "files," << stats.n_bytes_hashed << "bytes";
+        hash_cache->save();
+    }
 
     return EXIT_SUCCESS;
 }
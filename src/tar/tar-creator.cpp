@@ -29,6 +29,11 @@
  */
 #define _FILE_OFFSET_BITS 64
 
+#include "tar/block-compressor.h"
+#include "tar/entropy-classifier.h"
+#include "tar/link-finder.h"
+#include "tar/seekable-archive.h"
+#include "tar/sparse-map.h"
 #include "tar/tar-creator.h"
 
 #include <archive.h>
@@ -39,15 +44,178 @@
 #include <QSharedPointer>
 #include <QString>
 
+#include <fcntl.h> // AT_FDCWD
+#include <sys/stat.h>
+#include <sys/sysmacros.h> // makedev()
+#include <unistd.h> // close()
+
+#include <algorithm> // std::min(), std::upper_bound()
+#include <cerrno>
+#include <cstdint> // int64_t
+#include <cstring> // strerror()
+#include <ctime> // time()
 #include <memory>
+#include <utility> // std::pair
+#include <vector>
+
+namespace
+{
+    // The parts of struct stat that go into an archive entry.
+    // These are gathered once, up front, so that calculate_size()
+    // and step() agree even if files change in between.
+    struct FileInfo
+    {
+        dev_t dev {};
+        ino_t ino {};
+        mode_t mode {};
+        nlink_t nlink {};
+        uid_t uid {};
+        gid_t gid {};
+        off_t size {};
+        blkcnt_t blocks {}; // to spot sparse files
+        struct timespec mtime {};
+        std::shared_ptr<SparseMap> sparse; // only set if the file has holes
+        bool linked {}; // a hard link to an earlier file, with no contents of its own
+        size_t link_target {}; // the index of that earlier file
+
+        void set(struct stat const& st)
+        {
+            dev = st.st_dev;
+            ino = st.st_ino;
+            mode = st.st_mode;
+            nlink = st.st_nlink;
+            uid = st.st_uid;
+            gid = st.st_gid;
+            size = st.st_size;
+            blocks = st.st_blocks;
+            mtime = st.st_mtim;
+        }
+
+        struct stat to_stat() const
+        {
+            struct stat st {};
+            st.st_dev = dev;
+            st.st_ino = ino;
+            st.st_mode = mode;
+            st.st_nlink = nlink;
+            st.st_uid = uid;
+            st.st_gid = gid;
+            st.st_size = size;
+            st.st_blocks = blocks;
+            st.st_mtim = mtime;
+            return st;
+        }
+
+        // true if `st' looks like the same file contents we saw before
+        bool matches(struct stat const& st) const
+        {
+            return (size == st.st_size)
+                && (mtime.tv_sec == st.st_mtim.tv_sec)
+                && (mtime.tv_nsec == st.st_mtim.tv_nsec);
+        }
+    };
+
+#ifdef STATX_BASIC_STATS
+    struct timespec to_timespec(struct statx_timestamp const& ts)
+    {
+        struct timespec ret {};
+        ret.tv_sec = ts.tv_sec;
+        ret.tv_nsec = ts.tv_nsec;
+        return ret;
+    }
+#endif
+
+    bool read_file_info(QByteArray const& filename, FileInfo& setme)
+    {
+#ifdef STATX_BASIC_STATS
+        // only ask for what goes into the archive entry, and
+        // don't make network filesystems sync just to answer us
+        static constexpr unsigned int mask = STATX_TYPE | STATX_MODE | STATX_NLINK
+                                           | STATX_UID | STATX_GID | STATX_INO | STATX_SIZE
+                                           | STATX_BLOCKS | STATX_MTIME;
+        struct statx stx;
+        if (statx(AT_FDCWD, filename.constData(), AT_STATX_DONT_SYNC, mask, &stx) == 0)
+        {
+            setme.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            setme.ino = stx.stx_ino;
+            setme.mode = stx.stx_mode;
+            setme.nlink = stx.stx_nlink;
+            setme.uid = stx.stx_uid;
+            setme.gid = stx.stx_gid;
+            setme.size = off_t(stx.stx_size);
+            setme.blocks = blkcnt_t(stx.stx_blocks);
+            setme.mtime = to_timespec(stx.stx_mtime);
+            return true;
+        }
+        if (errno != ENOSYS) // older kernel? fall back to stat()
+            return false;
+#endif
+
+        struct stat st;
+        if (stat(filename.constData(), &st) == -1)
+            return false;
+        setme.set(st);
+        return true;
+    }
+
+    std::shared_ptr<SparseMap> find_sparse_map(QByteArray const& filename, FileInfo const& info)
+    {
+        std::shared_ptr<SparseMap> map;
+
+        const auto st = info.to_stat();
+        if (!SparseMap::maybe_sparse(st))
+            return map;
+
+        const auto fd = open(filename.constData(), O_RDONLY|O_CLOEXEC);
+        if (fd != -1) {
+            map.reset(new SparseMap);
+            if (!SparseMap::find(fd, st, *map))
+                map.reset();
+            close(fd);
+        }
+        return map;
+    }
+
+    // libarchive skips the holes in a sparse entry's data,
+    // so it doesn't matter what we pass it for them
+    constexpr qint64 ZEROES_SIZE {1024*64};
+    const char zeroes[ZEROES_SIZE] {};
+
+    // Reads the next part of `file' like QFile::read(), but if `map' says
+    // it's a hole, seeks past it and points `data' at zeroes instead.
+    qint64 read_file(QFile& file, SparseMap const* map, char* buf, qint64 maxlen, const char** data)
+    {
+        if (map != nullptr)
+        {
+            // find the first region that ends after pos
+            const auto pos = int64_t(file.pos());
+            const auto& regions = map->regions;
+            const auto it = std::upper_bound(regions.begin(), regions.end(), pos,
+                [](int64_t p, SparseMap::Region const& region){return p < region.offset + region.length;});
+            if ((it != regions.end()) && (pos < it->offset))
+            {
+                const auto n = std::min(qint64(it->offset - pos), ZEROES_SIZE);
+                if (file.seek(pos + n)) {
+                    *data = zeroes;
+                    return n;
+                }
+            }
+        }
+
+        *data = buf;
+        return file.read(buf, maxlen);
+    }
+}
 
 class TarCreator::Impl
 {
 public:
 
-    Impl(const QStringList& filenames, bool compress)
+    Impl(PathTable const& filenames, Codec const& codec, int n_threads)
         : filenames_(filenames)
-        , compress_(compress)
+        , codec_(codec)
+        , compress_(codec.type() != Codec::Type::NONE)
+        , n_threads_(n_threads)
         , step_archive_()
         , step_filenum_(-1)
         , step_file_()
@@ -55,9 +223,66 @@ public:
     {
     }
 
+    void set_store_incompressible(bool enabled)
+    {
+        store_incompressible_ = enabled;
+    }
+
+    void set_seekable(bool enabled)
+    {
+        seekable_ = enabled;
+        if (seekable_ && !compress_)
+            qWarning() << "Uncompressed archives are always seekable; not adding an index";
+    }
+
+    void set_data_source(DataSource const& source)
+    {
+        source_ = source;
+    }
+
+    void set_find_duplicates(bool enabled)
+    {
+        find_duplicates_ = enabled;
+    }
+
+    void set_hash_cache(std::shared_ptr<HashCache> const& hash_cache)
+    {
+        hash_cache_ = hash_cache;
+    }
+
+    void add_memory_file(QByteArray const& name, QByteArray const& contents)
+    {
+        MemoryFile file {name, contents, {}};
+        file.info.mode = S_IFREG | 0644;
+        file.info.size = off_t(contents.size());
+        file.info.uid = getuid();
+        file.info.gid = getgid();
+        file.info.mtime.tv_sec = time(nullptr);
+        memory_files_.push_back(file);
+    }
+
+    PathTable files_with_contents() const
+    {
+        PathTable ret;
+        auto info = files().begin();
+        for (auto const& filename : filenames_)
+            if (!(info++)->linked)
+                ret.append(filename.constData(), size_t(filename.size()));
+        ret.squeeze();
+        return ret;
+    }
+
+    Stats stats() const
+    {
+        return stats_;
+    }
+
     ssize_t calculate_size() const
     {
-        return compress_ ? calculate_compressed_size() : calculate_uncompressed_size();
+        if (!compress_)
+            return calculate_uncompressed_size();
+
+        return use_block_compressor() ? calculate_block_compressed_size() : calculate_compressed_size();
     }
 
     bool step(std::vector<char>& fillme)
@@ -70,43 +295,120 @@ public:
         {
             step_archive_.reset(archive_write_new(), [](struct archive* a){archive_write_free(a);});
             archive_write_set_format_pax(step_archive_.get());
-            if (compress_)
-                archive_write_add_filter_xz(step_archive_.get());
-            archive_write_open(step_archive_.get(), &step_buf_, nullptr, append_bytes_write_cb, nullptr);
+            if (use_block_compressor())
+            {
+                // libarchive writes the plain tar into step_raw_,
+                // and step_compressor_ compresses it in parallel
+                step_compressor_.reset(new BlockCompressor{codec_, n_threads_});
+                step_storing_ = false;
+                step_raw_pos_ = 0;
+                if (seekable_)
+                {
+                    SeekableArchive::append_header(step_buf_);
+                    step_out_pos_ = step_buf_.size();
+                    step_block_raw_pos_ = 0;
+                    step_index_ = SeekableArchive::Index{};
+                    step_entries_.clear();
+                    step_index_written_ = false;
+                }
+                // don't let libarchive buffer output; we want
+                // entries to start where we switch codec levels
+                archive_write_set_bytes_per_block(step_archive_.get(), 0);
+                archive_write_open(step_archive_.get(), &step_raw_, nullptr, append_bytes_write_cb, nullptr);
+            }
+            else
+            {
+                codec_.add_filter(step_archive_.get());
+                archive_write_open(step_archive_.get(), &step_buf_, nullptr, append_bytes_write_cb, nullptr);
+            }
 
             step_file_.reset();
+            step_in_file_ = false;
             step_filenum_ = -1;
+            step_done_ = false;
+            stats_ = Stats{};
+            files(); // builds links_
+            stats_.links = links_->stats();
         }
 
         // if we don't have a file we're working on, then get one
-        if (!step_file_)
+        if (!step_in_file_)
         {
-            if (step_filenum_ >= filenames_.size()) // tried to read past the end
+            const auto n_files = int(filenames_.size());
+            if (step_filenum_ >= n_files) // tried to read past the end
             {
                 success = false;
             }
             // step to next file
-            else if (++step_filenum_ == filenames_.size()) // we made it to the end!
+            else if (++step_filenum_ == n_files) // we made it to the end!
             {
+                add_memory_files_to_archive(step_archive_.get(), [this](QByteArray const& name){begin_entry(name);});
+                archive_write_finish_entry(step_archive_.get());
+                step_archive_end_ = step_raw_pos_ + step_raw_.size();
                 archive_write_close(step_archive_.get());
+                step_done_ = true;
             }
             else
             {
-                // write the file's header
-                const auto& filename = filenames_[step_filenum_];
-                add_file_header_to_archive(step_archive_.get(), filename);
-
-                // prep it for reading
-                step_file_.reset(new QFile(filename));
-                step_file_->open(QIODevice::ReadOnly);
+                // write the last file's padding, so that it
+                // stays with the file when we switch codec levels
+                archive_write_finish_entry(step_archive_.get());
+
+                const auto filename_utf8 = filenames_.at(size_t(step_filenum_));
+                step_filename_ = QString::fromUtf8(filename_utf8);
+                const auto& filename = step_filename_;
+                const auto& info = files()[size_t(step_filenum_)];
+
+                if (info.linked)
+                {
+                    // a link is just a header; there's nothing to read
+                    begin_entry(filename_utf8);
+                    add_file_header_to_archive(step_archive_.get(), filename_utf8, info, link_target(info));
+                }
+                else
+                {
+                    classify_next_file(filename, info);
+
+                    // write the file's header
+                    begin_entry(filename_utf8);
+                    add_file_header_to_archive(step_archive_.get(), filename_utf8, info, link_target(info));
+
+                    // prep it for reading
+                    step_in_file_ = true;
+                    step_file_incomplete_ = false;
+                    step_file_left_ = info.size;
+                    step_sparse_ = info.sparse.get();
+                    if (!source_) {
+                        step_file_.reset(new QFile(filename));
+                        step_file_->open(QIODevice::ReadOnly);
+                    }
+                }
             }
         }
 
-        if (step_file_)
+        if (step_in_file_)
         {
+            const auto& filename = step_filename_;
             static constexpr int BUFSIZE {1024*10};
-            char inbuf[BUFSIZE];
-            auto inbuf_len = step_file_->read(inbuf, sizeof(inbuf));
+            char buf[BUFSIZE];
+            const char* inbuf = buf;
+            const auto n_read = source_ ? source_(filename, &inbuf)
+                                        : read_file(*step_file_, step_sparse_, buf, sizeof(buf), &inbuf);
+
+            // if the file grew, only take as much as its header says
+            auto inbuf_len = n_read;
+            if (n_read > step_file_left_)
+            {
+                if (step_file_left_ >= 0)
+                    qWarning() << filename << "grew while being archived; truncating it";
+                inbuf_len = std::max(step_file_left_, qint64(0));
+                step_file_left_ = -1; // only warn once
+            }
+            else if (n_read > 0)
+            {
+                step_file_left_ -= n_read;
+            }
+
             if (inbuf_len > 0) // got data
             {
                 decltype(inbuf_len) offset = 0;
@@ -122,7 +424,7 @@ public:
                     if (err == ARCHIVE_RETRY)
                         continue;
                     auto errstr = QString::fromUtf8("Error adding data for '%1': %2 (%3)")
-                        .arg(step_file_->fileName())
+                        .arg(filename)
                         .arg(archive_error_string(step_archive_.get()))
                         .arg(err);
                     qWarning() << qPrintable(errstr);
@@ -134,15 +436,48 @@ public:
             {
                 success = false;
                 auto errstr = QStringLiteral("read()ing %1 returned %2 (%3)")
-                                  .arg(step_file_->fileName())
+                                  .arg(filename)
                                   .arg(inbuf_len)
-                                  .arg(step_file_->errorString());
+                                  .arg(step_file_ ? step_file_->errorString() : QStringLiteral("read-ahead failed"));
                 qWarning() << errstr;
                 throw std::runtime_error(errstr.toStdString());
             }
 
-            if (step_file_->atEnd()) // if we're done with the file, close it
+            // if the file shrank, libarchive pads the entry out to its header's size
+            if ((n_read == 0) && (step_file_left_ > 0)) {
+                qWarning() << filename << "shrank while being archived; padding it with zeroes";
+                step_file_incomplete_ = true;
+            }
+
+            // if we're done with the file, close it.
+            // A data source is read to its end to keep it in step with us.
+            const bool at_end = source_ ? (n_read == 0)
+                                        : (step_file_->atEnd() || (step_file_left_ < 0));
+            if (at_end) {
+                const auto filename_utf8 = filenames_.at(size_t(step_filenum_));
+                const auto& info = files()[size_t(step_filenum_)];
+                if (changed_since_stat(filename_utf8, info, step_file_ ? step_file_->handle() : -1)) {
+                    // what we archived may be part old and part new
+                    qWarning() << filename << "changed while being archived";
+                    ++stats_.n_changed_files;
+                    step_file_incomplete_ = true;
+                }
+                if (step_file_incomplete_)
+                    stats_.incomplete.append(filename_utf8);
                 step_file_.reset();
+                step_in_file_ = false;
+            }
+        }
+
+        if (step_compressor_)
+        {
+            compress_raw();
+            if (step_done_)
+                step_compressor_->flush();
+            if (seekable_)
+                take_seekable_blocks();
+            else
+                step_compressor_->take(step_buf_, step_done_);
         }
 
         std::swap(fillme,step_buf_);
@@ -151,6 +486,138 @@ public:
 
 private:
 
+    bool use_block_compressor() const
+    {
+        return compress_ && ((n_threads_ > 1) || store_incompressible_ || seekable_);
+    }
+
+    // hands the plain tar that libarchive has written to the block compressor
+    void compress_raw()
+    {
+        step_compressor_->write(step_raw_.data(), step_raw_.size());
+        step_raw_pos_ += step_raw_.size();
+        step_raw_.resize(0);
+    }
+
+    // notes where an entry starts in the plain tar, for the seekable index
+    void begin_entry(QByteArray const& filename_utf8)
+    {
+        if (seekable_ && step_compressor_)
+            step_entries_.push_back(std::make_pair(filename_utf8, step_raw_pos_ + step_raw_.size()));
+    }
+
+    // frames the compressed blocks, and after the last one, adds the index
+    void take_seekable_blocks()
+    {
+        std::vector<char> compressed;
+        std::vector<BlockCompressor::Block> blocks;
+        step_compressor_->take(compressed, step_done_, &blocks);
+
+        size_t pos {};
+        for (auto const& block : blocks)
+        {
+            SeekableArchive::append_block(step_buf_, compressed.data() + pos, block.size);
+            step_index_.blocks << SeekableArchive::Block{step_out_pos_ + SeekableArchive::BLOCK_HEADER_SIZE,
+                                                         quint32(block.size),
+                                                         step_block_raw_pos_,
+                                                         quint32(block.raw_size)};
+            step_out_pos_ += SeekableArchive::BLOCK_HEADER_SIZE + block.size;
+            step_block_raw_pos_ += block.raw_size;
+            pos += block.size;
+        }
+
+        if (!step_done_ || step_index_written_)
+            return;
+
+        // now that we know where the blocks start, find each entry's block
+        auto const& index_blocks = step_index_.blocks;
+        for (size_t i=0, n=step_entries_.size(); i<n; ++i)
+        {
+            const auto start = step_entries_[i].second;
+            const auto end = i+1<n ? step_entries_[i+1].second : step_archive_end_;
+            const auto it = std::upper_bound(index_blocks.begin(), index_blocks.end(), start,
+                [](quint64 p, SeekableArchive::Block const& block){return p < block.raw_offset;});
+            if (it == index_blocks.begin())
+                continue;
+            const auto block = it - 1;
+            step_index_.entries << SeekableArchive::Entry{step_entries_[i].first,
+                                                          quint32(block - index_blocks.begin()),
+                                                          quint32(start - block->raw_offset),
+                                                          end - start};
+        }
+        SeekableArchive::append_index(step_buf_, step_index_);
+        step_index_written_ = true;
+    }
+
+    std::vector<FileInfo> const& files() const
+    {
+        // stat each file once; calculate_size() and step() both use this
+        if (!files_valid_)
+        {
+            files_.clear();
+            files_.reserve(size_t(filenames_.size()));
+            links_.reset(new LinkFinder{filenames_, find_duplicates_, hash_cache_});
+            for (auto const& filename : filenames_)
+            {
+                FileInfo info;
+                if (!read_file_info(filename, info))
+                {
+                    // give it a placeholder; reading it will fail later
+                    qWarning() << "Unable to stat" << filename.constData() << ':' << strerror(errno);
+                    info.mode = S_IFREG | 0644;
+                }
+                links_->add(info.to_stat());
+                files_.push_back(info);
+            }
+            links_->finish();
+
+            // now that we know which files are links, look for holes in the rest
+            size_t i {};
+            for (auto const& filename : filenames_)
+            {
+                auto& info = files_[i];
+                info.linked = links_->find_target(i, info.link_target);
+                if (!info.linked)
+                    info.sparse = find_sparse_map(filename, info);
+                ++i;
+            }
+            files_valid_ = true;
+        }
+
+        return files_;
+    }
+
+    // true if a file changed since we gathered its metadata.
+    // `fd' is the open file, or -1 to look it up by name.
+    static bool changed_since_stat(QByteArray const& filename, FileInfo const& info, int fd)
+    {
+        struct stat st;
+        const auto ret = fd != -1 ? fstat(fd, &st) : stat(filename.constData(), &st);
+        return (ret == 0) && !info.matches(st);
+    }
+
+    void classify_next_file(QString const& filename, FileInfo const& info)
+    {
+        const auto size = qint64(info.size);
+        const bool store = store_incompressible_ && EntropyClassifier::is_incompressible(filename, size);
+        if (store) {
+            ++stats_.n_stored_files;
+            stats_.n_stored_bytes += size;
+        } else {
+            ++stats_.n_compressed_files;
+            stats_.n_compressed_bytes += size;
+        }
+
+        // if we're switching between storing and compressing,
+        // finish the current block so that the file gets its own
+        if (step_compressor_ && (store != step_storing_))
+        {
+            compress_raw();
+            step_compressor_->set_codec(store ? codec_.stored() : codec_);
+            step_storing_ = store;
+        }
+    }
+
     static ssize_t append_bytes_write_cb(struct archive *,
                                          void * vtarget,
                                          const void * vsource,
@@ -171,24 +638,46 @@ private:
         return ssize_t(len);
     }
 
+    // the filename that `info' is a hard link to, or an empty string if none
+    QByteArray link_target(FileInfo const& info) const
+    {
+        return info.linked ? filenames_.at(info.link_target) : QByteArray();
+    }
+
     static void add_file_header_to_archive(struct archive* archive,
-                                           const QString& filename)
+                                           QByteArray const& filename_utf8,
+                                           FileInfo const& info,
+                                           QByteArray const& link_target)
     {
-        struct stat st;
-        const auto filename_utf8 = filename.toUtf8();
-        stat(filename_utf8.constData(), &st);
+        const auto st = info.to_stat();
 
         auto entry = archive_entry_new();
         archive_entry_copy_stat(entry, &st);
+
+        // like TarSender, leave out the atime and ctime: restores only
+        // set the mtime, and reading a file changes its atime anyway
+        archive_entry_unset_atime(entry);
+        archive_entry_unset_ctime(entry);
         archive_entry_set_pathname(entry, filename_utf8.constData());
 
+        if (!link_target.isEmpty())
+        {
+            // a hard link entry has no contents of its own
+            archive_entry_set_hardlink(entry, link_target.constData());
+            archive_entry_set_size(entry, 0);
+        }
+        // libarchive writes these as a GNU sparse entry that skips the holes
+        else if (info.sparse)
+            for (auto const& region : info.sparse->regions)
+                archive_entry_sparse_add_entry(entry, region.offset, region.length);
+
         int ret;
         do {
             ret = archive_write_header(archive, entry);
             if ((ret==ARCHIVE_WARN) || (ret==ARCHIVE_FAILED) || (ret==ARCHIVE_FATAL))
             {
                 auto errstr = QString::fromUtf8("Error adding header for '%1': %2 (%3)")
-                                .arg(filename)
+                                .arg(QString::fromUtf8(filename_utf8))
                                 .arg(archive_error_string(archive))
                                 .arg(ret);
                 qWarning() << qPrintable(errstr);
@@ -200,6 +689,28 @@ private:
         archive_entry_free(entry);
     }
 
+    void add_memory_files_to_archive(struct archive* archive,
+                                     std::function<void(QByteArray const&)> const& before_each = {}) const
+    {
+        for (auto const& file : memory_files_)
+        {
+            if (before_each)
+            {
+                archive_write_finish_entry(archive);
+                before_each(file.name);
+            }
+            add_file_header_to_archive(archive, file.name, file.info, QByteArray());
+            if (archive_write_data(archive, file.contents.constData(), size_t(file.contents.size())) < 0)
+            {
+                auto errstr = QString::fromUtf8("Error adding data for '%1': %2")
+                                .arg(QString::fromUtf8(file.name))
+                                .arg(archive_error_string(archive));
+                qWarning() << qPrintable(errstr);
+                throw std::runtime_error(errstr.toStdString());
+            }
+        }
+    }
+
     ssize_t calculate_uncompressed_size() const
     {
         ssize_t archive_size {};
@@ -208,13 +719,16 @@ private:
         archive_write_set_format_pax(a);
         archive_write_open(a, &archive_size, nullptr, count_bytes_write_cb, nullptr);
 
-        for (const auto& filename : filenames_)
+        auto info = files().begin();
+        for (auto const& filename : filenames_)
         {
-            add_file_header_to_archive(a, filename);
+            add_file_header_to_archive(a, filename, *info, link_target(*info));
+            ++info;
 
             // libarchive pads any missing data,
             // so we don't need to call archive_write_data()
         }
+        add_memory_files_to_archive(a);
 
         archive_write_close(a);
         archive_write_free(a);
@@ -227,24 +741,30 @@ private:
 
         auto a = archive_write_new();
         archive_write_set_format_pax(a);
-        archive_write_add_filter_xz(a);
+        codec_.add_filter(a);
         archive_write_open(a, &archive_size, nullptr, count_bytes_write_cb, nullptr);
 
-        for (const auto& filename : filenames_)
+        auto infos = files().begin();
+        for (auto const& filename : filenames_)
         {
-            add_file_header_to_archive(a, filename);
+            const auto& info = *infos++;
+            add_file_header_to_archive(a, filename, info, link_target(info));
+            if (info.linked)
+                continue;
 
-            // process the file
-            QFile file(filename);
+            // process the file, up to the size in its header
+            QFile file(QString::fromUtf8(filename));
             file.open(QIODevice::ReadOnly);
             static constexpr int BUFSIZE {4096};
             char buf[BUFSIZE];
-            for(;;) {
-                const auto n_read = file.read(buf, sizeof(buf));
+            for (qint64 n_left=info.size; n_left>0; ) {
+                const char* data;
+                const auto n_read = read_file(file, info.sparse.get(), buf, std::min(n_left, qint64(sizeof(buf))), &data);
                 if (n_read == 0)
                     break;
+                n_left -= std::max(n_read, qint64(0));
                 if (n_read > 0)
-                    archive_write_data(a, buf, size_t(n_read));
+                    archive_write_data(a, data, size_t(n_read));
                 if (n_read < 0) {
                     auto errstr = QStringLiteral("Reading '%1' returned %2 (%3)")
                                       .arg(file.fileName())
@@ -255,32 +775,146 @@ private:
                 }
             }
         }
+        add_memory_files_to_archive(a);
 
         archive_write_close(a);
         archive_write_free(a);
         return archive_size;
     }
 
-    const QStringList filenames_;
+    ssize_t calculate_block_compressed_size() const
+    {
+        // block compression is deterministic, so we can
+        // just run a scratch archive and count its size
+        ssize_t archive_size {};
+
+        Impl scratch{filenames_, codec_, n_threads_};
+        scratch.set_store_incompressible(store_incompressible_);
+        scratch.seekable_ = seekable_;
+        scratch.files_ = files();
+        scratch.links_ = links_;
+        scratch.memory_files_ = memory_files_;
+        scratch.files_valid_ = true;
+        std::vector<char> buf;
+        while (scratch.step(buf))
+            archive_size += ssize_t(buf.size());
+
+        return archive_size;
+    }
+
+    const PathTable filenames_;
+    const Codec codec_;
     const bool compress_ {};
+    const int n_threads_ {};
+    bool store_incompressible_ {};
+    bool seekable_ {};
+    bool find_duplicates_ {};
+    std::shared_ptr<HashCache> hash_cache_;
+    Stats stats_;
+    mutable std::shared_ptr<LinkFinder> links_;
+
+    struct MemoryFile
+    {
+        QByteArray name;
+        QByteArray contents;
+        FileInfo info;
+    };
+    std::vector<MemoryFile> memory_files_;
+    mutable std::vector<FileInfo> files_;
+    mutable bool files_valid_ {};
 
     std::shared_ptr<struct archive> step_archive_;
     int step_filenum_ {-1};
+    bool step_done_ {};
+    bool step_storing_ {};
+    bool step_in_file_ {};
+    bool step_file_incomplete_ {};
+    QString step_filename_;
+    qint64 step_file_left_ {};
+    SparseMap const* step_sparse_ {};
+    DataSource source_;
     QSharedPointer<QFile> step_file_;
     std::vector<char> step_buf_;
+    std::vector<char> step_raw_;
+    std::shared_ptr<BlockCompressor> step_compressor_;
+    quint64 step_raw_pos_ {}; // how much plain tar went into step_compressor_
+    quint64 step_archive_end_ {}; // where the end-of-archive marker starts in the plain tar
+    quint64 step_out_pos_ {}; // how much of the seekable container we've written
+    quint64 step_block_raw_pos_ {}; // where the next compressed block starts in the plain tar
+    std::vector<std::pair<QByteArray,quint64>> step_entries_; // each entry's start in the plain tar
+    SeekableArchive::Index step_index_;
+    bool step_index_written_ {};
 };
 
 /**
 ***
 **/
 
-TarCreator::TarCreator(const QStringList& filenames, bool compress)
-    : impl_{new Impl{filenames, compress}}
+TarCreator::TarCreator(PathTable const& filenames, Codec const& codec, int n_threads)
+    : impl_{new Impl{filenames, codec, n_threads}}
+{
+}
+
+TarCreator::TarCreator(const QStringList& filenames, Codec const& codec, int n_threads)
+    : TarCreator{PathTable{filenames}, codec, n_threads}
+{
+}
+
+TarCreator::TarCreator(const QStringList& filenames, bool compress, int n_threads)
+    : TarCreator{filenames, Codec{compress ? Codec::Type::XZ : Codec::Type::NONE}, n_threads}
 {
 }
 
 TarCreator::~TarCreator() =default;
 
+void
+TarCreator::set_store_incompressible(bool enabled)
+{
+    impl_->set_store_incompressible(enabled);
+}
+
+void
+TarCreator::set_seekable(bool enabled)
+{
+    impl_->set_seekable(enabled);
+}
+
+void
+TarCreator::set_data_source(DataSource const& source)
+{
+    impl_->set_data_source(source);
+}
+
+void
+TarCreator::set_find_duplicates(bool enabled)
+{
+    impl_->set_find_duplicates(enabled);
+}
+
+void
+TarCreator::set_hash_cache(std::shared_ptr<HashCache> const& hash_cache)
+{
+    impl_->set_hash_cache(hash_cache);
+}
+
+void
+TarCreator::add_memory_file(QByteArray const& name, QByteArray const& contents)
+{
+    impl_->add_memory_file(name, contents);
+}
+
+PathTable
+TarCreator::files_with_contents() const
+{
+    return impl_->files_with_contents();
+}
+
+TarCreator::Stats
+TarCreator::stats() const
+{
+    return impl_->stats();
+}
+
 ssize_t
 TarCreator::calculate_size() const
 {
@@ -19,9 +19,14 @@
 
 #pragma once
 
+#include "tar/codec.h"
+#include "tar/link-finder.h"
+#include "tar/path-table.h"
+
 #include <QStringList>
 
 #include <cstddef> // ssize_t
+#include <functional>
 #include <memory> // shared_ptr
 #include <vector>
 
@@ -29,9 +34,68 @@
 class TarCreator
 {
 public:
-    TarCreator(const QStringList& files, bool compress);
+    // if n_threads > 1, compression is split across that many threads
+    TarCreator(PathTable const& files, Codec const& codec, int n_threads=1);
+    TarCreator(const QStringList& files, Codec const& codec, int n_threads=1);
+    // if compress is true, uses the default xz codec
+    TarCreator(const QStringList& files, bool compress, int n_threads=1);
     ~TarCreator();
 
+    // if enabled, files that look already compressed (e.g. JPEG, MP4)
+    // get their own blocks, which are stored without compression.
+    // Must be called before the first step().
+    void set_store_incompressible(bool enabled);
+
+    // If enabled, the archive is a SeekableArchive, with an index
+    // of where each entry is so it can be read without the rest.
+    // It has no effect on uncompressed archives, which a reader
+    // can already seek through. Must be called before the first step().
+    void set_seekable(bool enabled);
+
+    // By default, step() reads the files itself. A data source lets
+    // another thread read ahead instead: it's called with the filename
+    // of the file being archived, and returns the length of the file's
+    // next chunk and points `data` at it, or 0 at the end of the file,
+    // or -1 on a read error. `data` must stay valid until the next call.
+    // Must be called before the first step().
+    using DataSource = std::function<qint64(QString const& filename, const char** data)>;
+    void set_data_source(DataSource const& source);
+
+    // Hard links are always archived as links to the first of them.
+    // If enabled, files with identical contents are archived that way
+    // too, and so are restored as hard links to a single file.
+    // Must be called before the first step() or calculate_size().
+    void set_find_duplicates(bool enabled);
+
+    // If set, finding duplicates uses the hashes in `hash_cache',
+    // so files that haven't changed since it was saved aren't read.
+    // Must be called before the first step() or calculate_size().
+    void set_hash_cache(std::shared_ptr<HashCache> const& hash_cache);
+
+    // The files whose contents go into the archive, in archive order;
+    // i.e. all of them except the links. A data source is only
+    // called for these files.
+    PathTable files_with_contents() const;
+
+    // Adds a file that isn't on disk, e.g. a list of deleted files,
+    // after the files from disk. A data source isn't called for it.
+    // Must be called before the first step() or calculate_size().
+    void add_memory_file(QByteArray const& name, QByteArray const& contents);
+
+    struct Stats
+    {
+        int n_stored_files {};
+        qint64 n_stored_bytes {};
+        int n_compressed_files {};
+        qint64 n_compressed_bytes {};
+        int n_changed_files {}; // files that changed while they were being read
+        LinkFinder::Stats links;
+        PathTable incomplete; // files that changed or shrank while being read, so the archive may not match them
+    };
+
+    // how many files and bytes step() has stored vs compressed so far
+    Stats stats() const;
+
     ssize_t calculate_size() const;
     bool step(std::vector<char>& fillme);
 
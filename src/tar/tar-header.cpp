@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/tar-header.h"
+
+#include <grp.h> // getgrgid_r()
+#include <pwd.h> // getpwuid_r()
+#include <unistd.h> // sysconf()
+
+#include <algorithm> // std::copy_n(), std::min()
+#include <cstdio> // snprintf()
+#include <cstring> // memcpy()
+#include <map>
+#include <mutex>
+
+namespace
+{
+    // ustar field offsets and sizes
+    constexpr size_t NAME_OFFSET {0};       constexpr size_t NAME_SIZE {100};
+    constexpr size_t MODE_OFFSET {100};     constexpr size_t MODE_SIZE {8};
+    constexpr size_t UID_OFFSET {108};      constexpr size_t UID_SIZE {8};
+    constexpr size_t GID_OFFSET {116};      constexpr size_t GID_SIZE {8};
+    constexpr size_t SIZE_OFFSET {124};     constexpr size_t SIZE_SIZE {12};
+    constexpr size_t MTIME_OFFSET {136};    constexpr size_t MTIME_SIZE {12};
+    constexpr size_t CHKSUM_OFFSET {148};   constexpr size_t CHKSUM_SIZE {8};
+    constexpr size_t TYPEFLAG_OFFSET {156};
+    constexpr size_t LINKNAME_OFFSET {157}; constexpr size_t LINKNAME_SIZE {100};
+    constexpr size_t MAGIC_OFFSET {257};
+    constexpr size_t VERSION_OFFSET {263};
+    constexpr size_t UNAME_OFFSET {265};    constexpr size_t UNAME_SIZE {32};
+    constexpr size_t GNAME_OFFSET {297};    constexpr size_t GNAME_SIZE {32};
+    constexpr size_t PREFIX_OFFSET {345};   constexpr size_t PREFIX_SIZE {155};
+
+    constexpr char TYPE_FILE {'0'};
+    constexpr char TYPE_HARDLINK {'1'};
+    constexpr char TYPE_SYMLINK {'2'};
+    constexpr char TYPE_CHAR {'3'};
+    constexpr char TYPE_BLOCK {'4'};
+    constexpr char TYPE_DIR {'5'};
+    constexpr char TYPE_FIFO {'6'};
+    constexpr char TYPE_PAX {'x'};
+
+    // the largest value that fits in an octal field of `size' bytes
+    // (one byte is reserved for the trailing NUL)
+    unsigned long long max_octal(size_t size)
+    {
+        return (1ull << (3 * (size - 1))) - 1;
+    }
+
+    void set_string(std::vector<char>& block, size_t offset, size_t size, std::string const& str)
+    {
+        std::copy_n(str.data(), std::min(size, str.size()), block.begin() + long(offset));
+    }
+
+    void set_octal(std::vector<char>& block, size_t offset, size_t size, unsigned long long val)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%0*llo", int(size - 1), std::min(val, max_octal(size)));
+        memcpy(&block[offset], buf, size - 1);
+    }
+
+    char get_typeflag(struct stat const& st)
+    {
+        if (S_ISLNK(st.st_mode)) return TYPE_SYMLINK;
+        if (S_ISDIR(st.st_mode)) return TYPE_DIR;
+        if (S_ISCHR(st.st_mode)) return TYPE_CHAR;
+        if (S_ISBLK(st.st_mode)) return TYPE_BLOCK;
+        if (S_ISFIFO(st.st_mode)) return TYPE_FIFO;
+        return TYPE_FILE;
+    }
+
+    // splits `path' into ustar's prefix and name fields. Returns false if it won't fit.
+    bool split_path(std::string const& path, std::string& prefix, std::string& name)
+    {
+        if (path.size() <= NAME_SIZE)
+        {
+            prefix.clear();
+            name = path;
+            return true;
+        }
+
+        // find the first slash that leaves a short enough name
+        for (auto pos = path.find('/'); pos != std::string::npos; pos = path.find('/', pos+1))
+        {
+            if (pos > PREFIX_SIZE)
+                break;
+            if (path.size() - pos - 1 <= NAME_SIZE)
+            {
+                prefix = path.substr(0, pos);
+                name = path.substr(pos+1);
+                return !name.empty();
+            }
+        }
+
+        return false;
+    }
+
+    // looks up the user or group name for `id', remembering the answers
+    // since an archive's files usually all share one or two owners
+    template<typename Id, typename Lookup>
+    std::string get_name(std::map<Id,std::string>& cache, Id id, Lookup lookup)
+    {
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = cache.find(id);
+        if (it == cache.end())
+            it = cache.emplace(id, lookup(id)).first;
+        return it->second;
+    }
+
+    std::string get_uname(uid_t uid)
+    {
+        static std::map<uid_t,std::string> cache;
+        return get_name(cache, uid, [](uid_t id) {
+            struct passwd pwd, *result {};
+            std::vector<char> buf(16384);
+            getpwuid_r(id, &pwd, buf.data(), buf.size(), &result);
+            return result ? std::string(result->pw_name) : std::string();
+        });
+    }
+
+    std::string get_gname(gid_t gid)
+    {
+        static std::map<gid_t,std::string> cache;
+        return get_name(cache, gid, [](gid_t id) {
+            struct group grp, *result {};
+            std::vector<char> buf(16384);
+            getgrgid_r(id, &grp, buf.data(), buf.size(), &result);
+            return result ? std::string(result->gr_name) : std::string();
+        });
+    }
+
+    // pax times are "<sec>[.<fraction>]", like libarchive's pax writer
+    std::string pax_time(struct timespec const& ts)
+    {
+        auto sec = static_cast<long long>(ts.tv_sec);
+        auto nsec = static_cast<long>(ts.tv_nsec);
+
+        std::string ret;
+        if ((sec < 0) && (nsec > 0))
+        {
+            // -1.25 is stored as tv_sec -2, tv_nsec 750000000
+            ret = sec == -1 ? "-0" : std::to_string(sec + 1);
+            nsec = 1000000000 - nsec;
+        }
+        else
+        {
+            ret = std::to_string(sec);
+        }
+
+        if (nsec > 0)
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), ".%09ld", nsec);
+            std::string fraction(buf);
+            fraction.erase(fraction.find_last_not_of('0') + 1);
+            ret += fraction;
+        }
+
+        return ret;
+    }
+
+    // a pax record is "<len> <key>=<value>\n", where <len> includes itself
+    std::string pax_record(std::string const& key, std::string const& value)
+    {
+        const auto payload_len = 1 + key.size() + 1 + value.size() + 1;
+        auto len = payload_len + 1;
+        while (std::to_string(len).size() + payload_len != len)
+            ++len;
+        return std::to_string(len) + ' ' + key + '=' + value + '\n';
+    }
+
+    std::vector<char> create_block(std::string const& prefix,
+                                   std::string const& name,
+                                   struct stat const& st,
+                                   char typeflag,
+                                   size_t size,
+                                   std::string const& linkname,
+                                   std::string const& uname,
+                                   std::string const& gname)
+    {
+        std::vector<char> block(TarHeader::BLOCK_SIZE, '\0');
+
+        set_string(block, NAME_OFFSET, NAME_SIZE, name);
+        set_octal(block, MODE_OFFSET, MODE_SIZE, st.st_mode & 07777);
+        set_octal(block, UID_OFFSET, UID_SIZE, st.st_uid);
+        set_octal(block, GID_OFFSET, GID_SIZE, st.st_gid);
+        set_octal(block, SIZE_OFFSET, SIZE_SIZE, size);
+        set_octal(block, MTIME_OFFSET, MTIME_SIZE, st.st_mtime > 0 ? static_cast<unsigned long long>(st.st_mtime) : 0);
+        block[TYPEFLAG_OFFSET] = typeflag;
+        set_string(block, LINKNAME_OFFSET, LINKNAME_SIZE, linkname);
+        memcpy(&block[MAGIC_OFFSET], "ustar", 6);
+        memcpy(&block[VERSION_OFFSET], "00", 2);
+        set_string(block, UNAME_OFFSET, UNAME_SIZE - 1, uname);
+        set_string(block, GNAME_OFFSET, GNAME_SIZE - 1, gname);
+        set_string(block, PREFIX_OFFSET, PREFIX_SIZE, prefix);
+
+        // the checksum is calculated with the checksum field set to spaces
+        memset(&block[CHKSUM_OFFSET], ' ', CHKSUM_SIZE);
+        unsigned int chksum {};
+        for (auto const ch : block)
+            chksum += static_cast<unsigned char>(ch);
+        char buf[CHKSUM_SIZE];
+        snprintf(buf, sizeof(buf), "%06o", chksum);
+        memcpy(&block[CHKSUM_OFFSET], buf, 7); // six digits, a NUL, and the original space
+
+        return block;
+    }
+}
+
+namespace
+{
+    // builds the header for an entry with `size' bytes of content,
+    // plus a pax header for `records' and anything that won't fit in ustar
+    std::vector<char> create_entry(std::string const& path,
+                                   struct stat const& st,
+                                   char typeflag,
+                                   size_t size,
+                                   std::string const& linkname,
+                                   std::string records)
+    {
+        std::string prefix, name;
+        if (!split_path(path, prefix, name))
+        {
+            records += pax_record("path", path);
+            prefix.clear();
+            name = path.substr(0, NAME_SIZE);
+        }
+        if (linkname.size() > LINKNAME_SIZE)
+            records += pax_record("linkpath", linkname);
+        if (size > max_octal(SIZE_SIZE))
+            records += pax_record("size", std::to_string(size));
+        if (static_cast<unsigned long long>(st.st_uid) > max_octal(UID_SIZE))
+            records += pax_record("uid", std::to_string(st.st_uid));
+        if (static_cast<unsigned long long>(st.st_gid) > max_octal(GID_SIZE))
+            records += pax_record("gid", std::to_string(st.st_gid));
+        if ((st.st_mtime < 0) || (static_cast<unsigned long long>(st.st_mtime) > max_octal(MTIME_SIZE)) || (st.st_mtim.tv_nsec != 0))
+            records += pax_record("mtime", pax_time(st.st_mtim));
+        const auto uname = get_uname(st.st_uid);
+        if (uname.size() >= UNAME_SIZE)
+            records += pax_record("uname", uname);
+        const auto gname = get_gname(st.st_gid);
+        if (gname.size() >= GNAME_SIZE)
+            records += pax_record("gname", gname);
+
+        std::vector<char> ret;
+
+        if (!records.empty())
+        {
+            struct stat pax_st = st;
+            pax_st.st_mode = S_IFREG | 0644;
+            const auto pax_name = std::string("PaxHeader/") + name.substr(0, NAME_SIZE - 10);
+            ret = create_block(std::string(), pax_name, pax_st, TYPE_PAX, records.size(), std::string(), std::string(), std::string());
+            ret.insert(ret.end(), records.begin(), records.end());
+            ret.resize(ret.size() + TarHeader::padding(records.size()), '\0');
+        }
+
+        const auto block = create_block(prefix, name, st, typeflag, size, linkname, uname, gname);
+        ret.insert(ret.end(), block.begin(), block.end());
+        return ret;
+    }
+}
+
+std::vector<char>
+TarHeader::create(std::string const& path,
+                  struct stat const& st,
+                  std::string const& linkname)
+{
+    return create_entry(path, st, get_typeflag(st), content_size(st), linkname, std::string());
+}
+
+std::vector<char>
+TarHeader::create_sparse(std::string const& path,
+                         struct stat const& st,
+                         SparseMap const& map)
+{
+    // like GNU tar and libarchive, store it as "dir/GNUSparseFile.0/file"
+    // so that tars which don't know the format don't overwrite the
+    // real file with the map and data
+    const auto slash = path.rfind('/');
+    const auto dir = slash == std::string::npos ? std::string() : path.substr(0, slash+1);
+    const auto file = slash == std::string::npos ? path : path.substr(slash+1);
+
+    std::string records;
+    records += pax_record("GNU.sparse.major", "1");
+    records += pax_record("GNU.sparse.minor", "0");
+    records += pax_record("GNU.sparse.name", path);
+    records += pax_record("GNU.sparse.realsize", std::to_string(st.st_size));
+
+    return create_entry(dir + "GNUSparseFile.0/" + file, st, TYPE_FILE, content_size(map), std::string(), records);
+}
+
+std::vector<char>
+TarHeader::create_hardlink(std::string const& path,
+                           struct stat const& st,
+                           std::string const& target)
+{
+    return create_entry(path, st, TYPE_HARDLINK, 0, target, std::string());
+}
+
+std::vector<char>
+TarHeader::sparse_map_block(SparseMap const& map)
+{
+    const auto str = map.to_string();
+    std::vector<char> block(str.begin(), str.end());
+    block.resize(block.size() + padding(block.size()), '\0');
+    return block;
+}
+
+std::vector<char>
+TarHeader::end_of_archive()
+{
+    return std::vector<char>(BLOCK_SIZE * 2, '\0');
+}
+
+size_t
+TarHeader::padding(size_t n_bytes)
+{
+    const auto remainder = n_bytes % BLOCK_SIZE;
+    return remainder ? BLOCK_SIZE - remainder : 0;
+}
+
+size_t
+TarHeader::content_size(struct stat const& st)
+{
+    return S_ISREG(st.st_mode) ? size_t(st.st_size) : 0;
+}
+
+size_t
+TarHeader::content_size(SparseMap const& map)
+{
+    const auto map_size = map.to_string().size();
+    return map_size + padding(map_size) + size_t(map.data_size());
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/sparse-map.h"
+
+#include <sys/stat.h>
+
+#include <cstddef> // size_t
+#include <string>
+#include <vector>
+
+/**
+ * Builds tar entry headers without libarchive.
+ *
+ * Entries are written as ustar headers. Anything that doesn't fit
+ * in ustar (long paths, files >= 8 GiB, big uids, sub-second mtimes...)
+ * gets a pax extended header in front of it, the same as libarchive's
+ * pax writer. Owners' user and group names are recorded too.
+ * Sparse files are written in GNU tar's pax-based 1.0 sparse format.
+ */
+class TarHeader
+{
+public:
+
+    static constexpr size_t BLOCK_SIZE {512};
+
+    // returns the header block(s) for an entry.
+    // `linkname' is the target if `st' is a symlink.
+    static std::vector<char> create(std::string const& path,
+                                    struct stat const& st,
+                                    std::string const& linkname = std::string());
+
+    // returns the header block(s) for a sparse file's entry. Its content
+    // is sparse_map_block(map) followed by the data in each of map's regions.
+    static std::vector<char> create_sparse(std::string const& path,
+                                           struct stat const& st,
+                                           SparseMap const& map);
+
+    // returns the header block(s) for a hard link to `target', an earlier
+    // entry in the same archive. Hard links have no content of their own.
+    static std::vector<char> create_hardlink(std::string const& path,
+                                             struct stat const& st,
+                                             std::string const& target);
+
+    // the start of a sparse entry's content, before its data
+    static std::vector<char> sparse_map_block(SparseMap const& map);
+
+    // the zero blocks that mark the end of an archive
+    static std::vector<char> end_of_archive();
+
+    // how many zeroes to add after `n_bytes' of content to fill its last block
+    static size_t padding(size_t n_bytes);
+
+    // how many bytes of content follow the header for this entry
+    static size_t content_size(struct stat const& st);
+    static size_t content_size(SparseMap const& map);
+};
@@ -0,0 +1,439 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/tar-pipeline.h"
+#include "tar/async-file-reader.h"
+#include "util/spsc-queue.h"
+
+#include <QDebug>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring> // strerror()
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // how much the reader can get ahead of the compressor
+    constexpr qint64 READ_CHUNK_SIZE {1024*256};
+    constexpr size_t N_READ_BUFFERS {16};
+
+    // how much the compressor can get ahead of the sender
+    constexpr size_t N_SEND_BUFFERS {8};
+
+    // a piece of a file, with TarCreator::DataSource's return value
+    struct Chunk
+    {
+        std::vector<char> buf;
+        qint64 len {};
+    };
+}
+
+class TarPipeline::Impl
+{
+public:
+
+    Impl(PathTable const& filenames, Codec const& codec, int n_threads)
+        : creator_(filenames, codec, n_threads)
+        , to_compressor_(N_READ_BUFFERS)
+        , read_buffers_(N_READ_BUFFERS)
+        , to_sender_(N_SEND_BUFFERS)
+        , send_buffers_(N_SEND_BUFFERS)
+    {
+        creator_.set_data_source([this](QString const&, const char** data){
+            return next_chunk(data);
+        });
+    }
+
+    ~Impl()
+    {
+        stop();
+    }
+
+    void set_store_incompressible(bool enabled)
+    {
+        creator_.set_store_incompressible(enabled);
+    }
+
+    void set_find_duplicates(bool enabled)
+    {
+        creator_.set_find_duplicates(enabled);
+    }
+
+    void set_seekable(bool enabled)
+    {
+        creator_.set_seekable(enabled);
+    }
+
+    void set_hash_cache(std::shared_ptr<HashCache> const& hash_cache)
+    {
+        creator_.set_hash_cache(hash_cache);
+    }
+
+    void add_memory_file(QByteArray const& name, QByteArray const& contents)
+    {
+        creator_.add_memory_file(name, contents);
+    }
+
+    void set_observer(Observer const& observer)
+    {
+        observer_ = observer;
+    }
+
+    ssize_t calculate_size() const
+    {
+        return creator_.calculate_size();
+    }
+
+    ssize_t send(int fd)
+    {
+        fd_ = fd;
+        cancelled_ = false;
+        compressor_failed_ = false;
+        stats_ = Stats{};
+
+        // links have no contents, so the creator won't ask for them
+        files_to_read_ = creator_.files_with_contents();
+
+        reader_thread_ = std::thread(&Impl::reader_main, this);
+        compressor_thread_ = std::thread(&Impl::compressor_main, this);
+
+        // the sender stage runs on the caller's thread
+        ssize_t n_sent {};
+        for (;;)
+        {
+            std::vector<char> buf;
+            wait_to_pop(to_sender_, buf, stats_.sender_input);
+            if (buf.empty()) // the compressor is done
+                break;
+            if (!write_all(buf)) {
+                n_sent = -1;
+                break;
+            }
+            n_sent += ssize_t(buf.size());
+            send_buffers_.push(std::move(buf));
+        }
+
+        stop();
+        stats_.creator = creator_.stats();
+        return compressor_failed_ ? -1 : n_sent;
+    }
+
+    Stats stats() const
+    {
+        return stats_;
+    }
+
+private:
+
+    void stop()
+    {
+        cancelled_ = true;
+        to_compressor_.wake();
+        read_buffers_.wake();
+        to_sender_.wake();
+        send_buffers_.wake();
+        if (reader_thread_.joinable())
+            reader_thread_.join();
+        if (compressor_thread_.joinable())
+            compressor_thread_.join();
+    }
+
+    // Calls `try_once' until it succeeds, sleeping on `queue' in between
+    // and recording any wait in `stats'. `queue_ready' says when it's
+    // worth trying again, e.g. when the queue we pop from isn't empty.
+    // Returns false if the pipeline was cancelled while waiting.
+    template<typename Func, typename Queue, typename Pred>
+    bool wait_for(Func&& try_once, Queue& queue, Pred&& queue_ready, StageStats& stats)
+    {
+        if (try_once())
+            return true;
+
+        ++stats.n_stalls;
+        const auto begin = std::chrono::steady_clock::now();
+        bool success {};
+        for (;;)
+        {
+            if ((success = try_once()))
+                break;
+            if (cancelled_)
+                break;
+            queue.wait([this, &queue_ready](){return cancelled_ || queue_ready();});
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - begin;
+        stats.stall_usec += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        return success;
+    }
+
+    template<typename T>
+    bool wait_to_pop(SpscQueue<T>& queue, T& setme, StageStats& stats)
+    {
+        return wait_for([&queue, &setme](){return queue.pop(setme);},
+                        queue, [&queue](){return !queue.empty();}, stats);
+    }
+
+    template<typename T>
+    bool wait_to_push(SpscQueue<T>& queue, T&& item, StageStats& stats)
+    {
+        return wait_for([&queue, &item](){return queue.push(std::move(item));},
+                        queue, [&queue](){return !queue.full();}, stats);
+    }
+
+    /***
+    ****  Reader stage
+    ***/
+
+    bool get_read_buffer(std::vector<char>& setme)
+    {
+        if (!spare_read_buffer_.empty()) {
+            setme = std::move(spare_read_buffer_);
+            spare_read_buffer_ = std::vector<char>{};
+            return true;
+        }
+
+        if (read_buffers_.pop(setme))
+            return true;
+
+        // allocate buffers lazily, up to N_READ_BUFFERS
+        if (n_read_buffers_ < N_READ_BUFFERS) {
+            ++n_read_buffers_;
+            setme.resize(size_t(READ_CHUNK_SIZE));
+            return true;
+        }
+
+        return wait_to_pop(read_buffers_, setme, stats_.reader);
+    }
+
+    bool push_chunk(Chunk& chunk)
+    {
+        return wait_to_push(to_compressor_, std::move(chunk), stats_.reader);
+    }
+
+    void reader_main()
+    {
+        // keep several files' reads in flight at once,
+        // rather than waiting on each small file in turn
+        AsyncFileReader files(files_to_read_);
+
+        for (auto const& filename : files_to_read_)
+        {
+            for (;;)
+            {
+                Chunk chunk;
+                if (!get_read_buffer(chunk.buf))
+                    return;
+                chunk.buf.resize(size_t(READ_CHUNK_SIZE));
+                chunk.len = files.read(chunk.buf.data(), READ_CHUNK_SIZE);
+
+                if (chunk.len <= 0) {
+                    // the compressor doesn't need a buffer for EOF or errors,
+                    // so keep it for the next file
+                    spare_read_buffer_ = std::move(chunk.buf);
+                    chunk.buf = std::vector<char>{};
+                    if (chunk.len < 0)
+                        qWarning() << "Unable to read" << filename.constData() << ':' << files.error_string();
+                    if (!push_chunk(chunk))
+                        return;
+                    break;
+                }
+
+                if (!push_chunk(chunk))
+                    return;
+            }
+        }
+
+        const auto read_stats = files.stats();
+        stats_.reader_input.n_stalls = read_stats.n_stalls;
+        stats_.reader_input.stall_usec = read_stats.stall_usec;
+    }
+
+    /***
+    ****  Compressor stage
+    ***/
+
+    // TarCreator's data source
+    qint64 next_chunk(const char** data)
+    {
+        // give the last chunk's buffer back to the reader
+        if (!current_.buf.empty())
+            read_buffers_.push(std::move(current_.buf));
+        current_ = Chunk{};
+
+        if (!wait_to_pop(to_compressor_, current_, stats_.compressor_input))
+            return -1;
+
+        *data = current_.buf.data();
+        return current_.len;
+    }
+
+    void compressor_main()
+    {
+        try
+        {
+            std::vector<char> buf;
+            for (;;)
+            {
+                if (buf.empty())
+                    send_buffers_.pop(buf); // reuse a buffer if one's free
+                if (!creator_.step(buf))
+                    break;
+                if (buf.empty()) // libarchive is still buffering
+                    continue;
+                if (!wait_to_push(to_sender_, std::move(buf), stats_.compressor_output))
+                    return;
+                buf = std::vector<char>{};
+            }
+        }
+        catch (std::exception const& e)
+        {
+            qWarning() << "Error creating archive:" << e.what();
+            compressor_failed_ = true;
+        }
+
+        // an empty buffer tells the sender that we're done
+        std::vector<char> done;
+        wait_to_push(to_sender_, std::move(done), stats_.compressor_output);
+    }
+
+    /***
+    ****  Sender stage
+    ***/
+
+    bool write_all(std::vector<char> const& buf)
+    {
+        const char* walk = buf.data();
+        auto n_left = buf.size();
+        while (n_left > 0)
+        {
+            const auto n_written = write(fd_, walk, n_left);
+            if (n_written > 0) {
+                if (observer_)
+                    observer_(walk, size_t(n_written));
+                walk += n_written;
+                n_left -= size_t(n_written);
+            } else if ((errno == EAGAIN) || (errno == EINTR)) {
+                // the keeper socket may be nonblocking, so wait instead of spinning
+                if (!wait_for_fd(fd_, POLLOUT, stats_.sender_output))
+                    return false;
+            } else {
+                qCritical("error sending tar to Keeper: %s", strerror(errno));
+                return false;
+            }
+        }
+        return true;
+    }
+
+    TarCreator creator_;
+    PathTable files_to_read_;
+    int fd_ {-1};
+    Observer observer_;
+    Stats stats_;
+
+    std::thread reader_thread_;
+    std::thread compressor_thread_;
+    std::atomic<bool> cancelled_ {};
+    std::atomic<bool> compressor_failed_ {};
+
+    // reader -> compressor
+    SpscQueue<Chunk> to_compressor_;
+    SpscQueue<std::vector<char>> read_buffers_;
+    size_t n_read_buffers_ {};
+    std::vector<char> spare_read_buffer_;
+    Chunk current_;
+
+    // compressor -> sender
+    SpscQueue<std::vector<char>> to_sender_;
+    SpscQueue<std::vector<char>> send_buffers_;
+};
+
+/**
+***
+**/
+
+TarPipeline::TarPipeline(PathTable const& filenames, Codec const& codec, int n_threads)
+    : impl_{new Impl{filenames, codec, n_threads}}
+{
+}
+
+TarPipeline::TarPipeline(const QStringList& filenames, Codec const& codec, int n_threads)
+    : TarPipeline{PathTable{filenames}, codec, n_threads}
+{
+}
+
+TarPipeline::~TarPipeline() =default;
+
+void
+TarPipeline::set_store_incompressible(bool enabled)
+{
+    impl_->set_store_incompressible(enabled);
+}
+
+void
+TarPipeline::set_find_duplicates(bool enabled)
+{
+    impl_->set_find_duplicates(enabled);
+}
+
+void
+TarPipeline::set_seekable(bool enabled)
+{
+    impl_->set_seekable(enabled);
+}
+
+void
+TarPipeline::set_hash_cache(std::shared_ptr<HashCache> const& hash_cache)
+{
+    impl_->set_hash_cache(hash_cache);
+}
+
+void
+TarPipeline::set_observer(Observer const& observer)
+{
+    impl_->set_observer(observer);
+}
+
+void
+TarPipeline::add_memory_file(QByteArray const& name, QByteArray const& contents)
+{
+    impl_->add_memory_file(name, contents);
+}
+
+ssize_t
+TarPipeline::calculate_size() const
+{
+    return impl_->calculate_size();
+}
+
+ssize_t
+TarPipeline::send(int fd)
+{
+    return impl_->send(fd);
+}
+
+TarPipeline::Stats
+TarPipeline::stats() const
+{
+    return impl_->stats();
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/codec.h"
+#include "tar/path-table.h"
+#include "tar/tar-creator.h"
+#include "util/wait-for-fd.h"
+
+#include <QStringList>
+
+#include <cstddef> // ssize_t
+#include <functional>
+#include <memory> // shared_ptr
+
+/**
+ * Builds an archive with TarCreator and sends it to a file descriptor,
+ * keeping the disk, the CPU, and the socket busy at the same time.
+ *
+ * The work is split into three stages, each on its own thread:
+ * a reader that reads the files ahead with an AsyncFileReader,
+ * a compressor that runs TarCreator over what was read, and a
+ * sender that writes the archive to `fd'. The stages pass reusable buffers to each other
+ * through bounded lock-free queues.
+ */
+class TarPipeline
+{
+public:
+    TarPipeline(PathTable const& files, Codec const& codec, int n_threads=1);
+    TarPipeline(const QStringList& files, Codec const& codec, int n_threads=1);
+    ~TarPipeline();
+
+    // see TarCreator::set_store_incompressible()
+    void set_store_incompressible(bool enabled);
+
+    // see TarCreator::set_find_duplicates()
+    void set_find_duplicates(bool enabled);
+
+    // see TarCreator::set_seekable()
+    void set_seekable(bool enabled);
+
+    // see TarCreator::set_hash_cache()
+    void set_hash_cache(std::shared_ptr<HashCache> const& hash_cache);
+
+    // see TarCreator::add_memory_file()
+    void add_memory_file(QByteArray const& name, QByteArray const& contents);
+
+    // Called on the sending thread with each part of the archive
+    // once it's been sent, e.g. to report progress.
+    using Observer = std::function<void(char const* buf, size_t len)>;
+    void set_observer(Observer const& observer);
+
+    ssize_t calculate_size() const;
+
+    // returns the number of bytes sent, or -1 on error
+    ssize_t send(int fd);
+
+    using StageStats = StallStats;
+
+    // Each stage counts how often it had to wait on its neighbours,
+    // which shows where the bottleneck is: e.g. if the compressor is
+    // often waiting for input, the disk is the slowest stage.
+    struct Stats
+    {
+        StageStats reader_input; // waiting for the disk
+        StageStats reader; // waiting for the compressor to free a buffer
+        StageStats compressor_input; // waiting for the reader
+        StageStats compressor_output; // waiting for the sender
+        StageStats sender_input; // waiting for the compressor
+        StageStats sender_output; // waiting for the socket to drain
+        TarCreator::Stats creator;
+    };
+
+    Stats stats() const;
+
+private:
+    class Impl;
+    friend class Impl;
+    std::shared_ptr<Impl> impl_;
+};
@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+// for sendfile() and off_t on 32-bit systems; see tar-creator.cpp
+#define _FILE_OFFSET_BITS 64
+
+#include "tar/tar-header.h"
+#include "tar/tar-sender.h"
+
+#include <QDebug>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm> // std::min(), std::max()
+#include <cerrno>
+#include <cstdint> // uint32_t
+#include <cstring> // strerror()
+#include <ctime> // time()
+#include <memory> // shared_ptr
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    constexpr size_t BUF_FLUSH_SIZE {1024*64};
+    constexpr size_t READ_CHUNK {1024*64};
+    constexpr size_t SENDFILE_MAX_CHUNK {1024*1024*8};
+}
+
+class TarSender::Impl
+{
+public:
+
+    explicit Impl(PathTable const& filenames)
+        : filenames_(filenames)
+    {
+    }
+
+    void set_find_duplicates(bool enabled)
+    {
+        find_duplicates_ = enabled;
+    }
+
+    void set_hash_cache(std::shared_ptr<HashCache> const& hash_cache)
+    {
+        hash_cache_ = hash_cache;
+    }
+
+    void set_observer(Observer const& observer)
+    {
+        observer_ = observer;
+    }
+
+    void add_memory_file(QByteArray const& name, QByteArray const& contents)
+    {
+        MemoryFile file {name, contents, {}};
+        file.st.st_mode = S_IFREG | 0644;
+        file.st.st_size = off_t(contents.size());
+        file.st.st_uid = getuid();
+        file.st.st_gid = getgid();
+        file.st.st_mtim.tv_sec = time(nullptr);
+        memory_files_.push_back(file);
+    }
+
+    ssize_t calculate_size() const
+    {
+        ensure_entries();
+
+        ssize_t archive_size {};
+        for (size_t i=0, n_entries=entries_.size(); i<n_entries; ++i)
+        {
+            auto const& entry = entries_[i];
+            if (!entry.ok)
+                continue;
+            const auto n = content_size(i);
+            archive_size += ssize_t(entry.header_size + n + TarHeader::padding(n));
+        }
+        for (auto const& file : memory_files_)
+        {
+            const auto n = TarHeader::content_size(file.st);
+            archive_size += ssize_t(TarHeader::create(file.name.toStdString(), file.st).size() + n + TarHeader::padding(n));
+        }
+        archive_size += ssize_t(TarHeader::end_of_archive().size());
+        return archive_size;
+    }
+
+    ssize_t send(int fd)
+    {
+        ensure_entries();
+
+        fd_ = fd;
+        n_sent_ = 0;
+        stats_ = Stats{};
+        stats_.links = links_->stats();
+        buf_.clear();
+
+        size_t i {};
+        for (auto const& filename : filenames_)
+        {
+            const auto index = i++;
+            auto const& info = entries_[index];
+            if (!info.ok) {
+                stats_.incomplete.append(filename);
+                continue;
+            }
+
+            // headers are rebuilt here rather than kept, to save memory
+            append(create_header(filename, index));
+
+            const auto n = content_size(index);
+            if (n > 0)
+            {
+                if (!send_contents(filename, index))
+                    return -1;
+                buf_.resize(buf_.size() + TarHeader::padding(n), '\0');
+            }
+
+            if ((buf_.size() >= BUF_FLUSH_SIZE) && !flush())
+                return -1;
+        }
+
+        for (auto const& file : memory_files_)
+        {
+            append(TarHeader::create(file.name.toStdString(), file.st));
+            buf_.insert(buf_.end(), file.contents.begin(), file.contents.end());
+            buf_.resize(buf_.size() + TarHeader::padding(TarHeader::content_size(file.st)), '\0');
+        }
+
+        append(TarHeader::end_of_archive());
+        if (!flush())
+            return -1;
+
+        return n_sent_;
+    }
+
+    Stats stats() const
+    {
+        return stats_;
+    }
+
+    static size_t memory_per_file()
+    {
+        return sizeof(Entry);
+    }
+
+private:
+
+    // There's one of these for every file, so like TarCreator's FileInfo,
+    // it only keeps what goes into the file's header
+    struct Entry
+    {
+        off_t size {};
+        struct timespec mtime {};
+        mode_t mode {};
+        uid_t uid {};
+        gid_t gid {};
+        uint32_t header_size {};
+        bool ok {};
+        bool linked {}; // a hard link to an earlier file, with no contents of its own
+        bool sparse {}; // the file has holes; its map is in sparse_maps_
+
+        void set(struct stat const& st)
+        {
+            size = st.st_size;
+            mtime = st.st_mtim;
+            mode = st.st_mode;
+            uid = st.st_uid;
+            gid = st.st_gid;
+        }
+
+        struct stat to_stat() const
+        {
+            struct stat st {};
+            st.st_size = size;
+            st.st_mtim = mtime;
+            st.st_mode = mode;
+            st.st_uid = uid;
+            st.st_gid = gid;
+            return st;
+        }
+    };
+
+    struct MemoryFile
+    {
+        QByteArray name;
+        QByteArray contents;
+        struct stat st;
+    };
+
+    std::vector<char> create_header(QByteArray const& filename, size_t i) const
+    {
+        auto const& entry = entries_[i];
+        const auto st = entry.to_stat();
+        size_t target;
+        if (entry.linked && links_->find_target(i, target))
+            return TarHeader::create_hardlink(filename.toStdString(), st, filenames_.at(target).toStdString());
+        if (entry.sparse)
+            return TarHeader::create_sparse(filename.toStdString(), st, sparse_maps_.at(i));
+        return TarHeader::create(filename.toStdString(), st);
+    }
+
+    size_t content_size(size_t i) const
+    {
+        auto const& entry = entries_[i];
+        if (entry.linked)
+            return 0;
+        if (entry.sparse)
+            return TarHeader::content_size(sparse_maps_.at(i));
+        return TarHeader::content_size(entry.to_stat());
+    }
+
+    // stat each file once, so that calculate_size() and send() agree
+    void ensure_entries() const
+    {
+        if (entries_valid_)
+            return;
+
+        entries_.clear();
+        entries_.reserve(size_t(filenames_.size()));
+        sparse_maps_.clear();
+        links_.reset(new LinkFinder{filenames_, find_duplicates_, hash_cache_});
+        for (auto const& filename : filenames_)
+        {
+            Entry entry;
+            // like TarCreator, follow symlinks
+            struct stat st {};
+            entry.ok = stat(filename.constData(), &st) != -1;
+            if (!entry.ok) {
+                qWarning() << "Unable to stat" << filename.constData() << ':' << strerror(errno);
+                st = {};
+            }
+            entry.set(st);
+            // while we have its blocks, which aren't kept
+            if (entry.ok && SparseMap::maybe_sparse(st))
+                entry.sparse = find_sparse_map(filename, st, sparse_maps_[entries_.size()]);
+            links_->add(st);
+            entries_.push_back(entry);
+        }
+        links_->finish();
+
+        // now that we know which files are links, build their headers
+        size_t i {};
+        for (auto const& filename : filenames_)
+        {
+            auto& entry = entries_[i];
+            size_t target;
+            entry.linked = entry.ok && links_->find_target(i, target);
+            if (entry.linked)
+                entry.sparse = false;
+            if (!entry.sparse)
+                sparse_maps_.erase(i);
+            if (entry.ok)
+                entry.header_size = uint32_t(create_header(filename, i).size());
+            ++i;
+        }
+
+        entries_valid_ = true;
+    }
+
+    void append(std::vector<char> const& bytes)
+    {
+        buf_.insert(buf_.end(), bytes.begin(), bytes.end());
+    }
+
+    static bool find_sparse_map(QByteArray const& filename, struct stat const& st, SparseMap& setme)
+    {
+        const auto fd = open(filename.constData(), O_RDONLY|O_CLOEXEC);
+        if (fd == -1)
+            return false;
+        const auto found = SparseMap::find(fd, st, setme);
+        close(fd);
+        return found;
+    }
+
+    // sends the entry's contents, exactly as many bytes as its header says,
+    // even if the file has changed size since we wrote its header,
+    // so that the archive stays valid. Sparse files only send their
+    // map and data regions, and seek past the holes.
+    bool send_contents(QByteArray const& filename, size_t i)
+    {
+        auto const& entry = entries_[i];
+        const auto fd = open(filename.constData(), O_RDONLY|O_CLOEXEC);
+        if (fd == -1)
+            qWarning() << "Unable to open" << filename.constData() << ':' << strerror(errno);
+
+        std::vector<SparseMap::Region> regions;
+        if (entry.sparse) {
+            auto const& map = sparse_maps_.at(i);
+            append(TarHeader::sparse_map_block(map));
+            regions = map.regions;
+        } else {
+            regions.push_back(SparseMap::Region{0, int64_t(TarHeader::content_size(entry.to_stat()))});
+        }
+
+        bool ok = true;
+        size_t n_missing {};
+        for (auto const& region : regions)
+        {
+            const auto n = size_t(region.length);
+            size_t n_done {};
+
+            auto readable = fd != -1;
+            if (readable && (region.offset > 0) && (lseek(fd, off_t(region.offset), SEEK_SET) == -1)) {
+                qWarning() << "Unable to seek in" << filename.constData() << ':' << strerror(errno);
+                readable = false;
+            }
+
+            if (readable && (qint64(n) >= SENDFILE_MIN_SIZE))
+            {
+                // sendfile() sends from the file, so send our buffered headers first
+                ok = flush();
+                if (ok)
+                {
+                    posix_fadvise(fd, off_t(region.offset), off_t(n), POSIX_FADV_SEQUENTIAL);
+                    n_done = send_with_sendfile(fd, n, ok);
+                }
+            }
+
+            // small files, or anything sendfile() couldn't send, go through our buffer
+            if (ok && readable && (n_done < n))
+                n_done += send_with_read(fd, n - n_done, ok);
+
+            if (!ok)
+                break;
+
+            // if the file shrank, pad it out to the size in its header
+            if (n_done < n) {
+                n_missing += n - n_done;
+                buf_.resize(buf_.size() + (n - n_done), '\0');
+            }
+        }
+
+        if (fd != -1)
+            close(fd);
+
+        if (n_missing > 0) {
+            qWarning() << filename.constData() << "shrank by" << n_missing << "bytes while being archived";
+            stats_.incomplete.append(filename);
+        }
+
+        return ok;
+    }
+
+    size_t send_with_sendfile(int fd, size_t n, bool& ok)
+    {
+        size_t n_done {};
+        while (n_done < n)
+        {
+            const auto n_sent = sendfile(fd_, fd, nullptr, std::min(n - n_done, SENDFILE_MAX_CHUNK));
+            if (n_sent > 0) {
+                n_done += size_t(n_sent);
+                n_sent_ += n_sent;
+                stats_.n_bytes_sendfile += n_sent;
+                if (observer_)
+                    observer_(nullptr, size_t(n_sent));
+            } else if (n_sent == 0) { // file shrank
+                break;
+            } else if ((errno == EAGAIN) || (errno == EINTR)) {
+                if (!wait_for_writable()) {
+                    ok = false;
+                    break;
+                }
+            } else if ((errno == EINVAL) || (errno == ENOSYS)) { // not supported here; fall back
+                break;
+            } else {
+                qCritical("error sending file contents to Keeper: %s", strerror(errno));
+                ok = false;
+                break;
+            }
+        }
+        return n_done;
+    }
+
+    size_t send_with_read(int fd, size_t n, bool& ok)
+    {
+        size_t n_done {};
+        while (n_done < n)
+        {
+            const auto old_size = buf_.size();
+            const auto want = std::min(n - n_done, READ_CHUNK);
+            buf_.resize(old_size + want);
+            const auto n_read = read(fd, &buf_[old_size], want);
+            if (n_read < 0 && errno == EINTR) {
+                buf_.resize(old_size);
+                continue;
+            }
+            buf_.resize(old_size + size_t(std::max(n_read, ssize_t(0))));
+            if (n_read < 0) {
+                qWarning() << "Error reading file:" << strerror(errno);
+                break;
+            }
+            if (n_read == 0) // file shrank
+                break;
+            n_done += size_t(n_read);
+            stats_.n_bytes_copied += n_read;
+
+            if ((buf_.size() >= BUF_FLUSH_SIZE) && !flush()) {
+                ok = false;
+                break;
+            }
+        }
+        return n_done;
+    }
+
+    bool flush()
+    {
+        const char* walk = buf_.data();
+        auto n_left = buf_.size();
+        while (n_left > 0)
+        {
+            const auto n_written = write(fd_, walk, n_left);
+            if (n_written > 0) {
+                if (observer_)
+                    observer_(walk, size_t(n_written));
+                walk += n_written;
+                n_left -= size_t(n_written);
+                n_sent_ += n_written;
+            } else if ((errno == EAGAIN) || (errno == EINTR)) {
+                if (!wait_for_writable())
+                    return false;
+            } else {
+                qCritical("error sending tar to Keeper: %s", strerror(errno));
+                return false;
+            }
+        }
+
+        buf_.clear();
+        return true;
+    }
+
+    // the keeper socket may be nonblocking, so wait instead of spinning
+    bool wait_for_writable()
+    {
+        return wait_for_fd(fd_, POLLOUT, stats_.socket);
+    }
+
+    const PathTable filenames_;
+    bool find_duplicates_ {};
+    std::shared_ptr<HashCache> hash_cache_;
+    Observer observer_;
+    mutable std::shared_ptr<LinkFinder> links_;
+    mutable std::vector<Entry> entries_;
+    mutable std::unordered_map<size_t,SparseMap> sparse_maps_; // entry index -> map
+    mutable bool entries_valid_ {};
+    std::vector<MemoryFile> memory_files_;
+
+    int fd_ {-1};
+    ssize_t n_sent_ {};
+    std::vector<char> buf_;
+    Stats stats_;
+};
+
+/**
+***
+**/
+
+TarSender::TarSender(PathTable const& filenames)
+    : impl_{new Impl{filenames}}
+{
+}
+
+TarSender::TarSender(const QStringList& filenames)
+    : TarSender{PathTable{filenames}}
+{
+}
+
+TarSender::~TarSender() =default;
+
+void
+TarSender::set_find_duplicates(bool enabled)
+{
+    impl_->set_find_duplicates(enabled);
+}
+
+void
+TarSender::set_hash_cache(std::shared_ptr<HashCache> const& hash_cache)
+{
+    impl_->set_hash_cache(hash_cache);
+}
+
+void
+TarSender::set_observer(Observer const& observer)
+{
+    impl_->set_observer(observer);
+}
+
+void
+TarSender::add_memory_file(QByteArray const& name, QByteArray const& contents)
+{
+    impl_->add_memory_file(name, contents);
+}
+
+ssize_t
+TarSender::calculate_size() const
+{
+    return impl_->calculate_size();
+}
+
+ssize_t
+TarSender::send(int fd)
+{
+    return impl_->send(fd);
+}
+
+TarSender::Stats
+TarSender::stats() const
+{
+    return impl_->stats();
+}
+
+size_t
+TarSender::memory_per_file()
+{
+    return Impl::memory_per_file();
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "tar/link-finder.h"
+#include "tar/path-table.h"
+#include "util/wait-for-fd.h"
+
+#include <QStringList>
+
+#include <cstddef> // ssize_t
+#include <functional>
+#include <memory> // shared_ptr
+
+/**
+ * Writes an uncompressed tar archive straight to a file descriptor.
+ *
+ * Unlike TarCreator, this doesn't build the archive in memory:
+ * it writes the ustar/pax headers itself and uses sendfile() to
+ * move large file bodies from the page cache into `fd' without
+ * copying them through userspace.
+ */
+class TarSender
+{
+public:
+    explicit TarSender(PathTable const& files);
+    explicit TarSender(const QStringList& files);
+    ~TarSender();
+
+    // if enabled, files with the same contents as an earlier file are
+    // archived as hard links to it; see LinkFinder. Hard links to the
+    // same inode always are. Must be called before calculate_size() or send().
+    void set_find_duplicates(bool enabled);
+
+    // see TarCreator::set_hash_cache()
+    void set_hash_cache(std::shared_ptr<HashCache> const& hash_cache);
+
+    // Adds a file that isn't on disk, e.g. a list of deleted files,
+    // after the files from disk. Must be called before calculate_size() or send().
+    void add_memory_file(QByteArray const& name, QByteArray const& contents);
+
+    // Called on the sending thread with each part of the archive
+    // once it's been sent, e.g. to report progress. `buf' is null
+    // for parts that were sent with sendfile().
+    using Observer = std::function<void(char const* buf, size_t len)>;
+    void set_observer(Observer const& observer);
+
+    // files at least this big are sent with sendfile()
+    static constexpr qint64 SENDFILE_MIN_SIZE {1024*64};
+
+    ssize_t calculate_size() const;
+
+    // returns the number of bytes sent, or -1 on error
+    ssize_t send(int fd);
+
+    struct Stats
+    {
+        qint64 n_bytes_copied {}; // bytes copied through our own buffers
+        qint64 n_bytes_sendfile {}; // bytes moved by the kernel with sendfile()
+        StallStats socket; // waiting for keeper's socket to drain
+        LinkFinder::Stats links; // files that were sent as hard links instead
+        PathTable incomplete; // files that were left out or padded with zeroes because they couldn't be read
+    };
+
+    Stats stats() const;
+
+    // the memory held for each file until it's sent, besides its path
+    static size_t memory_per_file();
+
+private:
+    class Impl;
+    friend class Impl;
+    std::shared_ptr<Impl> impl_;
+};
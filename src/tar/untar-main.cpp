@@ -20,6 +20,7 @@
 #include "tar/untar.h"
 #include "qdbus-stubs/dbus-types.h"
 #include "qdbus-stubs/keeper_helper_interface.h"
+#include "util/wait-for-fd.h"
 
 #include <QCommandLineParser>
 #include <QCoreApplication>
@@ -29,19 +30,24 @@
 #include <QDBusUnixFileDescriptor>
 #include <QFile>
 #include <QLocalSocket>
+#include <QThread>
 
+#include <poll.h>
 #include <sys/select.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <cstdio> // fileno()
+#include <cstring> // strerror()
 #include <ctime>
 #include <iostream>
 #include <type_traits>
+#include <vector>
 
 namespace
 {
 
-std::tuple<QString>
+std::tuple<QString,int>
 parse_args(QCoreApplication& app)
 {
     // parse the command line
@@ -49,9 +55,8 @@ parse_args(QCoreApplication& app)
     parser.addHelpOption();
     parser.setApplicationDescription(
         "\n"
-        "The reverse of keeper-tar. Queries Keeper for a socket fd, then pipes\n"
-        "that socket through xzcat and tar to restore the archive data into the current\n"
-        "working directory.\n"
+        "The reverse of keeper-tar. Queries Keeper for a socket fd, then extracts\n"
+        "the archive that it reads from that socket into the current working directory.\n"
         "\n"
         "Helper usage: "  APP_NAME " -a /bus/path"
     );
@@ -61,6 +66,13 @@ parse_args(QCoreApplication& app)
         QStringLiteral("bus-path")
     };
     parser.addOption(bus_path_option);
+    QCommandLineOption threads_option{
+        QStringList() << "j" << "threads",
+        QStringLiteral("Number of threads to decompress and write files with, or 0 for one per CPU core"),
+        QStringLiteral("threads"),
+        QStringLiteral("0")
+    };
+    parser.addOption(threads_option);
     parser.process(app);
     const auto bus_path = parser.value(bus_path_option);
 
@@ -70,7 +82,16 @@ parse_args(QCoreApplication& app)
         parser.showHelp(EXIT_FAILURE);
     }
 
-    return std::make_tuple(bus_path);
+    bool threads_ok {};
+    auto n_threads = parser.value(threads_option).toInt(&threads_ok);
+    if (!threads_ok || (n_threads < 0)) {
+        std::cerr << "Invalid argument: --threads" << std::endl;
+        parser.showHelp(EXIT_FAILURE);
+    }
+    if (n_threads == 0)
+        n_threads = QThread::idealThreadCount();
+
+    return std::make_tuple(bus_path, n_threads);
 }
 
 QDBusUnixFileDescriptor
@@ -104,16 +125,17 @@ bool
 untar_from_socket(Untar& untar, int fd)
 {
     bool success = false;
-    static constexpr int STEP_BUFSIZE = 4096*4; // arbitrary
-    char buf[STEP_BUFSIZE];
+    static constexpr int STEP_BUFSIZE = 1024*64; // matches what keeper relays at a time
+    std::vector<char> buf(STEP_BUFSIZE);
+    StallStats stalls;
 
     for (;;)
     {
-        auto const n_read = read(fd, buf, sizeof(buf));
+        auto const n_read = read(fd, buf.data(), buf.size());
 
         if (n_read > 0)
         {
-            if (!untar.step(buf, n_read))
+            if (!untar.step(buf.data(), size_t(n_read)))
                 break;
         }
         else if (n_read == 0) // eof
@@ -122,10 +144,11 @@ untar_from_socket(Untar& untar, int fd)
             success = true;
             break;
         }
-        else if (errno == EAGAIN)
+        else if ((errno == EAGAIN) || (errno == EINTR))
         {
-            QThread::msleep(100);
-            continue;
+            // keeper's socket is nonblocking, so wait for data instead of spinning
+            if (!wait_for_fd(fd, POLLIN, stalls))
+                break;
         }
         else
         {
@@ -133,6 +156,7 @@ untar_from_socket(Untar& untar, int fd)
             break;
         }
     }
+    qDebug() << "waited for Keeper" << stalls.n_stalls << "times for" << stalls.stall_usec/1000 << "msec";
 
     if (success)
         success = untar.finish();
@@ -149,7 +173,8 @@ main(int argc, char **argv)
 
     // get the inputs
     QString bus_path;
-    std::tie(bus_path) = parse_args(app);
+    int n_threads;
+    std::tie(bus_path, n_threads) = parse_args(app);
 
     // ask keeper for a socket to read
     const auto qfd = get_socket_from_keeper(bus_path);
@@ -160,7 +185,9 @@ main(int argc, char **argv)
 
     // do it!
     auto const cwd = QDir::currentPath().toStdString();
-    Untar untar{cwd};
+    Untar untar{cwd, n_threads, [](std::string const& path, int64_t size){
+        qDebug() << "restored" << path.c_str() << size << "bytes";
+    }};
     auto const ret = untar_from_socket(untar, qfd.fileDescriptor())
         ? EXIT_SUCCESS
         : EXIT_FAILURE;
@@ -17,27 +17,36 @@
  *   Charles Kerr <charles.kerr@canonical.com>
  */
 
+#include "tar/archive-extractor.h"
+#include "tar/block-decompressor.h"
+#include "tar/catalog.h"
+#include "tar/codec.h"
+#include "tar/safe-path.h"
+#include "tar/seekable-archive.h"
 #include "tar/untar.h"
 
+#include <QByteArray>
 #include <QDebug>
-#include <QProcess>
-#include <QString>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring> // strerror()
+#include <memory>
 #include <string>
+#include <utility> // std::move()
 #include <vector>
 
 class Untar::Impl
 {
 public:
 
-    explicit Impl(std::string const& path)
+    Impl(std::string const& path, int n_threads, EntryFunc const& on_entry)
         : path_{path}
+        , n_threads_{n_threads}
+        , extractor_{path, n_threads, on_entry}
     {
-        uncompress_.setStandardOutputProcess(&untar_);
-        uncompress_.start("xz", QStringList{ "--decompress", "--stdout", "--force" });
-
-        untar_.start("tar", QStringList{ "-xv", "-C", path_.c_str()});
-        untar_.setProcessChannelMode(QProcess::ForwardedChannels);
     }
 
     ~Impl()
@@ -47,85 +56,156 @@ public:
 
     bool step(char const * buf, size_t buflen)
     {
-        bool success = true;
-
-        auto n_left = buflen;
-        while (n_left > 0)
+        // wait until we have enough bytes to tell if it's a seekable archive
+        if (!container_known_)
         {
-            auto const n_written_this_pass = uncompress_.write(buf, n_left);
-            if (n_written_this_pass == -1) {
-                qCritical() << Q_FUNC_INFO << strerror(errno);
-                success = false;
-                break;
-            } else {
-                n_left -= n_written_this_pass;
-                buf += n_written_this_pass;
-            }
+            prefix_.insert(prefix_.end(), buf, buf+buflen);
+            if (prefix_.size() < SeekableArchive::HEADER_SIZE)
+                return true;
+            return start_container();
         }
 
-        return success;
+        if (!seekable_)
+            return extractor_.write(buf, buflen);
+
+        // strip a seekable archive's framing; its blocks' payloads are a normal archive
+        bool ok = true;
+        if (n_threads_ > 1)
+        {
+            // the blocks are independent, so decompress them ourselves in parallel
+            reader_.feed(buf, buflen,
+                [this](char const* payload, size_t len){
+                    block_.insert(block_.end(), payload, payload+len);
+                },
+                [this, &ok](){
+                    ok = ok && decompress_block();
+                }
+            );
+        }
+        else
+        {
+            reader_.feed(buf, buflen, [this, &ok](char const* payload, size_t len){
+                ok = ok && extractor_.write(payload, len);
+            });
+        }
+        return ok && !reader_.failed();
     }
 
     bool finish ()
     {
         bool ok = true;
 
-        uncompress_.closeWriteChannel();
-        if (!finish(uncompress_, "xz"))
+        // maybe the archive was too small to fill prefix_
+        if (!container_known_ && !start_container())
             ok = false;
 
-        if (!finish(untar_, "untar"))
+        if (seekable_ && !reader_.at_end())
+        {
+            qCritical() << "seekable archive is truncated";
+            ok = false;
+        }
+
+        if (decompressor_ && !write_decompressed(true))
             ok = false;
 
+        if (!extractor_.finish())
+            ok = false;
+
+        if (ok)
+            apply_deletion_list();
+
         return ok;
     }
 
 private:
 
-    bool finish (QProcess& proc, QString const& name)
+    bool start_container()
     {
-        if (proc.state() != QProcess::NotRunning)
+        container_known_ = true;
+        seekable_ = SeekableArchive::is_seekable(prefix_.data(), prefix_.size());
+        if (seekable_)
+            qDebug() << "restoring seekable archive";
+
+        std::vector<char> prefix;
+        std::swap(prefix, prefix_);
+        return step(prefix.data(), prefix.size());
+    }
+
+    bool decompress_block()
+    {
+        if (!decompressor_)
         {
-            proc.waitForFinished();
+            const auto type = Codec::detect(block_.data(), block_.size());
+            qDebug() << "decompressing" << Codec::name(type) << "blocks on" << n_threads_ << "threads";
+            decompressor_.reset(new BlockDecompressor{type, n_threads_});
         }
 
-        bool ok;
+        decompressor_->write(std::move(block_));
+        block_.clear();
+        return write_decompressed(false);
+    }
 
-        if (proc.state() != QProcess::NotRunning)
-        {
-            qCritical() << name << "did not finish";
-            ok = false;
-        }
-        else if (proc.exitStatus() != QProcess::NormalExit)
+    // extracts the blocks that are done, in order
+    bool write_decompressed(bool wait)
+    {
+        std::vector<char> raw;
+        if (!decompressor_->take(raw, wait))
         {
-            qCritical() << name << "exited abnormally";
-            ok = false;
+            qCritical() << "unable to decompress an archive block";
+            return false;
         }
-        else if (proc.exitCode() != 0)
-        {
-            qCritical() << name << "exited with error code" << proc.exitCode();
-            ok = false;
+        return extractor_.write(raw.data(), raw.size());
+    }
+
+    // An incremental backup lists the files that were deleted since its
+    // base backup, which was restored before it, so delete them now.
+    // Only this archive's list counts, not a file on disk with its name.
+    void apply_deletion_list()
+    {
+        std::string list;
+        if (!extractor_.take_deletion_list(list))
+            return;
+
+        const auto dirfd = open(path_.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (dirfd == -1) {
+            qWarning() << "Unable to open" << path_.c_str() << ':' << strerror(errno);
+            return;
         }
-        else
+
+        for (auto const& path : Catalog::parse_deletion_list(QByteArray::fromStdString(list)))
         {
-            qDebug() << name << "finished ok";
-            ok = true;
+            // don't let a bad archive delete anything outside of path_,
+            // neither through '..' nor through a symlink on disk
+            const auto filename = path.toStdString();
+            if (has_dotdot(filename)) {
+                qWarning() << "Not deleting" << path << "because it's outside of" << path_.c_str();
+                continue;
+            }
+
+            if (!unlink_beneath(dirfd, filename))
+                qWarning() << "Unable to delete" << path << ':' << strerror(errno);
         }
 
-        return ok;
+        close(dirfd);
     }
 
     std::string const path_;
-    QProcess uncompress_;
-    QProcess untar_;
+    int const n_threads_;
+    std::vector<char> prefix_;
+    bool container_known_ {};
+    bool seekable_ {};
+    SeekableArchive::Reader reader_;
+    std::vector<char> block_;
+    std::shared_ptr<BlockDecompressor> decompressor_;
+    ArchiveExtractor extractor_;
 };
 
 /**
 ***
 **/
 
-Untar::Untar(std::string const& path)
-    : impl_{new Impl{path}}
+Untar::Untar(std::string const& path, int n_threads, EntryFunc const& on_entry)
+    : impl_{new Impl{path, n_threads, on_entry}}
 {
 }
 
@@ -19,14 +19,25 @@
 
 #pragma once
 
+#include "tar/archive-extractor.h"
+
 #include <cstddef> // size_t
 #include <memory> // shared_ptr
+#include <string>
 
 
 class Untar
 {
 public:
-    explicit Untar(std::string const& target_path);
+    using EntryFunc = ArchiveExtractor::EntryFunc;
+
+    // If n_threads > 1, files are written on that many threads,
+    // and a SeekableArchive's blocks are decompressed on that
+    // many threads instead of one after the other.
+    // `on_entry' is called after each file is extracted.
+    explicit Untar(std::string const& target_path,
+                   int n_threads=1,
+                   EntryFunc const& on_entry=EntryFunc());
     ~Untar();
     bool step(char const * buf, size_t n_bytes);
     bool finish();
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/archive-magic.h"
+
+#include <cstring> // memcmp()
+
+namespace
+{
+    constexpr char const XZ_MAGIC[] = { '\xFD', '7', 'z', 'X', 'Z', '\x00' };
+    constexpr char const ZSTD_MAGIC[] = { '\x28', '\xB5', '\x2F', '\xFD' };
+
+    template<size_t N>
+    bool has_magic(char const* buf, size_t buflen, char const (&magic)[N])
+    {
+        return (buflen >= N) && !memcmp(buf, magic, N);
+    }
+}
+
+static_assert(sizeof(XZ_MAGIC) <= ArchiveMagic::MAGIC_SIZE_MAX, "xz magic size");
+static_assert(sizeof(ZSTD_MAGIC) <= ArchiveMagic::MAGIC_SIZE_MAX, "zstd magic size");
+
+char const ArchiveMagic::SEEKABLE_HEADER[8] = { 'K', 'E', 'E', 'P', 'S', 'K', 'A', '1' };
+constexpr size_t ArchiveMagic::SEEKABLE_HEADER_SIZE;
+constexpr size_t ArchiveMagic::SEEKABLE_BLOCK_HEADER_SIZE;
+constexpr size_t ArchiveMagic::MAGIC_SIZE_MAX;
+constexpr size_t ArchiveMagic::HEAD_SIZE_MAX;
+
+bool
+ArchiveMagic::is_seekable(char const* buf, size_t buflen)
+{
+    return has_magic(buf, buflen, SEEKABLE_HEADER);
+}
+
+ArchiveMagic::Type
+ArchiveMagic::detect(char const* buf, size_t buflen)
+{
+    constexpr auto first_block = SEEKABLE_HEADER_SIZE + SEEKABLE_BLOCK_HEADER_SIZE;
+    if (is_seekable(buf, buflen) && (buflen > first_block))
+        return detect(buf + first_block, buflen - first_block);
+
+    if (has_magic(buf, buflen, XZ_MAGIC))
+        return Type::XZ;
+
+    if (has_magic(buf, buflen, ZSTD_MAGIC))
+        return Type::ZSTD;
+
+    return Type::NONE;
+}
+
+QString
+ArchiveMagic::name(Type type)
+{
+    switch (type)
+    {
+        case Type::XZ: return QStringLiteral("xz");
+        case Type::ZSTD: return QStringLiteral("zstd");
+        case Type::NONE: break;
+    }
+    return QStringLiteral("none");
+}
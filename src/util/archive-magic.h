@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QString>
+
+#include <cstddef> // size_t
+
+/**
+ * Identifies a keeper archive's compression from its first few bytes.
+ *
+ * This is all the service needs to know about an archive's format,
+ * so it's kept apart from the codecs and their libraries.
+ */
+struct ArchiveMagic
+{
+    enum class Type { NONE, XZ, ZSTD };
+
+    // a SeekableArchive starts with this, then its first block's header
+    static char const SEEKABLE_HEADER[8];
+    static constexpr size_t SEEKABLE_HEADER_SIZE {sizeof(SEEKABLE_HEADER)};
+    static constexpr size_t SEEKABLE_BLOCK_HEADER_SIZE {4};
+
+    // detect() needs up to this many bytes
+    static constexpr size_t MAGIC_SIZE_MAX {6};
+    static constexpr size_t HEAD_SIZE_MAX {SEEKABLE_HEADER_SIZE + SEEKABLE_BLOCK_HEADER_SIZE + MAGIC_SIZE_MAX};
+
+    // true if `buf' starts with a seekable archive's header
+    static bool is_seekable(char const* buf, size_t buflen);
+
+    // a seekable archive's type is the type of its blocks
+    static Type detect(char const* buf, size_t buflen);
+
+    // "none", "xz" or "zstd"
+    static QString name(Type type);
+};
@@ -78,19 +78,26 @@ public:
         );
     }
 
+    // If the future throws, `callme' is called with a default-constructed
+    // result, or `on_error' is called instead if there is one, for callers
+    // that need to tell a failure from an empty result.
     template<typename ResultType>
     void
     connect_future(QFuture<ResultType> future,
-                   std::function<void(ResultType const&)> const& callme)
+                   std::function<void(ResultType const&)> const& callme,
+                   std::function<void()> const& on_error = std::function<void()>())
     {
         auto watcher = new QFutureWatcher<ResultType>{};
 
-        std::function<void()> on_finished = [watcher, callme](){
+        std::function<void()> on_finished = [watcher, callme, on_error](){
             try {
                 callme(watcher->result());
             } catch(std::exception& e) {
                 qWarning() << "future threw error:" << e.what();
-                callme(ResultType{});
+                if (on_error)
+                    on_error();
+                else
+                    callme(ResultType{});
             }
         };
         std::function<void()> closure = [watcher](){ watcher->deleteLater();};
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/relay-loop.h"
+
+#include <QDebug>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm> // std::find(), std::remove()
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint> // uint64_t
+#include <cstring> // strerror()
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    void poke(int fd)
+    {
+        const uint64_t one {1};
+        if ((write(fd, &one, sizeof(one)) == -1) && (errno != EAGAIN))
+            qWarning() << "Unable to poke relay loop eventfd:" << strerror(errno);
+    }
+
+    void drain(int fd)
+    {
+        uint64_t count;
+        while (read(fd, &count, sizeof(count)) == sizeof(count)) {}
+    }
+
+    bool is_running(Relay::Status status)
+    {
+        return (status == Relay::Status::WAIT_READ) || (status == Relay::Status::WAIT_WRITE);
+    }
+}
+
+/***
+****  Job
+***/
+
+class RelayLoop::Job::Impl
+{
+public:
+
+    Impl(std::unique_ptr<Relay> relay, int in_fd, int out_fd):
+        relay_{std::move(relay)},
+        in_fd_{in_fd},
+        out_fd_{out_fd},
+        notify_fd_{eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)}
+    {
+        if (notify_fd_ == -1)
+            qWarning() << "Unable to create relay eventfd:" << strerror(errno);
+    }
+
+    ~Impl()
+    {
+        if (notify_fd_ != -1)
+            close(notify_fd_);
+    }
+
+    Q_DISABLE_COPY(Impl)
+
+    // called on the loop's thread.
+    // Returns true if the relay still has more to do.
+    bool pump()
+    {
+        const auto status = relay_->pump();
+        const auto n_written = relay_->n_written();
+        const auto changed = (n_written != n_written_) || (status != this->status());
+
+        n_read_ = relay_->n_read();
+        n_written_ = n_written;
+        status_ = int(status);
+        if (changed && (notify_fd_ != -1))
+            poke(notify_fd_);
+
+        return is_running(status);
+    }
+
+    // what the loop's thread should wait for before pumping again
+    pollfd wait_for() const
+    {
+        pollfd pfd {};
+        if (status() == Relay::Status::WAIT_WRITE) {
+            pfd.fd = out_fd_;
+            pfd.events = POLLOUT;
+        } else {
+            pfd.fd = in_fd_;
+            pfd.events = POLLIN;
+        }
+        return pfd;
+    }
+
+    qint64 n_read() const { return n_read_; }
+    qint64 n_written() const { return n_written_; }
+    Relay::Status status() const { return Relay::Status(status_.load()); }
+    int notify_fd() const { return notify_fd_; }
+
+    void clear_notify()
+    {
+        if (notify_fd_ != -1)
+            drain(notify_fd_);
+    }
+
+private:
+
+    // only touched on the loop's thread
+    std::unique_ptr<Relay> const relay_;
+    int const in_fd_;
+    int const out_fd_;
+
+    // read by the main thread
+    std::atomic<qint64> n_read_ {0};
+    std::atomic<qint64> n_written_ {0};
+    std::atomic<int> status_ {int(Relay::Status::WAIT_READ)};
+    int const notify_fd_;
+};
+
+RelayLoop::Job::Job(std::unique_ptr<Relay> relay, int in_fd, int out_fd):
+    impl_{new Impl{std::move(relay), in_fd, out_fd}}
+{
+}
+
+RelayLoop::Job::~Job() =default;
+
+qint64
+RelayLoop::Job::n_read() const
+{
+    return impl_->n_read();
+}
+
+qint64
+RelayLoop::Job::n_written() const
+{
+    return impl_->n_written();
+}
+
+Relay::Status
+RelayLoop::Job::status() const
+{
+    return impl_->status();
+}
+
+int
+RelayLoop::Job::notify_fd() const
+{
+    return impl_->notify_fd();
+}
+
+void
+RelayLoop::Job::clear_notify()
+{
+    impl_->clear_notify();
+}
+
+/***
+****  Loop
+***/
+
+class RelayLoop::Impl
+{
+public:
+
+    Impl():
+        wake_fd_{eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)}
+    {
+        if (wake_fd_ == -1)
+            qCritical() << "Unable to create relay loop eventfd:" << strerror(errno);
+        thread_ = std::thread(&Impl::run, this);
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        poke(wake_fd_);
+        thread_.join();
+        if (wake_fd_ != -1)
+            close(wake_fd_);
+    }
+
+    Q_DISABLE_COPY(Impl)
+
+    void add(std::shared_ptr<Job> const& job)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        added_.push_back(job);
+        poke(wake_fd_);
+    }
+
+    void remove(std::shared_ptr<Job> const& job)
+    {
+        // wait for the loop's thread to let go of it
+        std::unique_lock<std::mutex> lock(mutex_);
+        removed_.push_back(job);
+        const auto generation = generation_;
+        poke(wake_fd_);
+        updated_.wait(lock, [this, generation](){return generation_ != generation;});
+    }
+
+private:
+
+    void run()
+    {
+        std::vector<std::shared_ptr<Job>> jobs;
+        std::vector<std::shared_ptr<Job>> to_pump;
+        std::vector<pollfd> pfds;
+
+        for (;;)
+        {
+            // take in the jobs that were added or removed
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stopping_)
+                    break;
+                for (auto const& job : added_) {
+                    jobs.push_back(job);
+                    to_pump.push_back(job);
+                }
+                for (auto const& job : removed_) {
+                    jobs.erase(std::remove(jobs.begin(), jobs.end(), job), jobs.end());
+                    to_pump.erase(std::remove(to_pump.begin(), to_pump.end(), job), to_pump.end());
+                }
+                added_.clear();
+                removed_.clear();
+                ++generation_;
+            }
+            updated_.notify_all();
+
+            // move what we can
+            for (auto const& job : to_pump)
+                if (!job->impl_->pump())
+                    jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+            to_pump.clear();
+
+            // and wait until there's more
+            pfds.clear();
+            pfds.push_back(pollfd{wake_fd_, POLLIN, 0});
+            for (auto const& job : jobs)
+                pfds.push_back(job->impl_->wait_for());
+            if ((poll(pfds.data(), nfds_t(pfds.size()), -1) == -1) && (errno != EINTR))
+                qWarning() << "Error waiting on relays:" << strerror(errno);
+
+            if (pfds[0].revents)
+                drain(wake_fd_);
+            for (size_t i=0, n=jobs.size(); i<n; ++i)
+                if (pfds[i+1].revents)
+                    to_pump.push_back(jobs[i]);
+        }
+    }
+
+    int const wake_fd_;
+    std::thread thread_;
+
+    std::mutex mutex_;
+    std::condition_variable updated_;
+    std::vector<std::shared_ptr<Job>> added_;
+    std::vector<std::shared_ptr<Job>> removed_;
+    unsigned int generation_ {};
+    bool stopping_ {};
+};
+
+/***
+****
+***/
+
+RelayLoop::RelayLoop():
+    impl_{new Impl{}}
+{
+}
+
+RelayLoop::~RelayLoop() =default;
+
+std::shared_ptr<RelayLoop::Job>
+RelayLoop::add(std::unique_ptr<Relay> relay, int in_fd, int out_fd)
+{
+    std::shared_ptr<Job> job {new Job{std::move(relay), in_fd, out_fd}};
+    impl_->add(job);
+    return job;
+}
+
+void
+RelayLoop::remove(std::shared_ptr<Job> const& job)
+{
+    impl_->remove(job);
+}
+
+std::shared_ptr<RelayLoop>
+RelayLoop::shared()
+{
+    static std::mutex mutex;
+    static std::weak_ptr<RelayLoop> weak;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto loop = weak.lock();
+    if (!loop) {
+        loop = std::make_shared<RelayLoop>();
+        weak = loop;
+    }
+    return loop;
+}
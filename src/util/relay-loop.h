@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include "util/relay.h"
+
+#include <QtGlobal> // qint64
+
+#include <memory> // shared_ptr, unique_ptr
+
+/**
+ * Pumps Relays on a thread of its own, so that the data they move
+ * isn't held up by whatever else the main loop is busy with.
+ *
+ * The thread tells the main loop how a relay is doing only through
+ * its Job's counters, which can be read at any time without locking,
+ * and by poking the Job's notify_fd() when they change.
+ */
+class RelayLoop
+{
+public:
+
+    RelayLoop();
+    ~RelayLoop();
+    Q_DISABLE_COPY(RelayLoop)
+
+    class Job
+    {
+    public:
+        ~Job();
+        Q_DISABLE_COPY(Job)
+
+        qint64 n_read() const;
+        qint64 n_written() const;
+        // WAIT_READ or WAIT_WRITE until the relay is done or fails
+        Relay::Status status() const;
+
+        // readable when the counters or status changed.
+        // Call clear_notify() before reading them.
+        int notify_fd() const;
+        void clear_notify();
+
+    private:
+        friend class RelayLoop;
+        Job(std::unique_ptr<Relay> relay, int in_fd, int out_fd);
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+    // Pumps `relay' until it's done or fails, waiting on `in_fd'
+    // and `out_fd' when it asks to. Whatever the relay calls back,
+    // e.g. its Observer, is called on the loop's thread.
+    std::shared_ptr<Job> add(std::unique_ptr<Relay> relay, int in_fd, int out_fd);
+
+    // Stops pumping the job's relay.
+    // Once this returns, the loop's thread is done with it.
+    void remove(std::shared_ptr<Job> const& job);
+
+    // The loop that the helpers share. Its thread
+    // runs as long as someone is holding onto it.
+    static std::shared_ptr<RelayLoop> shared();
+
+private:
+    class Impl;
+    std::shared_ptr<Impl> impl_;
+};
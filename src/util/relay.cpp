@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/relay.h"
+
+#include <QDebug>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm> // std::min(), std::max()
+#include <cerrno>
+#include <cstdint> // SIZE_MAX
+#include <cstring> // strerror()
+#include <vector>
+
+namespace
+{
+    // how much to move through the pipe at once
+    constexpr size_t CHUNK_MIN {1024*16};
+    constexpr size_t CHUNK_MAX {1024*1024};
+
+    // for the bytes that can't be spliced
+    constexpr size_t RING_SIZE {1024*256};
+}
+
+class Relay::Impl
+{
+public:
+
+    Impl(int in_fd, ReadFunc const& read, int out_fd, Observer const& observer)
+        : in_fd_{in_fd}
+        , read_{read}
+        , out_fd_{out_fd}
+        , observer_{observer}
+        , skippable_{observer ? 0 : SIZE_MAX}
+    {
+        if ((in_fd_ != -1) && (pipe2(pipe_, O_NONBLOCK|O_CLOEXEC) == 0))
+        {
+            // a bigger pipe means fewer trips through it, but the system may limit it
+            auto size = fcntl(pipe_[1], F_SETPIPE_SZ, int(CHUNK_MAX));
+            if (size == -1)
+                size = fcntl(pipe_[1], F_GETPIPE_SZ);
+            pipe_size_ = size > 0 ? size_t(size) : CHUNK_MIN;
+            chunk_ = std::min(chunk_, pipe_size_);
+        }
+        else
+        {
+            pipe_[0] = pipe_[1] = -1;
+        }
+    }
+
+    ~Impl()
+    {
+        close_pipe();
+    }
+
+    Q_DISABLE_COPY(Impl)
+
+    Status pump()
+    {
+        for (;;)
+        {
+            auto moved = false;
+
+            if (!eof_)
+            {
+                const auto result = read_more();
+                if (result == Result::FAILED)
+                    return Status::READ_FAILED;
+                if (result == Result::END)
+                    eof_ = true;
+                moved = result == Result::MOVED;
+            }
+
+            // only one of these holds anything at a time, so the bytes stay in order
+            if (n_piped_ || ring_used_)
+            {
+                const auto result = n_piped_ ? write_from_pipe() : write_from_ring();
+                if (result == Result::FAILED)
+                    return Status::WRITE_FAILED;
+                moved = moved || (result == Result::MOVED);
+            }
+
+            if (!moved)
+            {
+                if (n_piped_ || ring_used_)
+                    return Status::WAIT_WRITE;
+                return eof_ ? Status::DONE : Status::WAIT_READ;
+            }
+        }
+    }
+
+    qint64 n_read() const
+    {
+        return n_read_;
+    }
+
+    qint64 n_written() const
+    {
+        return n_written_;
+    }
+
+    qint64 n_spliced() const
+    {
+        return n_spliced_;
+    }
+
+private:
+
+    enum class Result { MOVED, AGAIN, END, FAILED };
+
+    Result read_more()
+    {
+        if (splice_in_ && (pipe_[0] != -1) && skippable_ && !ring_used_ && (n_piped_ < pipe_size_))
+            return read_into_pipe();
+
+        if (!n_piped_ && (ring_used_ < ring_.size() || ring_.empty()))
+            return read_into_ring();
+
+        return Result::AGAIN; // we're full
+    }
+
+    Result read_into_pipe()
+    {
+        const auto want = std::min({chunk_, skippable_, pipe_size_ - n_piped_});
+        ssize_t n;
+        do {
+            n = splice(in_fd_, nullptr, pipe_[1], nullptr, want, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        } while ((n == -1) && (errno == EINTR));
+
+        if (n == 0)
+            return Result::END;
+
+        if (n == -1)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                return Result::AGAIN;
+            if ((errno == EINVAL) || (errno == ENOSYS))
+            {
+                // this source can't be spliced, so just read it
+                splice_in_ = false;
+                return n_piped_ ? Result::AGAIN : read_into_ring();
+            }
+            qWarning() << "Relay can't read:" << strerror(errno);
+            return Result::FAILED;
+        }
+
+        // if the source kept up, try moving more at once next time
+        chunk_ = size_t(n) == want ? std::min(chunk_*2, pipe_size_) : std::max(chunk_/2, CHUNK_MIN);
+
+        n_piped_ += size_t(n);
+        n_read_ += n;
+        n_spliced_ += n;
+        if (observer_)
+            skippable_ = observer_(nullptr, size_t(n));
+        return Result::MOVED;
+    }
+
+    Result write_from_pipe()
+    {
+        ssize_t n;
+        do {
+            n = splice(pipe_[0], nullptr, out_fd_, nullptr, n_piped_, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        } while ((n == -1) && (errno == EINTR));
+
+        if (n == -1)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                return Result::AGAIN;
+            if ((errno == EINVAL) || (errno == ENOSYS))
+            {
+                // this destination can't be spliced, so write it from the ring
+                if (!drain_pipe())
+                    return Result::FAILED;
+                close_pipe();
+                return Result::MOVED;
+            }
+            qWarning() << "Relay can't write:" << strerror(errno);
+            return Result::FAILED;
+        }
+
+        n_piped_ -= size_t(n);
+        n_written_ += n;
+        return Result::MOVED;
+    }
+
+    Result read_into_ring()
+    {
+        if (ring_.empty())
+            ring_.resize(RING_SIZE);
+
+        // read into the free space after the bytes we're holding
+        if (!ring_used_)
+            ring_begin_ = 0;
+        const auto end = (ring_begin_ + ring_used_) % ring_.size();
+        const auto maxlen = end < ring_begin_ || ring_used_ == ring_.size()
+                          ? ring_begin_ - end
+                          : ring_.size() - end;
+        auto buf = &ring_[end];
+
+        ssize_t n;
+        if (read_)
+        {
+            n = read_(buf, maxlen);
+            if (n == 0)
+                return Result::AGAIN;
+        }
+        else
+        {
+            do {
+                n = read(in_fd_, buf, maxlen);
+            } while ((n == -1) && (errno == EINTR));
+            if (n == 0)
+                return Result::END;
+            if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+                return Result::AGAIN;
+        }
+
+        if (n < 0)
+        {
+            qWarning() << "Relay can't read:" << strerror(errno);
+            return Result::FAILED;
+        }
+
+        ring_used_ += size_t(n);
+        n_read_ += n;
+        if (observer_)
+            skippable_ = observer_(buf, size_t(n));
+        return Result::MOVED;
+    }
+
+    Result write_from_ring()
+    {
+        const auto len = std::min(ring_used_, ring_.size() - ring_begin_);
+        ssize_t n;
+        do {
+            n = write(out_fd_, &ring_[ring_begin_], len);
+        } while ((n == -1) && (errno == EINTR));
+
+        if (n == -1)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                return Result::AGAIN;
+            qWarning() << "Relay can't write:" << strerror(errno);
+            return Result::FAILED;
+        }
+
+        ring_begin_ = (ring_begin_ + size_t(n)) % ring_.size();
+        ring_used_ -= size_t(n);
+        n_written_ += n;
+        return Result::MOVED;
+    }
+
+    // moves what's in the pipe into the ring, which is empty when the pipe isn't
+    bool drain_pipe()
+    {
+        ring_.resize(std::max({ring_.size(), RING_SIZE, n_piped_}));
+        ring_begin_ = 0;
+        while (ring_used_ < n_piped_)
+        {
+            const auto n = read(pipe_[0], &ring_[ring_used_], n_piped_ - ring_used_);
+            if ((n == -1) && (errno == EINTR))
+                continue;
+            if (n <= 0)
+            {
+                qWarning() << "Relay can't read its pipe:" << strerror(errno);
+                return false;
+            }
+            ring_used_ += size_t(n);
+        }
+        n_piped_ = 0;
+        return true;
+    }
+
+    void close_pipe()
+    {
+        for (auto& fd : pipe_)
+        {
+            if (fd != -1)
+                close(fd);
+            fd = -1;
+        }
+    }
+
+    int const in_fd_;
+    ReadFunc const read_;
+    int const out_fd_;
+    Observer const observer_;
+
+    int pipe_[2];
+    bool splice_in_ {true};
+    size_t pipe_size_ {CHUNK_MAX};
+    size_t chunk_ {CHUNK_MIN*4}; // how much to splice at once
+    size_t n_piped_ {}; // bytes waiting in the pipe
+    size_t skippable_; // bytes the observer doesn't need to see
+
+    std::vector<char> ring_;
+    size_t ring_begin_ {};
+    size_t ring_used_ {};
+
+    bool eof_ {};
+    qint64 n_read_ {};
+    qint64 n_written_ {};
+    qint64 n_spliced_ {};
+};
+
+/***
+****
+***/
+
+Relay::Relay(int in_fd, int out_fd, Observer const& observer)
+    : impl_{new Impl{in_fd, ReadFunc(), out_fd, observer}}
+{
+}
+
+Relay::Relay(ReadFunc const& read, int out_fd)
+    : impl_{new Impl{-1, read, out_fd, Observer()}}
+{
+}
+
+Relay::~Relay() =default;
+
+Relay::Status
+Relay::pump()
+{
+    return impl_->pump();
+}
+
+qint64
+Relay::n_read() const
+{
+    return impl_->n_read();
+}
+
+qint64
+Relay::n_written() const
+{
+    return impl_->n_written();
+}
+
+qint64
+Relay::n_spliced() const
+{
+    return impl_->n_spliced();
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QtGlobal> // qint64
+
+#include <sys/types.h> // ssize_t
+
+#include <cstddef> // size_t
+#include <functional>
+#include <memory> // shared_ptr
+
+/**
+ * Moves a stream of bytes from one file descriptor to another.
+ *
+ * Where the kernel allows, the bytes go through a pipe with splice(),
+ * so they're never copied into userspace. How much goes through the
+ * pipe at a time grows while both ends keep up and shrinks when they
+ * don't. Bytes that can't be spliced, e.g. because an Observer wants
+ * to see them, go through a fixed-size ring buffer instead.
+ *
+ * Both descriptors should be nonblocking. The Relay doesn't own them.
+ */
+class Relay
+{
+public:
+
+    // Shown the bytes as they go by, in order. `buf' is null for bytes
+    // that were spliced past, which it said it didn't need to see.
+    // Returns how many of the bytes after these it doesn't need to see.
+    using Observer = std::function<size_t(char const* buf, size_t len)>;
+
+    // For sources that have to be read through a userspace buffer,
+    // e.g. a QIODevice. Returns the number of bytes read, 0 if none
+    // are available right now, or -1 on error. The Relay can't tell
+    // where these sources end, so it never reports DONE for them.
+    using ReadFunc = std::function<ssize_t(char* buf, size_t maxlen)>;
+
+    enum class Status
+    {
+        WAIT_READ, // the source has nothing to read right now
+        WAIT_WRITE, // the destination can't take any more right now
+        DONE, // the source ended and everything read has been written
+        READ_FAILED,
+        WRITE_FAILED
+    };
+
+    Relay(int in_fd, int out_fd, Observer const& observer = Observer());
+    Relay(ReadFunc const& read, int out_fd);
+    ~Relay();
+
+    // moves as much as it can without blocking
+    Status pump();
+
+    qint64 n_read() const;
+    qint64 n_written() const;
+    qint64 n_spliced() const; // how many bytes were moved without being copied
+
+private:
+    class Impl;
+    std::shared_ptr<Impl> impl_;
+};
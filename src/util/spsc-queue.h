@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef> // size_t
+#include <mutex>
+#include <utility> // std::move()
+#include <vector>
+
+/**
+ * A bounded, lock-free queue for one producer thread and one consumer thread.
+ *
+ * push() and pop() never block; they return false if the queue is full
+ * or empty, and the caller can then wait() for the other end to catch up.
+ * Items are moved in and out, so queueing a std::vector hands over its
+ * buffer without copying.
+ */
+template<typename T>
+class SpscQueue
+{
+public:
+
+    explicit SpscQueue(size_t capacity)
+        : slots_(capacity + 1) // one slot is always left empty
+    {
+    }
+
+    SpscQueue(SpscQueue const&) =delete;
+    SpscQueue& operator=(SpscQueue const&) =delete;
+
+    // producer only
+    bool push(T&& item)
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        const auto next = increment(tail);
+        if (next == head_.load(std::memory_order_acquire)) // full
+            return false;
+
+        slots_[tail] = std::move(item);
+        tail_.store(next, std::memory_order_release);
+        notify();
+        return true;
+    }
+
+    // consumer only
+    bool pop(T& setme)
+    {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) // empty
+            return false;
+
+        setme = std::move(slots_[head]);
+        head_.store(increment(head), std::memory_order_release);
+        notify();
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    bool full() const
+    {
+        return increment(tail_.load(std::memory_order_acquire)) == head_.load(std::memory_order_acquire);
+    }
+
+    // Blocks until `ready()' returns true. It's rechecked each time the
+    // other end pushes or pops and each time wake() is called, so it
+    // should test full(), empty(), or a flag that's set before wake().
+    template<typename Pred>
+    void wait(Pred&& ready)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        n_waiting_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv_.wait(lock, ready);
+        n_waiting_.fetch_sub(1);
+    }
+
+    // wakes up any wait()ers so that they recheck their condition
+    void wake()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_all();
+    }
+
+private:
+
+    // only take the lock if someone's waiting,
+    // so push() and pop() stay lock-free while both ends keep up
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (n_waiting_.load(std::memory_order_relaxed) > 0)
+            wake();
+    }
+
+    size_t increment(size_t pos) const
+    {
+        return ++pos == slots_.size() ? 0 : pos;
+    }
+
+    std::vector<T> slots_;
+
+    // keep the two ends on separate cache lines so the
+    // producer and consumer don't keep invalidating each other.
+    // (padding rather than alignas, which plain `new' ignores in C++14)
+    static constexpr size_t CACHE_LINE_SIZE {64};
+    char pad0_[CACHE_LINE_SIZE] {};
+    std::atomic<size_t> head_ {0};
+    char pad1_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)] {};
+    std::atomic<size_t> tail_ {0};
+    char pad2_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)] {};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<int> n_waiting_ {0};
+};
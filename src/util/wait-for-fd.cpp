@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/wait-for-fd.h"
+
+#include <QDebug>
+
+#include <poll.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring> // strerror()
+
+bool
+wait_for_fd(int fd, short events, StallStats& stats)
+{
+    ++stats.n_stalls;
+    const auto begin = std::chrono::steady_clock::now();
+
+    struct pollfd pfd {};
+    pfd.fd = fd;
+    pfd.events = events;
+    int ret;
+    while (((ret = poll(&pfd, 1, -1)) < 0) && (errno == EINTR)) {}
+
+    const auto elapsed = std::chrono::steady_clock::now() - begin;
+    stats.stall_usec += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+
+    if (ret < 0) {
+        qCritical("error waiting for socket: %s", strerror(errno));
+        return false;
+    }
+
+    short failed = POLLERR|POLLNVAL;
+    if (events & POLLOUT)
+        failed |= POLLHUP;
+    return !(pfd.revents & failed);
+}
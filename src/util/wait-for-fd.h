@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#pragma once
+
+#include <QtGlobal> // qint64
+
+/**
+ * How often, and for how long, something had to wait.
+ */
+struct StallStats
+{
+    qint64 n_stalls {}; // how many times it had to wait
+    qint64 stall_usec {}; // how long it waited in total
+};
+
+// Blocks until nonblocking `fd' is ready for `events', e.g. POLLIN or
+// POLLOUT, and adds the wait to `stats'. Returns false if the fd failed.
+// A hangup only counts as failure when writing: a reader can still
+// read whatever is left, and then eof.
+bool wait_for_fd(int fd, short events, StallStats& stats);
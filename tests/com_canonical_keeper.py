@@ -3,6 +3,7 @@ import dbus
 import dbus.service
 import os
 import socket
+import struct
 import subprocess
 import sys
 import time
@@ -57,6 +58,11 @@ TYPE_APP = 'application'
 TYPE_FOLDER = 'folder'
 TYPE_SYSTEM = 'system-data'
 
+# the end-of-stream trailer sent by StartBackupStream() helpers:
+# magic string followed by the payload size as a little-endian uint64
+STREAM_TRAILER_MAGIC = b'KEEPEOS1'
+STREAM_TRAILER_SIZE = len(STREAM_TRAILER_MAGIC) + 8
+
 # magic keys used by dbusmock
 BUS_NAME = 'com.canonical.keeper'
 MAIN_IFACE = SERVICE_IFACE
@@ -78,6 +84,7 @@ class TaskData:
         self.error = ''
         self.chunks = []
         self.sock = None
+        self.streaming = False
         self.uuid = None
         self.bytes_per_second = {}
 
@@ -204,7 +211,10 @@ def user_periodic_func(user):
                 if chunk_len:
                     got_data_this_pass = True
                     td.chunks.append(chunk)
-                    td.n_left -= chunk_len
+                    if td.streaming:
+                        check_for_stream_trailer(td)
+                    else:
+                        td.n_left -= chunk_len
 
         if td.action == ACTION_RESTORING:
             begin = td.n_bytes - td.n_left
@@ -258,6 +268,21 @@ def user_periodic_func(user):
     return not done
 
 
+def check_for_stream_trailer(td):
+    data = b''.join(td.chunks)
+    if len(data) < STREAM_TRAILER_SIZE:
+        return
+    trailer = data[-STREAM_TRAILER_SIZE:]
+    if not trailer.startswith(STREAM_TRAILER_MAGIC):
+        return
+    n_bytes = struct.unpack('<Q', trailer[len(STREAM_TRAILER_MAGIC):])[0]
+    if n_bytes + STREAM_TRAILER_SIZE != len(data):
+        return
+    td.chunks = [data[:n_bytes]]
+    td.n_bytes = n_bytes
+    td.n_left = 0
+
+
 def user_init_tasks(user, uuids):
     user.all_tasks = uuids
     user.remaining_tasks = copy.copy(uuids)
@@ -395,6 +420,33 @@ def helper_start_backup(helper, n_bytes):
     return ret
 
 
+def helper_start_backup_stream(helper):
+
+    # are we forcing a fail?
+    main = mockobject.objects[SERVICE_PATH]
+    if main.fail_next_helper_start:
+        main.fail_next_helper_start = False
+        fail('main.fail_next_helper_start was set')
+
+    helper.log("got start_backup_stream request")
+
+    sock1, sock2 = socket.socketpair()
+
+    user = mockobject.objects[USER_PATH]
+    uuid = user.current_task
+
+    # size is unknown until the trailer arrives
+    td = user.task_data[uuid]
+    td.streaming = True
+    td.n_bytes = 0
+    td.n_left = -1
+    td.sock = sock1
+
+    ret = dbus.types.UnixFd(sock2)
+    sock2.close()
+    return ret
+
+
 def helper_start_restore(helper):
 
     user = mockobject.objects[USER_PATH]
@@ -505,10 +557,13 @@ def load(main, parameters):
     main.AddObject(path, HELPER_IFACE, {}, [])
     o = mockobject.objects[path]
     o.start_backup = helper_start_backup
+    o.start_backup_stream = helper_start_backup_stream
     o.start_restore = helper_start_restore
     o.AddMethods(HELPER_IFACE, [
         ('StartBackup', 't', 'h',
          'ret = self.start_backup(self, args[0])'),
+        ('StartBackupStream', '', 'h',
+         'ret = self.start_backup_stream(self)'),
         ('StartRestore', '', 'h',
          'ret = self.start_restore(self)')
     ])
@@ -50,7 +50,8 @@ main(int argc, char **argv)
     qDebug() << "Retrieving connection";
     // ask the service for a socket
     auto conn = QDBusConnection::connectToBus(QDBusConnection::SessionBus, DBusTypes::KEEPER_SERVICE);
-    const auto object_path = QString::fromUtf8(DBusTypes::KEEPER_HELPER_PATH);
+    // keeper tells us which path to call it on
+    const auto object_path = argc > 1 ? QString::fromUtf8(argv[1]) : QString::fromUtf8(DBusTypes::KEEPER_HELPER_PATH);
     DBusInterfaceKeeperHelper helper_iface (DBusTypes::KEEPER_SERVICE, object_path, conn);
 
     qDebug() << "Is valid:" << helper_iface.isValid();
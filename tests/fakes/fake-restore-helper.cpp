@@ -83,7 +83,8 @@ main(int argc, char **argv)
 
     // ask the service for a socket
     auto conn = QDBusConnection::connectToBus(QDBusConnection::SessionBus, DBusTypes::KEEPER_SERVICE);
-    const auto object_path = QString::fromUtf8(DBusTypes::KEEPER_HELPER_PATH);
+    // keeper tells us which path to call it on
+    const auto object_path = argc > 1 ? QString::fromUtf8(argv[1]) : QString::fromUtf8(DBusTypes::KEEPER_HELPER_PATH);
     QSharedPointer<DBusInterfaceKeeperHelper> helper_iface (new DBusInterfaceKeeperHelper(DBusTypes::KEEPER_SERVICE, object_path, conn));
 
     qDebug() << "Is valid:" << helper_iface->isValid();
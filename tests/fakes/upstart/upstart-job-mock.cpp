@@ -88,6 +88,25 @@ QString get_app_id(QStringList const &env)
     }
     return QString();
 }
+
+// set by UAL when it starts one of several instances of a helper
+QString get_instance_id(QStringList const &env)
+{
+    for (auto item : env)
+    {
+        if (item.startsWith("INSTANCE_ID="))
+        {
+            return item.remove(QString("INSTANCE_ID="));
+        }
+    }
+    return QString();
+}
+
+// the name that upstart's untrusted-helper job gives an instance
+QString get_instance_name(QString const &app_id, QString const &instance_id)
+{
+    return QStringLiteral("backup-helper:%1:%2").arg(instance_id).arg(app_id);
+}
 } // namespace
 
 QDBusObjectPath UpstartJobMock::Start(QStringList const &env, bool wait)
@@ -96,17 +115,20 @@ QDBusObjectPath UpstartJobMock::Start(QStringList const &env, bool wait)
     auto params = get_process_args(env);
 
     auto app_id = get_app_id(env);
+    auto instance_id = get_instance_id(env);
 
     if (app_id.isEmpty())
     {
         sendErrorReply(QDBusError::InvalidArgs, QString("Failed starting job. Please check that the APP_ID env is valid: [%s]").arg(env.join(':')));
     }
-    // arg[0] is the process, arg[1] is the directory where to execute the process
-    if (params.size() != 2)
+    // arg[0] is the process, arg[1] is the directory where to execute the process,
+    // and the process gets any args after that
+    if (params.size() < 2)
     {
         sendErrorReply(QDBusError::InvalidArgs, QString("Failed starting job. Please check that the APP_URIS env is valid: [%s]").arg(env.join(':')));
+        return QDBusObjectPath(UPSTART_HELPER_INSTANCE_PATH);
     }
-    if (!start_process(app_id, params.at(0), params.at(1)))
+    if (!start_process(app_id, instance_id, params.at(0), params.at(1), params.mid(2)))
     {
         sendErrorReply(QDBusError::InvalidArgs, QString("Failed starting job. Please check that the APP_URIS env is valid: [%s]").arg(env.join(':')));
     }
@@ -123,7 +145,7 @@ void UpstartJobMock::Stop(QStringList const &env, bool wait)
          sendErrorReply(QDBusError::InvalidArgs, QString("Failed stopping job. Please check that the APP_ID env is valid: [%s]").arg(env.join(':')));
          return;
      }
-     auto iter = processes_.find(app_id);
+     auto iter = processes_.find(get_instance_name(app_id, get_instance_id(env)));
      if (iter == processes_.end())
      {
          sendErrorReply(QDBusError::InvalidArgs, QString("Failed stopping job. Process for app_id was not found [%s]").arg(app_id));
@@ -142,7 +164,11 @@ QList<QDBusObjectPath> UpstartJobMock::GetAllInstances() const
     return ret;
 }
 
-bool UpstartJobMock::start_process(QString const & app_id, QString const & path, QString const & cwd)
+bool UpstartJobMock::start_process(QString const & app_id,
+                                   QString const & instance_id,
+                                   QString const & path,
+                                   QString const & cwd,
+                                   QStringList const & args)
 {
     auto new_process = QSharedPointer<QProcess>(new QProcess(this));
 
@@ -159,7 +185,7 @@ bool UpstartJobMock::start_process(QString const & app_id, QString const & path,
 
     // start the process
     QProcess setVolume;
-    new_process->start(path, QStringList());
+    new_process->start(path, args);
 
     if (!new_process->waitForStarted())
     {
@@ -168,15 +194,17 @@ bool UpstartJobMock::start_process(QString const & app_id, QString const & path,
         return false;
     }
 
-    QString instance_name = QStringLiteral("INSTANCE=backup-helper::%1").arg(app_id);
+    // several instances of a helper can run at once, so each gets its own name
+    auto const name = get_instance_name(app_id, instance_id);
+    QString instance_name = QStringLiteral("INSTANCE=%1").arg(name);
     qDebug() << "Sending signal " << QStringList{"JOB=untrusted-helper", instance_name};
     Q_EMIT(upstart_adaptor_->EventEmitted("started", {"JOB=untrusted-helper", instance_name}));
 
-    processes_[app_id] = new_process;
-    auto on_finished = [this, new_process, instance_name, app_id](int exit_code, QProcess::ExitStatus /*exit_status*/)
+    processes_[name] = new_process;
+    auto on_finished = [this, new_process, instance_name, name](int exit_code, QProcess::ExitStatus /*exit_status*/)
     {
         qDebug() << "Process finished: " << new_process->pid() << " Exit code: " << exit_code;
-        auto iter = processes_.find(app_id);
+        auto iter = processes_.find(name);
         if (iter != processes_.end())
         {
             processes_.erase(iter);
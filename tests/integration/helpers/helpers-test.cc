@@ -190,6 +190,101 @@ TEST_F(TestHelpers, StartFullTest)
     EXPECT_TRUE(FileUtils::compareDirectories(temp_source_dir_2.path(), user_dir_2));
 }
 
+TEST_F(TestHelpers, StartFullTestManyFolders)
+{
+    XdgUserDirsSandbox tmp_dir;
+
+    // starts the services, including keeper-service
+    start_tasks();
+
+    QSharedPointer<DBusInterfaceKeeperUser> user_iface(new DBusInterfaceKeeperUser(
+                                                            DBusTypes::KEEPER_SERVICE,
+                                                            DBusTypes::KEEPER_USER_PATH,
+                                                            dbus_test_runner.sessionConnection()
+                                                        ) );
+
+    ASSERT_TRUE(user_iface->isValid()) << qPrintable(dbus_test_runner.sessionConnection().lastError().message());
+
+    // ask for a list of backup choices
+    QDBusReply<keeper::Items> choices = user_iface->call("GetBackupChoices");
+    EXPECT_TRUE(choices.isValid()) << qPrintable(choices.error().message());
+
+    // more folders than the registry's max-concurrent-tasks
+    QStringList const user_options {
+        QStringLiteral("XDG_DESKTOP_DIR"),
+        QStringLiteral("XDG_DOWNLOAD_DIR"),
+        QStringLiteral("XDG_DOCUMENTS_DIR"),
+        QStringLiteral("XDG_MUSIC_DIR"),
+        QStringLiteral("XDG_PICTURES_DIR"),
+        QStringLiteral("XDG_VIDEOS_DIR")
+    };
+
+    QStringList user_dirs;
+    QStringList uuids;
+    QVector<BackupItem> backup_items;
+    for (auto const& user_option : user_options)
+    {
+        auto const user_dir = QString::fromUtf8(qgetenv(user_option.toLatin1().data()));
+        ASSERT_FALSE(user_dir.isEmpty());
+        FileUtils::fillTemporaryDirectory(user_dir, qrand() % 100);
+
+        auto const uuid = get_uuid_for_xdg_folder_path(user_dir, choices.value());
+        ASSERT_FALSE(uuid.isEmpty());
+
+        user_dirs << user_dir;
+        uuids << uuid;
+        backup_items.push_back(BackupItem{get_display_name_for_xdg_folder_path(user_dir, choices.value()),
+                                          get_type_for_xdg_folder_path(user_dir, choices.value()),
+                                          uuid});
+    }
+
+    QSharedPointer<DBusPropertiesInterface> properties_interface(new DBusPropertiesInterface(
+                                                            DBusTypes::KEEPER_SERVICE,
+                                                            DBusTypes::KEEPER_USER_PATH,
+                                                            dbus_test_runner.sessionConnection()
+                                                        ) );
+
+    ASSERT_TRUE(properties_interface->isValid()) << qPrintable(QDBusConnection::sessionBus().lastError().message());
+
+    QSignalSpy spy(properties_interface.data(),&DBusPropertiesInterface::PropertiesChanged);
+
+    // the helpers run at once, each calling keeper on its own path
+    QDBusReply<void> backup_reply = user_iface->call("StartBackup", uuids, "");
+    ASSERT_TRUE(backup_reply.isValid()) << qPrintable(dbus_test_runner.sessionConnection().lastError().message());
+
+    int max_running_tasks {};
+    EXPECT_TRUE(capture_max_running_tasks_until_all_tasks_complete(spy, uuids, max_running_tasks));
+    EXPECT_LE(max_running_tasks, 4);
+    EXPECT_TRUE(wait_for_all_tasks_have_action_state(uuids, "complete", user_iface));
+
+    // every helper's archive went to its own task, and the manifest lists them all
+    EXPECT_TRUE(StorageFrameworkLocalUtils::check_storage_framework_files(user_dirs));
+    EXPECT_TRUE(check_manifest_file(backup_items));
+
+    QList<QSharedPointer<QTemporaryDir>> sources;
+    for (auto const& user_dir : user_dirs)
+    {
+        QSharedPointer<QTemporaryDir> source(new QTemporaryDir);
+        ASSERT_TRUE(FileUtils::copyDirsRecursively(user_dir, source->path()));
+        sources << source;
+        EXPECT_TRUE(FileUtils::clearDir(user_dir));
+    }
+
+    // restores run one at a time, since a chain's increments need their base first
+    spy.clear();
+    QDBusPendingReply<void> restore_reply = user_iface->call("StartRestore", uuids, "");
+    restore_reply.waitForFinished();
+    ASSERT_TRUE(restore_reply.isValid()) << qPrintable(dbus_test_runner.sessionConnection().lastError().message());
+
+    EXPECT_TRUE(capture_max_running_tasks_until_all_tasks_complete(spy, uuids, max_running_tasks));
+    EXPECT_EQ(1, max_running_tasks);
+
+    for (int i = 0; i < user_dirs.size(); ++i)
+    {
+        EXPECT_TRUE(FileUtils::compareDirectories(sources[i]->path(), user_dirs[i]));
+    }
+}
+
 TEST_F(TestHelpers, StartFullTestCancelling)
 {
     XdgUserDirsSandbox tmp_dir;
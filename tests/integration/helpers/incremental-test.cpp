@@ -0,0 +1,118 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *     Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "test-helpers-base.h"
+
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QThread>
+
+class TestHelpers: public TestHelpersBase
+{
+    using super = TestHelpersBase;
+
+    void SetUp() override
+    {
+        super::SetUp();
+        init_helper_registry(HELPER_REGISTRY);
+    }
+
+protected:
+
+    // backs up the folder at `path', returning the uuid of its backup
+    QString backup_folder(QString const& path, QSharedPointer<DBusInterfaceKeeperUser> const& user_iface)
+    {
+        // a new backup gets a new uuid, so ask for the choices each time
+        QDBusReply<keeper::Items> choices = user_iface->call("GetBackupChoices");
+        EXPECT_TRUE(choices.isValid()) << qPrintable(choices.error().message());
+        const auto uuid = get_uuid_for_xdg_folder_path(path, choices.value());
+        EXPECT_FALSE(uuid.isEmpty());
+
+        QDBusReply<void> backup_reply = user_iface->call("StartBackup", QStringList{uuid}, "");
+        EXPECT_TRUE(backup_reply.isValid()) << qPrintable(dbus_test_runner.sessionConnection().lastError().message());
+        EXPECT_TRUE(wait_for_all_tasks_have_action_state({uuid}, "complete", user_iface));
+
+        return uuid;
+    }
+};
+
+TEST_F(TestHelpers, RestoreIncrementalBackup)
+{
+    XdgUserDirsSandbox tmp_dir;
+
+    // starts the services, including keeper-service
+    start_tasks();
+
+    QSharedPointer<DBusInterfaceKeeperUser> user_iface(new DBusInterfaceKeeperUser(
+                                                            DBusTypes::KEEPER_SERVICE,
+                                                            DBusTypes::KEEPER_USER_PATH,
+                                                            dbus_test_runner.sessionConnection()
+                                                        ) );
+    ASSERT_TRUE(user_iface->isValid()) << qPrintable(dbus_test_runner.sessionConnection().lastError().message());
+
+    const auto user_dir = QString::fromUtf8(qgetenv("XDG_MUSIC_DIR"));
+    ASSERT_FALSE(user_dir.isEmpty());
+    FileUtils::fillTemporaryDirectory(user_dir, 10, 20);
+
+    // the first backup is a full one
+    const auto full_uuid = backup_folder(user_dir, user_iface);
+
+    // backups are named after the second they were made in
+    QThread::msleep(1100);
+
+    // delete a file and add another, then make an incremental backup
+    const auto files = FileUtils::getFilesRecursively(user_dir);
+    ASSERT_FALSE(files.isEmpty());
+    const auto deleted_file = files.first();
+    ASSERT_TRUE(QFile::remove(deleted_file));
+    QFile added_file(QDir(user_dir).filePath("added-file"));
+    ASSERT_TRUE(added_file.open(QIODevice::WriteOnly));
+    added_file.write("added after the first backup");
+    added_file.close();
+    const auto incremental_uuid = backup_folder(user_dir, user_iface);
+
+    QTemporaryDir expected_dir;
+    ASSERT_TRUE(FileUtils::copyDirsRecursively(user_dir, expected_dir.path()));
+    ASSERT_TRUE(FileUtils::clearDir(user_dir));
+
+    // the second backup should be stored as incremental to the first
+    QDBusPendingReply<keeper::Items> restore_choices_reply = user_iface->call("GetRestoreChoices", "");
+    restore_choices_reply.waitForFinished();
+    ASSERT_TRUE(restore_choices_reply.isValid()) << qPrintable(restore_choices_reply.error().message());
+    const auto restore_choices = restore_choices_reply.value();
+    ASSERT_EQ(2, restore_choices.size());
+    const auto full = restore_choices.find(full_uuid);
+    ASSERT_NE(full, restore_choices.end());
+    const auto incremental = restore_choices.find(incremental_uuid);
+    ASSERT_NE(incremental, restore_choices.end());
+    EXPECT_TRUE((*full).get_base_dir_name().isEmpty());
+    EXPECT_EQ((*full).get_dir_name(), (*incremental).get_base_dir_name());
+
+    // restoring the second backup restores the first one too,
+    // then removes the file that was deleted in between
+    QDBusPendingReply<void> restore_reply = user_iface->call("StartRestore", QStringList{incremental_uuid}, "");
+    restore_reply.waitForFinished();
+    ASSERT_TRUE(restore_reply.isValid()) << qPrintable(dbus_test_runner.sessionConnection().lastError().message());
+    EXPECT_TRUE(wait_for_all_tasks_have_action_state({full_uuid, incremental_uuid}, "complete", user_iface));
+
+    EXPECT_FALSE(QFile::exists(deleted_file));
+    EXPECT_TRUE(QFile::exists(added_file.fileName()));
+    EXPECT_TRUE(FileUtils::compareDirectories(expected_dir.path(), user_dir));
+}
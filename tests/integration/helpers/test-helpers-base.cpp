@@ -23,6 +23,8 @@
 #include "service/manifest.h"
 #include "storage-framework/storage_framework_client.h"
 
+#include <algorithm> // std::max()
+
 #include <sys/types.h>
 #include <signal.h>
 
@@ -574,6 +576,75 @@ bool TestHelpersBase::capture_and_check_state_until_all_tasks_complete(QSignalSp
     return analyze_tasks_values(uuids_state);
 }
 
+bool TestHelpersBase::capture_max_running_tasks_until_all_tasks_complete(QSignalSpy & spy, QStringList const & uuids, int & max_running_tasks, int max_timeout_msec)
+{
+    QMap<QString, QString> uuids_current_state;
+    for (auto const& uuid : uuids)
+    {
+        uuids_current_state[uuid] = "none";
+    }
+
+    max_running_tasks = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    bool finished = false;
+    while (!timer.hasExpired(max_timeout_msec) && !finished)
+    {
+        spy.wait();
+
+        while (spy.count())
+        {
+            auto arguments = spy.takeFirst();
+
+            if (arguments.size() != 3)
+            {
+                qWarning() << "Bad number of arguments in PropertiesChanged signal";
+                return false;
+            }
+
+            // verify interface and invalidated_properties arguments
+            if(!verify_signal_interface_and_invalidated_properties(arguments.at(0), arguments.at(2), DBusTypes::KEEPER_USER_INTERFACE, "State"))
+            {
+                return false;
+            }
+            keeper::Items keeper_state;
+            if (!get_property_qvariant_keeper_items_map("State", arguments.at(1), keeper_state))
+            {
+                return false;
+            }
+            for (auto iter = keeper_state.begin(); iter != keeper_state.end(); ++iter )
+            {
+                QVariantMap task_state;
+                if (!qvariant_to_map((*iter), task_state))
+                {
+                    qWarning() << "Error converting second argument in PropertiesChanged signal to QVariantMap for uuid: " << iter.key();
+                    return false;
+                }
+
+                QVariant action;
+                if (get_task_property(keeper::Item::STATUS_KEY, task_state, action))
+                {
+                    uuids_current_state[iter.key()] = action.toString();
+                }
+            }
+
+            int running_tasks = 0;
+            for (auto const& state : uuids_current_state)
+            {
+                if (state != "none" && state != "queued" && state != "complete")
+                {
+                    ++running_tasks;
+                }
+            }
+            qDebug() << "Running tasks:" << running_tasks << uuids_current_state;
+            max_running_tasks = std::max(max_running_tasks, running_tasks);
+        }
+        finished = all_tasks_has_state(uuids_current_state, "complete");
+    }
+    return finished;
+}
+
 bool TestHelpersBase::cancel_first_task_at_percentage(QSignalSpy & spy, double expected_percentage, QSharedPointer<DBusInterfaceKeeperUser> const & user_iface, int max_timeout_msec)
 {
     QMap<QString, QList<QVariantMap>> uuids_state;
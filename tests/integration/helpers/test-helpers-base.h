@@ -100,6 +100,9 @@ protected:
 
     bool capture_and_check_state_until_all_tasks_complete(QSignalSpy & spy, QStringList const & uuids, QString const & action_state, int max_timeout_msec = 15000);
 
+    // records the most tasks that were running at once, i.e. neither queued nor complete
+    bool capture_max_running_tasks_until_all_tasks_complete(QSignalSpy & spy, QStringList const & uuids, int & max_running_tasks, int max_timeout_msec = 30000);
+
     bool cancel_first_task_at_percentage(QSignalSpy & spy, double expected_percentage, QSharedPointer<DBusInterfaceKeeperUser> const & user_iface, int max_timeout_msec = 15000);
 
     QString get_uuid_for_xdg_folder_path(QString const &path, keeper::Items const & choices) const;
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "helper/progress-channel.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+
+TEST(ProgressChannel, RecordsSurviveBeingSplit)
+{
+    QByteArray index;
+    for (int i=0; i<1000; ++i)
+        index.append(char(i % 256));
+    const QByteArray head {"head"};
+
+    const auto records = ProgressChannel::create_sent(5)
+                       + ProgressChannel::create_head(head)
+                       + ProgressChannel::create_sent(1234567890123)
+                       + ProgressChannel::create_index(index)
+                       + ProgressChannel::create_sent(1234567890124);
+
+    // one byte at a time
+    ProgressChannel::Parser parser;
+    for (int i=0; i<records.size(); ++i)
+    {
+        EXPECT_TRUE(parser.feed(records.constData()+i, 1));
+        if (i+1 == ProgressChannel::RECORD_SIZE) {
+            EXPECT_EQ(5, parser.n_sent());
+        }
+    }
+    EXPECT_EQ(1234567890124, parser.n_sent());
+    EXPECT_EQ(head, parser.head());
+    EXPECT_EQ(index, parser.index());
+
+    // all at once
+    ProgressChannel::Parser whole;
+    EXPECT_TRUE(whole.feed(records.constData(), records.size()));
+    EXPECT_EQ(parser.n_sent(), whole.n_sent());
+    EXPECT_EQ(head, whole.head());
+    EXPECT_EQ(index, whole.index());
+}
+
+TEST(ProgressChannel, GarbageFails)
+{
+    ProgressChannel::Parser parser;
+    EXPECT_TRUE(parser.feed("garbage", 7));
+    EXPECT_FALSE(parser.feed("garbage garbage", 15));
+    EXPECT_FALSE(parser.feed(ProgressChannel::create_sent(1).constData(), ProgressChannel::RECORD_SIZE));
+    EXPECT_EQ(0, parser.n_sent());
+}
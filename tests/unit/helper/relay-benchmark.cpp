@@ -0,0 +1,173 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/relay.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm> // std::min(), std::max()
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/**
+ * Compares the throughput and CPU cost of relaying a stream between
+ * two local socketpairs, as BackupHelper does between the helper and
+ * storage-framework: with the old fixed 16 KiB QByteArray, with
+ * Relay copying through its ring buffer, and with Relay splicing.
+ *
+ * This isn't run by ctest because it takes a while and its
+ * results depend on the machine. Run it by hand.
+ */
+
+namespace
+{
+    constexpr qint64 n_bytes {qint64(1024)*1024*1024};
+
+    // user + system CPU time used by the calling thread, in nanoseconds
+    qint64 thread_cpu_ns()
+    {
+        struct rusage usage {};
+        getrusage(RUSAGE_THREAD, &usage);
+        auto const to_ns = [](struct timeval const& tv){return qint64(tv.tv_sec)*1000000000 + qint64(tv.tv_usec)*1000;};
+        return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+    }
+
+    void wait_for(int fd, short events)
+    {
+        pollfd pfd {fd, events, 0};
+        poll(&pfd, 1, -1);
+    }
+
+    // `relay' moves everything from in_fd to out_fd, which are nonblocking.
+    // Another thread writes the input and another drains the output.
+    void benchmark(char const* name, std::function<qint64(int in_fd, int out_fd)> const& relay)
+    {
+        int in[2], out[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, in));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, out));
+        fcntl(in[0], F_SETFL, O_NONBLOCK);
+        fcntl(out[0], F_SETFL, O_NONBLOCK);
+
+        std::thread source([in](){
+            std::vector<char> buf(1024*64, 'x');
+            for (qint64 n_left=n_bytes; n_left>0; ) {
+                const auto n = write(in[1], buf.data(), size_t(std::min(n_left, qint64(buf.size()))));
+                if (n <= 0)
+                    break;
+                n_left -= n;
+            }
+            shutdown(in[1], SHUT_WR);
+        });
+        std::thread sink([out](){
+            char buf[1024*64];
+            while (read(out[1], buf, sizeof(buf)) > 0) {}
+        });
+
+        const auto begin = std::chrono::steady_clock::now();
+        const auto begin_cpu = thread_cpu_ns();
+        const auto n_relayed = relay(in[0], out[0]);
+        const auto cpu = thread_cpu_ns() - begin_cpu;
+        const qint64 msec = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+
+        shutdown(out[0], SHUT_WR);
+        source.join();
+        sink.join();
+        for (auto fd : {in[0], in[1], out[0], out[1]})
+            close(fd);
+
+        EXPECT_EQ(n_bytes, n_relayed);
+        std::cout << name << ": "
+                  << (double(n_relayed) / (1024*1024)) / (double(std::max(msec, qint64(1))) / 1000) << " MB/s, "
+                  << double(cpu) / double(n_relayed) << " CPU ns/byte in the relaying thread" << std::endl;
+    }
+
+    qint64 run_relay(Relay& relay, int in_fd, int out_fd)
+    {
+        for (;;)
+        {
+            const auto status = relay.pump();
+            if (status == Relay::Status::WAIT_READ)
+                wait_for(in_fd, POLLIN);
+            else if (status == Relay::Status::WAIT_WRITE)
+                wait_for(out_fd, POLLOUT);
+            else
+                return relay.n_written();
+        }
+    }
+}
+
+TEST(Relay, Benchmark)
+{
+    // what BackupHelper used to do: read 16 KiB at a time into a
+    // QByteArray, and remove() whatever each write managed to send
+    benchmark("16 KiB QByteArray", [](int in_fd, int out_fd){
+        static constexpr int UPLOAD_BUFFER_MAX {1024*16};
+        char readbuf[UPLOAD_BUFFER_MAX];
+        QByteArray upload_buffer;
+        qint64 n_written {};
+        bool eof {};
+        while (!eof || upload_buffer.size())
+        {
+            const int max_bytes = UPLOAD_BUFFER_MAX - upload_buffer.size();
+            const auto n_read = eof || !max_bytes ? 0 : read(in_fd, readbuf, size_t(max_bytes));
+            if (n_read > 0)
+                upload_buffer.append(readbuf, int(n_read));
+            else if (n_read == 0 && max_bytes)
+                eof = true;
+
+            const auto n = upload_buffer.size() ? write(out_fd, upload_buffer.constData(), size_t(upload_buffer.size())) : 0;
+            if (n > 0) {
+                upload_buffer.remove(0, int(n));
+                n_written += n;
+            }
+            else if ((n_read < 0) && upload_buffer.isEmpty()) {
+                wait_for(in_fd, POLLIN);
+            }
+            else if (n < 0) {
+                wait_for(out_fd, POLLOUT);
+            }
+        }
+        return n_written;
+    });
+
+    // an observer that looks at everything keeps it in the ring buffer
+    benchmark("Relay, copying", [](int in_fd, int out_fd){
+        Relay relay(in_fd, out_fd, [](char const*, size_t){return size_t(0);});
+        return run_relay(relay, in_fd, out_fd);
+    });
+
+    benchmark("Relay, splicing", [](int in_fd, int out_fd){
+        Relay relay(in_fd, out_fd);
+        const auto n_written = run_relay(relay, in_fd, out_fd);
+        std::cout << "Relay: " << relay.n_spliced() << " bytes spliced" << std::endl;
+        return n_written;
+    });
+}
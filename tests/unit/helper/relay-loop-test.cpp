@@ -0,0 +1,317 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "qdbus-stubs/dbus-types.h"
+#include "qdbus-stubs/DBusPropertiesInterface.h"
+#include "util/relay-loop.h"
+
+#include <gtest/gtest.h>
+#include <libqtdbustest/DBusTestRunner.h>
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusMessage>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm> // std::min()
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+    QByteArray random_bytes(int n)
+    {
+        QByteArray bytes(n, '\0');
+        for (auto& ch : bytes)
+            ch = char(qrand() % 256);
+        return bytes;
+    }
+
+    bool is_readable(int fd)
+    {
+        pollfd pfd {fd, POLLIN, 0};
+        return poll(&pfd, 1, 0) == 1;
+    }
+
+    // Relays `contents' through the shared RelayLoop while this thread
+    // keeps calling `keep_busy'. Returns how long it took, in msec.
+    qint64 relay_msec(QByteArray const& contents, std::function<void()> const& keep_busy)
+    {
+        int in[2], out[2];
+        EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, in));
+        EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, out));
+        fcntl(in[0], F_SETFL, O_NONBLOCK);
+        fcntl(out[0], F_SETFL, O_NONBLOCK);
+
+        std::thread writer([&in, &contents](){
+            for (int pos=0; pos<contents.size(); ) {
+                const auto n = write(in[1], contents.constData()+pos, size_t(std::min(1024*256, contents.size()-pos)));
+                if (n <= 0)
+                    break;
+                pos += int(n);
+            }
+            shutdown(in[1], SHUT_WR);
+        });
+
+        QByteArray received;
+        received.reserve(contents.size());
+        std::atomic<bool> received_all {false};
+        std::thread reader([&out, &received, &received_all, &contents](){
+            char buf[1024*64];
+            while (received.size() < contents.size()) {
+                const auto n = read(out[1], buf, sizeof(buf));
+                if (n <= 0)
+                    break;
+                received.append(buf, int(n));
+            }
+            received_all = true;
+        });
+
+        auto loop = RelayLoop::shared();
+        const auto begin = std::chrono::steady_clock::now();
+        auto job = loop->add(std::unique_ptr<Relay>(new Relay(in[0], out[0])), in[0], out[0]);
+
+        const auto deadline = begin + std::chrono::seconds(30);
+        while (!received_all && (std::chrono::steady_clock::now() < deadline))
+            keep_busy();
+        const auto elapsed = std::chrono::steady_clock::now() - begin;
+
+        writer.join();
+        reader.join();
+        EXPECT_TRUE(received_all);
+        EXPECT_EQ(contents, received);
+        EXPECT_EQ(contents.size(), job->n_written());
+        loop->remove(job);
+        for (auto fd : {in[0], in[1], out[0], out[1]})
+            close(fd);
+
+        return std::max(qint64(1), qint64(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()));
+    }
+}
+
+class RelayLoopFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        qsrand(uint(time(nullptr)));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, in_));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, out_));
+        fcntl(in_[0], F_SETFL, O_NONBLOCK);
+        fcntl(out_[0], F_SETFL, O_NONBLOCK);
+    }
+
+    void TearDown() override
+    {
+        for (auto fd : {in_[0], in_[1], out_[0], out_[1]})
+            close(fd);
+    }
+
+    int in_[2] {-1, -1};
+    int out_[2] {-1, -1};
+};
+
+
+// The helpers' data keeps moving even when the main loop
+// is stuck, e.g. in a slow DBus call or a burst of signals
+TEST_F(RelayLoopFixture, RelaysWhileMainThreadIsBusy)
+{
+    const auto contents = random_bytes(1024*1024*32);
+
+    std::thread writer([this, &contents](){
+        for (int pos=0; pos<contents.size(); ) {
+            const auto n = write(in_[1], contents.constData()+pos, size_t(std::min(1024*256, contents.size()-pos)));
+            if (n <= 0)
+                break;
+            pos += int(n);
+        }
+        shutdown(in_[1], SHUT_WR);
+    });
+
+    QByteArray received;
+    std::atomic<bool> received_all {false};
+    std::thread reader([this, &received, &received_all, &contents](){
+        char buf[1024*64];
+        while (received.size() < contents.size()) {
+            const auto n = read(out_[1], buf, sizeof(buf));
+            if (n <= 0)
+                break;
+            received.append(buf, int(n));
+        }
+        received_all = true;
+    });
+
+    auto loop = RelayLoop::shared();
+    const auto begin = std::chrono::steady_clock::now();
+    auto job = loop->add(std::unique_ptr<Relay>(new Relay(in_[0], out_[0])), in_[0], out_[0]);
+
+    // Block this thread the way a slow DBus handler would block
+    // the main loop. Nothing here pumps the relay.
+    const auto deadline = begin + std::chrono::seconds(30);
+    while (!received_all && (std::chrono::steady_clock::now() < deadline))
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const auto elapsed = std::chrono::steady_clock::now() - begin;
+    const auto msec = qint64(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+    std::cerr << "relayed " << contents.size() << " bytes in " << msec << " msec while the main thread was blocked" << std::endl;
+
+    writer.join();
+    reader.join();
+    EXPECT_TRUE(received_all);
+    EXPECT_EQ(contents, received);
+
+    // the main thread hears about it when it's free again
+    EXPECT_TRUE(is_readable(job->notify_fd()));
+    job->clear_notify();
+    EXPECT_FALSE(is_readable(job->notify_fd()));
+    EXPECT_EQ(Relay::Status::DONE, job->status());
+    EXPECT_EQ(contents.size(), job->n_read());
+    EXPECT_EQ(contents.size(), job->n_written());
+    loop->remove(job);
+}
+
+
+TEST_F(RelayLoopFixture, RemoveLetsGoOfTheRelay)
+{
+    std::atomic<qint64> n_observed {0};
+    auto relay = std::unique_ptr<Relay>(new Relay(in_[0], out_[0],
+        [&n_observed](char const*, size_t len) -> size_t {
+            n_observed += qint64(len);
+            return 0;
+        }
+    ));
+
+    auto loop = RelayLoop::shared();
+    auto job = loop->add(std::move(relay), in_[0], out_[0]);
+
+    const QByteArray chunk(1024, 'x');
+    for (int i=0; (i<1000) && (job->n_written() < 4*chunk.size()); ++i) {
+        EXPECT_EQ(ssize_t(chunk.size()), write(in_[1], chunk.constData(), size_t(chunk.size())));
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_LE(4*chunk.size(), job->n_written());
+    EXPECT_EQ(Relay::Status::WAIT_READ, job->status());
+
+    // once it's removed, nothing more is relayed or observed
+    loop->remove(job);
+    const auto n_written = job->n_written();
+    const auto n_seen = n_observed.load();
+    EXPECT_EQ(ssize_t(chunk.size()), write(in_[1], chunk.constData(), size_t(chunk.size())));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(n_written, job->n_written());
+    EXPECT_EQ(n_seen, n_observed.load());
+}
+
+
+// Like RelaysWhileMainThreadIsBusy, but with real traffic on a session
+// bus: a flood of State PropertiesChanged signals that the main loop has
+// to take in, like the ones keeper-service sends while a backup runs
+TEST_F(RelayLoopFixture, RelaysWhileSessionBusIsBusy)
+{
+    // how much slower the relay may be while the bus is busy
+    static constexpr double MAX_SLOWDOWN {3.0};
+
+    QtDBusTest::DBusTestRunner test_runner;
+    auto flood_conn = QDBusConnection::connectToBus(test_runner.sessionBus(), QStringLiteral("relay-loop-test-flood"));
+    ASSERT_TRUE(flood_conn.isConnected());
+    ASSERT_TRUE(flood_conn.registerService(DBusTypes::KEEPER_SERVICE));
+
+    DBusPropertiesInterface properties(DBusTypes::KEEPER_SERVICE,
+                                       DBusTypes::KEEPER_USER_PATH,
+                                       test_runner.sessionConnection());
+    std::atomic<qint64> n_signals {0};
+    QObject::connect(&properties, &DBusPropertiesInterface::PropertiesChanged,
+        [&n_signals](QString const&, QVariantMap const& changed, QStringList const&){
+            if (changed.contains(QStringLiteral("State")))
+                ++n_signals;
+        }
+    );
+
+    // a State the size of a dozen tasks' worth
+    QVariantDictMap state;
+    for (int i=0; i<12; ++i)
+        state[QStringLiteral("task-%1").arg(i)] = QVariantMap{
+            {QStringLiteral("action"), QStringLiteral("saving")},
+            {QStringLiteral("display-name"), QStringLiteral("Folder %1").arg(i)},
+            {QStringLiteral("percent-done"), 0.5},
+            {QStringLiteral("speed"), 1024*1024},
+            {QStringLiteral("uuid"), QStringLiteral("%1").arg(i, 36, 10, QChar('0'))}
+        };
+    auto signal = QDBusMessage::createSignal(DBusTypes::KEEPER_USER_PATH,
+                                             QStringLiteral("org.freedesktop.DBus.Properties"),
+                                             QStringLiteral("PropertiesChanged"));
+    signal << QString::fromUtf8(DBusTypes::KEEPER_USER_INTERFACE)
+           << QVariantMap{{QStringLiteral("State"), QVariant::fromValue(state)}}
+           << QStringList();
+
+    // the main loop, taking in whatever the bus has for it
+    auto keep_busy = [](){
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    };
+
+    const auto contents = random_bytes(1024*1024*64);
+
+    const auto idle_msec = relay_msec(contents, keep_busy);
+    EXPECT_EQ(0, n_signals.load());
+
+    // Flood the bus from another thread. The pings keep the flood
+    // at the bus's pace instead of queueing up without limit.
+    std::atomic<bool> flooding {true};
+    std::thread flooder([&flood_conn, &signal, &flooding](){
+        const auto ping = QDBusMessage::createMethodCall(QStringLiteral("org.freedesktop.DBus"),
+                                                         QStringLiteral("/org/freedesktop/DBus"),
+                                                         QStringLiteral("org.freedesktop.DBus.Peer"),
+                                                         QStringLiteral("Ping"));
+        for (int i=1; flooding; ++i) {
+            flood_conn.send(signal);
+            if (!(i % 64))
+                flood_conn.call(ping);
+        }
+    });
+
+    // make sure the flood has reached us before starting
+    for (int i=0; (i<500) && !n_signals; ++i)
+        keep_busy();
+    const auto n_before = n_signals.load();
+    EXPECT_LT(0, n_before);
+
+    const auto busy_msec = relay_msec(contents, keep_busy);
+    const auto n_during = n_signals.load() - n_before;
+
+    flooding = false;
+    flooder.join();
+    QDBusConnection::disconnectFromBus(flood_conn.name());
+
+    std::cerr << "relayed " << contents.size() << " bytes in " << idle_msec << " msec on an idle bus, "
+              << busy_msec << " msec while handling " << n_during << " PropertiesChanged signals" << std::endl;
+
+    // the main thread really was busy with the bus the whole time...
+    EXPECT_LT(0, n_during);
+
+    // ...and the relay, on its own thread, kept up
+    EXPECT_LE(double(busy_msec), double(idle_msec) * MAX_SLOWDOWN);
+}
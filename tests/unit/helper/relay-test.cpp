@@ -0,0 +1,237 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "util/relay.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QFile>
+#include <QTemporaryFile>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm> // std::min()
+#include <csignal>
+#include <cstring> // memcmp()
+#include <thread>
+
+namespace
+{
+    QByteArray random_bytes(int n)
+    {
+        QByteArray bytes(n, '\0');
+        for (auto& ch : bytes)
+            ch = char(qrand() % 256);
+        return bytes;
+    }
+
+    // pumps `relay' until it's moved everything, waiting on the fds when it asks to
+    Relay::Status run(Relay& relay, int in_fd, int out_fd, qint64 n_expected)
+    {
+        for (;;)
+        {
+            const auto status = relay.pump();
+            if ((status == Relay::Status::READ_FAILED) || (status == Relay::Status::WRITE_FAILED))
+                return status;
+            if (relay.n_written() == n_expected)
+                return status;
+
+            pollfd pfd {in_fd, POLLIN, 0};
+            if (status == Relay::Status::WAIT_WRITE)
+                pfd = pollfd{out_fd, POLLOUT, 0};
+            poll(&pfd, pfd.fd == -1 ? 0 : 1, 10);
+        }
+    }
+
+    // Passes `contents' through a relay between two socketpairs,
+    // written and read in odd-sized pieces by other threads
+    class SocketRelay
+    {
+    public:
+
+        SocketRelay()
+        {
+            EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, in_));
+            EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, out_));
+            fcntl(in_[0], F_SETFL, O_NONBLOCK);
+            fcntl(out_[0], F_SETFL, O_NONBLOCK);
+        }
+
+        ~SocketRelay()
+        {
+            for (auto fd : {in_[0], in_[1], out_[0], out_[1]})
+                close(fd);
+        }
+
+        int in_fd() const { return in_[0]; }
+        int out_fd() const { return out_[0]; }
+
+        // if `feed' is false, the relay has some other source
+        QByteArray relay(Relay& relay, QByteArray const& contents, bool feed=true)
+        {
+            std::thread writer([this, &contents, feed](){
+                for (int pos=0; feed && pos<contents.size(); ) {
+                    const auto n = write(in_[1], contents.constData()+pos, size_t(std::min(1 + qrand() % 100000, contents.size()-pos)));
+                    if (n <= 0)
+                        break;
+                    pos += int(n);
+                }
+                shutdown(in_[1], SHUT_WR);
+            });
+
+            QByteArray received;
+            std::thread reader([this, &received, &contents](){
+                char buf[1024*64];
+                while (received.size() < contents.size()) {
+                    const auto n = read(out_[1], buf, size_t(1 + qrand() % int(sizeof(buf))));
+                    if (n <= 0)
+                        break;
+                    received.append(buf, int(n));
+                }
+            });
+
+            const auto status = run(relay, feed ? in_[0] : -1, out_[0], contents.size());
+            EXPECT_NE(Relay::Status::READ_FAILED, status);
+            EXPECT_NE(Relay::Status::WRITE_FAILED, status);
+            writer.join();
+            reader.join();
+            EXPECT_EQ(contents.size(), relay.n_read());
+            EXPECT_EQ(contents.size(), relay.n_written());
+            return received;
+        }
+
+    private:
+
+        int in_[2];
+        int out_[2];
+    };
+}
+
+class RelayFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        qsrand(uint(time(nullptr)));
+    }
+};
+
+
+TEST_F(RelayFixture, SplicesWithoutObserver)
+{
+    const auto contents = random_bytes(1024*1024*16 + 1);
+
+    SocketRelay sockets;
+    Relay relay(sockets.in_fd(), sockets.out_fd());
+    EXPECT_EQ(contents, sockets.relay(relay, contents));
+    EXPECT_EQ(contents.size(), relay.n_spliced());
+}
+
+
+TEST_F(RelayFixture, ObserverSeesWhatItAsksFor)
+{
+    const auto contents = random_bytes(1024*1024*16 + 1);
+
+    // look at every other stretch of bytes, skipping the ones between
+    qint64 pos {};
+    qint64 n_seen {};
+    bool matched {true};
+    SocketRelay sockets;
+    Relay relay(sockets.in_fd(), sockets.out_fd(),
+        [&](char const* buf, size_t len) -> size_t {
+            if (buf) {
+                matched = matched && !memcmp(buf, contents.constData()+pos, len);
+                n_seen += qint64(len);
+            }
+            pos += qint64(len);
+            return size_t(qrand() % 2 ? 0 : qrand() % (1024*512));
+        }
+    );
+    EXPECT_EQ(contents, sockets.relay(relay, contents));
+    EXPECT_TRUE(matched);
+    EXPECT_EQ(contents.size(), pos);
+    EXPECT_EQ(contents.size(), n_seen + relay.n_spliced());
+    EXPECT_LT(0, relay.n_spliced());
+    EXPECT_LT(0, n_seen);
+}
+
+
+TEST_F(RelayFixture, ReadFunc)
+{
+    const auto contents = random_bytes(1024*1024*4 + 1);
+
+    // a source that trickles in
+    int pos {};
+    SocketRelay sockets;
+    Relay relay(
+        [&contents, &pos](char* buf, size_t maxlen) -> ssize_t {
+            const auto n = std::min({int(maxlen), contents.size()-pos, qrand() % 100000});
+            memcpy(buf, contents.constData()+pos, size_t(n));
+            pos += n;
+            return n;
+        },
+        sockets.out_fd()
+    );
+    EXPECT_EQ(contents, sockets.relay(relay, contents, false));
+    EXPECT_EQ(0, relay.n_spliced());
+}
+
+
+TEST_F(RelayFixture, FromFile)
+{
+    const auto contents = random_bytes(1024*1024*8 + 1);
+    QTemporaryFile file;
+    ASSERT_TRUE(file.open());
+    ASSERT_EQ(contents.size(), file.write(contents));
+    ASSERT_TRUE(file.flush());
+
+    const auto fd = open(QFile::encodeName(file.fileName()).constData(), O_RDONLY);
+    ASSERT_NE(-1, fd);
+    SocketRelay sockets;
+    Relay relay(fd, sockets.out_fd());
+    EXPECT_EQ(contents, sockets.relay(relay, contents, false));
+    EXPECT_EQ(Relay::Status::DONE, relay.pump());
+    EXPECT_EQ(contents.size(), relay.n_spliced());
+    close(fd);
+}
+
+
+TEST_F(RelayFixture, WriteFailure)
+{
+    const auto contents = random_bytes(1024*1024);
+
+    // the reader hangs up
+    int in[2], out[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, in));
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK, 0, out));
+    close(out[1]);
+    ASSERT_LT(0, write(in[1], contents.constData(), 1024));
+
+    signal(SIGPIPE, SIG_IGN);
+    Relay relay(in[0], out[0]);
+    EXPECT_EQ(Relay::Status::WRITE_FAILED, relay.pump());
+
+    for (auto fd : {in[0], in[1], out[0]})
+        close(fd);
+}
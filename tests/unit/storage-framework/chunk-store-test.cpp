@@ -0,0 +1,385 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include <storage-framework/chunk-cache.h>
+#include <storage-framework/chunk-store.h>
+#include <storage-framework/chunker.h>
+#include <storage-framework/storage_framework_client.h>
+
+#include "tests/utils/storage-framework-local.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QSet>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QVector>
+
+#include <gtest/gtest.h>
+#include <glib.h>
+
+namespace
+{
+    QByteArray random_bytes(int n)
+    {
+        QByteArray bytes(n, '\0');
+        for (auto& ch : bytes)
+            ch = char(qrand() % 256);
+        return bytes;
+    }
+
+    // splits `data' the way ChunkUploader does
+    QVector<QByteArray> chunk(QByteArray const& data)
+    {
+        QVector<QByteArray> chunks;
+        for (int pos=0; pos<data.size(); )
+        {
+            const auto n = int(Chunker::cut(data.constData()+pos, size_t(data.size()-pos)));
+            chunks << data.mid(pos, n);
+            pos += n;
+        }
+        return chunks;
+    }
+
+    template<typename T>
+    T get_result(QFuture<T> future)
+    {
+        if (!future.isFinished())
+        {
+            QFutureWatcher<T> w;
+            QSignalSpy spy(&w, &QFutureWatcher<T>::finished);
+            w.setFuture(future);
+            EXPECT_TRUE(spy.wait());
+        }
+        return future.result();
+    }
+
+    int count_packs()
+    {
+        QDir dir;
+        if (!StorageFrameworkLocalUtils::find_storage_framework_root_dir(dir) || !dir.cd(ChunkStore::DIR_NAME))
+            return 0;
+        return dir.entryList(QDir::Files).size();
+    }
+}
+
+class ChunkStoreFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        qsrand(uint(time(nullptr)));
+        g_setenv("XDG_DATA_HOME", tmp_dir_.path().toLatin1().data(), true);
+        g_setenv("XDG_CACHE_HOME", cache_dir_.path().toLatin1().data(), true);
+    }
+
+    void TearDown() override
+    {
+        g_unsetenv("XDG_DATA_HOME");
+        g_unsetenv("XDG_CACHE_HOME");
+    }
+
+    void upload(StorageFrameworkClient& sf_client, QString const& dir_name, QByteArray const& contents)
+    {
+        auto uploader = get_result(sf_client.get_new_chunk_uploader(contents.size(), dir_name, "test" + ChunkStore::LIST_SUFFIX));
+        ASSERT_NE(nullptr, uploader);
+
+        QSignalSpy spy(uploader.get(), &Uploader::commit_finished);
+        uploader->socket()->write(contents);
+        uploader->commit();
+        ASSERT_TRUE(spy.wait(30*1000));
+        ASSERT_EQ(1, spy.count());
+        EXPECT_TRUE(spy.takeFirst().at(0).toBool());
+        EXPECT_EQ("test" + ChunkStore::LIST_SUFFIX, uploader->file_name());
+    }
+
+    QByteArray download(StorageFrameworkClient& sf_client, QString const& dir_name)
+    {
+        auto downloader = get_result(sf_client.get_new_chunk_downloader(dir_name, "test" + ChunkStore::LIST_SUFFIX));
+        EXPECT_NE(nullptr, downloader);
+        if (!downloader)
+            return QByteArray();
+
+        auto socket = downloader->socket();
+        QByteArray contents;
+        for (;;)
+        {
+            contents += socket->readAll();
+            if (contents.size() >= downloader->file_size())
+                break;
+            QSignalSpy spy(socket.get(), &QLocalSocket::readyRead);
+            if (!spy.wait(10*1000))
+                break;
+        }
+        EXPECT_EQ(downloader->file_size(), contents.size());
+        downloader->finish();
+        return contents;
+    }
+
+    QTemporaryDir tmp_dir_;
+    QTemporaryDir cache_dir_;
+};
+
+
+TEST_F(ChunkStoreFixture, ChunkSizes)
+{
+    const auto data = random_bytes(4*1024*1024);
+    const auto chunks = chunk(data);
+
+    QByteArray joined;
+    for (int i=0, n=chunks.size(); i<n; ++i)
+    {
+        joined += chunks[i];
+        EXPECT_LE(size_t(chunks[i].size()), Chunker::MAX_SIZE);
+        if (i != n-1)
+            EXPECT_GE(size_t(chunks[i].size()), Chunker::MIN_SIZE);
+    }
+    EXPECT_EQ(data, joined);
+
+    // the average should be in the neighborhood of AVG_SIZE
+    const auto avg = size_t(data.size() / chunks.size());
+    EXPECT_GT(avg, Chunker::AVG_SIZE/2);
+    EXPECT_LT(avg, Chunker::AVG_SIZE*2);
+
+    // small buffers are a single chunk
+    EXPECT_EQ(size_t(100), Chunker::cut(data.constData(), 100));
+}
+
+
+TEST_F(ChunkStoreFixture, BoundariesSurviveEdits)
+{
+    const auto before = random_bytes(4*1024*1024);
+    auto after = before;
+    after.insert(1024*1024, random_bytes(100));
+
+    QSet<QByteArray> before_ids;
+    for (auto const& c : chunk(before))
+        before_ids << ChunkStore::chunk_id(c.constData(), c.size());
+
+    // only the chunks around the edit should be new
+    int n_new {};
+    for (auto const& c : chunk(after))
+        if (!before_ids.contains(ChunkStore::chunk_id(c.constData(), c.size())))
+            ++n_new;
+    EXPECT_LE(n_new, 2);
+}
+
+
+TEST_F(ChunkStoreFixture, ListAndIndex)
+{
+    QVector<ChunkStore::Chunk> chunks;
+    for (int i=0; i<100; ++i)
+    {
+        const auto data = random_bytes(10);
+        chunks << ChunkStore::Chunk{ChunkStore::chunk_id(data.constData(), data.size()),
+                                    QString("pack-%1").arg(i%3),
+                                    quint32(i*10),
+                                    10};
+    }
+
+    // list round trip
+    QVector<ChunkStore::Chunk> parsed;
+    ASSERT_TRUE(ChunkStore::parse_list(ChunkStore::create_list(chunks), parsed));
+    ASSERT_EQ(chunks.size(), parsed.size());
+    for (int i=0; i<chunks.size(); ++i)
+    {
+        EXPECT_EQ(chunks[i].id, parsed[i].id);
+        EXPECT_EQ(chunks[i].pack, parsed[i].pack);
+        EXPECT_EQ(chunks[i].offset, parsed[i].offset);
+        EXPECT_EQ(chunks[i].length, parsed[i].length);
+    }
+    EXPECT_FALSE(ChunkStore::parse_list("this is not a chunk list", parsed));
+
+    // index round trip
+    ChunkStore::Index index;
+    for (auto const& c : chunks)
+        index.add(c);
+    const auto path = ChunkStore::Index::path_for("storage");
+    ASSERT_TRUE(index.save(path));
+    ChunkStore::Index loaded;
+    ASSERT_TRUE(loaded.load(path));
+    EXPECT_EQ(chunks.size(), loaded.size());
+    for (auto const& c : chunks)
+    {
+        ChunkStore::Chunk found;
+        ASSERT_TRUE(loaded.find(c.id, found));
+        EXPECT_EQ(c.pack, found.pack);
+        EXPECT_EQ(c.offset, found.offset);
+    }
+    ChunkStore::Chunk found;
+    EXPECT_FALSE(loaded.find(QByteArray(32, 'x'), found));
+
+    // forgetting a pack forgets the chunks in it
+    EXPECT_EQ(QSet<QString>({"pack-0", "pack-1", "pack-2"}), loaded.packs());
+    loaded.remove_packs(QSet<QString>{"pack-1"});
+    EXPECT_EQ(QSet<QString>({"pack-0", "pack-2"}), loaded.packs());
+    EXPECT_EQ(chunks.size() - 33, loaded.size());
+}
+
+
+TEST_F(ChunkStoreFixture, UploadAndDownload)
+{
+    StorageFrameworkClient sf_client;
+
+    // big enough to fill more than one pack
+    const auto contents = random_bytes(ChunkStore::PACK_SIZE + 2*1024*1024);
+    upload(sf_client, "first", contents);
+    const auto n_packs = count_packs();
+    EXPECT_EQ(2, n_packs);
+    EXPECT_EQ(contents, download(sf_client, "first"));
+
+    // backing up the same thing again doesn't store anything new
+    upload(sf_client, "second", contents);
+    EXPECT_EQ(n_packs, count_packs());
+    EXPECT_EQ(contents, download(sf_client, "second"));
+
+    // a small change only stores a small new pack
+    auto changed = contents;
+    changed.replace(1024*1024, 1000, random_bytes(1000));
+    upload(sf_client, "third", changed);
+    EXPECT_EQ(n_packs + 1, count_packs());
+    EXPECT_EQ(changed, download(sf_client, "third"));
+}
+
+
+TEST_F(ChunkStoreFixture, MissingPacksAreUploadedAgain)
+{
+    StorageFrameworkClient sf_client;
+
+    const auto contents = random_bytes(1024*1024);
+    upload(sf_client, "first", contents);
+    const auto n_packs = count_packs();
+    ASSERT_LT(0, n_packs);
+
+    // lose the packs behind the index's back
+    QDir dir;
+    ASSERT_TRUE(StorageFrameworkLocalUtils::find_storage_framework_root_dir(dir));
+    ASSERT_TRUE(dir.cd(ChunkStore::DIR_NAME));
+    for (auto const& pack : dir.entryList(QDir::Files))
+        ASSERT_TRUE(dir.remove(pack));
+
+    // the next backup stores the chunks again instead of pointing at nothing
+    upload(sf_client, "second", contents);
+    EXPECT_EQ(n_packs, count_packs());
+    EXPECT_EQ(contents, download(sf_client, "second"));
+}
+
+
+TEST_F(ChunkStoreFixture, FailedListingKeepsIndex)
+{
+    StorageFrameworkClient sf_client;
+    upload(sf_client, "first", random_bytes(1024*1024));
+    ChunkStore::Index before;
+    ASSERT_TRUE(before.load(ChunkStore::Index::path_for(sf_client.get_storage())));
+    ASSERT_FALSE(before.packs().isEmpty());
+
+    // an account that doesn't exist can't be listed, nor uploaded to
+    StorageFrameworkClient bad_client;
+    bad_client.set_storage("no-such-account");
+    const auto index_path = ChunkStore::Index::path_for(bad_client.get_storage());
+    ASSERT_TRUE(before.save(index_path));
+
+    const auto contents = random_bytes(1024);
+    auto uploader = get_result(bad_client.get_new_chunk_uploader(contents.size(), "second", "test" + ChunkStore::LIST_SUFFIX));
+    ASSERT_NE(nullptr, uploader);
+    QSignalSpy spy(uploader.get(), &Uploader::commit_finished);
+    uploader->socket()->write(contents);
+    uploader->commit();
+    ASSERT_TRUE(spy.wait(30*1000));
+    EXPECT_FALSE(spy.takeFirst().at(0).toBool());
+
+    // not being able to look isn't the same as the packs being gone
+    ChunkStore::Index after;
+    ASSERT_TRUE(after.load(index_path));
+    EXPECT_EQ(before.packs(), after.packs());
+    EXPECT_EQ(before.size(), after.size());
+}
+
+
+TEST_F(ChunkStoreFixture, CacheIsLeastRecentlyUsed)
+{
+    QVector<QByteArray> datas, ids;
+    for (int i=0; i<4; ++i)
+    {
+        datas << random_bytes(1000);
+        ids << ChunkStore::chunk_id(datas[i].constData(), datas[i].size());
+    }
+
+    const auto dir = ChunkCache::default_dir();
+    {
+        ChunkCache cache(dir, 3000);
+        for (int i=0; i<3; ++i)
+            cache.put(ids[i], datas[i].constData(), datas[i].size());
+        EXPECT_EQ(3000, cache.size());
+
+        // use the first one, so the second one is the oldest
+        EXPECT_EQ(datas[0], cache.get(ids[0]));
+
+        cache.put(ids[3], datas[3].constData(), datas[3].size());
+        EXPECT_EQ(3000, cache.size());
+        EXPECT_TRUE(cache.contains(ids[0]));
+        EXPECT_FALSE(cache.contains(ids[1]));
+        EXPECT_TRUE(cache.contains(ids[2]));
+        EXPECT_TRUE(cache.contains(ids[3]));
+        EXPECT_TRUE(cache.get(ids[1]).isEmpty());
+    }
+
+    // the cache is still there next time, and a smaller limit shrinks it
+    ChunkCache cache(dir, 2000);
+    EXPECT_EQ(2000, cache.size());
+    QByteArray id;
+    for (int i=0; i<4; ++i)
+    {
+        if (!cache.contains(ids[i]))
+            continue;
+        EXPECT_EQ(datas[i], cache.get(ids[i]));
+        id = ids[i];
+    }
+
+    // damaged chunks are dropped
+    QFile file(QStringLiteral("%1/%2").arg(dir).arg(QString::fromLatin1(id.toHex())));
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    file.write("garbage");
+    file.close();
+    EXPECT_TRUE(cache.get(id).isEmpty());
+    EXPECT_FALSE(cache.contains(id));
+    EXPECT_EQ(1000, cache.size());
+}
+
+
+TEST_F(ChunkStoreFixture, DownloadRepeatedChunks)
+{
+    StorageFrameworkClient sf_client;
+
+    // The second `a' is all chunks that were written already,
+    // from packs that were freed to make room for `b'
+    const auto a = random_bytes(ChunkStore::PACK_SIZE + 1024*1024);
+    const auto b = random_bytes(2*ChunkStore::PACK_SIZE);
+    const auto contents = a + b + a;
+    upload(sf_client, "repeated", contents);
+
+    EXPECT_EQ(contents, download(sf_client, "repeated"));
+    EXPECT_LT(0, ChunkCache().size());
+
+    // and if the cache is gone, the packs get downloaded again
+    QDir(ChunkCache::default_dir()).removeRecursively();
+    EXPECT_EQ(contents, download(sf_client, "repeated"));
+}
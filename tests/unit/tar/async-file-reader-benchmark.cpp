@@ -0,0 +1,131 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/async-file-reader.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+
+/**
+ * Compares reading a tree of small files one at a time, the way
+ * TarCreator does, with reading them through an AsyncFileReader.
+ *
+ * The files are dropped from the page cache before each run so that
+ * the reads hit the disk. That only works if nothing else has them
+ * open; for a truly cold cache, run `echo 3 > /proc/sys/vm/drop_caches'
+ * as root between runs instead.
+ *
+ * This isn't run by ctest because it takes a while and its
+ * results depend on the machine. Run it by hand.
+ */
+
+namespace
+{
+    constexpr int n_files {100*1000};
+    constexpr int file_size {1024*4};
+    constexpr int n_files_per_dir {1000};
+
+    void drop_from_cache(PathTable const& filenames)
+    {
+        for (auto const& filename : filenames)
+        {
+            const auto fd = open(filename.constData(), O_RDONLY);
+            if (fd != -1) {
+                fdatasync(fd);
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+        }
+    }
+
+    template<typename Func>
+    void benchmark(char const* name, PathTable const& filenames, Func&& read_all)
+    {
+        drop_from_cache(filenames);
+
+        QElapsedTimer timer;
+        timer.start();
+        const auto n_read = read_all();
+        const auto msec = std::max(timer.elapsed(), qint64(1));
+
+        EXPECT_EQ(qint64(n_files) * file_size, n_read);
+        std::cout << name << ": " << msec << " msec, "
+                  << (n_files * 1000LL) / msec << " files/sec" << std::endl;
+    }
+}
+
+TEST(AsyncFileReader, Benchmark)
+{
+    // build the corpus
+    QTemporaryDir tmp;
+    QDir dir(tmp.path());
+    PathTable filenames;
+    const QByteArray contents(file_size, 'x');
+    for (int i=0; i<n_files; ++i)
+    {
+        const auto subdir = QString::fromUtf8("dir-%1").arg(i / n_files_per_dir);
+        if (i % n_files_per_dir == 0)
+            ASSERT_TRUE(dir.mkpath(subdir));
+        const auto filename = dir.filePath(QString::fromUtf8("%1/file-%2").arg(subdir).arg(i));
+        QFile file(filename);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(contents);
+        file.close();
+        filenames.append(filename);
+    }
+
+    benchmark("QFile, one at a time", filenames, [&filenames](){
+        qint64 n_read {};
+        char buf[1024*10];
+        for (auto const& filename : filenames) {
+            QFile file(QString::fromUtf8(filename));
+            file.open(QIODevice::ReadOnly);
+            qint64 n;
+            while ((n = file.read(buf, sizeof(buf))) > 0)
+                n_read += n;
+        }
+        return n_read;
+    });
+
+    for (const int n_threads : {1, 4, 16, 64})
+    {
+        const auto name = QString::fromUtf8("AsyncFileReader, %1 threads").arg(n_threads).toStdString();
+        benchmark(name.c_str(), filenames, [&filenames, n_threads](){
+            qint64 n_read {};
+            char buf[1024*10];
+            AsyncFileReader reader(filenames, n_threads);
+            for (size_t i=0; i<filenames.size(); ++i) {
+                qint64 n;
+                while ((n = reader.read(buf, sizeof(buf))) > 0)
+                    n_read += n;
+            }
+            return n_read;
+        });
+    }
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/async-file-reader.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <vector>
+
+namespace
+{
+    // reads the reader's current file to its end; returns false on error
+    bool read_file(AsyncFileReader& reader, QByteArray& setme)
+    {
+        setme.clear();
+        std::vector<char> buf(1000);
+        for (;;)
+        {
+            const auto n_read = reader.read(buf.data(), qint64(buf.size()));
+            if (n_read < 0)
+                return false;
+            if (n_read == 0)
+                return true;
+            setme.append(buf.data(), int(n_read));
+        }
+    }
+
+    QByteArray make_contents(int size, int seed)
+    {
+        QByteArray contents(size, '\0');
+        for (int i=0; i<size; ++i)
+            contents[i] = char((i * 31 + seed) & 0xFF);
+        return contents;
+    }
+}
+
+TEST(AsyncFileReader, ReadsFilesInOrder)
+{
+    QTemporaryDir tmp;
+    QDir dir(tmp.path());
+
+    // sizes around the read-ahead size, plus some small files
+    const int head = int(AsyncFileReader::HEAD_SIZE);
+    std::vector<int> sizes {0, 1, head-1, head, head+1, 1024*1024};
+    for (int i=0; i<100; ++i)
+        sizes.push_back((i*997) % 8192);
+
+    PathTable filenames;
+    std::vector<QByteArray> expected;
+    for (size_t i=0; i<sizes.size(); ++i)
+    {
+        const auto filename = dir.filePath(QString::fromUtf8("file-%1").arg(i));
+        expected.push_back(make_contents(sizes[i], int(i)));
+        QFile file(filename);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        ASSERT_EQ(expected.back().size(), file.write(expected.back()));
+        file.close();
+        filenames.append(filename);
+    }
+
+    // try a window smaller than, and larger than, the number of threads
+    for (const auto window : {size_t(1), size_t(4), AsyncFileReader::DEFAULT_WINDOW})
+    {
+        AsyncFileReader reader(filenames, 8, window);
+        for (size_t i=0; i<expected.size(); ++i)
+        {
+            QByteArray contents;
+            ASSERT_TRUE(read_file(reader, contents)) << i;
+            EXPECT_EQ(expected[i], contents) << i;
+        }
+
+        // reading past the last file is harmless
+        char c;
+        EXPECT_EQ(0, reader.read(&c, 1));
+        EXPECT_EQ(qint64(expected.size()), reader.stats().n_files);
+    }
+}
+
+TEST(AsyncFileReader, MissingFile)
+{
+    QTemporaryDir tmp;
+    QDir dir(tmp.path());
+
+    const auto present = dir.filePath(QStringLiteral("present"));
+    QFile file(present);
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    file.write("hello");
+    file.close();
+
+    PathTable filenames;
+    filenames.append(dir.filePath(QStringLiteral("missing")));
+    filenames.append(present);
+
+    // the missing file fails, and the next file is still readable
+    AsyncFileReader reader(filenames);
+    QByteArray contents;
+    EXPECT_FALSE(read_file(reader, contents));
+    EXPECT_FALSE(reader.error_string().isEmpty());
+    EXPECT_TRUE(read_file(reader, contents));
+    EXPECT_EQ(QByteArray("hello"), contents);
+}
+
+TEST(AsyncFileReader, DestroyedEarly)
+{
+    QTemporaryDir tmp;
+    QDir dir(tmp.path());
+
+    PathTable filenames;
+    for (int i=0; i<1000; ++i)
+    {
+        const auto filename = dir.filePath(QString::fromUtf8("file-%1").arg(i));
+        QFile file(filename);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(make_contents(100, i));
+        file.close();
+        filenames.append(filename);
+    }
+
+    // the workers should stop cleanly, without reading everything
+    AsyncFileReader reader(filenames, 4, 8);
+    char buf[10];
+    EXPECT_EQ(10, reader.read(buf, sizeof(buf)));
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/catalog.h"
+#include "tar/hash-cache.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+class CatalogFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        QStandardPaths::setTestModeEnabled(true);
+        ASSERT_TRUE(QDir::setCurrent(dir_.path()));
+    }
+
+    void TearDown() override
+    {
+        QFile::remove(Catalog::path_for(dir_.path()));
+        QFile::remove(Catalog::pending_path_for(dir_.path()));
+    }
+
+    static void write_file(QString const& filename, QByteArray const& contents)
+    {
+        QFile file(filename);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        ASSERT_EQ(qint64(contents.size()), file.write(contents));
+    }
+
+    // give the file a new mtime without changing its contents
+    static void touch(QString const& filename, time_t mtime)
+    {
+        struct timespec times[2] {{mtime, 0}, {mtime, 0}};
+        ASSERT_EQ(0, utimensat(AT_FDCWD, filename.toUtf8().constData(), times, 0));
+    }
+
+    static QStringList to_list(PathTable const& paths)
+    {
+        QStringList list;
+        for (auto const& path : paths)
+            list << QString::fromUtf8(path);
+        return list;
+    }
+
+    QTemporaryDir dir_;
+};
+
+
+TEST_F(CatalogFixture, FullScan)
+{
+    const QStringList filenames {"b", "a", "c"};
+    for (auto const& filename : filenames)
+        write_file(filename, filename.toUtf8());
+
+    PathTable changed, deleted;
+    const auto catalog = Catalog::scan(PathTable{filenames}, nullptr, changed, deleted);
+
+    // everything is new, and the catalog is sorted
+    EXPECT_EQ(QStringList({"a", "b", "c"}), to_list(catalog.paths));
+    EXPECT_EQ(size_t(3), catalog.infos.size());
+    EXPECT_EQ(QStringList({"a", "b", "c"}), to_list(changed));
+    EXPECT_TRUE(deleted.empty());
+    EXPECT_TRUE(catalog.base_dir_name.isEmpty());
+    EXPECT_EQ(0, catalog.depth);
+}
+
+
+TEST_F(CatalogFixture, IncrementalScan)
+{
+    write_file("unchanged", "unchanged");
+    write_file("modified", "modified");
+    write_file("touched", "touched");
+    write_file("deleted", "deleted");
+    for (auto const& filename : {"unchanged", "modified", "touched", "deleted"})
+        touch(filename, 1000000);
+
+    PathTable changed, deleted;
+    auto previous = Catalog::scan(PathTable{QStringList{"unchanged", "modified", "touched", "deleted"}}, nullptr, changed, deleted);
+    previous.dir_name = "first";
+
+    write_file("modified", "modified!");
+    touch("modified", 1000000);
+    touch("touched", 2000000);
+    ASSERT_TRUE(QFile::remove("deleted"));
+    write_file("added", "added");
+
+    auto catalog = Catalog::scan(PathTable{QStringList{"unchanged", "modified", "touched", "added"}}, &previous, changed, deleted);
+    catalog.dir_name = "second";
+
+    // hashes are only taken lazily, so the first time "touched"
+    // gets a new mtime, there's nothing to compare its contents to
+    EXPECT_EQ(QStringList({"added", "modified", "touched"}), to_list(changed));
+    EXPECT_EQ(QStringList({"deleted"}), to_list(deleted));
+    EXPECT_EQ(QStringList({"added", "modified", "touched", "unchanged"}), to_list(catalog.paths));
+    EXPECT_EQ(QString("first"), catalog.base_dir_name);
+    EXPECT_EQ(1, catalog.depth);
+
+    // but from then on, a touch that leaves the contents alone isn't a change
+    touch("touched", 3000000);
+    catalog = Catalog::scan(PathTable{QStringList{"unchanged", "modified", "touched", "added"}}, &catalog, changed, deleted);
+    EXPECT_TRUE(changed.empty());
+    EXPECT_TRUE(deleted.empty());
+    EXPECT_EQ(QString("second"), catalog.base_dir_name);
+    EXPECT_EQ(2, catalog.depth);
+}
+
+
+TEST_F(CatalogFixture, HashesComeFromTheHashCache)
+{
+    write_file("touched", "touched");
+    PathTable changed, deleted;
+    const auto previous = Catalog::scan(PathTable{QStringList{"touched"}}, nullptr, changed, deleted);
+
+    // files that just changed aren't cached; see HashCache
+    touch("touched", 1000000);
+    QThread::msleep(2100);
+
+    // a file that was already hashed, e.g. by --dedupe, isn't read again
+    HashCache cache;
+    cache.open(dir_.path() + QStringLiteral("/cache/hashes.cache"));
+    QByteArray sha256;
+    ASSERT_TRUE(cache.get_hash("touched", sha256));
+    const auto catalog = Catalog::scan(PathTable{QStringList{"touched"}}, &previous, changed, deleted, &cache);
+    ASSERT_EQ(size_t(1), catalog.infos.size());
+    EXPECT_NE(uint64_t(0), catalog.infos[0].hash);
+    const auto stats = cache.stats();
+    EXPECT_EQ(1, stats.n_hits);
+    EXPECT_EQ(1, stats.n_misses);
+}
+
+
+TEST_F(CatalogFixture, MetadataChanges)
+{
+    write_file("file", "file");
+
+    PathTable changed, deleted;
+    auto previous = Catalog::scan(PathTable{QStringList{"file"}}, nullptr, changed, deleted);
+    previous.dir_name = "first";
+
+    // e.g. a chmod changes the ctime but leaves the size and mtime alone;
+    // with no hash to compare the contents to, that counts as a change.
+    // (change the catalog rather than the file, since ctimes are coarse)
+    --previous.infos.front().ctime_nsec;
+    Catalog::scan(PathTable{QStringList{"file"}}, &previous, changed, deleted);
+    EXPECT_EQ(QStringList({"file"}), to_list(changed));
+}
+
+
+TEST_F(CatalogFixture, Remove)
+{
+    const QStringList filenames {"a", "b", "c", "d"};
+    for (auto const& filename : filenames)
+        write_file(filename, filename.toUtf8());
+
+    PathTable changed, deleted;
+    auto catalog = Catalog::scan(PathTable{filenames}, nullptr, changed, deleted);
+    const auto c_info = catalog.infos[2];
+
+    catalog.remove(PathTable{QStringList{"b", "d", "not-there"}});
+    EXPECT_EQ(QStringList({"a", "c"}), to_list(catalog.paths));
+    ASSERT_EQ(size_t(2), catalog.infos.size());
+    EXPECT_EQ(c_info.ino, catalog.infos[1].ino);
+
+    // so a backup based on it archives them again
+    catalog.dir_name = "backup";
+    Catalog::scan(PathTable{filenames}, &catalog, changed, deleted);
+    EXPECT_EQ(QStringList({"b", "d"}), to_list(changed));
+    EXPECT_TRUE(deleted.empty());
+}
+
+
+TEST_F(CatalogFixture, UnreadableFilesAreRetried)
+{
+    write_file("present", "present");
+
+    PathTable changed, deleted;
+    auto previous = Catalog::scan(PathTable{QStringList{"present", "missing"}}, nullptr, changed, deleted);
+    EXPECT_EQ(QStringList({"missing", "present"}), to_list(changed));
+    EXPECT_EQ(QStringList({"present"}), to_list(previous.paths));
+
+    // since "missing" never made it into the catalog, it's still new
+    write_file("missing", "missing");
+    Catalog::scan(PathTable{QStringList{"present", "missing"}}, &previous, changed, deleted);
+    EXPECT_EQ(QStringList({"missing"}), to_list(changed));
+    EXPECT_TRUE(deleted.empty());
+}
+
+
+TEST_F(CatalogFixture, MaxDepth)
+{
+    Catalog catalog;
+    EXPECT_FALSE(catalog.can_be_base());
+
+    catalog.dir_name = "backup";
+    catalog.depth = Catalog::MAX_DEPTH - 1;
+    EXPECT_TRUE(catalog.can_be_base());
+
+    catalog.depth = Catalog::MAX_DEPTH;
+    EXPECT_FALSE(catalog.can_be_base());
+}
+
+
+TEST_F(CatalogFixture, SaveAndLoad)
+{
+    const QStringList filenames {"one", "two", "three"};
+    for (auto const& filename : filenames)
+        write_file(filename, filename.toUtf8());
+
+    PathTable changed, deleted;
+    auto catalog = Catalog::scan(PathTable{filenames}, nullptr, changed, deleted);
+    catalog.dir_name = "dir-name";
+    catalog.base_dir_name = "base-dir-name";
+    catalog.depth = 7;
+
+    const auto path = Catalog::path_for(dir_.path());
+    ASSERT_TRUE(catalog.save(path));
+
+    Catalog loaded;
+    ASSERT_TRUE(loaded.load(path));
+    EXPECT_EQ(catalog.dir_name, loaded.dir_name);
+    EXPECT_EQ(catalog.base_dir_name, loaded.base_dir_name);
+    EXPECT_EQ(catalog.depth, loaded.depth);
+    EXPECT_EQ(to_list(catalog.paths), to_list(loaded.paths));
+    ASSERT_EQ(catalog.infos.size(), loaded.infos.size());
+    for (size_t i=0, n=catalog.infos.size(); i<n; ++i)
+    {
+        EXPECT_EQ(catalog.infos[i].size, loaded.infos[i].size);
+        EXPECT_EQ(catalog.infos[i].mtime_nsec, loaded.infos[i].mtime_nsec);
+        EXPECT_EQ(catalog.infos[i].ctime_nsec, loaded.infos[i].ctime_nsec);
+        EXPECT_EQ(catalog.infos[i].ino, loaded.infos[i].ino);
+        EXPECT_EQ(catalog.infos[i].hash, loaded.infos[i].hash);
+    }
+
+    // garbage isn't mistaken for a catalog
+    write_file("garbage", "this is not a catalog");
+    EXPECT_FALSE(loaded.load("garbage"));
+    EXPECT_FALSE(loaded.load("no-such-file"));
+}
+
+
+TEST_F(CatalogFixture, CommitPending)
+{
+    const auto dir = dir_.path();
+    Catalog catalog;
+    catalog.paths.append(QByteArray("file"));
+    catalog.infos.push_back(Catalog::Info{});
+    ASSERT_TRUE(catalog.save(Catalog::pending_path_for(dir)));
+
+    // commit it, and confirm that it's named after the stored backup
+    ASSERT_TRUE(Catalog::commit_pending(dir, "stored"));
+    EXPECT_FALSE(QFile::exists(Catalog::pending_path_for(dir)));
+    Catalog committed;
+    ASSERT_TRUE(committed.load(Catalog::path_for(dir)));
+    EXPECT_EQ(QString("stored"), committed.dir_name);
+    EXPECT_EQ(QStringList({"file"}), to_list(committed.paths));
+
+    // a discarded catalog leaves the committed one alone
+    ASSERT_TRUE(catalog.save(Catalog::pending_path_for(dir)));
+    Catalog::discard_pending(dir);
+    EXPECT_FALSE(QFile::exists(Catalog::pending_path_for(dir)));
+    EXPECT_FALSE(Catalog::commit_pending(dir, "failed"));
+    ASSERT_TRUE(committed.load(Catalog::path_for(dir)));
+    EXPECT_EQ(QString("stored"), committed.dir_name);
+
+    // once it's discarded, there's nothing to be incremental to
+    Catalog::discard(dir);
+    EXPECT_FALSE(committed.load(Catalog::path_for(dir)));
+}
+
+
+TEST_F(CatalogFixture, DeletionList)
+{
+    const QStringList filenames {"a", "sub/b", "with\nnewline", "with space"};
+
+    const auto list = Catalog::create_deletion_list(PathTable{filenames});
+    EXPECT_EQ(to_list(PathTable{filenames}), to_list(Catalog::parse_deletion_list(list)));
+
+    EXPECT_TRUE(Catalog::parse_deletion_list(QByteArray()).empty());
+}
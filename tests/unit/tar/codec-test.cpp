@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/codec.h"
+
+#include <gtest/gtest.h>
+
+#include <QProcess>
+#include <QString>
+
+#include <array>
+#include <vector>
+
+/***
+****
+***/
+
+TEST(CodecTest, ParseAndToString)
+{
+    Codec codec;
+    EXPECT_EQ(Codec::Type::NONE, codec.type());
+    EXPECT_EQ(QStringLiteral("none"), codec.to_string());
+
+    EXPECT_TRUE(Codec::parse(QStringLiteral("xz"), &codec));
+    EXPECT_EQ(Codec::Type::XZ, codec.type());
+    EXPECT_EQ(6, codec.level());
+    EXPECT_EQ(QStringLiteral("xz:6"), codec.to_string());
+
+    EXPECT_TRUE(Codec::parse(QStringLiteral("zstd:19"), &codec));
+    EXPECT_EQ(Codec::Type::ZSTD, codec.type());
+    EXPECT_EQ(19, codec.level());
+    EXPECT_EQ(QStringLiteral("zstd:19"), codec.to_string());
+
+    for (auto const& bad : { "", "gzip", "zstd:", "zstd:100", "xz:-1", "xz:1:2" })
+    {
+        EXPECT_FALSE(Codec::parse(QString::fromUtf8(bad), &codec)) << bad;
+        EXPECT_EQ(QStringLiteral("zstd:19"), codec.to_string()) << bad;
+    }
+}
+
+TEST(CodecTest, CompressBlock)
+{
+    const std::vector<char> in(1024*64, 'a');
+
+    for (auto const type : std::array<Codec::Type,3>{Codec::Type::NONE, Codec::Type::XZ, Codec::Type::ZSTD})
+    {
+        const Codec codec{type};
+        const auto out = codec.compress_block(in);
+
+        // confirm that we can recognize our own output
+        ASSERT_FALSE(out.empty());
+        EXPECT_EQ(type, Codec::detect(out.data(), out.size()));
+
+        // confirm that the stock decoder can read it
+        const auto command = Codec::decompress_command(type);
+        if (command.isEmpty())
+        {
+            EXPECT_EQ(in, out);
+            continue;
+        }
+        QProcess decompress;
+        decompress.start(command.first(), command.mid(1));
+        decompress.write(out.data(), qint64(out.size()));
+        decompress.closeWriteChannel();
+        EXPECT_TRUE(decompress.waitForFinished()) << qPrintable(decompress.errorString());
+        const auto decompressed = decompress.readAllStandardOutput();
+        EXPECT_EQ(std::vector<char>(decompressed.begin(), decompressed.end()), in);
+    }
+}
+
+TEST(CodecTest, StoreBlock)
+{
+    // compressible, so we can tell that it wasn't compressed.
+    // Bigger than one zstd raw block or LZMA2 chunk.
+    const std::vector<char> in(1024*300, 'a');
+
+    for (auto const type : std::array<Codec::Type,2>{Codec::Type::XZ, Codec::Type::ZSTD})
+    {
+        const auto codec = Codec{type}.stored();
+        EXPECT_TRUE(codec.is_stored());
+        const auto out = codec.compress_block(in);
+        EXPECT_LT(in.size(), out.size());
+        EXPECT_EQ(type, Codec::detect(out.data(), out.size()));
+
+        // our decoder and the stock one can both read it,
+        // including when it's concatenated with compressed blocks
+        auto both = Codec{type}.compress_block(in);
+        both.insert(both.end(), out.begin(), out.end());
+        std::vector<char> decompressed;
+        EXPECT_TRUE(Codec::decompress_block(type, both, decompressed));
+        std::vector<char> expected {in};
+        expected.insert(expected.end(), in.begin(), in.end());
+        EXPECT_EQ(expected, decompressed);
+
+        const auto command = Codec::decompress_command(type);
+        QProcess decompress;
+        decompress.start(command.first(), command.mid(1));
+        decompress.write(out.data(), qint64(out.size()));
+        decompress.closeWriteChannel();
+        EXPECT_TRUE(decompress.waitForFinished()) << qPrintable(decompress.errorString());
+        const auto stock = decompress.readAllStandardOutput();
+        EXPECT_EQ(in, std::vector<char>(stock.begin(), stock.end()));
+    }
+
+    // there's nothing to store uncompressed archives in
+    EXPECT_FALSE(Codec{}.stored().is_stored());
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tests/utils/file-utils.h"
+
+#include "tar/directory-walker.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QString>
+#include <QTemporaryDir>
+
+#include <sys/stat.h> // chmod()
+#include <unistd.h> // geteuid(), symlink()
+
+#include <iostream>
+
+class DirectoryWalkerFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        qsrand(uint(time(nullptr)));
+    }
+
+    void TearDown() override
+    {
+    }
+
+    // what `find root -type f' says
+    QStringList find_files(QString const& root)
+    {
+        QProcess find;
+        find.start("find", QStringList() << root << "-type" << "f" << "-print0");
+        EXPECT_TRUE(find.waitForFinished()) << qPrintable(find.errorString());
+
+        QStringList files;
+        for (auto const& token : find.readAllStandardOutput().split('\0'))
+            if (!token.isEmpty())
+                files += QString::fromUtf8(token);
+        return files;
+    }
+};
+
+/***
+****
+***/
+
+TEST_F(DirectoryWalkerFixture, MatchesFind)
+{
+    static constexpr int n_runs {5};
+
+    for (int i=0; i<n_runs; ++i)
+    {
+        QTemporaryDir in;
+        FileUtils::fillTemporaryDirectory(in.path(), 100, 500, 1024, 50);
+        EXPECT_TRUE(QDir::setCurrent(in.path()));
+
+        auto expected = find_files("./");
+        expected.sort();
+
+        for (int n_threads : {1, 4})
+        {
+            const auto files = DirectoryWalker::find_files("./", n_threads).to_string_list();
+            EXPECT_EQ(expected, files);
+        }
+    }
+}
+
+TEST_F(DirectoryWalkerFixture, SkipsSymlinksAndEmptyDirs)
+{
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(indir.mkpath("empty/emptier"));
+    EXPECT_TRUE(indir.mkpath("full"));
+    QFile file(indir.filePath("full/file"));
+    file.open(QIODevice::WriteOnly);
+    file.write("hello");
+    file.close();
+    EXPECT_EQ(0, symlink("full/file", indir.filePath("link-to-file").toUtf8().constData()));
+    EXPECT_EQ(0, symlink("full", indir.filePath("link-to-dir").toUtf8().constData()));
+
+    const auto files = DirectoryWalker::find_files(in.path(), 2).to_string_list();
+    EXPECT_EQ(QStringList{indir.filePath("full/file")}, files);
+    EXPECT_EQ(find_files(in.path()), files);
+}
+
+TEST_F(DirectoryWalkerFixture, MissingRoot)
+{
+    QTemporaryDir in;
+    bool ok {true};
+    const auto files = DirectoryWalker::find_files(QDir(in.path()).filePath("does-not-exist"), 0, &ok);
+    EXPECT_TRUE(files.empty());
+    EXPECT_FALSE(ok);
+}
+
+TEST_F(DirectoryWalkerFixture, UnreadableDir)
+{
+    if (geteuid() == 0) {
+        std::cerr << "root can read anything; skipping" << std::endl;
+        return;
+    }
+
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(indir.mkpath("readable"));
+    EXPECT_TRUE(indir.mkpath("unreadable"));
+    for (auto const& filename : {"readable/file", "unreadable/file"}) {
+        QFile file(indir.filePath(filename));
+        file.open(QIODevice::WriteOnly);
+        file.write("hello");
+    }
+
+    bool ok {};
+    auto files = DirectoryWalker::find_files(in.path(), 2, &ok).to_string_list();
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(2, files.size());
+
+    // a directory we can't read must not look like an empty one
+    ASSERT_EQ(0, chmod(indir.filePath("unreadable").toUtf8().constData(), 0));
+    files = DirectoryWalker::find_files(in.path(), 2, &ok).to_string_list();
+    EXPECT_FALSE(ok);
+    EXPECT_EQ(QStringList{indir.filePath("readable/file")}, files);
+    chmod(indir.filePath("unreadable").toUtf8().constData(), 0755);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/entropy-classifier.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <vector>
+
+namespace
+{
+    QString write_file(QDir const& dir, QString const& name, QByteArray const& contents)
+    {
+        const auto filename = dir.filePath(name);
+        QFile file(filename);
+        file.open(QIODevice::WriteOnly);
+        file.write(contents);
+        file.close();
+        return filename;
+    }
+
+    QByteArray random_bytes(int n)
+    {
+        QByteArray bytes(n, '\0');
+        for (auto& ch : bytes)
+            ch = char(qrand() % 256);
+        return bytes;
+    }
+}
+
+/***
+****
+***/
+
+TEST(EntropyClassifierTest, Magic)
+{
+    const unsigned char jpeg[] = { 0xFF, 0xD8, 0xFF, 0xE0 };
+    EXPECT_TRUE(EntropyClassifier::has_compressed_magic(jpeg, sizeof(jpeg)));
+
+    const unsigned char mp4[] = { 0, 0, 0, 0x20, 'f', 't', 'y', 'p', 'i', 's', 'o', 'm' };
+    EXPECT_TRUE(EntropyClassifier::has_compressed_magic(mp4, sizeof(mp4)));
+
+    const unsigned char text[] = { 'h', 'e', 'l', 'l', 'o', ' ', 'w', 'o', 'r', 'l', 'd' };
+    EXPECT_FALSE(EntropyClassifier::has_compressed_magic(text, sizeof(text)));
+
+    // too short to tell
+    EXPECT_FALSE(EntropyClassifier::has_compressed_magic(mp4, 6));
+}
+
+TEST(EntropyClassifierTest, BitsPerByte)
+{
+    const std::vector<unsigned char> constant(4096, 'a');
+    EXPECT_DOUBLE_EQ(0.0, EntropyClassifier::bits_per_byte(constant.data(), constant.size()));
+
+    std::vector<unsigned char> every_byte;
+    for (int i=0; i<4096; ++i)
+        every_byte.push_back(static_cast<unsigned char>(i % 256));
+    EXPECT_DOUBLE_EQ(8.0, EntropyClassifier::bits_per_byte(every_byte.data(), every_byte.size()));
+
+    // odd sizes shouldn't lose bytes
+    EXPECT_DOUBLE_EQ(1.0, EntropyClassifier::bits_per_byte(every_byte.data(), 2));
+    EXPECT_DOUBLE_EQ(0.0, EntropyClassifier::bits_per_byte(nullptr, 0));
+}
+
+TEST(EntropyClassifierTest, Files)
+{
+    QTemporaryDir tmp;
+    QDir dir(tmp.path());
+    const int big = int(EntropyClassifier::MIN_FILE_SIZE) * 2;
+
+    // random data doesn't compress
+    EXPECT_TRUE(EntropyClassifier::is_incompressible(write_file(dir, "random", random_bytes(big))));
+
+    // text does
+    QByteArray text;
+    while (text.size() < big)
+        text += "All work and no play makes Jack a dull boy.\n";
+    EXPECT_FALSE(EntropyClassifier::is_incompressible(write_file(dir, "text", text)));
+
+    // small files aren't worth the trouble
+    EXPECT_FALSE(EntropyClassifier::is_incompressible(write_file(dir, "small", random_bytes(1024))));
+
+    // magic wins over entropy
+    QByteArray jpeg("\xFF\xD8\xFF\xE0", 4);
+    jpeg += text;
+    EXPECT_TRUE(EntropyClassifier::is_incompressible(write_file(dir, "jpeg", jpeg)));
+
+    // missing files are just "don't know"
+    EXPECT_FALSE(EntropyClassifier::is_incompressible(dir.filePath("missing")));
+}
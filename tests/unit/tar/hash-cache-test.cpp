@@ -0,0 +1,217 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/hash-cache.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+class HashCacheFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(QDir::setCurrent(dir_.path()));
+    }
+
+    static void write_file(QString const& filename, QByteArray const& contents)
+    {
+        QFile file(filename);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        ASSERT_EQ(qint64(contents.size()), file.write(contents));
+    }
+
+    static void touch(QString const& filename, time_t mtime)
+    {
+        struct timespec times[2] {{mtime, 0}, {mtime, 0}};
+        ASSERT_EQ(0, utimensat(AT_FDCWD, filename.toUtf8().constData(), times, 0));
+    }
+
+    // files that just changed aren't cached; see HashCache
+    static void let_files_settle()
+    {
+        QThread::msleep(2100);
+    }
+
+    static QByteArray sha256(QByteArray const& contents)
+    {
+        return QCryptographicHash::hash(contents, QCryptographicHash::Sha256);
+    }
+
+    QString cache_path() const
+    {
+        return dir_.path() + QStringLiteral("/cache/hashes.cache");
+    }
+
+    QTemporaryDir dir_;
+};
+
+
+TEST_F(HashCacheFixture, HashesFiles)
+{
+    write_file("a", "hello");
+    write_file("b", "world");
+    let_files_settle();
+
+    HashCache cache;
+    cache.open(cache_path());
+    QByteArray hash;
+    ASSERT_TRUE(cache.get_hash("a", hash));
+    EXPECT_EQ(sha256("hello"), hash);
+    ASSERT_TRUE(cache.get_hash("b", hash));
+    EXPECT_EQ(sha256("world"), hash);
+    EXPECT_FALSE(cache.get_hash("missing", hash));
+
+    // asking again doesn't read it again
+    ASSERT_TRUE(cache.get_hash("a", hash));
+    EXPECT_EQ(sha256("hello"), hash);
+
+    const auto stats = cache.stats();
+    EXPECT_EQ(1, stats.n_hits);
+    EXPECT_EQ(2, stats.n_misses);
+    EXPECT_EQ(10, stats.n_bytes_hashed);
+}
+
+
+TEST_F(HashCacheFixture, RemembersHashes)
+{
+    write_file("a", "hello");
+    write_file("b", "world");
+    let_files_settle();
+    {
+        HashCache cache;
+        cache.open(cache_path());
+        QByteArray hash;
+        ASSERT_TRUE(cache.get_hash("a", hash));
+        ASSERT_TRUE(cache.get_hash("b", hash));
+        ASSERT_TRUE(cache.save());
+    }
+
+    // unchanged files aren't read
+    write_file("c", "new");
+    HashCache cache;
+    cache.open(cache_path());
+    QByteArray hash;
+    ASSERT_TRUE(cache.get_hash("a", hash));
+    EXPECT_EQ(sha256("hello"), hash);
+    ASSERT_TRUE(cache.get_hash("b", hash));
+    EXPECT_EQ(sha256("world"), hash);
+    ASSERT_TRUE(cache.get_hash("c", hash));
+    EXPECT_EQ(sha256("new"), hash);
+    const auto stats = cache.stats();
+    EXPECT_EQ(2, stats.n_hits);
+    EXPECT_EQ(1, stats.n_misses);
+    EXPECT_EQ(3, stats.n_bytes_hashed);
+}
+
+
+TEST_F(HashCacheFixture, ChangedFilesAreHashedAgain)
+{
+    write_file("a", "hello");
+    touch("a", 1000);
+    let_files_settle();
+    {
+        HashCache cache;
+        cache.open(cache_path());
+        QByteArray hash;
+        ASSERT_TRUE(cache.get_hash("a", hash));
+        ASSERT_TRUE(cache.save());
+    }
+
+    // same size, and the mtime is put back, but the ctime changes
+    write_file("a", "jello");
+    touch("a", 1000);
+
+    HashCache cache;
+    cache.open(cache_path());
+    QByteArray hash;
+    ASSERT_TRUE(cache.get_hash("a", hash));
+    EXPECT_EQ(sha256("jello"), hash);
+    EXPECT_EQ(0, cache.stats().n_hits);
+    EXPECT_EQ(1, cache.stats().n_misses);
+}
+
+
+TEST_F(HashCacheFixture, DropsOldEntries)
+{
+    write_file("a", "hello");
+    write_file("b", "world");
+    let_files_settle();
+    {
+        HashCache cache;
+        cache.open(cache_path());
+        QByteArray hash;
+        ASSERT_TRUE(cache.get_hash("a", hash));
+        ASSERT_TRUE(cache.get_hash("b", hash));
+        ASSERT_TRUE(cache.save());
+    }
+
+    // everything's too old to keep, except what gets used
+    {
+        HashCache cache;
+        cache.open(cache_path(), -1);
+        QByteArray hash;
+        ASSERT_TRUE(cache.get_hash("b", hash));
+        EXPECT_EQ(1, cache.stats().n_hits);
+        ASSERT_TRUE(cache.save());
+    }
+
+    HashCache cache;
+    cache.open(cache_path());
+    QByteArray hash;
+    ASSERT_TRUE(cache.get_hash("a", hash));
+    ASSERT_TRUE(cache.get_hash("b", hash));
+    EXPECT_EQ(1, cache.stats().n_hits);
+    EXPECT_EQ(1, cache.stats().n_misses);
+}
+
+
+TEST_F(HashCacheFixture, IgnoresBadCacheFiles)
+{
+    write_file("a", "hello");
+    let_files_settle();
+    QDir().mkpath(QFileInfo(cache_path()).absolutePath());
+    write_file(cache_path(), "this is not a hash cache");
+
+    HashCache cache;
+    cache.open(cache_path());
+    QByteArray hash;
+    ASSERT_TRUE(cache.get_hash("a", hash));
+    EXPECT_EQ(sha256("hello"), hash);
+    EXPECT_EQ(1, cache.stats().n_misses);
+
+    // and replaces them
+    ASSERT_TRUE(cache.save());
+    HashCache reopened;
+    reopened.open(cache_path());
+    ASSERT_TRUE(reopened.get_hash("a", hash));
+    EXPECT_EQ(1, reopened.stats().n_hits);
+}
@@ -99,6 +99,100 @@ TEST_F(KeeperTarCreateFixture, BackupRun)
 ****
 ***/
 
+TEST_F(KeeperTarCreateFixture, BackupRunStream)
+{
+    // build a directory full of random files
+    QTemporaryDir in;
+    FileUtils::fillTemporaryDirectory(in.path());
+
+    // tell keeper that's a backup choice
+    const auto uuid = add_backup_choice(QMap<QString,QVariant>{
+        { KEY_NAME, QDir(in.path()).dirName() },
+        { KEY_TYPE, keeper::Item::FOLDER_VALUE },
+        { KEY_SUBTYPE, in.path() },
+        { KEY_HELPER, QString::fromUtf8(KTC_INVOKE_STREAM) }
+    });
+
+    // start the backup
+    QDBusReply<void> reply = user_iface_->call("StartBackup", QStringList{uuid});
+    ASSERT_TRUE(reply.isValid()) << qPrintable(reply.error().message());
+    ASSERT_TRUE(wait_for_tasks_to_finish());
+
+    // confirm that the backup finished
+    const auto state = user_iface_->state();
+    const auto& properties = state[uuid];
+    EXPECT_EQ(QString::fromUtf8("complete"), properties.value(KEY_ACTION))
+        << qPrintable(properties.value(KEY_ACTION).toString());
+
+    // ask keeper for the blob
+    QDBusReply<QByteArray> blob = mock_iface_->call(QStringLiteral("GetBackupData"), uuid);
+    ASSERT_TRUE(blob.isValid()) << qPrintable(blob.error().message());
+
+    // untar it
+    QTemporaryDir out;
+    QDir outdir(out.path());
+    QFile tarfile(outdir.filePath("tmp.tar"));
+    tarfile.open(QIODevice::WriteOnly);
+    tarfile.write(blob.value());
+    tarfile.close();
+    QProcess untar;
+    untar.setWorkingDirectory(outdir.path());
+    untar.start("tar", QStringList() << "xvf" << tarfile.fileName());
+    EXPECT_TRUE(untar.waitForFinished()) << qPrintable(untar.errorString());
+
+    // after we remove the temporary tarfile, the original and copy dirs should match
+    EXPECT_TRUE(tarfile.remove());
+    EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
+}
+
+/***
+****
+***/
+
+TEST_F(KeeperTarCreateFixture, BackupRunDirectory)
+{
+    // build a directory full of random files
+    QTemporaryDir in;
+    FileUtils::fillTemporaryDirectory(in.path());
+
+    // tell keeper that's a backup choice
+    const auto uuid = add_backup_choice(QMap<QString,QVariant>{
+        { KEY_NAME, QDir(in.path()).dirName() },
+        { KEY_TYPE, keeper::Item::FOLDER_VALUE },
+        { KEY_SUBTYPE, in.path() },
+        { KEY_HELPER, QString::fromUtf8(KTC_INVOKE_DIRECTORY) }
+    });
+
+    // start the backup
+    QDBusReply<void> reply = user_iface_->call("StartBackup", QStringList{uuid});
+    ASSERT_TRUE(reply.isValid()) << qPrintable(reply.error().message());
+    ASSERT_TRUE(wait_for_tasks_to_finish());
+
+    // ask keeper for the blob
+    QDBusReply<QByteArray> blob = mock_iface_->call(QStringLiteral("GetBackupData"), uuid);
+    ASSERT_TRUE(blob.isValid()) << qPrintable(blob.error().message());
+
+    // untar it
+    QTemporaryDir out;
+    QDir outdir(out.path());
+    QFile tarfile(outdir.filePath("tmp.tar"));
+    tarfile.open(QIODevice::WriteOnly);
+    tarfile.write(blob.value());
+    tarfile.close();
+    QProcess untar;
+    untar.setWorkingDirectory(outdir.path());
+    untar.start("tar", QStringList() << "xvf" << tarfile.fileName());
+    EXPECT_TRUE(untar.waitForFinished()) << qPrintable(untar.errorString());
+
+    // after we remove the temporary tarfile, the original and copy dirs should match
+    EXPECT_TRUE(tarfile.remove());
+    EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
+}
+
+/***
+****
+***/
+
 TEST_F(KeeperTarCreateFixture, BadArgNoBus)
 {
     // build a directory full of random files
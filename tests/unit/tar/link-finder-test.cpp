@@ -0,0 +1,211 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/hash-cache.h"
+#include "tar/link-finder.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QVector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory> // make_shared
+
+class LinkFinderFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        qsrand(uint(time(nullptr)));
+        ASSERT_TRUE(QDir::setCurrent(dir_.path()));
+    }
+
+    static QByteArray random_bytes(int n)
+    {
+        QByteArray bytes(n, '\0');
+        for (auto& ch : bytes)
+            ch = char(qrand() % 256);
+        return bytes;
+    }
+
+    static void write_file(QString const& filename, QByteArray const& contents)
+    {
+        QFile file(filename);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        ASSERT_EQ(qint64(contents.size()), file.write(contents));
+    }
+
+    // runs a LinkFinder over `filenames' and returns each file's
+    // target index, or -1 if it isn't a link
+    static QVector<int> find_targets(LinkFinder& finder, QStringList const& filenames)
+    {
+        for (auto const& filename : filenames)
+        {
+            struct stat st {};
+            EXPECT_EQ(0, stat(filename.toUtf8().constData(), &st));
+            finder.add(st);
+        }
+        finder.finish();
+
+        QVector<int> targets;
+        for (int i=0; i<filenames.size(); ++i)
+        {
+            size_t target;
+            targets << (finder.find_target(size_t(i), target) ? int(target) : -1);
+        }
+        return targets;
+    }
+
+    QTemporaryDir dir_;
+};
+
+/***
+****
+***/
+
+TEST_F(LinkFinderFixture, FindsHardLinks)
+{
+    const auto contents = random_bytes(1024*10);
+    write_file("a", contents);
+    write_file("b", random_bytes(1024*10));
+    ASSERT_EQ(0, link("a", "a-link"));
+    ASSERT_EQ(0, link("a", "another-a-link"));
+
+    const QStringList files { "a", "b", "a-link", "another-a-link" };
+    LinkFinder finder(PathTable{files});
+    EXPECT_EQ((QVector<int>{-1, -1, 0, 0}), find_targets(finder, files));
+
+    const auto stats = finder.stats();
+    EXPECT_EQ(2, stats.n_hardlinks);
+    EXPECT_EQ(0, stats.n_duplicates);
+    EXPECT_EQ(qint64(contents.size()*2), stats.n_bytes_saved);
+}
+
+TEST_F(LinkFinderFixture, FindsDuplicatesOnlyIfEnabled)
+{
+    const auto contents = random_bytes(1024*10);
+    write_file("a", contents);
+    write_file("copy-of-a", contents);
+    write_file("another-copy-of-a", contents);
+    const QStringList files { "a", "copy-of-a", "another-copy-of-a" };
+
+    LinkFinder disabled(PathTable{files});
+    EXPECT_EQ((QVector<int>{-1, -1, -1}), find_targets(disabled, files));
+    EXPECT_EQ(0, disabled.stats().n_duplicates);
+
+    LinkFinder enabled(PathTable{files}, true);
+    EXPECT_EQ((QVector<int>{-1, 0, 0}), find_targets(enabled, files));
+    const auto stats = enabled.stats();
+    EXPECT_EQ(0, stats.n_hardlinks);
+    EXPECT_EQ(2, stats.n_duplicates);
+    EXPECT_EQ(qint64(contents.size()*2), stats.n_bytes_saved);
+}
+
+TEST_F(LinkFinderFixture, DifferentContentsAreNotDuplicates)
+{
+    // same size, and only the last byte differs
+    auto contents = random_bytes(1024*10);
+    write_file("a", contents);
+    contents[contents.size()-1] = char(contents[contents.size()-1] ^ 0x01);
+    write_file("b", contents);
+
+    const QStringList files { "a", "b" };
+    LinkFinder finder(PathTable{files}, true);
+    EXPECT_EQ((QVector<int>{-1, -1}), find_targets(finder, files));
+    EXPECT_EQ(0, finder.stats().n_duplicates);
+}
+
+TEST_F(LinkFinderFixture, SmallFilesAreNotDuplicates)
+{
+    const auto contents = random_bytes(int(LinkFinder::MIN_DUPLICATE_SIZE) - 1);
+    write_file("a", contents);
+    write_file("b", contents);
+    write_file("empty", QByteArray());
+    write_file("also-empty", QByteArray());
+
+    const QStringList files { "a", "b", "empty", "also-empty" };
+    LinkFinder finder(PathTable{files}, true);
+    EXPECT_EQ((QVector<int>{-1, -1, -1, -1}), find_targets(finder, files));
+}
+
+TEST_F(LinkFinderFixture, UnreadableFilesKeepTheirPlace)
+{
+    const auto contents = random_bytes(1024*10);
+    write_file("a", contents);
+    write_file("b", contents);
+
+    // a file that couldn't be stat()ed is added as a zeroed stat
+    const QStringList files { "missing", "a", "b" };
+    LinkFinder finder(PathTable{files}, true);
+    for (auto const& filename : files) {
+        struct stat st {};
+        if (stat(filename.toUtf8().constData(), &st) == -1)
+            st = {};
+        finder.add(st);
+    }
+    finder.finish();
+
+    size_t target;
+    EXPECT_FALSE(finder.find_target(0, target));
+    EXPECT_FALSE(finder.find_target(1, target));
+    EXPECT_TRUE(finder.find_target(2, target));
+    EXPECT_EQ(1u, target);
+}
+
+TEST_F(LinkFinderFixture, FindsDuplicatesWithHashCache)
+{
+    const auto contents = random_bytes(1024*10);
+    write_file("a", contents);
+    write_file("copy-of-a", contents);
+    auto different = contents;
+    different[0] = char(different[0] ^ 0x01);
+    write_file("b", different);
+    const QStringList files { "a", "copy-of-a", "b" };
+
+    // let the files get old enough to cache; see HashCache
+    QThread::msleep(2100);
+    const auto cache_path = dir_.path() + "/hashes.cache";
+    {
+        auto cache = std::make_shared<HashCache>();
+        cache->open(cache_path);
+        LinkFinder finder(PathTable{files}, true, cache);
+        EXPECT_EQ((QVector<int>{-1, 0, -1}), find_targets(finder, files));
+        EXPECT_EQ(1, finder.stats().n_duplicates);
+        EXPECT_EQ(3, cache->stats().n_misses);
+        ASSERT_TRUE(cache->save());
+    }
+
+    // the next time, nothing needs to be read
+    auto cache = std::make_shared<HashCache>();
+    cache->open(cache_path);
+    LinkFinder finder(PathTable{files}, true, cache);
+    EXPECT_EQ((QVector<int>{-1, 0, -1}), find_targets(finder, files));
+    EXPECT_EQ(3, cache->stats().n_hits);
+    EXPECT_EQ(0, cache->stats().n_misses);
+}
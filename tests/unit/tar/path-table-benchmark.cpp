@@ -0,0 +1,97 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/path-table.h"
+#include "tar/tar-sender.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+#include <malloc.h> // mallinfo()
+
+#include <iostream>
+
+/**
+ * Compares the memory used to hold a million paths in a QStringList
+ * vs. a PathTable, and what TarSender holds for each path on top of
+ * that while it's sending. This isn't run by ctest; run it by hand.
+ */
+
+namespace
+{
+    constexpr int n_paths {1000*1000};
+
+    // a plausible tree: 100 artists x 100 albums x 100 tracks
+    QByteArray make_path(int i)
+    {
+        return QStringLiteral("./Music/Artist %1/Album %2/%3 - Some Track Title.ogg")
+            .arg(i/10000).arg(i/100).arg(i).toUtf8();
+    }
+
+    size_t heap_in_use()
+    {
+        const auto info = mallinfo();
+        return size_t(info.uordblks) + size_t(info.hblkhd);
+    }
+
+    void report(char const* name, size_t n_bytes)
+    {
+        std::cout << name << ": " << n_bytes << " bytes, "
+                  << double(n_bytes) / n_paths << " bytes per file" << std::endl;
+    }
+}
+
+TEST(PathTable, MemoryBenchmark)
+{
+    size_t raw_size {};
+    for (int i=0; i<n_paths; ++i)
+        raw_size += size_t(make_path(i).size());
+    report("raw UTF-8", raw_size);
+
+    // QStringList, built the way keeper-tar used to build it
+    {
+        const auto before = heap_in_use();
+        QStringList paths;
+        for (int i=0; i<n_paths; ++i)
+            paths.append(QString::fromUtf8(make_path(i)));
+        report("QStringList", heap_in_use() - before);
+    }
+
+    for (const bool front_coding : {false, true})
+    {
+        const auto before = heap_in_use();
+        PathTable table(front_coding);
+        for (int i=0; i<n_paths; ++i)
+            table.append(make_path(i));
+        table.squeeze();
+        const auto used = heap_in_use() - before;
+        report(front_coding ? "PathTable, front coded" : "PathTable", used);
+        EXPECT_EQ(size_t(n_paths), table.size());
+        EXPECT_LT(used, raw_size * 2);
+
+        // TarSender keeps an entry for every path, so count those too
+        const auto with_entries = used + size_t(n_paths) * TarSender::memory_per_file();
+        report(front_coding ? "PathTable, front coded, with TarSender entries" : "PathTable with TarSender entries", with_entries);
+        if (front_coding)
+            EXPECT_LT(with_entries, raw_size * 2);
+    }
+}
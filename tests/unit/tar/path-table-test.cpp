@@ -0,0 +1,111 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/path-table.h"
+
+#include <gtest/gtest.h>
+
+#include <QString>
+#include <QStringList>
+
+namespace
+{
+    QStringList make_paths(int n)
+    {
+        QStringList paths;
+        for (int i=0; i<n; ++i)
+            paths << QStringLiteral("./Music/Artist %1/Album %2/%3 - Track.ogg").arg(i/100).arg(i/10).arg(i);
+        return paths;
+    }
+}
+
+TEST(PathTable, Empty)
+{
+    PathTable table;
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(0u, table.size());
+    EXPECT_TRUE(table.begin() == table.end());
+    EXPECT_TRUE(table.to_string_list().isEmpty());
+}
+
+TEST(PathTable, RoundTrip)
+{
+    const auto paths = make_paths(1000);
+
+    for (const bool front_coding : {true, false})
+    {
+        PathTable table(paths, front_coding);
+        EXPECT_EQ(size_t(paths.size()), table.size());
+
+        // iterating
+        EXPECT_EQ(paths, table.to_string_list());
+
+        // random access, including around the restart points
+        for (int i=paths.size()-1; i>=0; --i)
+            EXPECT_EQ(paths[i].toUtf8(), table.at(size_t(i))) << i;
+    }
+}
+
+TEST(PathTable, Unsorted)
+{
+    // front coding still works when neighbours share nothing,
+    // or when one path is a prefix of the next
+    const QStringList paths {
+        "b/c/d", "a", "a/b", "a", "", "zzzzzzzz", "z", QString::fromUtf8("caf\xc3\xa9/\xe2\x99\xab.ogg")
+    };
+    PathTable table(paths);
+    EXPECT_EQ(paths, table.to_string_list());
+    for (int i=0; i<paths.size(); ++i)
+        EXPECT_EQ(paths[i].toUtf8(), table.at(size_t(i)));
+}
+
+TEST(PathTable, LongPaths)
+{
+    // long enough to need multibyte length varints
+    QStringList paths;
+    for (int i=0; i<40; ++i)
+        paths << QString(200*i, QChar('a' + (i%26)));
+    PathTable table(paths);
+    EXPECT_EQ(paths, table.to_string_list());
+}
+
+TEST(PathTable, CopiesAreIndependent)
+{
+    PathTable table;
+    table.append(QStringLiteral("one"));
+    auto copy = table;
+    copy.append(QStringLiteral("two"));
+
+    EXPECT_EQ(QStringList{"one"}, table.to_string_list());
+    EXPECT_EQ((QStringList{"one", "two"}), copy.to_string_list());
+}
+
+TEST(PathTable, FrontCodingIsSmaller)
+{
+    const auto paths = make_paths(10000);
+
+    size_t raw_size {};
+    for (auto const& path : paths)
+        raw_size += size_t(path.toUtf8().size());
+
+    PathTable plain(paths, false);
+    PathTable coded(paths, true);
+    EXPECT_LT(coded.memory_usage(), plain.memory_usage());
+    EXPECT_LT(coded.memory_usage(), raw_size);
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "tests/utils/file-utils.h"
+
+#include "tar/codec.h"
+#include "tar/seekable-archive.h"
+#include "tar/tar-creator.h"
+#include "tar/untar.h"
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <gtest/gtest.h>
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QString>
+#include <QTemporaryDir>
+
+#include <array>
+#include <vector>
+
+namespace
+{
+    QByteArray decompress(Codec::Type type, QByteArray const& in)
+    {
+        const auto command = Codec::decompress_command(type);
+        QProcess proc;
+        proc.start(command.first(), command.mid(1));
+        proc.write(in);
+        proc.closeWriteChannel();
+        EXPECT_TRUE(proc.waitForFinished()) << qPrintable(proc.errorString());
+        return proc.readAllStandardOutput();
+    }
+
+    // pulls one entry out of the middle of a seekable archive, using only its index
+    QByteArray read_entry(QByteArray const& archive,
+                          SeekableArchive::Index const& index,
+                          SeekableArchive::Entry const& entry,
+                          Codec::Type type,
+                          QByteArray* setme_path)
+    {
+        // decompress just the blocks that the entry is in
+        QByteArray payloads;
+        quint64 n_raw {};
+        for (auto i=int(entry.block); (i<index.blocks.size()) && (n_raw < entry.offset + entry.size); ++i)
+        {
+            auto const& block = index.blocks[i];
+            payloads += archive.mid(int(block.offset), int(block.size));
+            n_raw += block.raw_size;
+        }
+        const auto raw = decompress(type, payloads).mid(int(entry.offset), int(entry.size));
+        EXPECT_EQ(int(entry.size), raw.size());
+
+        // and read it as a one-entry tar
+        QByteArray contents;
+        auto a = archive_read_new();
+        archive_read_support_format_tar(a);
+        EXPECT_EQ(ARCHIVE_OK, archive_read_open_memory(a, raw.constData(), size_t(raw.size())));
+        struct archive_entry* archive_entry;
+        if (archive_read_next_header(a, &archive_entry) == ARCHIVE_OK)
+        {
+            *setme_path = archive_entry_pathname(archive_entry);
+            char buf[4096];
+            ssize_t n;
+            while ((n = archive_read_data(a, buf, sizeof(buf))) > 0)
+                contents.append(buf, int(n));
+        }
+        archive_read_free(a);
+        return contents;
+    }
+
+    std::vector<char> create_archive(QString const& dir, Codec const& codec, int n_threads, bool seekable)
+    {
+        QDir indir(dir);
+        EXPECT_TRUE(QDir::setCurrent(dir));
+        QStringList files;
+        for (auto file : FileUtils::getFilesRecursively(dir))
+            files += indir.relativeFilePath(file);
+
+        TarCreator tar_creator(files, codec, n_threads);
+        tar_creator.set_seekable(seekable);
+        const auto estimated_size = tar_creator.calculate_size();
+
+        std::vector<char> contents, step;
+        while (tar_creator.step(step))
+            contents.insert(contents.end(), step.begin(), step.end());
+        EXPECT_EQ(estimated_size, ssize_t(contents.size()));
+        return contents;
+    }
+}
+
+class SeekableArchiveFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        qsrand(unsigned(time(nullptr)));
+    }
+};
+
+/***
+****
+***/
+
+TEST_F(SeekableArchiveFixture, IndexFindsEveryFile)
+{
+    // big enough to span several blocks
+    QTemporaryDir in;
+    FileUtils::fillTemporaryDirectory(in.path(), 20, 40, 1024*512);
+
+    for (auto const type : std::array<Codec::Type,2>{Codec::Type::XZ, Codec::Type::ZSTD})
+    {
+        const auto contents = create_archive(in.path(), Codec{type}, 2, true);
+        const QByteArray archive(contents.data(), int(contents.size()));
+        ASSERT_TRUE(SeekableArchive::is_seekable(archive.constData(), size_t(archive.size())));
+        EXPECT_EQ(type, Codec::detect(archive.constData(), size_t(archive.size())));
+
+        // the index can be found from the end
+        QBuffer buffer;
+        buffer.setData(archive);
+        ASSERT_TRUE(buffer.open(QIODevice::ReadOnly));
+        SeekableArchive::Index index;
+        ASSERT_TRUE(SeekableArchive::read_index(buffer, index));
+        EXPECT_LT(1, index.blocks.size());
+
+        // every file can be read from its own blocks
+        const QDir indir(in.path());
+        const auto files = FileUtils::getFilesRecursively(in.path());
+        EXPECT_EQ(files.size(), index.entries.size());
+        for (auto const& file : files)
+        {
+            const auto path = indir.relativeFilePath(file).toUtf8();
+            const auto entry = index.find(path);
+            ASSERT_NE(nullptr, entry) << path.constData();
+
+            QFile expected(file);
+            ASSERT_TRUE(expected.open(QIODevice::ReadOnly));
+            QByteArray entry_path;
+            EXPECT_EQ(expected.readAll(), read_entry(archive, index, *entry, type, &entry_path));
+            EXPECT_EQ(path, entry_path);
+        }
+    }
+}
+
+TEST_F(SeekableArchiveFixture, ReaderSplitsBlocksFromIndex)
+{
+    QTemporaryDir in;
+    FileUtils::fillTemporaryDirectory(in.path(), 5, 10, 1024*64);
+
+    const auto contents = create_archive(in.path(), Codec{Codec::Type::XZ}, 1, true);
+    const QByteArray archive(contents.data(), int(contents.size()));
+    QBuffer buffer;
+    buffer.setData(archive);
+    ASSERT_TRUE(buffer.open(QIODevice::ReadOnly));
+    SeekableArchive::Index index;
+    ASSERT_TRUE(SeekableArchive::read_index(buffer, index));
+
+    // feed it a little at a time
+    SeekableArchive::Reader reader;
+    QByteArray payloads;
+    for (int pos=0; pos<archive.size(); pos+=7)
+        reader.feed(archive.constData()+pos, size_t(std::min(7, archive.size()-pos)),
+                    [&payloads](char const* payload, size_t len){payloads.append(payload, int(len));});
+    EXPECT_TRUE(reader.is_seekable());
+    EXPECT_FALSE(reader.failed());
+    ASSERT_TRUE(reader.at_end());
+    EXPECT_EQ(index.serialize(), reader.index());
+
+    // the payloads are a plain .tar.xz
+    QByteArray expected_payloads;
+    for (auto const& block : index.blocks)
+        expected_payloads += archive.mid(int(block.offset), int(block.size));
+    EXPECT_EQ(expected_payloads, payloads);
+    EXPECT_EQ(Codec::Type::XZ, Codec::detect(payloads.constData(), size_t(payloads.size())));
+
+    // the index is still found if the payloads are skipped instead of fed
+    SeekableArchive::Reader skipper;
+    size_t n_skipped {};
+    for (size_t pos=0; pos<size_t(archive.size()); )
+    {
+        const auto n_skippable = std::min(skipper.skippable(), size_t(archive.size()) - pos);
+        if (n_skippable) {
+            skipper.skip(n_skippable);
+            n_skipped += n_skippable;
+            pos += n_skippable;
+        } else {
+            skipper.feed(archive.constData()+pos, 1);
+            ++pos;
+        }
+    }
+    EXPECT_EQ(size_t(payloads.size()), n_skipped);
+    ASSERT_TRUE(skipper.at_end());
+    EXPECT_EQ(index.serialize(), skipper.index());
+
+    // a truncated archive has no index
+    SeekableArchive::Reader truncated;
+    truncated.feed(archive.constData(), size_t(archive.size() - 1));
+    EXPECT_TRUE(truncated.is_seekable());
+    EXPECT_FALSE(truncated.at_end());
+    EXPECT_TRUE(truncated.index().isEmpty());
+
+    // and other archives are left alone
+    const auto plain = create_archive(in.path(), Codec{Codec::Type::XZ}, 1, false);
+    SeekableArchive::Reader other;
+    other.feed(plain.data(), plain.size(), [](char const*, size_t){ADD_FAILURE();});
+    EXPECT_FALSE(other.is_seekable());
+    EXPECT_EQ(SIZE_MAX, other.skippable());
+    EXPECT_TRUE(other.index().isEmpty());
+    QBuffer plain_buffer;
+    plain_buffer.setData(plain.data(), int(plain.size()));
+    ASSERT_TRUE(plain_buffer.open(QIODevice::ReadOnly));
+    EXPECT_FALSE(SeekableArchive::read_index(plain_buffer, index));
+}
+
+TEST_F(SeekableArchiveFixture, Untar)
+{
+    QTemporaryDir in;
+    FileUtils::fillTemporaryDirectory(in.path(), 10, 20, 1024*256);
+
+    for (auto const type : std::array<Codec::Type,2>{Codec::Type::XZ, Codec::Type::ZSTD})
+    {
+        const auto contents = create_archive(in.path(), Codec{type}, 2, true);
+
+        // decompressing the blocks one after the other, and in parallel
+        for (auto const n_threads : std::array<int,2>{1, 4})
+        {
+            QTemporaryDir out;
+            {
+                Untar untar(out.path().toStdString(), n_threads);
+                static constexpr size_t step_size {4096};
+                for (size_t pos=0; pos<contents.size(); pos+=step_size)
+                    EXPECT_TRUE(untar.step(&contents[pos], std::min(step_size, contents.size()-pos)));
+                EXPECT_TRUE(untar.finish());
+            }
+            EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
+        }
+    }
+
+    // a damaged block makes the restore fail.
+    // (xz blocks have checksums; our zstd frames don't)
+    auto damaged = create_archive(in.path(), Codec{Codec::Type::XZ}, 2, true);
+    damaged[SeekableArchive::HEADER_SIZE + SeekableArchive::BLOCK_HEADER_SIZE + 20] ^= 0x55;
+    QTemporaryDir out;
+    Untar untar(out.path().toStdString(), 4);
+    bool ok = untar.step(damaged.data(), damaged.size());
+    ok = untar.finish() && ok;
+    EXPECT_FALSE(ok);
+}
@@ -30,10 +30,15 @@
 #include <QProcess>
 #include <QString>
 #include <QTemporaryDir>
+#include <QVector>
+
+#include <sys/stat.h>
+#include <unistd.h> // link()
 
 #include <algorithm>
 #include <array>
 #include <cstdio>
+#include <iostream>
 
 class TarCreatorFixture: public ::testing::Test
 {
@@ -112,3 +117,325 @@ TEST_F(TarCreatorFixture, Create)
         }
     }
 }
+
+/***
+****
+***/
+
+TEST_F(TarCreatorFixture, CreateMultithreaded)
+{
+    static constexpr int n_threads {4};
+
+    // build a directory full of random files,
+    // big enough to span several compression blocks
+    QTemporaryDir in;
+    QDir indir(in.path());
+    FileUtils::fillTemporaryDirectory(in.path(), 20, 40, 1024*512);
+
+    // create the tar creator
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+    QStringList files;
+    for (auto file : FileUtils::getFilesRecursively(in.path()))
+        files += indir.relativeFilePath(file);
+    TarCreator tar_creator(files, true, n_threads);
+
+    // does the estimate match the actual size?
+    const auto estimated_size = tar_creator.calculate_size();
+    size_t actual_size {};
+    std::vector<char> contents, step;
+    while (tar_creator.step(step)) {
+        contents.insert(contents.end(), step.begin(), step.end());
+        actual_size += step.size();
+    }
+    ASSERT_EQ(estimated_size, actual_size);
+
+    // untar it
+    QTemporaryDir out;
+    QDir outdir(out.path());
+    QFile tarfile(outdir.filePath("tmp.tar.xz"));
+    tarfile.open(QIODevice::WriteOnly);
+    tarfile.write(contents.data(), contents.size());
+    tarfile.close();
+    QProcess untar;
+    untar.setWorkingDirectory(outdir.path());
+    untar.start("tar", QStringList() << "xJf" << tarfile.fileName());
+    EXPECT_TRUE(untar.waitForFinished()) << qPrintable(untar.errorString());
+
+    // compare it to the original
+    EXPECT_TRUE(tarfile.remove());
+    EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
+}
+
+/***
+****
+***/
+
+TEST_F(TarCreatorFixture, CreateStoreIncompressible)
+{
+    // build a directory with some compressible and some incompressible files
+    QTemporaryDir in;
+    QDir indir(in.path());
+    static constexpr int n_files {4};
+    static constexpr int filesize {1024*256};
+    for (int i=0; i<n_files; ++i)
+    {
+        QByteArray contents;
+        if (i % 2) {
+            while (contents.size() < filesize)
+                contents += "All work and no play makes Jack a dull boy.\n";
+        } else {
+            for (int j=0; j<filesize; ++j)
+                contents += char(qrand() % 256);
+        }
+        QFile file(indir.filePath(QStringLiteral("file-%1").arg(i)));
+        file.open(QIODevice::WriteOnly);
+        file.write(contents);
+    }
+
+    // create the tar creator
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+    QStringList files;
+    for (auto file : FileUtils::getFilesRecursively(in.path()))
+        files += indir.relativeFilePath(file);
+    TarCreator tar_creator(files, Codec{Codec::Type::XZ});
+    tar_creator.set_store_incompressible(true);
+
+    // does the estimate match the actual size?
+    const auto estimated_size = tar_creator.calculate_size();
+    size_t actual_size {};
+    std::vector<char> contents, step;
+    while (tar_creator.step(step)) {
+        contents.insert(contents.end(), step.begin(), step.end());
+        actual_size += step.size();
+    }
+    ASSERT_EQ(estimated_size, actual_size);
+
+    // did it sort the files correctly?
+    const auto stats = tar_creator.stats();
+    EXPECT_EQ(n_files/2, stats.n_stored_files);
+    EXPECT_EQ(n_files/2, stats.n_compressed_files);
+    EXPECT_EQ(qint64(filesize) * n_files/2, stats.n_stored_bytes);
+
+    // untar it
+    QTemporaryDir out;
+    QDir outdir(out.path());
+    QFile tarfile(outdir.filePath("tmp.tar.xz"));
+    tarfile.open(QIODevice::WriteOnly);
+    tarfile.write(contents.data(), contents.size());
+    tarfile.close();
+    QProcess untar;
+    untar.setWorkingDirectory(outdir.path());
+    untar.start("tar", QStringList() << "xJf" << tarfile.fileName());
+    EXPECT_TRUE(untar.waitForFinished()) << qPrintable(untar.errorString());
+
+    // compare it to the original
+    EXPECT_TRUE(tarfile.remove());
+    EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
+}
+
+/***
+****
+***/
+
+TEST_F(TarCreatorFixture, FilesChangeAfterSizing)
+{
+    static constexpr int filesize {1024*100};
+
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+    const QStringList files { "grows", "shrinks", "same" };
+    for (auto const& filename : files) {
+        QFile file(indir.filePath(filename));
+        file.open(QIODevice::WriteOnly);
+        file.write(QByteArray(filesize, 'x'));
+        file.close();
+    }
+
+    TarCreator tar_creator(files, false);
+    const auto estimated_size = tar_creator.calculate_size();
+
+    // change the files after the size was calculated
+    QFile grows(indir.filePath("grows"));
+    grows.open(QIODevice::Append);
+    grows.write(QByteArray(filesize, 'y'));
+    grows.close();
+    QFile shrinks(indir.filePath("shrinks"));
+    shrinks.resize(filesize/2);
+
+    // the archive should still be the size that was promised
+    size_t actual_size {};
+    std::vector<char> contents, step;
+    while (tar_creator.step(step)) {
+        contents.insert(contents.end(), step.begin(), step.end());
+        actual_size += step.size();
+    }
+    ASSERT_EQ(estimated_size, actual_size);
+
+    // the files that changed should be counted and marked as incomplete
+    const auto stats = tar_creator.stats();
+    EXPECT_EQ(2, stats.n_changed_files);
+    QStringList incomplete;
+    for (size_t i=0, n=stats.incomplete.size(); i<n; ++i)
+        incomplete << QString::fromUtf8(stats.incomplete.at(i));
+    incomplete.sort();
+    EXPECT_EQ(QStringList({"grows", "shrinks"}), incomplete);
+
+    // untar it
+    QTemporaryDir out;
+    QDir outdir(out.path());
+    QFile tarfile(outdir.filePath("tmp.tar"));
+    tarfile.open(QIODevice::WriteOnly);
+    tarfile.write(contents.data(), contents.size());
+    tarfile.close();
+    QProcess untar;
+    untar.setWorkingDirectory(outdir.path());
+    untar.start("tar", QStringList() << "xf" << tarfile.fileName());
+    EXPECT_TRUE(untar.waitForFinished()) << qPrintable(untar.errorString());
+
+    // the files should be as they were when the size was calculated,
+    // except that the shrunken one is padded with zeroes
+    for (auto const& filename : files) {
+        QFile file(outdir.filePath(filename));
+        EXPECT_TRUE(file.open(QIODevice::ReadOnly));
+        const auto data = file.readAll();
+        EXPECT_EQ(filesize, data.size()) << qPrintable(filename);
+        if (filename == "shrinks") {
+            EXPECT_EQ(QByteArray(filesize/2, 'x'), data.left(filesize/2));
+            EXPECT_EQ(QByteArray(filesize/2, '\0'), data.mid(filesize/2));
+        } else {
+            EXPECT_EQ(QByteArray(filesize, 'x'), data) << qPrintable(filename);
+        }
+    }
+}
+
+/***
+****
+***/
+
+TEST_F(TarCreatorFixture, CreateSparseFiles)
+{
+    static constexpr qint64 filesize {1024*1024*64};
+    static constexpr int chunksize {1024*100};
+
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+
+    // ends in data, ends in a hole, and nothing but a hole
+    const QStringList files { "data-at-end", "hole-at-end", "all-hole" };
+    const QVector<QVector<qint64>> offsets {
+        { 0, filesize/2, filesize - chunksize },
+        { filesize/4 },
+        { }
+    };
+    for (int i=0; i<files.size(); ++i)
+    {
+        if (!FileUtils::createSparseFile(indir.filePath(files[i]), filesize, offsets[i], chunksize))
+        {
+            std::cerr << "This filesystem doesn't support sparse files; skipping" << std::endl;
+            return;
+        }
+    }
+
+    for (const auto compression_enabled : std::array<bool,2>{false, true})
+    {
+        TarCreator tar_creator(files, compression_enabled);
+        const auto estimated_size = tar_creator.calculate_size();
+        std::vector<char> contents, step;
+        while (tar_creator.step(step))
+            contents.insert(contents.end(), step.begin(), step.end());
+        EXPECT_EQ(estimated_size, ssize_t(contents.size()));
+
+        // only the data should be in the archive, not the holes
+        EXPECT_LT(contents.size(), size_t(chunksize * 8));
+
+        // the restored files should be sparse too
+        QTemporaryDir out;
+        QDir outdir(out.path());
+        QFile tarfile(indir.filePath("tmp.tar"));
+        tarfile.open(QIODevice::WriteOnly);
+        tarfile.write(contents.data(), qint64(contents.size()));
+        tarfile.close();
+        QProcess untar;
+        untar.setWorkingDirectory(outdir.path());
+        untar.start("tar", QStringList() << "xf" << tarfile.fileName());
+        EXPECT_TRUE(untar.waitForFinished()) << qPrintable(untar.errorString());
+        EXPECT_EQ(0, untar.exitCode()) << untar.readAllStandardError().constData();
+        EXPECT_TRUE(tarfile.remove());
+        for (auto const& filename : files)
+        {
+            EXPECT_TRUE(FileUtils::compareFiles(indir.filePath(filename), outdir.filePath(filename)));
+            EXPECT_LT(FileUtils::allocatedSize(outdir.filePath(filename)), filesize / 2) << qPrintable(filename);
+        }
+    }
+}
+
+/***
+****
+***/
+
+TEST_F(TarCreatorFixture, CreateLinks)
+{
+    static constexpr int filesize {1024*100};
+
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+
+    QByteArray file_contents(filesize, '\0');
+    for (auto& ch : file_contents)
+        ch = char(qrand() % 256);
+    for (auto const& filename : { "a", "copy-of-a" }) {
+        QFile file(filename);
+        EXPECT_TRUE(file.open(QIODevice::WriteOnly));
+        EXPECT_EQ(qint64(filesize), file.write(file_contents));
+    }
+    EXPECT_EQ(0, link("a", "link-to-a"));
+    const QStringList files { "a", "copy-of-a", "link-to-a" };
+
+    for (const auto compression_enabled : std::array<bool,2>{false, true})
+    {
+        for (const auto find_duplicates : std::array<bool,2>{false, true})
+        {
+            TarCreator tar_creator(files, compression_enabled);
+            tar_creator.set_find_duplicates(find_duplicates);
+            EXPECT_EQ(find_duplicates ? 1u : 2u, tar_creator.files_with_contents().size());
+
+            const auto estimated_size = tar_creator.calculate_size();
+            std::vector<char> contents, step;
+            while (tar_creator.step(step))
+                contents.insert(contents.end(), step.begin(), step.end());
+            EXPECT_EQ(estimated_size, ssize_t(contents.size()));
+
+            const auto stats = tar_creator.stats();
+            EXPECT_EQ(1, stats.links.n_hardlinks);
+            EXPECT_EQ(find_duplicates ? 1 : 0, stats.links.n_duplicates);
+            EXPECT_EQ(qint64(filesize * (find_duplicates ? 2 : 1)), stats.links.n_bytes_saved);
+
+            // untar it
+            QTemporaryDir out;
+            QDir outdir(out.path());
+            QFile tarfile(indir.filePath("tmp.tar"));
+            tarfile.open(QIODevice::WriteOnly);
+            tarfile.write(contents.data(), qint64(contents.size()));
+            tarfile.close();
+            QProcess untar;
+            untar.setWorkingDirectory(outdir.path());
+            untar.start("tar", QStringList() << "xf" << tarfile.fileName());
+            EXPECT_TRUE(untar.waitForFinished()) << qPrintable(untar.errorString());
+            EXPECT_EQ(0, untar.exitCode()) << untar.readAllStandardError().constData();
+            EXPECT_TRUE(tarfile.remove());
+
+            // the links should be restored as links
+            struct stat a_st {}, copy_st {}, link_st {};
+            EXPECT_EQ(0, stat(outdir.filePath("a").toUtf8().constData(), &a_st));
+            EXPECT_EQ(0, stat(outdir.filePath("copy-of-a").toUtf8().constData(), &copy_st));
+            EXPECT_EQ(0, stat(outdir.filePath("link-to-a").toUtf8().constData(), &link_st));
+            EXPECT_EQ(a_st.st_ino, link_st.st_ino);
+            EXPECT_EQ(find_duplicates, a_st.st_ino == copy_st.st_ino);
+            for (auto const& filename : files)
+                EXPECT_TRUE(FileUtils::compareFiles(indir.filePath(filename), outdir.filePath(filename)));
+        }
+    }
+}
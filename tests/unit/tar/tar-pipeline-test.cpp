@@ -0,0 +1,216 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tests/utils/file-utils.h"
+
+#include "tar/tar-creator.h"
+#include "tar/tar-pipeline.h"
+#include "util/spsc-queue.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QString>
+#include <QTemporaryDir>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+class TarPipelineFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        qsrand(uint(time(nullptr)));
+    }
+
+    void TearDown() override
+    {
+    }
+};
+
+/***
+****
+***/
+
+TEST(SpscQueue, PushPop)
+{
+    static constexpr int n_items {100000};
+    SpscQueue<std::vector<int>> queue(8);
+
+    // the consumer should see every item, in order
+    std::thread producer([&queue](){
+        for (int i=0; i<n_items; ++i) {
+            std::vector<int> item{i};
+            while (!queue.push(std::move(item)))
+                std::this_thread::yield();
+        }
+    });
+
+    for (int i=0; i<n_items; ++i) {
+        std::vector<int> item;
+        while (!queue.pop(item))
+            std::this_thread::yield();
+        ASSERT_EQ(1u, item.size());
+        ASSERT_EQ(i, item.front());
+    }
+
+    producer.join();
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(SpscQueue, Bounded)
+{
+    static constexpr int capacity {4};
+    SpscQueue<int> queue(capacity);
+
+    for (int i=0; i<capacity; ++i)
+        EXPECT_TRUE(queue.push(int(i)));
+    EXPECT_FALSE(queue.push(int(capacity)));
+
+    int val {};
+    EXPECT_TRUE(queue.pop(val));
+    EXPECT_EQ(0, val);
+    EXPECT_TRUE(queue.push(int(capacity)));
+}
+
+TEST(SpscQueue, Wait)
+{
+    static constexpr int n_items {100000};
+    SpscQueue<int> queue(2);
+
+    // with a tiny queue, both ends spend most of their time in wait()
+    std::thread producer([&queue](){
+        for (int i=0; i<n_items; ++i) {
+            int item {i};
+            while (!queue.push(std::move(item)))
+                queue.wait([&queue](){return !queue.full();});
+        }
+    });
+
+    for (int i=0; i<n_items; ++i) {
+        int item {};
+        while (!queue.pop(item))
+            queue.wait([&queue](){return !queue.empty();});
+        ASSERT_EQ(i, item);
+    }
+
+    producer.join();
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(SpscQueue, Wake)
+{
+    SpscQueue<int> queue(1);
+    std::atomic<bool> stop {};
+
+    // wake() should get a waiter to recheck its condition
+    std::thread waiter([&queue, &stop](){
+        queue.wait([&queue, &stop](){return stop || !queue.empty();});
+    });
+
+    stop = true;
+    queue.wake();
+    waiter.join();
+    EXPECT_TRUE(queue.empty());
+}
+
+/***
+****
+***/
+
+TEST_F(TarPipelineFixture, MatchesTarCreator)
+{
+    struct Test
+    {
+        Codec codec;
+        int n_threads;
+    };
+
+    const std::vector<Test> tests = {
+        { Codec{Codec::Type::NONE}, 1 },
+        { Codec{Codec::Type::XZ}, 1 },
+        { Codec{Codec::Type::XZ}, 4 },
+        { Codec{Codec::Type::ZSTD}, 1 }
+    };
+
+    for (auto const& test : tests)
+    {
+        // build a directory full of random files,
+        // some bigger than the pipeline's read buffers
+        QTemporaryDir in;
+        QDir indir(in.path());
+        FileUtils::fillTemporaryDirectory(in.path(), 10, 50, 1024*1024);
+        EXPECT_TRUE(QDir::setCurrent(in.path()));
+        QStringList files;
+        for (auto file : FileUtils::getFilesRecursively(in.path()))
+            files += indir.relativeFilePath(file);
+
+        // build the expected archive with a plain TarCreator
+        TarCreator tar_creator(files, test.codec, test.n_threads);
+        std::vector<char> expected, step;
+        while (tar_creator.step(step))
+            expected.insert(expected.end(), step.begin(), step.end());
+
+        // send it through the pipeline
+        TarPipeline tar_pipeline(files, test.codec, test.n_threads);
+        EXPECT_EQ(ssize_t(expected.size()), tar_pipeline.calculate_size());
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        std::vector<char> actual;
+        std::thread reader([&actual, fds](){
+            char buf[4096];
+            ssize_t n_read;
+            while ((n_read = read(fds[1], buf, sizeof(buf))) > 0)
+                actual.insert(actual.end(), buf, buf+n_read);
+        });
+        const auto n_sent = tar_pipeline.send(fds[0]);
+        close(fds[0]);
+        reader.join();
+        close(fds[1]);
+
+        // the pipeline should produce the same bytes
+        EXPECT_EQ(ssize_t(expected.size()), n_sent) << qPrintable(test.codec.to_string());
+        EXPECT_EQ(expected, actual) << qPrintable(test.codec.to_string());
+        EXPECT_EQ(files.size(), tar_pipeline.stats().creator.n_compressed_files);
+    }
+}
+
+TEST_F(TarPipelineFixture, MissingFileFails)
+{
+    QTemporaryDir in;
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+
+    TarPipeline tar_pipeline(QStringList{"does-not-exist"}, Codec{Codec::Type::XZ});
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    std::thread reader([fds](){
+        char buf[4096];
+        while (read(fds[1], buf, sizeof(buf)) > 0) {}
+    });
+    EXPECT_EQ(-1, tar_pipeline.send(fds[0]));
+    close(fds[0]);
+    reader.join();
+    close(fds[1]);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/tar-creator.h"
+#include "tar/tar-sender.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <thread>
+
+/**
+ * Compares the CPU cost of sending an uncompressed archive
+ * with TarCreator (copied through libarchive's buffers) and
+ * with TarSender (file bodies moved with sendfile()).
+ *
+ * This isn't run by ctest because it takes a while and its
+ * results depend on the machine. Run it by hand.
+ */
+
+namespace
+{
+    constexpr int n_files {8};
+    constexpr int file_size {1024*1024*32};
+
+    // user + system CPU time used by this process, in nanoseconds
+    qint64 cpu_ns()
+    {
+        struct rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        auto const to_ns = [](struct timeval const& tv){return qint64(tv.tv_sec)*1000000000 + qint64(tv.tv_usec)*1000;};
+        return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+    }
+
+    // runs `send' against a socket that's drained and discarded by another thread
+    template<typename Func>
+    void benchmark(char const* name, Func&& send)
+    {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        std::thread drain([fds](){
+            char buf[1024*64];
+            while (read(fds[1], buf, sizeof(buf)) > 0) {}
+        });
+
+        const auto begin = cpu_ns();
+        const auto n_sent = send(fds[0]);
+        const auto end = cpu_ns();
+        close(fds[0]);
+        drain.join();
+        close(fds[1]);
+
+        ASSERT_GT(n_sent, 0);
+        std::cout << name << ": " << n_sent << " bytes, "
+                  << double(end - begin) / double(n_sent) << " CPU ns/byte" << std::endl;
+    }
+}
+
+TEST(TarSender, Benchmark)
+{
+    // build a directory of large files
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+    QStringList files;
+    for (int i=0; i<n_files; ++i)
+    {
+        const auto filename = QString::fromUtf8("file-%1").arg(i);
+        QFile file(indir.filePath(filename));
+        file.open(QIODevice::WriteOnly);
+        QByteArray chunk(1024*1024, char('a'+i));
+        for (int j=0; j<file_size/chunk.size(); ++j)
+            file.write(chunk);
+        file.close();
+        files += filename;
+    }
+
+    benchmark("TarCreator", [&files](int fd){
+        TarCreator tar_creator(files, false);
+        ssize_t n_sent {};
+        std::vector<char> buf;
+        while (tar_creator.step(buf)) {
+            for (size_t n_done=0; n_done<buf.size(); ) {
+                const auto n = write(fd, buf.data()+n_done, buf.size()-n_done);
+                if (n <= 0)
+                    return ssize_t(-1);
+                n_done += size_t(n);
+            }
+            n_sent += ssize_t(buf.size());
+        }
+        return n_sent;
+    });
+
+    benchmark("TarSender", [&files](int fd){
+        TarSender tar_sender(files);
+        const auto n_sent = tar_sender.send(fd);
+        const auto stats = tar_sender.stats();
+        std::cout << "TarSender: " << stats.n_bytes_sendfile << " bytes sent with sendfile(), "
+                  << stats.n_bytes_copied << " bytes copied" << std::endl;
+        return n_sent;
+    });
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tests/utils/file-utils.h"
+
+#include "tar/tar-sender.h"
+
+#include <gtest/gtest.h>
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QString>
+#include <QTemporaryDir>
+#include <QVector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+class TarSenderFixture: public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        qsrand(uint(time(nullptr)));
+    }
+
+    void TearDown() override
+    {
+    }
+
+    // sends the files through a socket, the same way keeper-tar does
+    std::vector<char> send_files(TarSender& tar_sender, ssize_t& n_sent)
+    {
+        int fds[2];
+        EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+        std::vector<char> contents;
+        std::thread reader([&contents, fds](){
+            char buf[4096];
+            ssize_t n_read;
+            while ((n_read = read(fds[1], buf, sizeof(buf))) > 0)
+                contents.insert(contents.end(), buf, buf+n_read);
+        });
+
+        n_sent = tar_sender.send(fds[0]);
+        close(fds[0]);
+        reader.join();
+        close(fds[1]);
+
+        return contents;
+    }
+
+    bool untar_and_compare(std::vector<char> const& contents, QString const& in_path)
+    {
+        QTemporaryDir out;
+        QDir outdir(out.path());
+        QFile tarfile(outdir.filePath("tmp.tar"));
+        tarfile.open(QIODevice::WriteOnly);
+        tarfile.write(contents.data(), contents.size());
+        tarfile.close();
+        QProcess untar;
+        untar.setWorkingDirectory(outdir.path());
+        untar.start("tar", QStringList() << "xf" << tarfile.fileName());
+        EXPECT_TRUE(untar.waitForFinished()) << qPrintable(untar.errorString());
+        EXPECT_EQ(0, untar.exitCode()) << untar.readAllStandardError().constData();
+        EXPECT_TRUE(tarfile.remove());
+        return FileUtils::compareDirectories(in_path, out.path());
+    }
+};
+
+/***
+****
+***/
+
+TEST_F(TarSenderFixture, Send)
+{
+    static constexpr int n_runs {5};
+
+    for (int i=0; i<n_runs; ++i)
+    {
+        // build a directory full of random files,
+        // some big enough to be sent with sendfile()
+        QTemporaryDir in;
+        QDir indir(in.path());
+        FileUtils::fillTemporaryDirectory(in.path(), 1, 50, int(TarSender::SENDFILE_MIN_SIZE*4));
+
+        EXPECT_TRUE(QDir::setCurrent(in.path()));
+        QStringList files;
+        for (auto file : FileUtils::getFilesRecursively(in.path()))
+            files += indir.relativeFilePath(file);
+        TarSender tar_sender(files);
+
+        // does the estimate match the actual size?
+        const auto estimated_size = tar_sender.calculate_size();
+        ssize_t n_sent {};
+        const auto contents = send_files(tar_sender, n_sent);
+        EXPECT_EQ(estimated_size, n_sent);
+        EXPECT_EQ(estimated_size, ssize_t(contents.size()));
+
+        // every byte should be accounted for
+        const auto stats = tar_sender.stats();
+        EXPECT_LE(stats.n_bytes_copied + stats.n_bytes_sendfile, qint64(n_sent));
+
+        EXPECT_TRUE(untar_and_compare(contents, in.path()));
+    }
+}
+
+TEST_F(TarSenderFixture, ShrunkFilesAreIncomplete)
+{
+    QTemporaryDir in;
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+    for (auto const& filename : {"intact", "shrinks"}) {
+        QFile file(filename);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(QByteArray(1000, 'x'));
+    }
+
+    TarSender tar_sender(QStringList{"intact", "shrinks"});
+    const auto estimated_size = tar_sender.calculate_size();
+    ASSERT_EQ(0, truncate("shrinks", 10));
+
+    // the archive is still the size its headers promised...
+    ssize_t n_sent {};
+    const auto contents = send_files(tar_sender, n_sent);
+    EXPECT_EQ(estimated_size, n_sent);
+
+    // ...but the file it padded out is reported
+    const auto incomplete = tar_sender.stats().incomplete;
+    ASSERT_EQ(size_t(1), incomplete.size());
+    EXPECT_EQ(QByteArray("shrinks"), incomplete.at(0));
+}
+
+/***
+****
+***/
+
+TEST_F(TarSenderFixture, SendUsesSendfile)
+{
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+
+    // one big file and one small one
+    static constexpr qint64 big_size {TarSender::SENDFILE_MIN_SIZE * 16};
+    static constexpr qint64 small_size {100};
+    QFile big(indir.filePath("big"));
+    big.open(QIODevice::WriteOnly);
+    big.write(QByteArray(int(big_size), 'x'));
+    big.close();
+    QFile small(indir.filePath("small"));
+    small.open(QIODevice::WriteOnly);
+    small.write(QByteArray(int(small_size), 'y'));
+    small.close();
+
+    TarSender tar_sender(QStringList{"big", "small"});
+    ssize_t n_sent {};
+    const auto contents = send_files(tar_sender, n_sent);
+    EXPECT_EQ(tar_sender.calculate_size(), n_sent);
+
+    const auto stats = tar_sender.stats();
+    EXPECT_EQ(big_size, stats.n_bytes_sendfile);
+    EXPECT_EQ(small_size, stats.n_bytes_copied);
+
+    EXPECT_TRUE(untar_and_compare(contents, in.path()));
+}
+
+/***
+****
+***/
+
+TEST_F(TarSenderFixture, SendLongPaths)
+{
+    // build a path too long for a plain ustar header
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+    QString subdir;
+    for (int i=0; i<8; ++i)
+        subdir += QString(40, QChar(ushort('a'+i))) + '/';
+    EXPECT_TRUE(indir.mkpath(subdir));
+    QStringList files;
+    for (auto const& filename : QStringList{subdir + "short", subdir + QString(150, QChar('z'))})
+    {
+        QFile file(indir.filePath(filename));
+        file.open(QIODevice::WriteOnly);
+        file.write(filename.toUtf8());
+        file.close();
+        files += filename;
+    }
+
+    TarSender tar_sender(files);
+    ssize_t n_sent {};
+    const auto contents = send_files(tar_sender, n_sent);
+    EXPECT_EQ(tar_sender.calculate_size(), n_sent);
+
+    EXPECT_TRUE(untar_and_compare(contents, in.path()));
+}
+
+/***
+****
+***/
+
+TEST_F(TarSenderFixture, SendSparseFiles)
+{
+    static constexpr qint64 filesize {1024*1024*64};
+    static constexpr int chunksize {1024*100};
+
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+
+    // ends in data, ends in a hole, and nothing but a hole
+    const QStringList files { "data-at-end", "hole-at-end", "all-hole" };
+    const QVector<QVector<qint64>> offsets {
+        { 0, filesize/2, filesize - chunksize },
+        { filesize/4 },
+        { }
+    };
+    for (int i=0; i<files.size(); ++i)
+    {
+        if (!FileUtils::createSparseFile(indir.filePath(files[i]), filesize, offsets[i], chunksize))
+        {
+            std::cerr << "This filesystem doesn't support sparse files; skipping" << std::endl;
+            return;
+        }
+    }
+
+    TarSender tar_sender(files);
+    ssize_t n_sent {};
+    const auto contents = send_files(tar_sender, n_sent);
+    EXPECT_EQ(tar_sender.calculate_size(), n_sent);
+
+    // only the data should have been sent, not the holes
+    EXPECT_LT(n_sent, chunksize * 8);
+
+    // the restored files should be sparse too
+    QTemporaryDir out;
+    QDir outdir(out.path());
+    QFile tarfile(indir.filePath("tmp.tar"));
+    tarfile.open(QIODevice::WriteOnly);
+    tarfile.write(contents.data(), qint64(contents.size()));
+    tarfile.close();
+    QProcess untar;
+    untar.setWorkingDirectory(outdir.path());
+    untar.start("tar", QStringList() << "xf" << tarfile.fileName());
+    EXPECT_TRUE(untar.waitForFinished()) << qPrintable(untar.errorString());
+    EXPECT_EQ(0, untar.exitCode()) << untar.readAllStandardError().constData();
+    EXPECT_TRUE(tarfile.remove());
+    for (auto const& filename : files)
+    {
+        EXPECT_TRUE(FileUtils::compareFiles(indir.filePath(filename), outdir.filePath(filename)));
+        EXPECT_LT(FileUtils::allocatedSize(outdir.filePath(filename)), filesize / 2) << qPrintable(filename);
+    }
+}
+
+/***
+****
+***/
+
+TEST_F(TarSenderFixture, SendLinks)
+{
+    static constexpr int filesize {1024*100};
+
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+
+    QByteArray contents(filesize, '\0');
+    for (auto& ch : contents)
+        ch = char(qrand() % 256);
+    for (auto const& filename : { "a", "copy-of-a" }) {
+        QFile file(filename);
+        EXPECT_TRUE(file.open(QIODevice::WriteOnly));
+        EXPECT_EQ(qint64(filesize), file.write(contents));
+    }
+    EXPECT_EQ(0, link("a", "link-to-a"));
+    const QStringList files { "a", "copy-of-a", "link-to-a" };
+
+    for (const bool find_duplicates : { false, true })
+    {
+        TarSender tar_sender(files);
+        tar_sender.set_find_duplicates(find_duplicates);
+        const auto estimated_size = tar_sender.calculate_size();
+        ssize_t n_sent {};
+        const auto archive = send_files(tar_sender, n_sent);
+        EXPECT_EQ(estimated_size, n_sent);
+
+        // the links' contents shouldn't have been sent
+        const auto stats = tar_sender.stats();
+        EXPECT_EQ(1, stats.links.n_hardlinks);
+        EXPECT_EQ(find_duplicates ? 1 : 0, stats.links.n_duplicates);
+        EXPECT_EQ(qint64(filesize * (find_duplicates ? 2 : 1)), stats.links.n_bytes_saved);
+        EXPECT_LT(n_sent, filesize * (find_duplicates ? 2 : 3));
+
+        EXPECT_TRUE(untar_and_compare(archive, in.path()));
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include "tar/codec.h"
+#include "tar/tar-creator.h"
+#include "tar/untar.h"
+
+#include <gtest/gtest.h>
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <iostream>
+
+/**
+ * Compares how fast a seekable archive is restored when its
+ * blocks are decompressed one after the other and when
+ * they're decompressed in parallel.
+ *
+ * This isn't run by ctest because it takes a while and its
+ * results depend on the machine. Run it by hand.
+ */
+
+namespace
+{
+    constexpr int n_files {8};
+    constexpr int file_size {1024*1024*32};
+
+    void benchmark(char const* name, std::vector<char> const& archive, int n_threads)
+    {
+        QTemporaryDir out;
+        QElapsedTimer timer;
+        timer.start();
+        {
+            Untar untar(out.path().toStdString(), n_threads);
+            static constexpr size_t step_size {1024*64};
+            for (size_t pos=0; pos<archive.size(); pos+=step_size)
+                ASSERT_TRUE(untar.step(&archive[pos], std::min(step_size, archive.size()-pos)));
+            ASSERT_TRUE(untar.finish());
+        }
+        const auto msec = std::max(qint64(1), timer.elapsed());
+
+        const auto n_bytes = qint64(n_files) * file_size;
+        std::cout << name << " (" << n_threads << " threads): " << msec << " msec, "
+                  << (double(n_bytes) / (1024*1024)) / (double(msec) / 1000) << " MB/s restored" << std::endl;
+    }
+}
+
+TEST(Untar, Benchmark)
+{
+    // build a directory of large, somewhat compressible files
+    qsrand(1);
+    QTemporaryDir in;
+    QDir indir(in.path());
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+    QStringList files;
+    for (int i=0; i<n_files; ++i)
+    {
+        const auto filename = QString::fromUtf8("file-%1").arg(i);
+        QFile file(indir.filePath(filename));
+        file.open(QIODevice::WriteOnly);
+        QByteArray chunk(1024*1024, '\0');
+        for (int j=0; j<file_size/chunk.size(); ++j)
+        {
+            for (auto& ch : chunk)
+                ch = char('a' + qrand() % 16);
+            file.write(chunk);
+        }
+        file.close();
+        files += filename;
+    }
+
+    // make a seekable archive of them
+    const auto n_threads = QThread::idealThreadCount();
+    TarCreator tar_creator(files, Codec{Codec::Type::XZ}, n_threads);
+    tar_creator.set_seekable(true);
+    std::vector<char> archive, step;
+    while (tar_creator.step(step))
+        archive.insert(archive.end(), step.begin(), step.end());
+    std::cout << "archive is " << archive.size() << " bytes" << std::endl;
+
+    benchmark("serial", archive, 1);
+    benchmark("block decompressor", archive, n_threads);
+}
@@ -19,9 +19,15 @@
 
 #include "tests/utils/file-utils.h"
 
+#include "tar/catalog.h"
+#include "tar/codec.h"
+#include "tar/path-table.h"
 #include "tar/tar-creator.h"
 #include "tar/untar.h"
 
+#include <archive.h>
+#include <archive_entry.h>
+
 #include <gtest/gtest.h>
 
 #include <QDebug>
@@ -35,6 +41,55 @@
 #include <algorithm>
 #include <array>
 #include <cstdio>
+#include <string>
+#include <utility> // std::pair
+#include <vector>
+
+namespace
+{
+    // an uncompressed archive of regular files, in memory
+    std::vector<char> create_archive(std::vector<std::pair<std::string,QByteArray>> const& files)
+    {
+        std::vector<char> contents(1024*64);
+        size_t used {};
+
+        auto a = archive_write_new();
+        archive_write_set_format_pax_restricted(a);
+        EXPECT_EQ(ARCHIVE_OK, archive_write_open_memory(a, contents.data(), contents.size(), &used));
+
+        auto entry = archive_entry_new();
+        for (auto const& file : files)
+        {
+            archive_entry_clear(entry);
+            archive_entry_set_pathname(entry, file.first.c_str());
+            archive_entry_set_filetype(entry, AE_IFREG);
+            archive_entry_set_perm(entry, 0644);
+            archive_entry_set_size(entry, file.second.size());
+            EXPECT_EQ(ARCHIVE_OK, archive_write_header(a, entry));
+            EXPECT_EQ(la_ssize_t(file.second.size()), archive_write_data(a, file.second.constData(), size_t(file.second.size())));
+        }
+        archive_entry_free(entry);
+        archive_write_close(a);
+        archive_write_free(a);
+
+        contents.resize(used);
+        return contents;
+    }
+
+    bool untar(QString const& path, int n_threads, std::vector<char> const& contents)
+    {
+        Untar untar(path.toStdString(), n_threads);
+        return untar.step(contents.data(), contents.size()) && untar.finish();
+    }
+
+    void touch(QString const& filename)
+    {
+        QDir().mkpath(QFileInfo(filename).path());
+        QFile file(filename);
+        EXPECT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write("old");
+    }
+}
 
 class UntarFixture: public ::testing::Test
 {
@@ -60,8 +115,10 @@ TEST_F(UntarFixture, Untar)
     static constexpr int n_runs {5};
     static constexpr std::array<size_t,4> step_sizes = { 1024, 2048, 4096, INT_MAX };
     //static constexpr std::array<int,1> step_sizes = { 1024 };
+    const std::array<Codec,3> codecs = { Codec{Codec::Type::NONE}, Codec{Codec::Type::XZ}, Codec{Codec::Type::ZSTD} };
 
     for (int i=0; i<n_runs; ++i)
+    for (auto const& codec : codecs)
     {
         // build a directory full of random files
         QTemporaryDir in;
@@ -76,7 +133,7 @@ TEST_F(UntarFixture, Untar)
             QStringList files;
             for (auto file : FileUtils::getFilesRecursively(in.path()))
                 files += indir.relativeFilePath(file);
-            TarCreator tar_creator(files, false);
+            TarCreator tar_creator(files, codec);
             std::vector<char> step;
             while (tar_creator.step(step))
                 contents.insert(contents.end(), step.begin(), step.end());
@@ -92,8 +149,9 @@ TEST_F(UntarFixture, Untar)
             QTemporaryDir out;
             QDir outdir(out.path());
 
+            int n_entries {};
             {
-                Untar untar(out.path().toStdString());
+                Untar untar(out.path().toStdString(), 1, [&n_entries](std::string const&, int64_t){++n_entries;});
                 do
                 {
                     auto const current_step_size = std::min(step_size, n_left);
@@ -104,6 +162,7 @@ TEST_F(UntarFixture, Untar)
                 while(n_left > 0);
                 EXPECT_TRUE(untar.finish());
             }
+            EXPECT_EQ(FileUtils::getFilesRecursively(in.path()).size(), n_entries);
 
             // compare it to the original
             EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
@@ -118,3 +177,148 @@ TEST_F(UntarFixture, Untar)
         in.setAutoRemove(passed);
     }
 }
+
+TEST_F(UntarFixture, WriterPool)
+{
+    // lots of small files, and a sparse one
+    QTemporaryDir in;
+    FileUtils::fillTemporaryDirectory(in.path(), 200, 200, 4096, 10);
+    QDir indir(in.path());
+    static constexpr qint64 sparse_size {1024*1024*16};
+    const auto has_holes = FileUtils::createSparseFile(indir.filePath("sparse"), sparse_size, {0, sparse_size/2}, 4096);
+
+    EXPECT_TRUE(QDir::setCurrent(in.path()));
+    QStringList files;
+    for (auto file : FileUtils::getFilesRecursively(in.path()))
+        files += indir.relativeFilePath(file);
+    TarCreator tar_creator(files, Codec{Codec::Type::XZ});
+    std::vector<char> contents, step;
+    while (tar_creator.step(step))
+        contents.insert(contents.end(), step.begin(), step.end());
+
+    QTemporaryDir out;
+    {
+        Untar untar(out.path().toStdString(), 4);
+        EXPECT_TRUE(untar.step(contents.data(), contents.size()));
+        EXPECT_TRUE(untar.finish());
+    }
+    EXPECT_TRUE(FileUtils::compareDirectories(in.path(), out.path()));
+
+    // the files were closed after their last write
+    QDir outdir(out.path());
+    for (auto const& file : files)
+        EXPECT_EQ(QFileInfo(indir.filePath(file)).lastModified(), QFileInfo(outdir.filePath(file)).lastModified()) << qPrintable(file);
+
+    // and the holes were left as holes
+    if (has_holes)
+        EXPECT_LT(FileUtils::allocatedSize(outdir.filePath("sparse")), sparse_size/2);
+}
+
+TEST_F(UntarFixture, DoesNotFollowSymlinks)
+{
+    QTemporaryDir outside;
+
+    // an archive with a symlink out of the target, then a file inside it
+    std::vector<char> contents(1024*64);
+    size_t used {};
+    {
+        auto a = archive_write_new();
+        archive_write_set_format_pax_restricted(a);
+        ASSERT_EQ(ARCHIVE_OK, archive_write_open_memory(a, contents.data(), contents.size(), &used));
+
+        auto entry = archive_entry_new();
+        archive_entry_set_pathname(entry, "link");
+        archive_entry_set_filetype(entry, AE_IFLNK);
+        archive_entry_set_perm(entry, 0777);
+        archive_entry_set_symlink(entry, outside.path().toUtf8().constData());
+        ASSERT_EQ(ARCHIVE_OK, archive_write_header(a, entry));
+
+        static constexpr char data[] {"evil"};
+        archive_entry_clear(entry);
+        archive_entry_set_pathname(entry, "link/evil");
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_size(entry, sizeof(data));
+        ASSERT_EQ(ARCHIVE_OK, archive_write_header(a, entry));
+        ASSERT_EQ(la_ssize_t(sizeof(data)), archive_write_data(a, data, sizeof(data)));
+
+        archive_entry_free(entry);
+        archive_write_close(a);
+        archive_write_free(a);
+    }
+
+    // with and without the writer pool
+    for (const int n_threads : {1, 4})
+    {
+        QTemporaryDir out;
+        bool ok {};
+        {
+            Untar untar(out.path().toStdString(), n_threads);
+            ok = untar.step(contents.data(), used) && untar.finish();
+        }
+        EXPECT_FALSE(ok) << n_threads;
+        EXPECT_FALSE(QFile::exists(QDir(outside.path()).filePath("evil"))) << n_threads;
+    }
+}
+
+TEST_F(UntarFixture, AppliesDeletionList)
+{
+    const auto list = Catalog::create_deletion_list(PathTable{QStringList{"gone", "dir/gone", "missing/gone"}});
+    const auto contents = create_archive({{"kept", "new"}, {Catalog::DELETION_LIST_NAME, list}});
+
+    for (const int n_threads : {1, 4})
+    {
+        QTemporaryDir out;
+        QDir outdir(out.path());
+        touch(outdir.filePath("gone"));
+        touch(outdir.filePath("dir/gone"));
+        touch(outdir.filePath("dir/kept"));
+
+        EXPECT_TRUE(untar(out.path(), n_threads, contents)) << n_threads;
+        EXPECT_FALSE(outdir.exists("gone")) << n_threads;
+        EXPECT_FALSE(outdir.exists("dir/gone")) << n_threads;
+        EXPECT_TRUE(outdir.exists("dir/kept")) << n_threads;
+        EXPECT_TRUE(outdir.exists("kept")) << n_threads;
+
+        // the list itself isn't restored
+        EXPECT_FALSE(outdir.exists(Catalog::DELETION_LIST_NAME)) << n_threads;
+    }
+}
+
+TEST_F(UntarFixture, IgnoresDeletionListOnDisk)
+{
+    // e.g. left behind by an older restore, or the user's own file
+    QTemporaryDir out;
+    QDir outdir(out.path());
+    touch(outdir.filePath("victim"));
+    QFile stale(outdir.filePath(Catalog::DELETION_LIST_NAME));
+    ASSERT_TRUE(stale.open(QIODevice::WriteOnly));
+    stale.write(Catalog::create_deletion_list(PathTable{QStringList{"victim"}}));
+    stale.close();
+
+    EXPECT_TRUE(untar(out.path(), 1, create_archive({{"kept", "new"}})));
+    EXPECT_TRUE(outdir.exists("victim"));
+    EXPECT_TRUE(outdir.exists("kept"));
+    EXPECT_TRUE(outdir.exists(Catalog::DELETION_LIST_NAME));
+}
+
+TEST_F(UntarFixture, DeletionListStaysInsideTarget)
+{
+    QTemporaryDir outside;
+    QDir outsidedir(outside.path());
+    touch(outsidedir.filePath("victim"));
+
+    QTemporaryDir out;
+    QDir outdir(out.path());
+    touch(outdir.filePath("victim"));
+    ASSERT_TRUE(QFile::link(outside.path(), outdir.filePath("link")));
+
+    const auto escape = QStringLiteral("../%1/victim").arg(outsidedir.dirName());
+    const auto list = Catalog::create_deletion_list(PathTable{QStringList{"link/victim", escape, "/victim"}});
+    EXPECT_TRUE(untar(out.path(), 1, create_archive({{Catalog::DELETION_LIST_NAME, list}})));
+
+    EXPECT_TRUE(outsidedir.exists("victim"));
+
+    // an absolute path is relative to the target, like the entries' paths
+    EXPECT_FALSE(outdir.exists("victim"));
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors:
+ *   Charles Kerr <charles.kerr@canonical.com>
+ */
+
+#include <qdbus-stubs/dbus-types.h>
+#include <service/task-queue.h>
+
+#include <QRegExp>
+#include <QSet>
+
+#include <gtest/gtest.h>
+
+namespace
+{
+    QStringList take_all_startable(TaskQueue& queue)
+    {
+        QStringList ret;
+        for (QString uuid; !(uuid = queue.take_next()).isEmpty(); )
+            ret << uuid;
+        return ret;
+    }
+}
+
+TEST(TaskQueue, StartsUpToMaxConcurrentInOrder)
+{
+    TaskQueue queue(3);
+    queue.reset(QStringList{"a", "b", "c", "d", "e"}, false);
+
+    EXPECT_EQ(QStringList({"a", "b", "c"}), take_all_startable(queue));
+    EXPECT_EQ(QStringList({"a", "b", "c"}), queue.in_flight());
+    EXPECT_EQ(QStringList({"d", "e"}), queue.remaining());
+
+    // a helper exiting doesn't free a slot while its task is still uploading
+    queue.helper_finished("b");
+    EXPECT_FALSE(queue.is_helper_running("b"));
+    EXPECT_TRUE(queue.take_next().isEmpty());
+
+    // tasks can finish out of order
+    queue.task_finished("b");
+    EXPECT_EQ(QStringList({"d"}), take_all_startable(queue));
+    EXPECT_EQ(QStringList({"a", "c", "d"}), queue.in_flight());
+
+    queue.task_finished("a");
+    queue.task_finished("c");
+    EXPECT_EQ(QStringList({"e"}), take_all_startable(queue));
+    EXPECT_TRUE(queue.remaining().isEmpty());
+}
+
+TEST(TaskQueue, SerialStartsOneAtATime)
+{
+    TaskQueue queue(4);
+    queue.reset(QStringList{"base", "incr1", "incr2"}, true);
+
+    EXPECT_EQ(QStringList({"base"}), take_all_startable(queue));
+
+    // the base's helper exiting isn't enough; its task must be finished
+    queue.helper_finished("base");
+    EXPECT_TRUE(queue.take_next().isEmpty());
+
+    queue.task_finished("base");
+    EXPECT_EQ(QStringList({"incr1"}), take_all_startable(queue));
+    queue.task_finished("incr1");
+    EXPECT_EQ(QStringList({"incr2"}), take_all_startable(queue));
+    EXPECT_TRUE(queue.is_last("incr2"));
+}
+
+TEST(TaskQueue, IsLast)
+{
+    TaskQueue queue(2);
+    queue.reset(QStringList{"a", "b", "c"}, false);
+    take_all_startable(queue);
+
+    EXPECT_FALSE(queue.is_last("a"));
+    queue.task_finished("a");
+    take_all_startable(queue);
+    EXPECT_FALSE(queue.is_last("b"));
+    queue.task_finished("b");
+    EXPECT_TRUE(queue.is_last("c"));
+    EXPECT_FALSE(queue.is_last("b"));
+}
+
+TEST(TaskQueue, TakeRemaining)
+{
+    TaskQueue queue(1);
+    queue.reset(QStringList{"a", "b", "c"}, false);
+    take_all_startable(queue);
+
+    EXPECT_EQ(QStringList({"b", "c"}), queue.take_remaining());
+    EXPECT_TRUE(queue.remaining().isEmpty());
+    EXPECT_EQ(QStringList({"a"}), queue.in_flight());
+
+    queue.task_finished("a");
+    EXPECT_TRUE(queue.take_next().isEmpty());
+    EXPECT_TRUE(queue.in_flight().isEmpty());
+}
+
+TEST(TaskQueue, EachTaskGetsItsOwnHelperPath)
+{
+    auto const base = QString::fromUtf8(DBusTypes::KEEPER_HELPER_PATH);
+    auto const uuids = QStringList{
+        "0fa5c8ae-9a1f-4bd2-a50d-3d6e2f0b9c11",
+        "0fa5c8ae_9a1f_4bd2_a50d_3d6e2f0b9c11", // same path element once sanitized
+        "docs",
+    };
+
+    TaskQueue queue(4);
+    queue.reset(uuids, false);
+    EXPECT_EQ(uuids, take_all_startable(queue));
+
+    QSet<QString> paths;
+    for (auto const& uuid : uuids)
+    {
+        auto const path = queue.helper_path(uuid);
+        EXPECT_TRUE(path.startsWith(base + '/')) << qPrintable(path);
+        EXPECT_TRUE(QRegExp("[A-Za-z0-9_/]+").exactMatch(path)) << qPrintable(path);
+        EXPECT_EQ(uuid, queue.task_for_helper_path(path));
+        paths << path;
+    }
+    EXPECT_EQ(uuids.size(), paths.size());
+    EXPECT_EQ(base + "/docs", queue.helper_path("docs"));
+
+    EXPECT_TRUE(queue.task_for_helper_path(base + "/nope").isEmpty());
+
+    // a finished task's path no longer routes to it
+    auto const docs_path = queue.helper_path("docs");
+    queue.task_finished("docs");
+    EXPECT_TRUE(queue.helper_path("docs").isEmpty());
+    EXPECT_TRUE(queue.task_for_helper_path(docs_path).isEmpty());
+}
+
+TEST(TaskQueue, SharedHelperPathOnlyRoutesToALoneHelper)
+{
+    auto const shared = QString::fromUtf8(DBusTypes::KEEPER_HELPER_PATH);
+
+    TaskQueue queue(2);
+    queue.reset(QStringList{"a", "b"}, false);
+    take_all_startable(queue);
+
+    // can't tell which of the two helpers is calling
+    EXPECT_TRUE(queue.task_for_helper_path(shared).isEmpty());
+
+    // b is uploading, but its helper is gone, so it must be a
+    queue.helper_finished("b");
+    EXPECT_EQ(QString("a"), queue.task_for_helper_path(shared));
+
+    queue.task_finished("a");
+    EXPECT_TRUE(queue.task_for_helper_path(shared).isEmpty());
+}
+
+TEST(TaskQueue, ResetForgetsPreviousTasks)
+{
+    TaskQueue queue(2);
+    queue.reset(QStringList{"a", "b", "c"}, false);
+    take_all_startable(queue);
+    auto const a_path = queue.helper_path("a");
+
+    queue.reset(QStringList{"d"}, true);
+    EXPECT_TRUE(queue.in_flight().isEmpty());
+    EXPECT_TRUE(queue.task_for_helper_path(a_path).isEmpty());
+    EXPECT_EQ(QStringList({"d"}), take_all_startable(queue));
+}
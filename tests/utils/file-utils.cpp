@@ -28,6 +28,9 @@
 #include <QString>
 #include <QTemporaryFile>
 
+#include <sys/stat.h>
+
+#include <cerrno>
 #include <cstring> // std::strerror
 
 
@@ -358,3 +361,38 @@ FileUtils::checkPathIsDir(QString const &dirPath)
     }
     return true;
 }
+
+bool
+FileUtils::createSparseFile(QString const & path, qint64 filesize, QVector<qint64> const & offsets, int chunksize)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly) || !f.resize(filesize))
+    {
+        qWarning() << "Error creating sparse file:" << f.errorString();
+        return false;
+    }
+
+    QByteArray chunk(chunksize, '\0');
+    for (auto const offset : offsets)
+    {
+        for (auto& ch : chunk)
+            ch = char('a' + char(qrand() % ('z'-'a')));
+        f.seek(offset);
+        f.write(chunk.left(int(std::min(qint64(chunksize), filesize - offset))));
+    }
+    f.close();
+
+    return allocatedSize(path) < filesize;
+}
+
+qint64
+FileUtils::allocatedSize(QString const & path)
+{
+    struct stat st;
+    if (stat(path.toUtf8().constData(), &st) == -1)
+    {
+        qWarning() << "Unable to stat" << path << ':' << std::strerror(errno);
+        return -1;
+    }
+    return qint64(st.st_blocks) * 512;
+}
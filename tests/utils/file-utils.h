@@ -21,6 +21,7 @@
 #pragma once
 
 #include <QString>
+#include <QVector>
 
 namespace FileUtils
 {
@@ -37,4 +38,12 @@ namespace FileUtils
     bool copyDirsRecursively(QString const & source, QString const & dest);
 
     bool clearDir(QString const & path);
+
+    // creates a file of `filesize' bytes that's all holes except for
+    // `chunksize' bytes of noise at each of `offsets'. Returns false
+    // if the filesystem didn't leave holes, e.g. if it doesn't support them.
+    bool createSparseFile(QString const & path, qint64 filesize, QVector<qint64> const & offsets, int chunksize);
+
+    // how many bytes of disk the file takes up, holes excluded
+    qint64 allocatedSize(QString const & path);
 }